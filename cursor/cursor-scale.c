@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cursor-scale.h"
+
+/*
+ * Rescaling of premultiplied ARGB cursor images.  Xcursor pixels are
+ * premultiplied already, so the channels can be filtered independently.
+ * Enlarging uses a bilinear filter with 8 bit weights, shrinking a box
+ * filter averaging every source pixel covered by the destination pixel.
+ */
+
+/* Position of the source sample for destination coordinate d, in 24.8
+ * fixed point, sampling at pixel centers. */
+static inline int
+source_position(int d, int src_size, int dst_size)
+{
+	int p;
+
+	p = ((2 * d + 1) * (int64_t) src_size * 256) / (2 * dst_size) - 128;
+
+	return p < 0 ? 0 : p;
+}
+
+/* Split a source position into the left/top tap and the weight of the
+ * right/bottom one, keeping both taps inside the image. */
+static inline void
+bilinear_taps(int p, int src_size, int *i, int *w)
+{
+	*i = p >> 8;
+	*w = p & 0xff;
+	if (*i >= src_size - 1) {
+		*i = src_size - 2;
+		*w = 256;
+	}
+}
+
+#ifdef __SSE2__
+
+static void
+scale_bilinear(const uint32_t *src, int sw, int sh,
+	       uint32_t *dst, int dw, int dh)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const uint32_t *top, *bottom;
+	__m128i t, b, v, wx;
+	int x, y, x0, y0, fx, fy;
+
+	for (y = 0; y < dh; y++) {
+		bilinear_taps(source_position(y, sh, dh), sh, &y0, &fy);
+		top = src + y0 * sw;
+		bottom = top + sw;
+
+		for (x = 0; x < dw; x++) {
+			bilinear_taps(source_position(x, sw, dw), sw,
+				      &x0, &fx);
+
+			/* Two horizontally adjacent pixels from each row,
+			 * widened to 16 bits per channel */
+			t = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *) (top + x0)),
+				zero);
+			b = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *) (bottom + x0)),
+				zero);
+
+			/* Vertical pass: t * (256 - fy) + b * fy fits in
+			 * an unsigned 16 bit lane */
+			v = _mm_add_epi16(
+				_mm_mullo_epi16(t, _mm_set1_epi16(256 - fy)),
+				_mm_mullo_epi16(b, _mm_set1_epi16(fy)));
+			v = _mm_srli_epi16(v, 8);
+
+			/* Horizontal pass between the two columns */
+			wx = _mm_set_epi16(fx, fx, fx, fx,
+					   256 - fx, 256 - fx,
+					   256 - fx, 256 - fx);
+			v = _mm_mullo_epi16(v, wx);
+			v = _mm_add_epi16(v, _mm_srli_si128(v, 8));
+			v = _mm_srli_epi16(v, 8);
+
+			dst[y * dw + x] = _mm_cvtsi128_si32(
+				_mm_packus_epi16(v, zero));
+		}
+	}
+}
+
+static void
+scale_box(const uint32_t *src, int sw, int sh,
+	  uint32_t *dst, int dw, int dh)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum, p;
+	__m128 scale;
+	int x, y, sx, sy, x0, x1, y0, y1;
+
+	for (y = 0; y < dh; y++) {
+		y0 = y * sh / dh;
+		y1 = (y + 1) * sh / dh;
+		if (y1 == y0)
+			y1 = y0 + 1;
+
+		for (x = 0; x < dw; x++) {
+			x0 = x * sw / dw;
+			x1 = (x + 1) * sw / dw;
+			if (x1 == x0)
+				x1 = x0 + 1;
+
+			sum = zero;
+			for (sy = y0; sy < y1; sy++)
+				for (sx = x0; sx < x1; sx++) {
+					p = _mm_cvtsi32_si128(src[sy * sw + sx]);
+					p = _mm_unpacklo_epi8(p, zero);
+					p = _mm_unpacklo_epi16(p, zero);
+					sum = _mm_add_epi32(sum, p);
+				}
+
+			scale = _mm_set1_ps(1.0f / ((x1 - x0) * (y1 - y0)));
+			p = _mm_cvtps_epi32(
+				_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+			p = _mm_packs_epi32(p, zero);
+			dst[y * dw + x] = _mm_cvtsi128_si32(
+				_mm_packus_epi16(p, zero));
+		}
+	}
+}
+
+#else
+
+static inline uint32_t
+lerp(uint32_t a, uint32_t b, int w)
+{
+	uint32_t r = 0;
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8)
+		r |= ((((a >> shift) & 0xff) * (256 - w) +
+		       ((b >> shift) & 0xff) * w) >> 8) << shift;
+
+	return r;
+}
+
+static void
+scale_bilinear(const uint32_t *src, int sw, int sh,
+	       uint32_t *dst, int dw, int dh)
+{
+	const uint32_t *top, *bottom;
+	int x, y, x0, y0, fx, fy;
+
+	for (y = 0; y < dh; y++) {
+		bilinear_taps(source_position(y, sh, dh), sh, &y0, &fy);
+		top = src + y0 * sw;
+		bottom = top + sw;
+
+		for (x = 0; x < dw; x++) {
+			bilinear_taps(source_position(x, sw, dw), sw,
+				      &x0, &fx);
+			dst[y * dw + x] =
+				lerp(lerp(top[x0], bottom[x0], fy),
+				     lerp(top[x0 + 1], bottom[x0 + 1], fy),
+				     fx);
+		}
+	}
+}
+
+static void
+scale_box(const uint32_t *src, int sw, int sh,
+	  uint32_t *dst, int dw, int dh)
+{
+	uint32_t sum[4], p, n;
+	int x, y, sx, sy, x0, x1, y0, y1, c;
+
+	for (y = 0; y < dh; y++) {
+		y0 = y * sh / dh;
+		y1 = (y + 1) * sh / dh;
+		if (y1 == y0)
+			y1 = y0 + 1;
+
+		for (x = 0; x < dw; x++) {
+			x0 = x * sw / dw;
+			x1 = (x + 1) * sw / dw;
+			if (x1 == x0)
+				x1 = x0 + 1;
+
+			memset(sum, 0, sizeof sum);
+			for (sy = y0; sy < y1; sy++)
+				for (sx = x0; sx < x1; sx++) {
+					p = src[sy * sw + sx];
+					for (c = 0; c < 4; c++)
+						sum[c] += (p >> (c * 8)) & 0xff;
+				}
+
+			n = (x1 - x0) * (y1 - y0);
+			p = 0;
+			for (c = 0; c < 4; c++)
+				p |= ((sum[c] + n / 2) / n) << (c * 8);
+			dst[y * dw + x] = p;
+		}
+	}
+}
+
+#endif
+
+/** Rescale a premultiplied ARGB image
+ *
+ * \param src The source pixels, src_width * src_height of them
+ * \param dst Where to write the dst_width * dst_height scaled pixels
+ */
+void
+cursor_scale_image(const uint32_t *src, int src_width, int src_height,
+		   uint32_t *dst, int dst_width, int dst_height)
+{
+	if (src_width == dst_width && src_height == dst_height)
+		memcpy(dst, src, dst_width * dst_height * sizeof *dst);
+	else if (src_width >= 2 && src_height >= 2 &&
+		 dst_width >= src_width && dst_height >= src_height)
+		scale_bilinear(src, src_width, src_height,
+			       dst, dst_width, dst_height);
+	else
+		scale_box(src, src_width, src_height,
+			  dst, dst_width, dst_height);
+}
@@ -27,15 +27,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
 #include "os-compatibility.h"
+#include "cursor-scale.h"
 
 struct shm_pool {
 	struct wl_shm_pool *pool;
 	int fd;
 	unsigned int size;
-	unsigned int used;
 	char *data;
 };
 
@@ -60,7 +61,6 @@ shm_pool_create(struct wl_shm *shm, int size)
 
 	pool->pool = wl_shm_create_pool(shm, pool->fd, size);
 	pool->size = size;
-	pool->used = 0;
 
 	return pool;
 
@@ -71,38 +71,6 @@ err_free:
 	return NULL;
 }
 
-static int
-shm_pool_resize(struct shm_pool *pool, int size)
-{
-	if (ftruncate(pool->fd, size) < 0)
-		return 0;
-
-	wl_shm_pool_resize(pool->pool, size);
-
-	munmap(pool->data, pool->size);
-
-	pool->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
-			  pool->fd, 0);
-	pool->size = size;
-
-	return 1;
-}
-
-static int
-shm_pool_allocate(struct shm_pool *pool, int size)
-{
-	int offset;
-
-	if (pool->used + size > pool->size)
-		if (!shm_pool_resize(pool, 2 * pool->size + size))
-			return -1;
-
-	offset = pool->used;
-	pool->used += size;
-
-	return offset;
-}
-
 static void
 shm_pool_destroy(struct shm_pool *pool)
 {
@@ -118,6 +86,8 @@ struct wl_cursor_theme {
 	struct wl_cursor **cursors;
 	struct wl_shm *shm;
 	struct shm_pool *pool;
+	unsigned int pool_size;
+	struct theme_loader *loader; /* until decoding has been waited for */
 	char *name;
 	int size;
 };
@@ -127,11 +97,13 @@ struct cursor_image {
 	struct wl_cursor_theme *theme;
 	struct wl_buffer *buffer;
 	int offset; /* data offset of this image in the shm pool */
+	uint32_t size; /* nominal size the image was drawn for */
 };
 
 struct cursor {
 	struct wl_cursor cursor;
 	uint32_t total_delay; /* length of the animation in ms */
+	uint32_t *frame_end; /* end time of each frame, NULL if static */
 };
 
 /** Get an shm buffer for a cursor image
@@ -177,10 +149,38 @@ wl_cursor_destroy(struct wl_cursor *cursor)
 	for (i = 0; i < cursor->image_count; i++)
 		wl_cursor_image_destroy(cursor->images[i]);
 
+	free(((struct cursor *) cursor)->frame_end);
+	free(cursor->images);
 	free(cursor->name);
 	free(cursor);
 }
 
+/* Sums the frame delays into the time at which each frame ends, so that
+ * wl_cursor_frame() can binary search the animation. */
+static int
+cursor_init_frames(struct cursor *cursor)
+{
+	unsigned int i;
+
+	cursor->total_delay = 0;
+	cursor->frame_end = NULL;
+
+	if (cursor->cursor.image_count <= 1)
+		return 0;
+
+	cursor->frame_end = malloc(cursor->cursor.image_count *
+				   sizeof cursor->frame_end[0]);
+	if (!cursor->frame_end)
+		return -1;
+
+	for (i = 0; i < cursor->cursor.image_count; i++) {
+		cursor->total_delay += cursor->cursor.images[i]->delay;
+		cursor->frame_end[i] = cursor->total_delay;
+	}
+
+	return 0;
+}
+
 static struct wl_cursor *
 wl_cursor_create_from_xcursor_images(XcursorImages *images,
 				     struct wl_cursor_theme *theme)
@@ -202,7 +202,7 @@ wl_cursor_create_from_xcursor_images(XcursorImages *images,
 	}
 
 	cursor->cursor.name = strdup(images->name);
-	cursor->total_delay = 0;
+	cursor->frame_end = NULL;
 
 	for (i = 0; i < images->nimage; i++) {
 		image = malloc(sizeof *image);
@@ -216,43 +216,279 @@ wl_cursor_create_from_xcursor_images(XcursorImages *images,
 		image->image.hotspot_x = images->images[i]->xhot;
 		image->image.hotspot_y = images->images[i]->yhot;
 		image->image.delay = images->images[i]->delay;
-		cursor->total_delay += image->image.delay;
+		image->size = images->images[i]->size;
 
-		/* copy pixels to shm pool */
+		/* reserve space in the shm pool; the pixels are decoded
+		 * once the pool has been created at its final size */
 		size = image->image.width * image->image.height * 4;
-		image->offset = shm_pool_allocate(theme->pool, size);
-		memcpy(theme->pool->data + image->offset,
-		       images->images[i]->pixels, size);
+		image->offset = theme->pool_size;
+		theme->pool_size += size;
+	}
+
+	if (cursor_init_frames(cursor) < 0) {
+		wl_cursor_destroy(&cursor->cursor);
+		return NULL;
 	}
 
 	return &cursor->cursor;
 }
 
+/* Loading a theme is split in two passes.  The cursor files are first
+ * scanned on the caller's thread, reading only the image headers: this
+ * creates the wl_cursor objects, lays out every image in the shm pool
+ * and gives the final pool size, so that the pool is created once.
+ * The pixels are then read straight into their pool offsets by a few
+ * worker threads, each taking the next file not yet decoded. */
+
+#define MAX_LOAD_THREADS 4
+
+struct cursor_file {
+	char *path;
+	XcursorImages *images; /* headers, pixels point into the pool */
+};
+
+struct theme_loader {
+	pthread_mutex_t mutex;
+	pthread_t threads[MAX_LOAD_THREADS];
+	int thread_count;
+	int running;
+	unsigned int next; /* next file to decode */
+	struct cursor_file *files; /* files[i] is for theme->cursors[i] */
+	wl_cursor_theme_load_func_t done;
+	void *data;
+};
+
 static void
-load_callback(XcursorImages *images, void *data)
+scan_callback(const char *path, const char *name, void *data)
 {
 	struct wl_cursor_theme *theme = data;
+	struct theme_loader *loader = theme->loader;
 	struct wl_cursor *cursor;
+	struct wl_cursor **cursors;
+	struct cursor_file *files;
+	XcursorImages *images;
 
-	if (wl_cursor_theme_get_cursor(theme, images->name)) {
-		XcursorImagesDestroy(images);
+	if (wl_cursor_theme_get_cursor(theme, name))
 		return;
-	}
+
+	images = xcursor_load_file_headers(path, theme->size);
+	if (!images)
+		return;
+	images->name = strdup(name);
+	if (!images->name)
+		goto err_images;
+
+	files = realloc(loader->files,
+			(theme->cursor_count + 1) * sizeof *files);
+	if (!files)
+		goto err_images;
+	loader->files = files;
+
+	cursors = realloc(theme->cursors,
+			  (theme->cursor_count + 1) * sizeof *cursors);
+	if (!cursors)
+		goto err_images;
+	theme->cursors = cursors;
+
+	files[theme->cursor_count].path = strdup(path);
+	if (!files[theme->cursor_count].path)
+		goto err_images;
 
 	cursor = wl_cursor_create_from_xcursor_images(images, theme);
+	if (!cursor) {
+		free(files[theme->cursor_count].path);
+		goto err_images;
+	}
 
-	if (cursor) {
-		theme->cursor_count++;
-		theme->cursors =
-			realloc(theme->cursors,
-				theme->cursor_count * sizeof theme->cursors[0]);
+	files[theme->cursor_count].images = images;
+	theme->cursors[theme->cursor_count] = cursor;
+	theme->cursor_count++;
 
-		theme->cursors[theme->cursor_count - 1] = cursor;
-	}
+	return;
 
+err_images:
 	XcursorImagesDestroy(images);
 }
 
+static void
+decode_cursor(struct wl_cursor_theme *theme, unsigned int i)
+{
+	struct cursor_file *file = &theme->loader->files[i];
+	struct wl_cursor *cursor = theme->cursors[i];
+	struct cursor_image *image;
+	unsigned int j;
+
+	for (j = 0; j < cursor->image_count; j++) {
+		image = (struct cursor_image *) cursor->images[j];
+		file->images->images[j]->pixels = (XcursorPixel *)
+			(theme->pool->data + image->offset);
+	}
+
+	/* On failure the cursor just stays transparent */
+	xcursor_load_file_pixels(file->path, theme->size, file->images);
+
+	for (j = 0; j < cursor->image_count; j++)
+		file->images->images[j]->pixels = NULL;
+	XcursorImagesDestroy(file->images);
+	file->images = NULL;
+}
+
+static void
+decode_cursors(struct wl_cursor_theme *theme)
+{
+	struct theme_loader *loader = theme->loader;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&loader->mutex);
+		i = loader->next++;
+		pthread_mutex_unlock(&loader->mutex);
+
+		if (i >= theme->cursor_count)
+			break;
+
+		decode_cursor(theme, i);
+	}
+}
+
+static void
+finish_decoding(struct wl_cursor_theme *theme)
+{
+	struct theme_loader *loader = theme->loader;
+	int last;
+
+	pthread_mutex_lock(&loader->mutex);
+	last = --loader->running == 0;
+	pthread_mutex_unlock(&loader->mutex);
+
+	if (last && loader->done)
+		loader->done(theme, loader->data);
+}
+
+static void *
+decode_thread(void *data)
+{
+	struct wl_cursor_theme *theme = data;
+
+	decode_cursors(theme);
+	finish_decoding(theme);
+
+	return NULL;
+}
+
+static void
+start_decoding(struct wl_cursor_theme *theme)
+{
+	struct theme_loader *loader = theme->loader;
+	unsigned int count;
+	long cpus;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	count = cpus > 0 ? cpus : 1;
+	if (count > MAX_LOAD_THREADS)
+		count = MAX_LOAD_THREADS;
+	if (count > theme->cursor_count)
+		count = theme->cursor_count;
+
+	/* The caller holds a reference of its own until every thread has
+	 * been started, so the completion callback can't run early. */
+	loader->running = 1;
+	while (loader->thread_count < (int) count) {
+		pthread_mutex_lock(&loader->mutex);
+		loader->running++;
+		pthread_mutex_unlock(&loader->mutex);
+
+		if (pthread_create(&loader->threads[loader->thread_count],
+				   NULL, decode_thread, theme) != 0) {
+			pthread_mutex_lock(&loader->mutex);
+			loader->running--;
+			pthread_mutex_unlock(&loader->mutex);
+			break;
+		}
+		loader->thread_count++;
+	}
+
+	if (loader->thread_count == 0)
+		decode_cursors(theme);
+
+	finish_decoding(theme);
+}
+
+static void
+theme_loader_destroy(struct wl_cursor_theme *theme)
+{
+	struct theme_loader *loader = theme->loader;
+	unsigned int i;
+	int j;
+
+	for (j = 0; j < loader->thread_count; j++)
+		pthread_join(loader->threads[j], NULL);
+
+	for (i = 0; i < theme->cursor_count; i++) {
+		free(loader->files[i].path);
+		if (loader->files[i].images)
+			XcursorImagesDestroy(loader->files[i].images);
+	}
+	free(loader->files);
+
+	pthread_mutex_destroy(&loader->mutex);
+	free(loader);
+	theme->loader = NULL;
+}
+
+static struct wl_cursor_theme *
+load_theme(const char *name, int size, struct wl_shm *shm,
+	   wl_cursor_theme_load_func_t done, void *data)
+{
+	struct wl_cursor_theme *theme;
+	unsigned int i;
+
+	theme = malloc(sizeof *theme);
+	if (!theme)
+		return NULL;
+
+	if (!name)
+		name = "default";
+
+	theme->name = strdup(name);
+	theme->size = size;
+	theme->shm = shm;
+	theme->cursor_count = 0;
+	theme->cursors = NULL;
+	theme->pool_size = 0;
+
+	theme->loader = malloc(sizeof *theme->loader);
+	if (!theme->loader)
+		goto err_free;
+	memset(theme->loader, 0, sizeof *theme->loader);
+	pthread_mutex_init(&theme->loader->mutex, NULL);
+	theme->loader->done = done;
+	theme->loader->data = data;
+
+	xcursor_scan_theme(name, scan_callback, theme);
+
+	if (theme->pool_size == 0)
+		theme->pool_size = size * size * 4;
+
+	theme->pool = shm_pool_create(shm, theme->pool_size);
+	if (!theme->pool)
+		goto err_loader;
+
+	start_decoding(theme);
+
+	return theme;
+
+err_loader:
+	theme_loader_destroy(theme);
+	for (i = 0; i < theme->cursor_count; i++)
+		wl_cursor_destroy(theme->cursors[i]);
+	free(theme->cursors);
+err_free:
+	free(theme->name);
+	free(theme);
+	return NULL;
+}
+
 /** Load a cursor theme to memory shared with the compositor
  *
  * \param name The name of the cursor theme to load. If %NULL, the default
@@ -268,29 +504,203 @@ wl_cursor_theme_load(const char *name, int size, struct wl_shm *shm)
 {
 	struct wl_cursor_theme *theme;
 
+	theme = load_theme(name, size, shm, NULL, NULL);
+	if (theme)
+		theme_loader_destroy(theme);
+
+	return theme;
+}
+
+/** Start loading a cursor theme to memory shared with the compositor
+ *
+ * Like wl_cursor_theme_load(), but only the cursor files' headers are
+ * read before returning.  The theme's cursors can be looked up right
+ * away, but their pixels are decoded in the background and must not be
+ * used, for example by attaching a buffer from
+ * wl_cursor_image_get_buffer(), until \a done has been called.
+ *
+ * \a done is called once, from a decoding thread, or from the calling
+ * thread before this function returns if there was nothing to decode.
+ * It must not destroy the theme.
+ *
+ * \param name The name of the cursor theme to load. If %NULL, the default
+ * theme will be loaded.
+ * \param size Desired size of the cursor images.
+ * \param shm The compositor's shm interface.
+ * \param done Called when all the cursor images have been decoded.
+ * \param data User data passed to \a done.
+ *
+ * \return An object representing the theme that should be destroyed with
+ * wl_cursor_theme_destroy() or %NULL on error, in which case \a done
+ * is not called.
+ */
+WL_EXPORT struct wl_cursor_theme *
+wl_cursor_theme_load_async(const char *name, int size, struct wl_shm *shm,
+			   wl_cursor_theme_load_func_t done, void *data)
+{
+	return load_theme(name, size, shm, done, data);
+}
+
+static uint32_t
+scale_dimension(uint32_t value, int size, uint32_t nominal)
+{
+	uint32_t scaled;
+
+	scaled = ((uint64_t) value * size + nominal / 2) / nominal;
+
+	return scaled > 0 ? scaled : 1;
+}
+
+static struct wl_cursor *
+wl_cursor_create_scaled(struct wl_cursor *base, int size,
+			struct wl_cursor_theme *theme)
+{
+	struct cursor *cursor;
+	struct cursor_image *image, *src;
+	unsigned int i;
+
+	cursor = malloc(sizeof *cursor);
+	if (!cursor)
+		return NULL;
+
+	cursor->cursor.images =
+		malloc(base->image_count * sizeof cursor->cursor.images[0]);
+	cursor->cursor.name = strdup(base->name);
+	if (!cursor->cursor.images || !cursor->cursor.name) {
+		free(cursor->cursor.images);
+		free(cursor->cursor.name);
+		free(cursor);
+		return NULL;
+	}
+
+	cursor->cursor.image_count = 0;
+	cursor->frame_end = NULL;
+
+	for (i = 0; i < base->image_count; i++) {
+		src = (struct cursor_image *) base->images[i];
+		image = malloc(sizeof *image);
+		if (!image) {
+			wl_cursor_destroy(&cursor->cursor);
+			return NULL;
+		}
+		cursor->cursor.images[i] = (struct wl_cursor_image *) image;
+		cursor->cursor.image_count++;
+
+		image->theme = theme;
+		image->buffer = NULL;
+		image->size = size;
+
+		image->image.width =
+			scale_dimension(src->image.width, size, src->size);
+		image->image.height =
+			scale_dimension(src->image.height, size, src->size);
+		image->image.hotspot_x =
+			(src->image.hotspot_x * size + src->size / 2) /
+			src->size;
+		image->image.hotspot_y =
+			(src->image.hotspot_y * size + src->size / 2) /
+			src->size;
+		if (image->image.hotspot_x >= image->image.width)
+			image->image.hotspot_x = image->image.width - 1;
+		if (image->image.hotspot_y >= image->image.height)
+			image->image.hotspot_y = image->image.height - 1;
+		image->image.delay = src->image.delay;
+
+		image->offset = theme->pool_size;
+		theme->pool_size +=
+			image->image.width * image->image.height * 4;
+	}
+
+	if (cursor_init_frames(cursor) < 0) {
+		wl_cursor_destroy(&cursor->cursor);
+		return NULL;
+	}
+
+	return &cursor->cursor;
+}
+
+/** Create a rescaled copy of a cursor theme
+ *
+ * Creates a new theme with the cursors of \a base, every image scaled
+ * from the nominal size it was drawn for to \a size.  The pixels come
+ * from the images \a base already decoded, so no cursor file is read
+ * again; this can be used to get a theme at a size none of its files
+ * provides, or to get the same theme at several output scales from one
+ * load.  Enlarged images are filtered bilinearly, shrunk ones with a
+ * box filter.
+ *
+ * If \a base was loaded with wl_cursor_theme_load_async(), its loading
+ * must have completed.
+ *
+ * \param base The cursor theme to scale
+ * \param size Desired size of the cursor images
+ *
+ * \return An object representing the scaled theme that should be
+ * destroyed with wl_cursor_theme_destroy() or %NULL on error.
+ */
+WL_EXPORT struct wl_cursor_theme *
+wl_cursor_theme_create_scaled(struct wl_cursor_theme *base, int size)
+{
+	struct wl_cursor_theme *theme;
+	struct cursor_image *src, *dst;
+	struct wl_cursor *cursor;
+	unsigned int i, j;
+
+	if (size <= 0)
+		return NULL;
+
 	theme = malloc(sizeof *theme);
 	if (!theme)
 		return NULL;
 
-	if (!name)
-		name = "default";
-
-	theme->name = strdup(name);
+	theme->name = strdup(base->name);
 	theme->size = size;
+	theme->shm = base->shm;
 	theme->cursor_count = 0;
-	theme->cursors = NULL;
-
-	theme->pool =
-		shm_pool_create(shm, size * size * 4);
-	if (!theme->pool) {
-		free(theme->name);
-		free(theme);
-		return NULL;
+	theme->pool_size = 0;
+	theme->loader = NULL;
+	theme->cursors = malloc(base->cursor_count * sizeof *theme->cursors);
+	if (!theme->name || (base->cursor_count && !theme->cursors))
+		goto err;
+
+	for (i = 0; i < base->cursor_count; i++) {
+		cursor = wl_cursor_create_scaled(base->cursors[i], size, theme);
+		if (!cursor)
+			goto err;
+		theme->cursors[theme->cursor_count++] = cursor;
 	}
 
-	xcursor_load_theme(name, size, load_callback, theme);
+	if (theme->pool_size == 0)
+		theme->pool_size = size * size * 4;
+
+	theme->pool = shm_pool_create(theme->shm, theme->pool_size);
+	if (!theme->pool)
+		goto err;
+
+	for (i = 0; i < theme->cursor_count; i++) {
+		cursor = theme->cursors[i];
+		for (j = 0; j < cursor->image_count; j++) {
+			src = (struct cursor_image *)
+				base->cursors[i]->images[j];
+			dst = (struct cursor_image *) cursor->images[j];
+			cursor_scale_image((uint32_t *)
+					   (base->pool->data + src->offset),
+					   src->image.width, src->image.height,
+					   (uint32_t *)
+					   (theme->pool->data + dst->offset),
+					   dst->image.width, dst->image.height);
+		}
+	}
 
 	return theme;
+
+err:
+	for (i = 0; i < theme->cursor_count; i++)
+		wl_cursor_destroy(theme->cursors[i]);
+	free(theme->cursors);
+	free(theme->name);
+	free(theme);
+	return NULL;
 }
 
 /** Destroys a cursor theme object
@@ -302,12 +712,16 @@ wl_cursor_theme_destroy(struct wl_cursor_theme *theme)
 {
 	unsigned int i;
 
+	if (theme->loader)
+		theme_loader_destroy(theme);
+
 	for (i = 0; i < theme->cursor_count; i++)
 		wl_cursor_destroy(theme->cursors[i]);
 
 	shm_pool_destroy(theme->pool);
 
 	free(theme->cursors);
+	free(theme->name);
 	free(theme);
 }
 
@@ -333,28 +747,59 @@ wl_cursor_theme_get_cursor(struct wl_cursor_theme *theme,
 }
 
 /** Find the frame for a given elapsed time in a cursor animation
+ * as well as the time left until next cursor change.
  *
  * \param cursor The cursor
- * \param time Elapsed time since the beginning of the animation
+ * \param time Elapsed time in ms since the beginning of the animation
+ * \param duration Pointer to uint32_t to store time left for this image
+ * or zero if the cursor won't change, may be %NULL
  *
  * \return The index of the image that should be displayed for the
  * given time in the cursor animation.
  */
 WL_EXPORT int
-wl_cursor_frame(struct wl_cursor *_cursor, uint32_t time)
+wl_cursor_frame_and_duration(struct wl_cursor *_cursor, uint32_t time,
+			     uint32_t *duration)
 {
 	struct cursor *cursor = (struct cursor *) _cursor;
 	uint32_t t;
-	int i;
+	int lo, hi, mid;
 
-	if (cursor->cursor.image_count == 1)
+	if (!cursor->frame_end || cursor->total_delay == 0) {
+		if (duration)
+			*duration = 0;
 		return 0;
+	}
 
-	i = 0;
 	t = time % cursor->total_delay;
 
-	while (t - cursor->cursor.images[i]->delay < t)
-		t -= cursor->cursor.images[i++]->delay;
+	/* first frame ending after t; frames with no delay are skipped */
+	lo = 0;
+	hi = cursor->cursor.image_count - 1;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cursor->frame_end[mid] <= t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (duration)
+		*duration = cursor->frame_end[lo] - t;
+
+	return lo;
+}
 
-	return i;
+/** Find the frame for a given elapsed time in a cursor animation
+ *
+ * \param cursor The cursor
+ * \param time Elapsed time in ms since the beginning of the animation
+ *
+ * \return The index of the image that should be displayed for the
+ * given time in the cursor animation.
+ */
+WL_EXPORT int
+wl_cursor_frame(struct wl_cursor *_cursor, uint32_t time)
+{
+	return wl_cursor_frame_and_duration(_cursor, time, NULL);
 }
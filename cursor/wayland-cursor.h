@@ -47,9 +47,19 @@ struct wl_cursor {
 
 struct wl_shm;
 
+typedef void (*wl_cursor_theme_load_func_t)(struct wl_cursor_theme *theme,
+					    void *data);
+
 struct wl_cursor_theme *
 wl_cursor_theme_load(const char *name, int size, struct wl_shm *shm);
 
+struct wl_cursor_theme *
+wl_cursor_theme_load_async(const char *name, int size, struct wl_shm *shm,
+			   wl_cursor_theme_load_func_t done, void *data);
+
+struct wl_cursor_theme *
+wl_cursor_theme_create_scaled(struct wl_cursor_theme *base, int size);
+
 void
 wl_cursor_theme_destroy(struct wl_cursor_theme *theme);
 
@@ -63,6 +73,10 @@ wl_cursor_image_get_buffer(struct wl_cursor_image *image);
 int
 wl_cursor_frame(struct wl_cursor *cursor, uint32_t time);
 
+int
+wl_cursor_frame_and_duration(struct wl_cursor *cursor, uint32_t time,
+			     uint32_t *duration);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -452,58 +452,93 @@ _XcursorFindImageToc (XcursorFileHeader	*fileHeader,
     return toc;
 }
 
+static XcursorBool
+_XcursorReadImageHeader (XcursorFile		*file,
+			 XcursorFileHeader	*fileHeader,
+			 int			toc,
+			 XcursorImage		*head)
+{
+    XcursorChunkHeader	chunkHeader;
+
+    if (!file || !fileHeader || !head)
+        return XcursorFalse;
+
+    if (!_XcursorFileReadChunkHeader (file, fileHeader, toc, &chunkHeader))
+	return XcursorFalse;
+    if (!_XcursorReadUInt (file, &head->width))
+	return XcursorFalse;
+    if (!_XcursorReadUInt (file, &head->height))
+	return XcursorFalse;
+    if (!_XcursorReadUInt (file, &head->xhot))
+	return XcursorFalse;
+    if (!_XcursorReadUInt (file, &head->yhot))
+	return XcursorFalse;
+    if (!_XcursorReadUInt (file, &head->delay))
+	return XcursorFalse;
+    /* sanity check data */
+    if (head->width >= 0x10000 || head->height > 0x10000)
+	return XcursorFalse;
+    if (head->width == 0 || head->height == 0)
+	return XcursorFalse;
+    if (head->xhot > head->width || head->yhot > head->height)
+	return XcursorFalse;
+    /* scaling divides by the nominal size */
+    if (chunkHeader.subtype == 0)
+	return XcursorFalse;
+
+    head->version = XCURSOR_IMAGE_VERSION;
+    if (chunkHeader.version < head->version)
+	head->version = chunkHeader.version;
+    head->size = chunkHeader.subtype;
+    head->pixels = NULL;
+    return XcursorTrue;
+}
+
+/*
+ * Read n pixels in one go and convert them from the LSBFirst file
+ * representation in place, instead of issuing one read per pixel.
+ */
+static XcursorBool
+_XcursorReadPixels (XcursorFile *file, XcursorPixel *pixels, int n)
+{
+    unsigned char   *bytes = (unsigned char *) pixels;
+    int		    i;
+
+    if ((*file->read) (file, bytes, n * 4) != n * 4)
+	return XcursorFalse;
+    for (i = 0; i < n; i++, bytes += 4)
+	pixels[i] = ((bytes[0] << 0) |
+		     (bytes[1] << 8) |
+		     (bytes[2] << 16) |
+		     ((XcursorPixel) bytes[3] << 24));
+    return XcursorTrue;
+}
+
 static XcursorImage *
 _XcursorReadImage (XcursorFile		*file,
 		   XcursorFileHeader	*fileHeader,
 		   int			toc)
 {
-    XcursorChunkHeader	chunkHeader;
     XcursorImage	head;
     XcursorImage	*image;
-    int			n;
-    XcursorPixel	*p;
-
-    if (!file || !fileHeader)
-        return NULL;
 
-    if (!_XcursorFileReadChunkHeader (file, fileHeader, toc, &chunkHeader))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.width))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.height))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.xhot))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.yhot))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.delay))
-	return NULL;
-    /* sanity check data */
-    if (head.width >= 0x10000 || head.height > 0x10000)
-	return NULL;
-    if (head.width == 0 || head.height == 0)
-	return NULL;
-    if (head.xhot > head.width || head.yhot > head.height)
+    if (!_XcursorReadImageHeader (file, fileHeader, toc, &head))
 	return NULL;
 
     /* Create the image and initialize it */
     image = XcursorImageCreate (head.width, head.height);
-    if (chunkHeader.version < image->version)
-	image->version = chunkHeader.version;
-    image->size = chunkHeader.subtype;
+    if (!image)
+	return NULL;
+    image->version = head.version;
+    image->size = head.size;
     image->xhot = head.xhot;
     image->yhot = head.yhot;
     image->delay = head.delay;
-    n = image->width * image->height;
-    p = image->pixels;
-    while (n--)
+    if (!_XcursorReadPixels (file, image->pixels,
+			     image->width * image->height))
     {
-	if (!_XcursorReadUInt (file, p))
-	{
-	    XcursorImageDestroy (image);
-	    return NULL;
-	}
-	p++;
+	XcursorImageDestroy (image);
+	return NULL;
     }
     return image;
 }
@@ -555,6 +590,107 @@ XcursorXcFileLoadImages (XcursorFile *file, int size)
     return images;
 }
 
+/*
+ * Like XcursorXcFileLoadImages, but only reads the image headers; the
+ * pixels pointers of the returned images are NULL.
+ */
+static XcursorImages *
+XcursorXcFileLoadImageHeaders (XcursorFile *file, int size)
+{
+    XcursorFileHeader	*fileHeader;
+    XcursorDim		bestSize;
+    int			nsize;
+    XcursorImages	*images;
+    XcursorImage	*image;
+    int			n;
+    int			toc;
+
+    if (!file || size < 0)
+	return NULL;
+    fileHeader = _XcursorReadFileHeader (file);
+    if (!fileHeader)
+	return NULL;
+    bestSize = _XcursorFindBestSize (fileHeader, (XcursorDim) size, &nsize);
+    if (!bestSize)
+    {
+        _XcursorFileHeaderDestroy (fileHeader);
+	return NULL;
+    }
+    images = XcursorImagesCreate (nsize);
+    if (!images)
+    {
+        _XcursorFileHeaderDestroy (fileHeader);
+	return NULL;
+    }
+    for (n = 0; n < nsize; n++)
+    {
+	toc = _XcursorFindImageToc (fileHeader, bestSize, n);
+	if (toc < 0)
+	    break;
+	image = malloc (sizeof (XcursorImage));
+	if (!image)
+	    break;
+	if (!_XcursorReadImageHeader (file, fileHeader, toc, image))
+	{
+	    free (image);
+	    break;
+	}
+	images->images[images->nimage++] = image;
+    }
+    _XcursorFileHeaderDestroy (fileHeader);
+    if (images->nimage != nsize)
+    {
+	XcursorImagesDestroy (images);
+	images = NULL;
+    }
+    return images;
+}
+
+/*
+ * Read the pixels of images previously described by
+ * XcursorXcFileLoadImageHeaders into the buffers their pixels
+ * pointers have been set to.  Fails if the file no longer matches
+ * the headers.
+ */
+static XcursorBool
+XcursorXcFileLoadPixels (XcursorFile *file, int size, XcursorImages *images)
+{
+    XcursorFileHeader	*fileHeader;
+    XcursorDim		bestSize;
+    XcursorImage	head;
+    int			nsize;
+    int			n;
+    int			toc;
+
+    if (!file || !images || size < 0)
+	return XcursorFalse;
+    fileHeader = _XcursorReadFileHeader (file);
+    if (!fileHeader)
+	return XcursorFalse;
+    bestSize = _XcursorFindBestSize (fileHeader, (XcursorDim) size, &nsize);
+    if (!bestSize || nsize != images->nimage)
+    {
+        _XcursorFileHeaderDestroy (fileHeader);
+	return XcursorFalse;
+    }
+    for (n = 0; n < nsize; n++)
+    {
+	toc = _XcursorFindImageToc (fileHeader, bestSize, n);
+	if (toc < 0)
+	    break;
+	if (!_XcursorReadImageHeader (file, fileHeader, toc, &head))
+	    break;
+	if (head.width != images->images[n]->width ||
+	    head.height != images->images[n]->height)
+	    break;
+	if (!_XcursorReadPixels (file, images->images[n]->pixels,
+				 head.width * head.height))
+	    break;
+    }
+    _XcursorFileHeaderDestroy (fileHeader);
+    return n == nsize;
+}
+
 static int
 _XcursorStdioFileRead (XcursorFile *file, unsigned char *buf, int len)
 {
@@ -857,20 +993,18 @@ XcursorLibraryLoadImages (const char *file, const char *theme, int size)
 }
 
 static void
-load_all_cursors_from_dir(const char *path, int size,
-			  void (*load_callback)(XcursorImages *, void *),
+scan_all_cursors_from_dir(const char *path,
+			  void (*file_callback)(const char *, const char *,
+						void *),
 			  void *user_data)
 {
-	FILE *f;
 	DIR *dir = opendir(path);
 	struct dirent *ent;
 	char *full;
-	XcursorImages *images;
 
 	if (!dir)
 		return;
 
-	ent = readdir(dir);
 	for(ent = readdir(dir); ent; ent = readdir(dir)) {
 #ifdef _DIRENT_HAVE_D_TYPE
 		if (ent->d_type != DT_UNKNOWN &&
@@ -882,49 +1016,33 @@ load_all_cursors_from_dir(const char *path, int size,
 		if (!full)
 			continue;
 
-		f = fopen(full, "r");
-		if (!f) {
-			free(full);
-			continue;
-		}
-
-		images = XcursorFileLoadImages(f, size);
+		file_callback(full, ent->d_name, user_data);
 
-		if (images) {
-			XcursorImagesSetName(images, ent->d_name);
-			load_callback(images, user_data);
-		}
-
-		fclose (f);
 		free(full);
 	}
 
 	closedir(dir);
 }
 
-/** Load all the cursor of a theme
+/** Find all the cursor files of a theme
  *
- * This function loads all the cursor images of a given theme and its
- * inherited themes. Each cursor is loaded into an XcursorImages object
- * which is passed to the caller's load callback. If a cursor appears
- * more than once across all the inherited themes, the load callback
- * will be called multiple times, with possibly different XcursorImages
- * object which have the same name. The user is expected to destroy the
- * XcursorImages objects passed to the callback with
- * XcursorImagesDestroy().
+ * This function walks the cursor directories of a given theme and then
+ * those of its inherited themes, and passes the full path and the
+ * cursor name of every file found to the caller's callback without
+ * opening it.  If a cursor appears more than
+ * once across all the inherited themes, the callback will be called
+ * multiple times with the same name.
  *
- * \param theme The name of theme that should be loaded
- * \param size The desired size of the cursor images
- * \param load_callback A callback function that will be called
- * for each cursor loaded. The first parameter is the XcursorImages
- * object representing the loaded cursor and the second is a pointer
- * to data provided by the user.
- * \param user_data The data that should be passed to the load callback
+ * \param theme The name of theme that should be scanned
+ * \param file_callback A callback function that will be called for
+ * each file found, with its full path, the cursor name and a pointer to
+ * data provided by the user.
+ * \param user_data The data that should be passed to the callback
  */
 void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
-		    void *user_data)
+xcursor_scan_theme(const char *theme,
+		   void (*file_callback)(const char *, const char *, void *),
+		   void *user_data)
 {
 	char *full, *dir;
 	char *inherits = NULL;
@@ -943,7 +1061,7 @@ xcursor_load_theme(const char *theme, int size,
 		full = _XcursorBuildFullname(dir, "cursors", "");
 
 		if (full) {
-			load_all_cursors_from_dir(full, size, load_callback,
+			scan_all_cursors_from_dir(full, file_callback,
 						  user_data);
 			free(full);
 		}
@@ -960,8 +1078,65 @@ xcursor_load_theme(const char *theme, int size,
 	}
 
 	for (i = inherits; i; i = _XcursorNextPath(i))
-		xcursor_load_theme(i, size, load_callback, user_data);
+		xcursor_scan_theme(i, file_callback, user_data);
 
 	if (inherits)
 		free(inherits);
 }
+
+/** Read the image headers of a cursor file
+ *
+ * Picks the images of the nominal size closest to \a size, like the
+ * full loader does, but only reads their headers.  The pixels pointer
+ * of every returned image is %NULL; the caller can point them at
+ * memory of width * height pixels each and fill them in later, from
+ * any thread, with xcursor_load_file_pixels().
+ *
+ * \return The images, to be destroyed with XcursorImagesDestroy(), or
+ * %NULL if the file is not a usable cursor file.
+ */
+XcursorImages *
+xcursor_load_file_headers(const char *path, int size)
+{
+	XcursorImages *images;
+	XcursorFile f;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file)
+		return NULL;
+
+	_XcursorStdioFileInitialize(file, &f);
+	images = XcursorXcFileLoadImageHeaders(&f, size);
+	fclose(file);
+
+	return images;
+}
+
+/** Read the pixels of a cursor file
+ *
+ * Fills in the pixels of images returned by xcursor_load_file_headers()
+ * for the same \a path and \a size.  Only touches the file and the
+ * memory the pixels pointers refer to, so different files can be read
+ * concurrently.
+ *
+ * \return XcursorTrue on success, XcursorFalse if the file could not be
+ * read or changed since its headers were read.
+ */
+XcursorBool
+xcursor_load_file_pixels(const char *path, int size, XcursorImages *images)
+{
+	XcursorBool ret;
+	XcursorFile f;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file)
+		return XcursorFalse;
+
+	_XcursorStdioFileInitialize(file, &f);
+	ret = XcursorXcFileLoadPixels(&f, size, images);
+	fclose(file);
+
+	return ret;
+}
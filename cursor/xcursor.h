@@ -56,7 +56,13 @@ void
 XcursorImagesDestroy (XcursorImages *images);
 
 void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
-		    void *user_data);
+xcursor_scan_theme(const char *theme,
+		   void (*file_callback)(const char *, const char *, void *),
+		   void *user_data);
+
+XcursorImages *
+xcursor_load_file_headers(const char *path, int size);
+
+XcursorBool
+xcursor_load_file_pixels(const char *path, int size, XcursorImages *images);
 #endif
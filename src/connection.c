@@ -34,20 +34,29 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "wayland-util.h"
 #include "wayland-private.h"
 #include "wayland-os.h"
+#include "wayland-probes.h"
 
 #define DIV_ROUNDUP(n, a) ( ((n) + ((a) - 1)) / (a) )
 
+/* A ring of WL_BUFFER_SIZE bytes.  The data is allocated when the
+ * ring is first written to; the output and fd rings give it back
+ * whenever they are drained, so that idle connections don't hold
+ * them. */
 struct wl_buffer {
-	char data[4096];
+	char *data;
 	int head, tail;
 };
 
-#define MASK(i) ((i) & 4095)
+#define WL_BUFFER_SIZE 4096
+#define MASK(i) ((i) & (WL_BUFFER_SIZE - 1))
 
 #define MAX_FDS_OUT	28
 #define CLEN		(CMSG_LEN(MAX_FDS_OUT * sizeof(int32_t)))
@@ -58,8 +67,9 @@ struct wl_connection {
 	int fd;
 	void *data;
 	wl_connection_update_func_t update;
-	struct wl_closure receive_closure, send_closure;
 	int write_signalled;
+	int active;		/* moved data since wl_connection_release_idle() */
+	uint32_t *reserve_buffer;
 };
 
 union wl_value {
@@ -76,10 +86,10 @@ wl_buffer_put(struct wl_buffer *b, const void *data, size_t count)
 	int head, size;
 
 	head = MASK(b->head);
-	if (head + count <= sizeof b->data) {
+	if (head + count <= WL_BUFFER_SIZE) {
 		memcpy(b->data + head, data, count);
 	} else {
-		size = sizeof b->data - head;
+		size = WL_BUFFER_SIZE - head;
 		memcpy(b->data + head, data, size);
 		memcpy(b->data, (const char *) data + size, count - size);
 	}
@@ -100,11 +110,11 @@ wl_buffer_put_iov(struct wl_buffer *b, struct iovec *iov, int *count)
 		*count = 1;
 	} else if (tail == 0) {
 		iov[0].iov_base = b->data + head;
-		iov[0].iov_len = sizeof b->data - head;
+		iov[0].iov_len = WL_BUFFER_SIZE - head;
 		*count = 1;
 	} else {
 		iov[0].iov_base = b->data + head;
-		iov[0].iov_len = sizeof b->data - head;
+		iov[0].iov_len = WL_BUFFER_SIZE - head;
 		iov[1].iov_base = b->data;
 		iov[1].iov_len = tail;
 		*count = 2;
@@ -124,11 +134,11 @@ wl_buffer_get_iov(struct wl_buffer *b, struct iovec *iov, int *count)
 		*count = 1;
 	} else if (head == 0) {
 		iov[0].iov_base = b->data + tail;
-		iov[0].iov_len = sizeof b->data - tail;
+		iov[0].iov_len = WL_BUFFER_SIZE - tail;
 		*count = 1;
 	} else {
 		iov[0].iov_base = b->data + tail;
-		iov[0].iov_len = sizeof b->data - tail;
+		iov[0].iov_len = WL_BUFFER_SIZE - tail;
 		iov[1].iov_base = b->data;
 		iov[1].iov_len = head;
 		*count = 2;
@@ -141,10 +151,10 @@ wl_buffer_copy(struct wl_buffer *b, void *data, size_t count)
 	int tail, size;
 
 	tail = MASK(b->tail);
-	if (tail + count <= sizeof b->data) {
+	if (tail + count <= WL_BUFFER_SIZE) {
 		memcpy(data, b->data + tail, count);
 	} else {
-		size = sizeof b->data - tail;
+		size = WL_BUFFER_SIZE - tail;
 		memcpy(data, b->data + tail, size);
 		memcpy((char *) data + size, b->data, count - size);
 	}
@@ -156,6 +166,27 @@ wl_buffer_size(struct wl_buffer *b)
 	return b->head - b->tail;
 }
 
+static int
+wl_buffer_ensure(struct wl_buffer *b)
+{
+	if (b->data == NULL)
+		b->data = malloc(WL_BUFFER_SIZE);
+
+	return b->data ? 0 : -1;
+}
+
+static void
+wl_buffer_trim(struct wl_buffer *b)
+{
+	if (b->head != b->tail)
+		return;
+
+	free(b->data);
+	b->data = NULL;
+	b->head = 0;
+	b->tail = 0;
+}
+
 struct wl_connection *
 wl_connection_create(int fd,
 		     wl_connection_update_func_t update,
@@ -182,6 +213,11 @@ void
 wl_connection_destroy(struct wl_connection *connection)
 {
 	close(connection->fd);
+	free(connection->in.data);
+	free(connection->out.data);
+	free(connection->fds_in.data);
+	free(connection->fds_out.data);
+	free(connection->reserve_buffer);
 	free(connection);
 }
 
@@ -233,20 +269,35 @@ close_fds(struct wl_buffer *buffer)
 	buffer->tail += size;
 }
 
-static void
+static int
 decode_cmsg(struct wl_buffer *buffer, struct msghdr *msg)
 {
 	struct cmsghdr *cmsg;
+	int fds[MAX_FDS_OUT], i, count;
 	size_t size;
+	int ret = 0;
 
 	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
 	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
-		if (cmsg->cmsg_level == SOL_SOCKET &&
-		    cmsg->cmsg_type == SCM_RIGHTS) {
-			size = cmsg->cmsg_len - CMSG_LEN(0);
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		size = cmsg->cmsg_len - CMSG_LEN(0);
+		if (ret == 0 && wl_buffer_ensure(buffer) == 0) {
 			wl_buffer_put(buffer, CMSG_DATA(cmsg), size);
+			continue;
 		}
+
+		/* Nowhere to keep them */
+		memcpy(fds, CMSG_DATA(cmsg), size);
+		count = size / sizeof fds[0];
+		for (i = 0; i < count; i++)
+			close(fds[i]);
+		ret = -1;
 	}
+
+	return ret;
 }
 
 int
@@ -257,7 +308,7 @@ wl_connection_data(struct wl_connection *connection, uint32_t mask)
 	char cmsg[CLEN];
 	int len, count, clen;
 
-	if (mask & WL_CONNECTION_WRITABLE) {
+	if (mask & WL_CONNECTION_WRITABLE && connection->out.data) {
 		wl_buffer_get_iov(&connection->out, iov, &count);
 
 		build_cmsg(&connection->fds_out, cmsg, &clen);
@@ -284,9 +335,12 @@ wl_connection_data(struct wl_connection *connection, uint32_t mask)
 			return -1;
 		}
 
+		WL_PROBE(connection_write, connection->fd, len);
+
 		close_fds(&connection->fds_out);
 
 		connection->out.tail += len;
+		connection->active = 1;
 		if (connection->out.tail == connection->out.head &&
 		    connection->write_signalled) {
 			connection->update(connection,
@@ -297,6 +351,9 @@ wl_connection_data(struct wl_connection *connection, uint32_t mask)
 	}
 
 	if (mask & WL_CONNECTION_READABLE) {
+		if (wl_buffer_ensure(&connection->in) < 0)
+			return -1;
+
 		wl_buffer_put_iov(&connection->in, iov, &count);
 
 		msg.msg_name = NULL;
@@ -321,32 +378,46 @@ wl_connection_data(struct wl_connection *connection, uint32_t mask)
 			return -1;
 		}
 
-		decode_cmsg(&connection->fds_in, &msg);
+		WL_PROBE(connection_read, connection->fd, len);
 
 		connection->in.head += len;
+
+		if (decode_cmsg(&connection->fds_in, &msg) < 0)
+			return -1;
+		if (connection->fds_in.data)
+			connection->active = 1;
 	}	
 
 	return connection->in.head - connection->in.tail;
 }
 
+static void
+wl_connection_signal_write(struct wl_connection *connection)
+{
+	if (!connection->write_signalled) {
+		connection->update(connection,
+				   WL_CONNECTION_READABLE |
+				   WL_CONNECTION_WRITABLE,
+				   connection->data);
+		connection->write_signalled = 1;
+	}
+}
+
 int
 wl_connection_write(struct wl_connection *connection,
 		    const void *data, size_t count)
 {
 	if (connection->out.head - connection->out.tail +
-	    count > ARRAY_LENGTH(connection->out.data))
+	    count > WL_BUFFER_SIZE)
 		if (wl_connection_data(connection, WL_CONNECTION_WRITABLE))
 			return -1;
 
+	if (wl_buffer_ensure(&connection->out) < 0)
+		return -1;
+
 	wl_buffer_put(&connection->out, data, count);
 
-	if (!connection->write_signalled) {
-		connection->update(connection,
-				   WL_CONNECTION_READABLE |
-				   WL_CONNECTION_WRITABLE,
-				   connection->data);
-		connection->write_signalled = 1;
-	}
+	wl_connection_signal_write(connection);
 
 	return 0;
 }
@@ -356,40 +427,277 @@ wl_connection_queue(struct wl_connection *connection,
 		    const void *data, size_t count)
 {
 	if (connection->out.head - connection->out.tail +
-	    count > ARRAY_LENGTH(connection->out.data))
+	    count > WL_BUFFER_SIZE)
 		if (wl_connection_data(connection, WL_CONNECTION_WRITABLE))
 			return -1;
 
+	if (wl_buffer_ensure(&connection->out) < 0)
+		return -1;
+
 	wl_buffer_put(&connection->out, data, count);
 
 	return 0;
 }
 
-static int
-wl_message_size_extra(const struct wl_message *message)
+/* Reserves room for a message of size bytes in the output buffer and
+ * returns where to write it, so that it can be marshalled in place
+ * rather than through a closure.  The message header must be written
+ * before wl_connection_commit() is called.  When the message would
+ * wrap around the end of the buffer, it is written to a separate
+ * buffer and copied on commit instead. */
+uint32_t *
+wl_connection_reserve(struct wl_connection *connection, size_t size)
 {
-	int i, extra;
+	struct wl_buffer *b = &connection->out;
+	int head;
 
-	for (i = 0, extra = 0; message->signature[i]; i++) {
+	if (size > WL_BUFFER_SIZE) {
+		errno = E2BIG;
+		return NULL;
+	}
 
-		switch (message->signature[i]) {
-		case 's':
-		case 'o':
+	if (b->head - b->tail + size > WL_BUFFER_SIZE)
+		if (wl_connection_data(connection, WL_CONNECTION_WRITABLE))
+			return NULL;
+
+	if (wl_buffer_ensure(b) < 0)
+		return NULL;
+
+	head = MASK(b->head);
+	if (head + size <= WL_BUFFER_SIZE)
+		return (uint32_t *) (b->data + head);
+
+	if (!connection->reserve_buffer) {
+		connection->reserve_buffer = malloc(WL_BUFFER_SIZE);
+		if (!connection->reserve_buffer)
+			return NULL;
+	}
+
+	return connection->reserve_buffer;
+}
+
+void
+wl_connection_commit(struct wl_connection *connection, uint32_t *p)
+{
+	uint32_t size = p[1] >> 16;
+
+	if (p == connection->reserve_buffer)
+		wl_buffer_put(&connection->out, p, size);
+	else
+		connection->out.head += size;
+
+	wl_connection_signal_write(connection);
+}
+
+/* Free the output, reserve and fd buffers if they are empty and no data
+ * went through the connection since the last call, so that idle
+ * connections only keep their input buffer.  Returns whether any of them are still
+ * held, to be tried again later. */
+int
+wl_connection_release_idle(struct wl_connection *connection)
+{
+	if (connection->active) {
+		connection->active = 0;
+		return 1;
+	}
+
+	wl_buffer_trim(&connection->out);
+	wl_buffer_trim(&connection->fds_out);
+	wl_buffer_trim(&connection->fds_in);
+
+	/* Only used between a reserve and its commit */
+	free(connection->reserve_buffer);
+	connection->reserve_buffer = NULL;
+
+	return connection->out.data || connection->fds_out.data ||
+		connection->fds_in.data;
+}
+
+/* Bytes sent to the other end that it hasn't read yet: those still in
+ * the output buffer and those in the socket.  For a unix socket,
+ * SIOCOUTQ counts the memory of the messages the peer hasn't
+ * received, which is more than the bytes but zero once all are read. */
+size_t
+wl_connection_unread_output(struct wl_connection *connection)
+{
+	int queued;
+
+	if (ioctl(connection->fd, SIOCOUTQ, &queued) < 0)
+		queued = 0;
+
+	return connection->out.head - connection->out.tail + queued;
+}
+
+/* Descriptions of the messages of the core protocol, hashed by
+ * message.  The messages of an interface are contiguous, so they land
+ * in consecutive slots.  Extensions are described from their
+ * signatures: entries can't be taken out again, so one left by a
+ * library that was unloaded would describe whatever message is later
+ * loaded at its address, and libwayland-client and libwayland-server
+ * each have their own table, which one exported function couldn't
+ * fill both of.
+ *
+ * Adding may race with other threads marshalling: it is serialized by
+ * the mutex, and a slot's info is written before its message is
+ * published, so that lookups need no lock. */
+#define MESSAGE_INFO_TABLE_SIZE 256
+
+static struct {
+	const struct wl_message *message;
+	const struct wl_message_info *info;
+} message_info_table[MESSAGE_INFO_TABLE_SIZE];
+static int message_info_count;
+static pthread_mutex_t message_info_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t
+message_info_hash(const struct wl_message *message)
+{
+	return (uintptr_t) message / sizeof *message;
+}
+
+static void
+message_info_insert(const struct wl_message *message,
+		    const struct wl_message_info *info)
+{
+	uint32_t h, i;
+
+	h = message_info_hash(message);
+	for (i = 0; i < MESSAGE_INFO_TABLE_SIZE; i++) {
+		h &= MESSAGE_INFO_TABLE_SIZE - 1;
+		if (message_info_table[h].message == message)
+			return;
+		if (message_info_table[h].message == NULL)
+			break;
+		h++;
+	}
+
+	/* Keep the probe sequences short; messages left out are
+	 * described from their signature instead */
+	if (message_info_count >= MESSAGE_INFO_TABLE_SIZE * 3 / 4)
+		return;
+
+	message_info_table[h].info = info;
+	__atomic_store_n(&message_info_table[h].message, message,
+			 __ATOMIC_RELEASE);
+	message_info_count++;
+}
+
+void
+wl_message_info_add(const struct wl_protocol_info *protocol)
+{
+	const struct wl_interface_info *interface_info;
+	const struct wl_interface *interface;
+	uint32_t i;
+	int j;
+
+	if (protocol->version != WL_PROTOCOL_INFO_VERSION)
+		return;
+
+	pthread_mutex_lock(&message_info_mutex);
+
+	for (i = 0; i < protocol->interface_count; i++) {
+		interface_info = &protocol->interfaces[i];
+		interface = interface_info->interface;
+
+		for (j = 0; j < interface->method_count; j++)
+			message_info_insert(&interface->methods[j],
+					    &interface_info->requests[j]);
+		for (j = 0; j < interface->event_count; j++)
+			message_info_insert(&interface->events[j],
+					    &interface_info->events[j]);
+	}
+
+	pthread_mutex_unlock(&message_info_mutex);
+}
+
+static void
+message_info_from_signature(const struct wl_message *message,
+			    struct wl_message_info_buffer *buffer)
+{
+	struct wl_message_info *info = &buffer->info;
+	const char *signature = message->signature;
+	struct argument_details arg;
+	int n;
+
+	memset(info, 0, sizeof *info);
+	info->types = buffer->types;
+	info->fixed_size = 8;
+
+	for (n = 0; *signature; n++) {
+		signature = get_next_argument(signature, &arg);
+
+		/* Too many arguments, the caller rejects the message */
+		if (n < WL_CLOSURE_MAX_ARGS)
+			buffer->types[n] = arg.type;
+		if (arg.nullable && n < 32)
+			info->nullable |= 1 << n;
+
+		switch (arg.type) {
+		case 'h':
+			info->flags |= WL_MESSAGE_HAS_FD;
+			info->fd_count++;
+			continue;
 		case 'n':
-			extra += sizeof (void *);
+			info->flags |= WL_MESSAGE_HAS_NEW_ID;
+			info->pointer_count++;
 			break;
-		case 'a':
-			extra += sizeof (void *) + sizeof (struct wl_array);
+		case 'o':
+			info->flags |= WL_MESSAGE_HAS_OBJECT;
+			info->pointer_count++;
 			break;
-		case 'h':
-			extra += sizeof (int);
+		case 'a':
+			info->array_count++;
+			/* fall through */
+		case 's':
+			info->flags |= WL_MESSAGE_HAS_VARIABLE;
+			info->pointer_count++;
 			break;
 		default:
 			break;
 		}
+
+		info->fixed_size += 4;
 	}
 
-	return extra;
+	buffer->types[n < WL_CLOSURE_MAX_ARGS ? n : WL_CLOSURE_MAX_ARGS] = '\0';
+	info->arg_count = n;
+}
+
+/* Returns the description of a message, from the scanner generated
+ * tables when the protocol has been added, or else parsed from the
+ * signature into the given buffer. */
+const struct wl_message_info *
+wl_message_get_info(const struct wl_message *message,
+		    struct wl_message_info_buffer *buffer)
+{
+	const struct wl_message *m;
+	uint32_t h, i;
+
+	h = message_info_hash(message);
+	for (i = 0; i < MESSAGE_INFO_TABLE_SIZE; i++) {
+		h &= MESSAGE_INFO_TABLE_SIZE - 1;
+		m = __atomic_load_n(&message_info_table[h].message,
+				    __ATOMIC_ACQUIRE);
+		if (m == message)
+			return message_info_table[h].info;
+		if (m == NULL)
+			break;
+		h++;
+	}
+
+	message_info_from_signature(message, buffer);
+
+	return &buffer->info;
+}
+
+/* Space needed in a closure for the pointers to the arguments that
+ * aren't passed by value */
+static int
+wl_message_size_extra(const struct wl_message_info *info)
+{
+	return info->pointer_count * sizeof (void *) +
+		info->array_count * sizeof (struct wl_array) +
+		info->fd_count * sizeof (int);
 }
 
 static int
@@ -399,6 +707,9 @@ wl_connection_put_fd(struct wl_connection *connection, int32_t fd)
 		if (wl_connection_data(connection, WL_CONNECTION_WRITABLE))
 			return -1;
 
+	if (wl_buffer_ensure(&connection->fds_out) < 0)
+		return -1;
+
 	wl_buffer_put(&connection->fds_out, &fd, sizeof fd);
 
 	return 0;
@@ -417,18 +728,6 @@ get_next_argument(const char *signature, struct argument_details *details)
 	return signature + 1;
 }
 
-int
-arg_count_for_signature(const char *signature)
-{
-	int count = 0;
-	while (*signature) {
-		if (*signature != '?')
-			count++;
-		signature++;
-	}
-	return count;
-}
-
 struct wl_closure *
 wl_closure_vmarshal(struct wl_object *sender,
 		    uint32_t opcode, va_list ap,
@@ -440,18 +739,26 @@ wl_closure_vmarshal(struct wl_object *sender,
 	int dup_fd;
 	struct wl_array **arrayp, *array;
 	const char **sp, *s;
-	const char *signature = message->signature;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
 	struct argument_details arg;
 	char *extra;
 	int i, count, fd, extra_size, *fd_ptr;
 
+	info = wl_message_get_info(message, &info_buffer);
+	count = info->arg_count + 2;
+	if (count > WL_CLOSURE_MAX_ARGS) {
+		printf("too many args (%d)\n", count);
+		errno = EINVAL;
+		return NULL;
+	}
+
 	/* FIXME: Match old fixed allocation for now */
 	closure = malloc(sizeof *closure + 1024);
 	if (closure == NULL)
 		return NULL;
 
-	extra_size = wl_message_size_extra(message);
-	count = arg_count_for_signature(signature) + 2;
+	extra_size = wl_message_size_extra(info);
 	extra = (char *) closure->buffer;
 	start = &closure->buffer[DIV_ROUNDUP(extra_size, sizeof *p)];
 	end = &closure->buffer[256];
@@ -461,7 +768,7 @@ wl_closure_vmarshal(struct wl_object *sender,
 	closure->types[1] = &ffi_type_pointer;
 
 	for (i = 2; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
+		get_argument(info, i - 2, &arg);
 
 		switch (arg.type) {
 		case 'f':
@@ -604,6 +911,9 @@ wl_closure_vmarshal(struct wl_object *sender,
 	ffi_prep_cif(&closure->cif, FFI_DEFAULT_ABI,
 		     closure->count, &ffi_type_void, closure->types);
 
+	WL_PROBE(marshal, sender->interface->name, opcode,
+		 closure->start[0], closure->start[1] >> 16);
+
 	return closure;
 
 err:
@@ -623,6 +933,58 @@ err_null:
 	return NULL;
 }
 
+static int
+lookup_object(struct wl_map *objects, const struct wl_message *message,
+	      int i, uint32_t id, struct wl_object **object)
+{
+	*object = wl_map_lookup(objects, id);
+	if (*object == WL_ZOMBIE_OBJECT) {
+		/* references object we've already
+		 * destroyed client side */
+		*object = NULL;
+	} else if (*object == NULL && id != 0) {
+		printf("unknown object (%u), message %s(%s)\n",
+		       id, message->name, message->signature);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (*object != NULL && message->types[i-2] != NULL &&
+	    (*object)->interface != message->types[i-2]) {
+		printf("invalid object (%u), type (%s), "
+			"message %s(%s)\n",
+		       id, (*object)->interface->name,
+		       message->name, message->signature);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+reserve_new_id(struct wl_map *objects, const struct wl_message *message,
+	       uint32_t id)
+{
+	if (wl_map_reserve_new(objects, id) < 0) {
+		printf("not a valid new object id (%d), "
+		       "message %s(%s)\n",
+		       id, message->name, message->signature);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Decode a message from the connection into a closure.
+ *
+ * When \a objects is NULL only the wire format is validated: object
+ * arguments are left NULL and new ids are not reserved.  Such a closure
+ * must go through wl_closure_lookup() before it is invoked.  This split
+ * lets the map-independent part run off the thread that owns \a objects.
+ */
 struct wl_closure *
 wl_connection_demarshal(struct wl_connection *connection,
 			uint32_t size,
@@ -633,13 +995,15 @@ wl_connection_demarshal(struct wl_connection *connection,
 	int *fd;
 	char *extra, **s;
 	unsigned int i, count, extra_space;
-	const char *signature = message->signature;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
 	struct argument_details arg;
 	struct wl_object **object;
 	struct wl_array **array;
 	struct wl_closure *closure;
 
-	count = arg_count_for_signature(signature) + 2;
+	info = wl_message_get_info(message, &info_buffer);
+	count = info->arg_count + 2;
 	if (count > ARRAY_LENGTH(closure->types)) {
 		printf("too many args (%d)\n", count);
 		errno = EINVAL;
@@ -647,7 +1011,15 @@ wl_connection_demarshal(struct wl_connection *connection,
 		return NULL;
 	}
 
-	extra_space = wl_message_size_extra(message);
+	if (size < info->fixed_size) {
+		printf("message too short, message %s(%s)\n",
+		       message->name, message->signature);
+		errno = EINVAL;
+		wl_connection_consume(connection, size);
+		return NULL;
+	}
+
+	extra_space = wl_message_size_extra(info);
 	closure = malloc(sizeof *closure + 8 + size + extra_space);
 	if (closure == NULL)
 		return NULL;
@@ -662,7 +1034,7 @@ wl_connection_demarshal(struct wl_connection *connection,
 	end = (uint32_t *) ((char *) p + size);
 	extra = (char *) end;
 	for (i = 2; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
+		get_argument(info, i - 2, &arg);
 
 		if (p + 1 > end) {
 			printf("message too short, "
@@ -732,28 +1104,10 @@ wl_connection_demarshal(struct wl_connection *connection,
 				goto err;
 			}
 
-			*object = wl_map_lookup(objects, *p);
-			if (*object == WL_ZOMBIE_OBJECT) {
-				/* references object we've already
-				 * destroyed client side */
+			if (objects == NULL)
 				*object = NULL;
-			} else if (*object == NULL && *p != 0) {
-				printf("unknown object (%u), message %s(%s)\n",
-				       *p, message->name, message->signature);
-				*object = NULL;
-				errno = EINVAL;
-				goto err;
-			}
-
-			if (*object != NULL && message->types[i-2] != NULL &&
-			    (*object)->interface != message->types[i-2]) {
-				printf("invalid object (%u), type (%s), "
-					"message %s(%s)\n",
-				       *p, (*object)->interface->name,
-				       message->name, message->signature);
-				errno = EINVAL;
+			else if (lookup_object(objects, message, i, *p, object) < 0)
 				goto err;
-			}
 
 			p++;
 			break;
@@ -772,13 +1126,8 @@ wl_connection_demarshal(struct wl_connection *connection,
 				goto err;
 			}
 
-			if (wl_map_reserve_new(objects, *p) < 0) {
-				printf("not a valid new object id (%d), "
-				       "message %s(%s)\n",
-				       *p, message->name, message->signature);
-				errno = EINVAL;
+			if (objects && reserve_new_id(objects, message, *p) < 0)
 				goto err;
-			}
 
 			p++;
 			break;
@@ -814,6 +1163,13 @@ wl_connection_demarshal(struct wl_connection *connection,
 			extra += sizeof *fd;
 			closure->args[i] = fd;
 
+			if (wl_buffer_size(&connection->fds_in) < (int) sizeof *fd) {
+				printf("missing fd, message %s(%s)\n",
+				       message->name, message->signature);
+				errno = EINVAL;
+				goto err;
+			}
+
 			wl_buffer_copy(&connection->fds_in, fd, sizeof *fd);
 			connection->fds_in.tail += sizeof *fd;
 			break;
@@ -829,6 +1185,9 @@ wl_connection_demarshal(struct wl_connection *connection,
 	ffi_prep_cif(&closure->cif, FFI_DEFAULT_ABI,
 		     closure->count, &ffi_type_void, closure->types);
 
+	WL_PROBE(demarshal, message->name, closure->buffer[1] & 0xffff,
+		 closure->buffer[0], size);
+
 	wl_connection_consume(connection, size);
 
 	return closure;
@@ -841,6 +1200,61 @@ wl_connection_demarshal(struct wl_connection *connection,
 	return NULL;
 }
 
+/**
+ * Resolve the object and new id arguments of a closure decoded by
+ * wl_connection_demarshal() without an object map.
+ *
+ * \return 0 on success, -1 with errno set to EINVAL if an argument
+ * does not name a valid object.
+ */
+int
+wl_closure_lookup(struct wl_closure *closure, struct wl_map *objects)
+{
+	const struct wl_message *message = closure->message;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
+	struct argument_details arg;
+	uint32_t *p, length;
+	int i;
+
+	info = wl_message_get_info(message, &info_buffer);
+	if (!(info->flags & (WL_MESSAGE_HAS_OBJECT | WL_MESSAGE_HAS_NEW_ID)))
+		return 0;
+
+	p = &closure->buffer[2];
+	for (i = 2; i < closure->count; i++) {
+		get_argument(info, i - 2, &arg);
+
+		switch (arg.type) {
+		case 'u':
+		case 'i':
+		case 'f':
+			p++;
+			break;
+		case 's':
+		case 'a':
+			length = *p++;
+			p += DIV_ROUNDUP(length, sizeof *p);
+			break;
+		case 'o':
+			if (lookup_object(objects, message, i, *p,
+					  closure->args[i]) < 0)
+				return -1;
+			p++;
+			break;
+		case 'n':
+			if (reserve_new_id(objects, message, *p) < 0)
+				return -1;
+			p++;
+			break;
+		case 'h':
+			break;
+		}
+	}
+
+	return 0;
+}
+
 void
 wl_closure_invoke(struct wl_closure *closure,
 		  struct wl_object *target, void (*func)(void), void *data)
@@ -850,23 +1264,33 @@ wl_closure_invoke(struct wl_closure *closure,
 	closure->args[0] = &data;
 	closure->args[1] = &target;
 
+	WL_PROBE(invoke_begin, target->interface->name,
+		 closure->start[1] & 0xffff, closure->start[0],
+		 closure->start[1] >> 16);
+
 	ffi_call(&closure->cif, func, &result, closure->args);
+
+	/* The request may have destroyed target */
+	WL_PROBE(invoke_end, closure->start[1] & 0xffff, closure->start[0],
+		 closure->start[1] >> 16);
 }
 
 static int
 copy_fds_to_connection(struct wl_closure *closure,
 		       struct wl_connection *connection)
 {
-	const struct wl_message *message = closure->message;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
 	uint32_t i, count;
-	struct argument_details arg;
-	const char *signature = message->signature;
 	int *fd;
 
-	count = arg_count_for_signature(signature) + 2;
+	info = wl_message_get_info(closure->message, &info_buffer);
+	if (!(info->flags & WL_MESSAGE_HAS_FD))
+		return 0;
+
+	count = info->arg_count + 2;
 	for (i = 2; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-		if (arg.type != 'h')
+		if (info->types[i - 2] != 'h')
 			continue;
 
 		fd = closure->args[i];
@@ -913,10 +1337,13 @@ wl_closure_print(struct wl_closure *closure, struct wl_object *target, int send)
 	int32_t si;
 	int i;
 	struct argument_details arg;
-	const char *signature = closure->message->signature;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
 	struct timespec tp;
 	unsigned int time;
 
+	info = wl_message_get_info(closure->message, &info_buffer);
+
 	clock_gettime(CLOCK_REALTIME, &tp);
 	time = (tp.tv_sec * 1000000L) + (tp.tv_nsec / 1000);
 
@@ -927,7 +1354,7 @@ wl_closure_print(struct wl_closure *closure, struct wl_object *target, int send)
 		closure->message->name);
 
 	for (i = 2; i < closure->count; i++) {
-		signature = get_next_argument(signature, &arg);
+		get_argument(info, i - 2, &arg);
 		if (i > 2)
 			fprintf(stderr, ", ");
 
@@ -20,12 +20,367 @@
  * OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <time.h>
 
 #include "wayland-server.h"
+#include "wayland-private.h"
+
+/* Sources created by clients.  Their MIME types are interned on the
+ * display, and the offer events for them are encoded once and copied
+ * into every offer made from the source. */
+struct wl_client_data_source {
+	struct wl_data_source base;
+	struct wl_display *display;
+	/* The type arguments of the offer events, as on the wire */
+	struct wl_array offer_args;
+};
+
+/* The data of one MIME type of the selection, read into a memfd */
+struct wl_selection_entry {
+	struct wl_list link;
+	struct wl_selection_cache *cache;
+	char *mime_type;
+	int fd;
+	loff_t size;
+	int pipe_fd;
+	struct wl_event_source *source;
+	int complete;
+};
+
+struct wl_selection_cache {
+	struct wl_seat *seat;
+	struct wl_event_loop *loop;
+	const char * const *mime_types;
+	size_t max_size;
+	struct wl_data_source *source;
+	struct wl_list entries;
+	struct wl_listener seat_destroy_listener;
+};
+
+/* A paste being served from the cache */
+struct wl_selection_transfer {
+	int fd;
+	int data_fd;
+	off_t offset;
+	off_t size;
+	struct wl_event_source *source;
+};
+
+static void
+selection_entry_stop(struct wl_selection_entry *entry)
+{
+	if (entry->source) {
+		wl_event_source_remove(entry->source);
+		entry->source = NULL;
+	}
+	if (entry->pipe_fd >= 0) {
+		close(entry->pipe_fd);
+		entry->pipe_fd = -1;
+	}
+}
+
+static void
+selection_cache_clear(struct wl_selection_cache *cache)
+{
+	struct wl_selection_entry *entry, *next;
+
+	wl_list_for_each_safe(entry, next, &cache->entries, link) {
+		selection_entry_stop(entry);
+		close(entry->fd);
+		free(entry->mime_type);
+		free(entry);
+	}
+	wl_list_init(&cache->entries);
+	cache->source = NULL;
+}
+
+static int
+selection_entry_data(int fd, uint32_t mask, void *data)
+{
+	struct wl_selection_entry *entry = data;
+	ssize_t len;
+
+	do {
+		len = splice(fd, NULL, entry->fd, &entry->size, 65536,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	} while ((len > 0 && (size_t) entry->size <= entry->cache->max_size) ||
+		 (len < 0 && errno == EINTR));
+
+	/* Leave oversized data and failed reads to the source */
+	if ((size_t) entry->size > entry->cache->max_size ||
+	    (len < 0 && errno != EAGAIN)) {
+		selection_entry_stop(entry);
+		return 1;
+	}
+
+	if (len == 0) {
+		selection_entry_stop(entry);
+		entry->complete = 1;
+	}
+
+	return 1;
+}
+
+static void
+selection_cache_add(struct wl_selection_cache *cache, const char *mime_type)
+{
+	struct wl_data_source *source = cache->source;
+	struct wl_selection_entry *entry;
+	int p[2];
+
+	entry = malloc(sizeof *entry);
+	if (entry == NULL)
+		return;
+
+	entry->cache = cache;
+	entry->size = 0;
+	entry->complete = 0;
+	entry->source = NULL;
+	entry->mime_type = strdup(mime_type);
+	entry->fd = memfd_create("wayland-selection", MFD_CLOEXEC);
+	if (entry->mime_type == NULL || entry->fd < 0)
+		goto err_entry;
+
+	if (pipe2(p, O_CLOEXEC | O_NONBLOCK) < 0)
+		goto err_entry;
+
+	entry->pipe_fd = p[0];
+	entry->source = wl_event_loop_add_fd(cache->loop, p[0],
+					     WL_EVENT_READABLE,
+					     selection_entry_data, entry);
+	if (entry->source == NULL) {
+		close(p[0]);
+		close(p[1]);
+		goto err_entry;
+	}
+
+	wl_list_insert(cache->entries.prev, &entry->link);
+	source->send(source, mime_type, p[1]);
+
+	return;
+
+err_entry:
+	if (entry->fd >= 0)
+		close(entry->fd);
+	free(entry->mime_type);
+	free(entry);
+}
+
+static void
+selection_cache_fill(struct wl_selection_cache *cache,
+		     struct wl_data_source *source)
+{
+	const char * const *type;
+	char **p;
+
+	selection_cache_clear(cache);
+	if (source == NULL)
+		return;
+
+	cache->source = source;
+	for (type = cache->mime_types; *type; type++)
+		wl_array_for_each(p, &source->mime_types)
+			if (strcmp(*p, *type) == 0) {
+				selection_cache_add(cache, *type);
+				break;
+			}
+}
+
+static void
+selection_transfer_destroy(struct wl_selection_transfer *transfer)
+{
+	if (transfer->source)
+		wl_event_source_remove(transfer->source);
+	close(transfer->data_fd);
+	close(transfer->fd);
+	free(transfer);
+}
+
+/* Returns 1 when the transfer is over, 0 if the receiver is full.
+ *
+ * There is no MSG_NOSIGNAL for sendfile(), so SIGPIPE is blocked while
+ * writing to the receiver's pipe, and the one raised when the receiver
+ * has closed it is taken off the thread again. */
+static int
+selection_transfer_write(struct wl_selection_transfer *transfer)
+{
+	static const struct timespec no_wait = { 0, 0 };
+	sigset_t pipe_mask, old_mask;
+	ssize_t len;
+	int ret = 1;
+
+	sigemptyset(&pipe_mask);
+	sigaddset(&pipe_mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe_mask, &old_mask);
+
+	while (transfer->offset < transfer->size) {
+		len = sendfile(transfer->fd, transfer->data_fd,
+			       &transfer->offset,
+			       transfer->size - transfer->offset);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN) {
+			ret = 0;
+			break;
+		}
+		if (len < 0 && errno == EPIPE)
+			while (sigtimedwait(&pipe_mask, NULL, &no_wait) < 0 &&
+			       errno == EINTR)
+				;
+		if (len <= 0)
+			break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	return ret;
+}
+
+static int
+selection_transfer_data(int fd, uint32_t mask, void *data)
+{
+	struct wl_selection_transfer *transfer = data;
+
+	if (selection_transfer_write(transfer))
+		selection_transfer_destroy(transfer);
+
+	return 1;
+}
+
+/* Write the cached data for mime_type to fd, without waiting for the
+ * receiving end.  Returns -1, leaving fd alone, when the data isn't
+ * in the cache. */
+static int
+selection_cache_send(struct wl_selection_cache *cache,
+		     struct wl_data_source *source,
+		     const char *mime_type, int32_t fd)
+{
+	struct wl_selection_entry *entry;
+	struct wl_selection_transfer *transfer;
+	int flags;
+
+	if (cache == NULL || cache->source != source)
+		return -1;
+
+	wl_list_for_each(entry, &cache->entries, link)
+		if (entry->complete && strcmp(entry->mime_type, mime_type) == 0)
+			break;
+	if (&entry->link == &cache->entries)
+		return -1;
+
+	transfer = malloc(sizeof *transfer);
+	if (transfer == NULL)
+		return -1;
+
+	transfer->data_fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+	if (transfer->data_fd < 0) {
+		free(transfer);
+		return -1;
+	}
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags >= 0)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+	transfer->fd = fd;
+	transfer->offset = 0;
+	transfer->size = entry->size;
+	transfer->source = NULL;
+
+	/* Most pastes fit in the pipe and are done right away */
+	if (selection_transfer_write(transfer)) {
+		selection_transfer_destroy(transfer);
+		return 0;
+	}
+
+	transfer->source = wl_event_loop_add_fd(cache->loop, fd,
+						WL_EVENT_WRITABLE,
+						selection_transfer_data,
+						transfer);
+	if (transfer->source == NULL)
+		selection_transfer_destroy(transfer);
+
+	return 0;
+}
+
+static void
+selection_cache_seat_destroyed(struct wl_listener *listener, void *data)
+{
+	struct wl_selection_cache *cache =
+		container_of(listener, struct wl_selection_cache,
+			     seat_destroy_listener);
+
+	selection_cache_clear(cache);
+	cache->seat->selection_cache = NULL;
+	free(cache);
+}
+
+/** Keep a copy of the selection in the compositor
+ *
+ * \param seat The seat
+ * \param loop Event loop for reading and writing the data
+ * \param mime_types NULL-terminated list of MIME types to cache
+ * \param max_size Largest amount of data to cache per MIME type
+ * \return 0 on success, -1 on failure
+ *
+ * When a new selection is set, the data for the MIME types in the
+ * list that the source offers is requested from it right away and
+ * read into memory.  Once a type has been read in full, pastes of it
+ * are answered from the copy, and the source isn't asked again.
+ * Pastes of other types, of data larger than max_size, or that come
+ * before the data has arrived still go to the source.
+ *
+ * The list isn't copied and has to stay around.  A max_size of 0
+ * turns the cache off again.
+ */
+WL_EXPORT int
+wl_seat_set_selection_cache(struct wl_seat *seat, struct wl_event_loop *loop,
+			    const char * const *mime_types, size_t max_size)
+{
+	struct wl_selection_cache *cache = seat->selection_cache;
+
+	if (max_size == 0) {
+		if (cache) {
+			wl_list_remove(&cache->seat_destroy_listener.link);
+			selection_cache_seat_destroyed(
+				&cache->seat_destroy_listener, seat);
+		}
+		return 0;
+	}
+
+	if (cache == NULL) {
+		cache = malloc(sizeof *cache);
+		if (cache == NULL)
+			return -1;
+		cache->seat = seat;
+		cache->source = NULL;
+		wl_list_init(&cache->entries);
+		cache->seat_destroy_listener.notify =
+			selection_cache_seat_destroyed;
+		wl_signal_add(&seat->destroy_signal,
+			      &cache->seat_destroy_listener);
+		seat->selection_cache = cache;
+	}
+
+	cache->loop = loop;
+	cache->mime_types = mime_types;
+	cache->max_size = max_size;
+	selection_cache_fill(cache, seat->selection_data_source);
+
+	return 0;
+}
 
 static void
 data_offer_accept(struct wl_client *client, struct wl_resource *resource,
@@ -47,6 +402,11 @@ data_offer_receive(struct wl_client *client, struct wl_resource *resource,
 {
 	struct wl_data_offer *offer = resource->data;
 
+	if (offer->source && offer->seat &&
+	    selection_cache_send(offer->seat->selection_cache,
+				 offer->source, mime_type, fd) == 0)
+		return;
+
 	if (offer->source)
 		offer->source->send(offer->source, mime_type, fd);
 	else
@@ -72,6 +432,8 @@ destroy_data_offer(struct wl_resource *resource)
 
 	if (offer->source)
 		wl_list_remove(&offer->source_destroy_listener.link);
+	if (offer->seat)
+		wl_list_remove(&offer->seat_destroy_listener.link);
 	free(offer);
 }
 
@@ -86,8 +448,76 @@ destroy_offer_data_source(struct wl_listener *listener, void *data)
 	offer->source = NULL;
 }
 
+/* Clients can hold on to offers past the seat */
+static void
+destroy_offer_seat(struct wl_listener *listener, void *data)
+{
+	struct wl_data_offer *offer;
+
+	offer = container_of(listener, struct wl_data_offer,
+			     seat_destroy_listener);
+
+	offer->seat = NULL;
+}
+
+static void destroy_data_source(struct wl_resource *resource);
+
+static void
+encode_offers(struct wl_client_data_source *source)
+{
+	uint32_t *p, len, words;
+	char **type;
+
+	wl_array_for_each(type, &source->base.mime_types) {
+		len = strlen(*type) + 1;
+		words = 1 + (len + 3) / 4;
+		p = wl_array_add(&source->offer_args, words * sizeof *p);
+		if (p == NULL) {
+			source->offer_args.size = 0;
+			return;
+		}
+		p[0] = len;
+		p[words - 1] = 0;
+		memcpy(p + 1, *type, len);
+	}
+}
+
+static void
+send_encoded_offers(struct wl_client_data_source *source,
+		    struct wl_resource *offer)
+{
+	uint32_t *args, *end, *p;
+	size_t words;
+	char **type;
+
+	if (source->offer_args.size == 0)
+		encode_offers(source);
+
+	/* Sources that ran out of memory encoding go the slow way */
+	if (source->offer_args.size == 0) {
+		wl_array_for_each(type, &source->base.mime_types)
+			wl_data_offer_send_offer(offer, *type);
+		return;
+	}
+
+	args = source->offer_args.data;
+	end = (uint32_t *) ((char *) args + source->offer_args.size);
+	for (; args < end; args += words) {
+		words = 1 + (args[0] + 3) / 4;
+		p = wl_resource_marshal_reserve(offer, WL_DATA_OFFER_OFFER,
+						(2 + words) * sizeof *p);
+		if (p == NULL) {
+			wl_data_offer_send_offer(offer,
+						 (const char *) (args + 1));
+			continue;
+		}
+		memcpy(p + 2, args, words * sizeof *p);
+		wl_resource_marshal_commit(offer, p);
+	}
+}
+
 static struct wl_resource *
-wl_data_source_send_offer(struct wl_data_source *source,
+wl_data_source_send_offer(struct wl_seat *seat, struct wl_data_source *source,
 			  struct wl_resource *target)
 {
 	struct wl_data_offer *offer;
@@ -105,6 +535,9 @@ wl_data_source_send_offer(struct wl_data_source *source,
 	offer->resource.data = offer;
 	wl_signal_init(&offer->resource.destroy_signal);
 
+	offer->seat = seat;
+	offer->seat_destroy_listener.notify = destroy_offer_seat;
+	wl_signal_add(&seat->destroy_signal, &offer->seat_destroy_listener);
 	offer->source = source;
 	offer->source_destroy_listener.notify = destroy_offer_data_source;
 	wl_signal_add(&source->resource.destroy_signal,
@@ -114,25 +547,62 @@ wl_data_source_send_offer(struct wl_data_source *source,
 
 	wl_data_device_send_data_offer(target, &offer->resource);
 
-	wl_array_for_each(p, &source->mime_types)
-		wl_data_offer_send_offer(&offer->resource, *p);
+	if (source->resource.destroy == destroy_data_source)
+		send_encoded_offers((struct wl_client_data_source *) source,
+				    &offer->resource);
+	else
+		wl_array_for_each(p, &source->mime_types)
+			wl_data_offer_send_offer(&offer->resource, *p);
 
 	return &offer->resource;
 }
 
+/* What a client is charged for offering a MIME type */
+static size_t
+mime_type_size(const char *type)
+{
+	return strlen(type) + 1 + sizeof type;
+}
+
 static void
 data_source_offer(struct wl_client *client,
 		  struct wl_resource *resource,
 		  const char *type)
 {
-	struct wl_data_source *source = resource->data;
+	struct wl_client_data_source *source = resource->data;
+	const char *interned;
 	char **p;
 
-	p = wl_array_add(&source->mime_types, sizeof *p);
-	if (p)
-		*p = strdup(type);
-	if (!p || !*p)
+	interned = wl_display_intern_string(source->display, type);
+	if (interned == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	/* Interned strings are equal only if they are the same string */
+	wl_array_for_each(p, &source->base.mime_types)
+		if (*p == interned) {
+			wl_display_release_string(source->display, interned);
+			return;
+		}
+
+	if (wl_client_charge(client, WL_CLIENT_ACCOUNT_DATA,
+			     1, mime_type_size(interned)) < 0) {
+		wl_display_release_string(source->display, interned);
+		return;
+	}
+
+	p = wl_array_add(&source->base.mime_types, sizeof *p);
+	if (p == NULL) {
+		wl_client_uncharge(client, WL_CLIENT_ACCOUNT_DATA,
+				   1, mime_type_size(interned));
+		wl_display_release_string(source->display, interned);
 		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	*p = (char *) interned;
+	source->offer_args.size = 0;
 }
 
 static void
@@ -159,6 +629,177 @@ find_resource(struct wl_list *list, struct wl_client *client)
 	return NULL;
 }
 
+/* Pointer motion held back from a drop target that is falling behind.
+ * Only the latest position is kept, so the target gets at most one
+ * motion event per delivery. */
+struct wl_drag_throttle {
+	struct wl_seat *seat;
+	struct wl_event_source *timer;
+	uint32_t interval_ms;
+	uint64_t last_ms;
+	int armed;
+	int pending;
+	uint32_t time;
+	wl_fixed_t x, y;
+	struct wl_listener seat_destroy_listener;
+};
+
+static uint64_t
+drag_throttle_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+drag_throttle_send(struct wl_drag_throttle *throttle)
+{
+	struct wl_resource *resource = throttle->seat->drag_focus_resource;
+
+	if (throttle->pending && resource)
+		wl_data_device_send_motion(resource, throttle->time,
+					   throttle->x, throttle->y);
+	throttle->pending = 0;
+	throttle->last_ms = drag_throttle_now();
+}
+
+/* Deliver the pending motion unless the interval since the last one
+ * hasn't passed, in which case the timer tries again when it has, or
+ * the target hasn't read everything it was sent.  Nothing tells us
+ * when the target catches up, so then the motion waits for the next
+ * one, the next interval or the drop. */
+static void
+drag_throttle_flush(struct wl_drag_throttle *throttle)
+{
+	struct wl_resource *resource = throttle->seat->drag_focus_resource;
+	uint64_t elapsed;
+	int delay;
+
+	if (!throttle->pending || !resource)
+		return;
+
+	elapsed = drag_throttle_now() - throttle->last_ms;
+	if (elapsed < throttle->interval_ms) {
+		delay = throttle->interval_ms - elapsed;
+	} else if (!wl_client_has_unread_output(resource->client)) {
+		drag_throttle_send(throttle);
+		return;
+	} else if (throttle->interval_ms == 0) {
+		return;
+	} else {
+		delay = throttle->interval_ms;
+	}
+
+	throttle->armed = 1;
+	wl_event_source_timer_update(throttle->timer, delay);
+}
+
+static int
+drag_throttle_timeout(void *data)
+{
+	struct wl_drag_throttle *throttle = data;
+
+	throttle->armed = 0;
+	drag_throttle_flush(throttle);
+
+	return 1;
+}
+
+/* Drop the pending motion, when the target changes */
+static void
+drag_throttle_reset(struct wl_drag_throttle *throttle)
+{
+	throttle->pending = 0;
+	throttle->last_ms = 0;
+	if (throttle->armed) {
+		throttle->armed = 0;
+		wl_event_source_timer_update(throttle->timer, 0);
+	}
+}
+
+static void
+drag_throttle_destroy(struct wl_drag_throttle *throttle)
+{
+	wl_list_remove(&throttle->seat_destroy_listener.link);
+	wl_event_source_remove(throttle->timer);
+	throttle->seat->drag_throttle = NULL;
+	free(throttle);
+}
+
+static void
+drag_throttle_seat_destroyed(struct wl_listener *listener, void *data)
+{
+	struct wl_drag_throttle *throttle =
+		container_of(listener, struct wl_drag_throttle,
+			     seat_destroy_listener);
+
+	drag_throttle_destroy(throttle);
+}
+
+/** Coalesce the motion events of drags
+ *
+ * \param seat The seat
+ * \param loop Event loop for the timer that delivers held motion, or
+ * NULL to send every motion again
+ * \param interval_ms Least time between motion events to a target
+ * \return 0 on success, -1 on failure
+ *
+ * Normally every pointer motion during a drag is sent to the drop
+ * target.  With this set, a motion is held back while the target
+ * hasn't read all the events it was sent, or while interval_ms hasn't
+ * passed since the last one, and later motion replaces it.  So a
+ * target has at most one motion event unread.
+ *
+ * The server isn't told when a target reads, so motion held back for
+ * that reason is only sent with the next motion, the next interval_ms
+ * tick or a drop, whichever comes first once the target has caught
+ * up.  With interval_ms 0, a target that falls behind doesn't get the
+ * final position of a pointer that stops until it moves again or
+ * drops.  Motion still pending when the pointer leaves the target is
+ * dropped, and it is sent before a drop, so the drop happens where
+ * the target last saw the pointer.
+ */
+WL_EXPORT int
+wl_seat_set_drag_motion_throttle(struct wl_seat *seat,
+				 struct wl_event_loop *loop,
+				 uint32_t interval_ms)
+{
+	struct wl_drag_throttle *throttle = seat->drag_throttle;
+
+	if (throttle) {
+		drag_throttle_send(throttle);
+		drag_throttle_destroy(throttle);
+	}
+
+	if (loop == NULL)
+		return 0;
+
+	throttle = malloc(sizeof *throttle);
+	if (throttle == NULL)
+		return -1;
+
+	throttle->timer = wl_event_loop_add_timer(loop, drag_throttle_timeout,
+						  throttle);
+	if (throttle->timer == NULL) {
+		free(throttle);
+		return -1;
+	}
+
+	throttle->seat = seat;
+	throttle->interval_ms = interval_ms;
+	throttle->last_ms = 0;
+	throttle->armed = 0;
+	throttle->pending = 0;
+	throttle->seat_destroy_listener.notify = drag_throttle_seat_destroyed;
+	wl_signal_add(&seat->destroy_signal, &throttle->seat_destroy_listener);
+	seat->drag_throttle = throttle;
+
+	return 0;
+}
+
 static void
 destroy_drag_focus(struct wl_listener *listener, void *data)
 {
@@ -177,6 +818,9 @@ drag_grab_focus(struct wl_pointer_grab *grab,
 	struct wl_display *display;
 	uint32_t serial;
 
+	if (seat->drag_throttle)
+		drag_throttle_reset(seat->drag_throttle);
+
 	if (seat->drag_focus_resource) {
 		wl_data_device_send_leave(seat->drag_focus_resource);
 		wl_list_remove(&seat->drag_focus_listener.link);
@@ -200,7 +844,8 @@ drag_grab_focus(struct wl_pointer_grab *grab,
 	serial = wl_display_next_serial(display);
 
 	if (seat->drag_data_source)
-		offer = wl_data_source_send_offer(seat->drag_data_source,
+		offer = wl_data_source_send_offer(seat,
+						  seat->drag_data_source,
 						  resource);
 
 	wl_data_device_send_enter(resource, serial, &surface->resource,
@@ -219,10 +864,23 @@ drag_grab_motion(struct wl_pointer_grab *grab,
 		 uint32_t time, wl_fixed_t x, wl_fixed_t y)
 {
 	struct wl_seat *seat = container_of(grab, struct wl_seat, drag_grab);
+	struct wl_drag_throttle *throttle = seat->drag_throttle;
 
-	if (seat->drag_focus_resource)
+	if (!seat->drag_focus_resource)
+		return;
+
+	if (throttle == NULL) {
 		wl_data_device_send_motion(seat->drag_focus_resource,
 					   time, x, y);
+		return;
+	}
+
+	throttle->time = time;
+	throttle->x = x;
+	throttle->y = y;
+	throttle->pending = 1;
+	if (!throttle->armed)
+		drag_throttle_flush(throttle);
 }
 
 static void
@@ -260,8 +918,11 @@ drag_grab_button(struct wl_pointer_grab *grab,
 
 	if (seat->drag_focus_resource &&
 	    seat->pointer->grab_button == button &&
-	    state == WL_POINTER_BUTTON_STATE_RELEASED)
+	    state == WL_POINTER_BUTTON_STATE_RELEASED) {
+		if (seat->drag_throttle)
+			drag_throttle_send(seat->drag_throttle);
 		wl_data_device_send_drop(seat->drag_focus_resource);
+	}
 
 	if (seat->pointer->button_count == 0 &&
 	    state == WL_POINTER_BUTTON_STATE_RELEASED) {
@@ -343,6 +1004,8 @@ destroy_selection_data_source(struct wl_listener *listener, void *data)
 	struct wl_resource *focus = NULL;
 
 	seat->selection_data_source = NULL;
+	if (seat->selection_cache)
+		selection_cache_clear(seat->selection_cache);
 
 	if (seat->keyboard)
 		focus = seat->keyboard->focus_resource;
@@ -376,13 +1039,18 @@ wl_seat_set_selection(struct wl_seat *seat, struct wl_data_source *source,
 	seat->selection_data_source = source;
 	seat->selection_serial = serial;
 
+	/* Ask for the data before any offer goes out */
+	if (seat->selection_cache)
+		selection_cache_fill(seat->selection_cache, source);
+
 	if (seat->keyboard)
 		focus = seat->keyboard->focus_resource;
 	if (focus) {
 		data_device = find_resource(&seat->drag_resource_list,
 					    focus->client);
 		if (data_device && source) {
-			offer = wl_data_source_send_offer(seat->selection_data_source,
+			offer = wl_data_source_send_offer(seat,
+							  seat->selection_data_source,
 							  data_device);
 			wl_data_device_send_selection(data_device, offer);
 		} else if (data_device) {
@@ -421,16 +1089,21 @@ static const struct wl_data_device_interface data_device_interface = {
 static void
 destroy_data_source(struct wl_resource *resource)
 {
-	struct wl_data_source *source =
-		container_of(resource, struct wl_data_source, resource);
+	struct wl_client_data_source *source =
+		container_of(resource, struct wl_client_data_source,
+			     base.resource);
 	char **p;
 
-	wl_array_for_each(p, &source->mime_types)
-		free(*p);
+	wl_array_for_each(p, &source->base.mime_types) {
+		wl_client_uncharge(resource->client, WL_CLIENT_ACCOUNT_DATA,
+				   1, mime_type_size(*p));
+		wl_display_release_string(source->display, *p);
+	}
 
-	wl_array_release(&source->mime_types);
+	wl_array_release(&source->base.mime_types);
+	wl_array_release(&source->offer_args);
 
-	source->resource.object.id = 0;
+	source->base.resource.object.id = 0;
 }
 
 static void
@@ -458,7 +1131,7 @@ static void
 create_data_source(struct wl_client *client,
 		   struct wl_resource *resource, uint32_t id)
 {
-	struct wl_data_source *source;
+	struct wl_client_data_source *source;
 
 	source = malloc(sizeof *source);
 	if (source == NULL) {
@@ -466,20 +1139,22 @@ create_data_source(struct wl_client *client,
 		return;
 	}
 
-	source->resource.destroy = destroy_data_source;
-	source->resource.object.id = id;
-	source->resource.object.interface = &wl_data_source_interface;
-	source->resource.object.implementation =
+	source->base.resource.destroy = destroy_data_source;
+	source->base.resource.object.id = id;
+	source->base.resource.object.interface = &wl_data_source_interface;
+	source->base.resource.object.implementation =
 		(void (**)(void)) &data_source_interface;
-	source->resource.data = source;
-	wl_signal_init(&source->resource.destroy_signal);
+	source->base.resource.data = source;
+	wl_signal_init(&source->base.resource.destroy_signal);
 
-	source->accept = client_source_accept;
-	source->send = client_source_send;
-	source->cancel = client_source_cancel;
+	source->base.accept = client_source_accept;
+	source->base.send = client_source_send;
+	source->base.cancel = client_source_cancel;
 
-	wl_array_init(&source->mime_types);
-	wl_client_add_resource(client, &source->resource);
+	source->display = wl_client_get_display(client);
+	wl_array_init(&source->base.mime_types);
+	wl_array_init(&source->offer_args);
+	wl_client_add_resource(client, &source->base.resource);
 }
 
 static void unbind_data_device(struct wl_resource *resource)
@@ -537,7 +1212,7 @@ wl_data_device_set_keyboard_focus(struct wl_seat *seat)
 
 	source = seat->selection_data_source;
 	if (source) {
-		offer = wl_data_source_send_offer(source, data_device);
+		offer = wl_data_source_send_offer(seat, source, data_device);
 		wl_data_device_send_selection(data_device, offer);
 	}
 }
@@ -32,16 +32,59 @@
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
+#include <time.h>
 #include <assert.h>
+#include <pthread.h>
+#include "../config.h"
 #include "wayland-server.h"
+#include "wayland-private.h"
 #include "wayland-os.h"
+#include "wayland-probes.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(IORING_POLL_UPDATE_EVENTS) && defined(IORING_ENTER_EXT_ARG) && \
+    defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#endif
+#endif
+
+struct wl_uring;
+struct wl_work_pool;
+struct wl_signal_mux;
 
 struct wl_event_loop {
 	int epoll_fd;
+	struct wl_uring *uring;
+	struct wl_work_pool *work_pool;
+	struct wl_signal_mux *signal_mux;
 	struct wl_list check_list;
 	struct wl_list idle_list;
 	struct wl_list destroy_list;
+
+	int stats_enabled;
+	struct wl_list stats_list;
+
+	uint64_t watchdog_ns;
+	wl_event_loop_watchdog_func_t watchdog_func;
+	void *watchdog_data;
+
+	/* The slowest dispatch of the current iteration */
+	struct wl_event_source *slowest;
+	uint64_t slowest_ns;
+};
+
+/* Allocated on a source's first dispatch with stats enabled, so that
+ * sources don't pay for it otherwise */
+struct wl_event_source_record {
+	struct wl_list link;
+	struct wl_event_source *source;
+	struct wl_event_source_stats stats;
 };
 
 struct wl_event_source_interface {
@@ -55,8 +98,428 @@ struct wl_event_source {
 	struct wl_list link;
 	void *data;
 	int fd;
+	struct wl_event_source_record *record;
+
+	/* Used by the io_uring backend only */
+	uint32_t events;
+	uint32_t uring_id;
+	uint32_t uring_generation;
+	int armed;
+};
+
+#ifdef HAVE_IO_URING
+
+/* The io_uring backend keeps a one-shot poll request in flight for
+ * every fd, timer and signal source and re-arms it after the source
+ * has been dispatched.  That keeps the level-triggered behaviour the
+ * sources get from epoll, and the re-arms, updates and removals done
+ * during an iteration all go to the kernel in the one io_uring_enter()
+ * call that also waits for the next events.
+ *
+ * Requests are tagged with the source's slot in a wl_map plus a
+ * generation, so that completions for sources that have since been
+ * removed, and maybe freed, are dropped.
+ *
+ * A re-arm can fail when the rings are full.  The source is then left
+ * disarmed and rearm_pending set, and the next wait retries all such
+ * sources once the completions that filled the rings are reaped. */
+
+#define URING_ENTRIES 256
+
+struct wl_uring {
+	int fd;
+	int exported;
+	uint32_t generation;
+	int rearm_pending;
+	struct wl_map sources;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array, *sq_flags;
+	unsigned int sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	char *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
 };
 
+static int
+uring_enter(struct wl_uring *ring, unsigned int submit, unsigned int wait,
+	    unsigned int flags, void *arg, size_t size)
+{
+	return syscall(__NR_io_uring_enter,
+		       ring->fd, submit, wait, flags, arg, size);
+}
+
+static unsigned int
+uring_unsubmitted(struct wl_uring *ring)
+{
+	return *ring->sq_tail - __atomic_load_n(ring->sq_head,
+						 __ATOMIC_ACQUIRE);
+}
+
+static int
+uring_submit(struct wl_uring *ring)
+{
+	int ret;
+
+	if (uring_unsubmitted(ring) == 0)
+		return 0;
+
+	do {
+		ret = uring_enter(ring, uring_unsubmitted(ring), 0, 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(struct wl_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	if (uring_unsubmitted(ring) == ring->sq_entries)
+		uring_submit(ring);
+	if (uring_unsubmitted(ring) == ring->sq_entries)
+		return NULL;
+
+	sqe = &ring->sqes[*ring->sq_tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof *sqe);
+
+	return sqe;
+}
+
+static void
+uring_queue_sqe(struct wl_uring *ring)
+{
+	unsigned int tail = *ring->sq_tail;
+
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t
+uring_poll_events(uint32_t events)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = events << 16 | events >> 16;
+#endif
+	return events;
+}
+
+static uint64_t
+uring_tag(struct wl_event_source *source)
+{
+	return (uint64_t) source->uring_generation << 32 | source->uring_id;
+}
+
+static struct wl_event_source *
+uring_lookup(struct wl_uring *ring, uint64_t tag)
+{
+	struct wl_event_source *source;
+
+	if (tag == 0)
+		return NULL;
+
+	source = wl_map_lookup(&ring->sources, tag & 0xffffffff);
+	if (source == NULL || source->uring_generation != tag >> 32)
+		return NULL;
+
+	return source;
+}
+
+static int
+uring_poll_add(struct wl_uring *ring, struct wl_event_source *source)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe(ring);
+	if (sqe == NULL)
+		return -1;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = source->fd;
+	sqe->poll32_events = uring_poll_events(source->events);
+	sqe->user_data = uring_tag(source);
+	uring_queue_sqe(ring);
+	source->armed = 1;
+
+	return 0;
+}
+
+/* Cancels the poll request of source, or changes the events it waits
+ * for if update is set.  If the request has already completed this
+ * fails, which is fine: the source will be re-armed with its current
+ * events after it has been dispatched. */
+static int
+uring_poll_remove(struct wl_uring *ring,
+		  struct wl_event_source *source, int update)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe(ring);
+	if (sqe == NULL)
+		return -1;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_tag(source);
+	if (update) {
+		sqe->len = IORING_POLL_UPDATE_EVENTS;
+		sqe->poll32_events = uring_poll_events(source->events);
+	}
+	sqe->user_data = 0;
+	uring_queue_sqe(ring);
+
+	return 0;
+}
+
+/* With the ring fd handed out, someone else may be polling it instead
+ * of calling wl_event_loop_dispatch(), so requests can't wait there */
+static int
+uring_flush(struct wl_uring *ring)
+{
+	if (!ring->exported)
+		return 0;
+
+	return uring_submit(ring) < 0 ? -1 : 0;
+}
+
+static int
+uring_add_source(struct wl_uring *ring, struct wl_event_source *source)
+{
+	source->uring_id = wl_map_insert_new(&ring->sources,
+					     WL_MAP_CLIENT_SIDE, source);
+	if (++ring->generation == 0)
+		ring->generation = 1;
+	source->uring_generation = ring->generation;
+
+	if (uring_poll_add(ring, source) < 0) {
+		wl_map_remove(&ring->sources, source->uring_id);
+		return -1;
+	}
+
+	return uring_flush(ring);
+}
+
+static int
+uring_update_source(struct wl_uring *ring, struct wl_event_source *source)
+{
+	if (source->armed && uring_poll_remove(ring, source, 1) < 0)
+		return -1;
+
+	return uring_flush(ring);
+}
+
+static void
+uring_remove_source(struct wl_uring *ring, struct wl_event_source *source)
+{
+	if (source->armed)
+		uring_poll_remove(ring, source, 0);
+	wl_map_remove(&ring->sources, source->uring_id);
+	uring_flush(ring);
+}
+
+static void
+uring_rearm(struct wl_uring *ring, struct wl_event_source *source)
+{
+	if (source->fd != -1 && !source->armed &&
+	    uring_poll_add(ring, source) < 0)
+		ring->rearm_pending = 1;
+}
+
+static void
+uring_rearm_helper(void *element, void *data)
+{
+	uring_rearm(data, element);
+}
+
+static int
+uring_wait(struct wl_uring *ring, struct epoll_event *ep, int max, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	struct wl_event_source *source;
+	unsigned int head, tail, wait = 0, flags = 0, overflow;
+	int n;
+
+	if (ring->rearm_pending) {
+		ring->rearm_pending = 0;
+		wl_map_for_each(&ring->sources, uring_rearm_helper, ring);
+	}
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	/* Don't sleep while sources are disarmed, they could be the
+	 * ones that are ready */
+	if (head == tail && timeout != 0 && !ring->rearm_pending) {
+		wait = 1;
+		flags = IORING_ENTER_GETEVENTS;
+	}
+
+	/* Completions that didn't fit the ring are kept by the kernel
+	 * and only moved back into it by a GETEVENTS enter */
+	overflow = __atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) &
+		IORING_SQ_CQ_OVERFLOW;
+	if (overflow)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	if (wait && timeout > 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000 * 1000;
+		memset(&arg, 0, sizeof arg);
+		arg.ts = (uint64_t) (uintptr_t) &ts;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	if (wait || overflow || uring_unsubmitted(ring) > 0) {
+		if (uring_enter(ring, uring_unsubmitted(ring), wait, flags,
+				flags & IORING_ENTER_EXT_ARG ? &arg : NULL,
+				sizeof arg) < 0 &&
+		    errno != ETIME && errno != EBUSY)
+			return -1;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	for (n = 0; head != tail && n < max; head++) {
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		source = uring_lookup(ring, cqe->user_data);
+		if (source == NULL)
+			continue;
+
+		source->armed = 0;
+		ep[n].events = cqe->res < 0 ? EPOLLERR : (uint32_t) cqe->res;
+		ep[n].data.ptr = source;
+		n++;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static void
+uring_destroy(struct wl_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	wl_map_release(&ring->sources);
+	free(ring);
+}
+
+static void *
+uring_map(struct wl_uring *ring, size_t size, off_t offset)
+{
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static struct wl_uring *
+uring_create(void)
+{
+	struct wl_uring *ring;
+	struct io_uring_params params;
+	const uint32_t features = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG |
+		IORING_FEAT_SINGLE_MMAP |
+		/* Implies poll updates, from the same kernel */
+		IORING_FEAT_RSRC_TAGS;
+
+	ring = malloc(sizeof *ring);
+	if (ring == NULL)
+		return NULL;
+
+	memset(ring, 0, sizeof *ring);
+	memset(&params, 0, sizeof params);
+	ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	if ((params.features & features) != features) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	ring->sq_ring_size =
+		params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof (struct io_uring_cqe);
+	if (ring->cq_ring_size > ring->sq_ring_size)
+		ring->sq_ring_size = ring->cq_ring_size;
+	ring->cq_ring_size = ring->sq_ring_size;
+	ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+	ring->sq_ring = uring_map(ring, ring->sq_ring_size, IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->sq_ring;
+	ring->sqes = uring_map(ring, ring->sqes_size, IORING_OFF_SQES);
+	if (ring->sq_ring == NULL || ring->sqes == NULL) {
+		if (ring->sq_ring)
+			munmap(ring->sq_ring, ring->sq_ring_size);
+		if (ring->sqes)
+			munmap(ring->sqes, ring->sqes_size);
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	ring->sq_head = (void *) (ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (void *) (ring->sq_ring + params.sq_off.tail);
+	ring->sq_flags = (void *) (ring->sq_ring + params.sq_off.flags);
+	ring->sq_mask = (void *) (ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (void *) (ring->sq_ring + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head = (void *) (ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (void *) (ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = (void *) (ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (void *) (ring->cq_ring + params.cq_off.cqes);
+
+	wl_map_init(&ring->sources);
+
+	return ring;
+}
+
+#else
+
+static struct wl_uring *
+uring_create(void)
+{
+	return NULL;
+}
+
+#define uring_add_source(ring, source) (-1)
+#define uring_update_source(ring, source) (-1)
+#define uring_remove_source(ring, source) do { } while (0)
+#define uring_rearm(ring, source) do { } while (0)
+#define uring_flush(ring) (0)
+#define uring_wait(ring, ep, max, timeout) (-1)
+#define uring_destroy(ring) do { } while (0)
+
+#endif
+
+static uint32_t
+epoll_events(uint32_t mask)
+{
+	uint32_t events = 0;
+
+	if (mask & WL_EVENT_READABLE)
+		events |= EPOLLIN;
+	if (mask & WL_EVENT_WRITABLE)
+		events |= EPOLLOUT;
+
+	return events;
+}
+
 struct wl_event_source_fd {
 	struct wl_event_source base;
 	wl_event_loop_fd_func_t func;
@@ -97,13 +560,23 @@ add_source(struct wl_event_loop *loop,
 
 	source->loop = loop;
 	source->data = data;
+	source->record = NULL;
+	source->events = epoll_events(mask);
+	source->armed = 0;
 	wl_list_init(&source->link);
 
+	if (loop->uring) {
+		if (uring_add_source(loop->uring, source) < 0) {
+			close(source->fd);
+			free(source);
+			return NULL;
+		}
+
+		return source;
+	}
+
 	memset(&ep, 0, sizeof ep);
-	if (mask & WL_EVENT_READABLE)
-		ep.events |= EPOLLIN;
-	if (mask & WL_EVENT_WRITABLE)
-		ep.events |= EPOLLOUT;
+	ep.events = source->events;
 	ep.data.ptr = source;
 
 	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &ep) < 0) {
@@ -141,11 +614,12 @@ wl_event_source_fd_update(struct wl_event_source *source, uint32_t mask)
 	struct wl_event_loop *loop = source->loop;
 	struct epoll_event ep;
 
+	source->events = epoll_events(mask);
+	if (loop->uring)
+		return uring_update_source(loop->uring, source);
+
 	memset(&ep, 0, sizeof ep);
-	if (mask & WL_EVENT_READABLE)
-		ep.events |= EPOLLIN;
-	if (mask & WL_EVENT_WRITABLE)
-		ep.events |= EPOLLOUT;
+	ep.events = source->events;
 	ep.data.ptr = source;
 
 	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &ep);
@@ -212,10 +686,20 @@ wl_event_source_timer_update(struct wl_event_source *source, int ms_delay)
 	return 0;
 }
 
+/* All signal sources of a loop share one signalfd, read by this
+ * source, which passes each signal on to every source watching it. */
+struct wl_signal_mux {
+	struct wl_event_source base;
+	sigset_t mask;
+	struct wl_list sources;
+	int dispatching;
+};
+
 struct wl_event_source_signal {
 	struct wl_event_source base;
 	int signal_number;
 	wl_event_loop_signal_func_t func;
+	struct wl_list signal_link;
 };
 
 static int
@@ -224,13 +708,6 @@ wl_event_source_signal_dispatch(struct wl_event_source *source,
 {
 	struct wl_event_source_signal *signal_source =
 		(struct wl_event_source_signal *) source;
-	struct signalfd_siginfo signal_info;
-	int len;
-
-	len = read(source->fd, &signal_info, sizeof signal_info);
-	if (len != sizeof signal_info)
-		/* Is there anything we can do here?  Will this ever happen? */
-		fprintf(stderr, "signalfd read error: %m\n");
 
 	return signal_source->func(signal_source->signal_number,
 				   signal_source->base.data);
@@ -240,6 +717,100 @@ struct wl_event_source_interface signal_source_interface = {
 	wl_event_source_signal_dispatch,
 };
 
+static int
+dispatch_source(struct wl_event_loop *loop, struct wl_event_source *source,
+		struct epoll_event *ep);
+
+static int
+signal_mux_dispatch(struct wl_event_source *source, struct epoll_event *ep)
+{
+	struct wl_signal_mux *mux = (struct wl_signal_mux *) source;
+	struct wl_event_source_signal *signal_source, *next;
+	struct signalfd_siginfo info[16];
+	int len, i, count, n = 0;
+
+	mux->dispatching = 1;
+	do {
+		len = read(source->fd, info, sizeof info);
+		if (len < 0) {
+			if (errno != EAGAIN)
+				fprintf(stderr, "signalfd read error: %m\n");
+			break;
+		}
+
+		count = len / sizeof info[0];
+		for (i = 0; i < count; i++)
+			wl_list_for_each(signal_source, &mux->sources,
+					 signal_link)
+				if (signal_source->signal_number ==
+				    (int) info[i].ssi_signo)
+					n += dispatch_source(source->loop,
+						&signal_source->base, ep);
+	} while (count == ARRAY_LENGTH(info));
+	mux->dispatching = 0;
+
+	/* Sources removed by the callbacks were left on the list */
+	wl_list_for_each_safe(signal_source, next, &mux->sources, signal_link)
+		if (signal_source->signal_number == 0)
+			wl_list_remove(&signal_source->signal_link);
+
+	return n;
+}
+
+struct wl_event_source_interface signal_mux_interface = {
+	signal_mux_dispatch,
+};
+
+static struct wl_signal_mux *
+signal_mux_create(struct wl_event_loop *loop)
+{
+	struct wl_signal_mux *mux;
+
+	mux = malloc(sizeof *mux);
+	if (mux == NULL)
+		return NULL;
+
+	mux->base.interface = &signal_mux_interface;
+	sigemptyset(&mux->mask);
+	mux->base.fd = signalfd(-1, &mux->mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	wl_list_init(&mux->sources);
+	mux->dispatching = 0;
+
+	if (add_source(loop, &mux->base, WL_EVENT_READABLE, NULL) == NULL)
+		return NULL;
+
+	return mux;
+}
+
+static void
+signal_mux_remove(struct wl_signal_mux *mux,
+		  struct wl_event_source_signal *source)
+{
+	struct wl_event_source_signal *other;
+	int signal_number = source->signal_number;
+
+	/* Leave it to signal_mux_dispatch() to unlink, so that its walk
+	 * over the list stays valid */
+	source->signal_number = 0;
+	if (!mux->dispatching)
+		wl_list_remove(&source->signal_link);
+
+	wl_list_for_each(other, &mux->sources, signal_link)
+		if (other->signal_number == signal_number)
+			return;
+
+	sigdelset(&mux->mask, signal_number);
+	signalfd(mux->base.fd, &mux->mask, 0);
+}
+
+/** Watch for a signal
+ *
+ * The signal is blocked for the calling thread and received through a
+ * signalfd the loop shares between all its signal sources, so watching
+ * several signals takes a single fd and signals arriving together are
+ * read together.  A signal can have more than one source, and each of
+ * them is dispatched when it arrives.
+ */
 WL_EXPORT struct wl_event_source *
 wl_event_loop_add_signal(struct wl_event_loop *loop,
 			int signal_number,
@@ -247,23 +818,43 @@ wl_event_loop_add_signal(struct wl_event_loop *loop,
 			void *data)
 {
 	struct wl_event_source_signal *source;
+	struct wl_signal_mux *mux;
 	sigset_t mask;
 
+	if (loop->signal_mux == NULL) {
+		loop->signal_mux = signal_mux_create(loop);
+		if (loop->signal_mux == NULL)
+			return NULL;
+	}
+	mux = loop->signal_mux;
+
 	source = malloc(sizeof *source);
 	if (source == NULL)
 		return NULL;
 
-	source->base.interface = &signal_source_interface;
-	source->signal_number = signal_number;
+	sigaddset(&mux->mask, signal_number);
+	if (signalfd(mux->base.fd, &mux->mask, 0) < 0) {
+		sigdelset(&mux->mask, signal_number);
+		free(source);
+		return NULL;
+	}
 
 	sigemptyset(&mask);
 	sigaddset(&mask, signal_number);
-	source->base.fd = signalfd(-1, &mask, SFD_CLOEXEC);
 	sigprocmask(SIG_BLOCK, &mask, NULL);
 
+	source->base.interface = &signal_source_interface;
+	source->base.loop = loop;
+	source->base.data = data;
+	source->base.fd = -1;
+	source->base.record = NULL;
+	source->base.armed = 0;
+	wl_list_init(&source->base.link);
+	source->signal_number = signal_number;
 	source->func = func;
+	wl_list_insert(mux->sources.prev, &source->signal_link);
 
-	return add_source(loop, &source->base, WL_EVENT_READABLE, data);
+	return &source->base;
 }
 
 struct wl_event_source_idle {
@@ -289,6 +880,8 @@ wl_event_loop_add_idle(struct wl_event_loop *loop,
 	source->base.interface = &idle_source_interface;
 	source->base.loop = loop;
 	source->base.fd = -1;
+	source->base.record = NULL;
+	source->base.armed = 0;
 
 	source->func = func;
 	source->base.data = data;
@@ -298,6 +891,284 @@ wl_event_loop_add_idle(struct wl_event_loop *loop,
 	return &source->base;
 }
 
+/* At most this many threads run work for a loop */
+#define WL_WORK_THREADS_MAX 4
+
+enum wl_event_work_state {
+	WL_EVENT_WORK_QUEUED,
+	WL_EVENT_WORK_RUNNING,
+	WL_EVENT_WORK_DONE,
+	WL_EVENT_WORK_CANCELLED
+};
+
+struct wl_event_work {
+	struct wl_list link;
+	struct wl_work_pool *pool;
+	wl_event_loop_work_func_t work;
+	wl_event_loop_work_done_func_t done;
+	void *data;
+	enum wl_event_work_state state;
+};
+
+/* The threads running a loop's work, started as the queue needs them.
+ * Finished work goes on the done list and the pool, itself a source on
+ * the loop, is woken through an eventfd to call the done functions. */
+struct wl_work_pool {
+	struct wl_event_source base;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct wl_list queue;
+	struct wl_list done;
+	pthread_t threads[WL_WORK_THREADS_MAX];
+	int thread_count;
+	int thread_max;
+	int idle;
+	int stop;
+};
+
+static void
+work_pool_complete(struct wl_work_pool *pool, struct wl_event_work *work)
+{
+	uint64_t one = 1;
+
+	if (wl_list_empty(&pool->done) &&
+	    write(pool->base.fd, &one, sizeof one) < 0)
+		fprintf(stderr, "could not wake event loop: %m\n");
+	wl_list_insert(pool->done.prev, &work->link);
+}
+
+static void *
+work_pool_run(void *data)
+{
+	struct wl_work_pool *pool = data;
+	struct wl_event_work *work;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		if (wl_list_empty(&pool->queue)) {
+			pool->idle++;
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			pool->idle--;
+			continue;
+		}
+
+		work = container_of(pool->queue.next,
+				    struct wl_event_work, link);
+		wl_list_remove(&work->link);
+		work->state = WL_EVENT_WORK_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
+
+		work->work(work->data);
+
+		pthread_mutex_lock(&pool->lock);
+		work->state = WL_EVENT_WORK_DONE;
+		work_pool_complete(pool, work);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/* Call the done functions of everything on the list and free it */
+static void
+work_pool_finish(struct wl_list *list)
+{
+	struct wl_event_work *work, *next;
+
+	wl_list_for_each_safe(work, next, list, link) {
+		work->done(work->data,
+			   work->state == WL_EVENT_WORK_CANCELLED);
+		free(work);
+	}
+}
+
+static int
+work_pool_dispatch(struct wl_event_source *source, struct epoll_event *ep)
+{
+	struct wl_work_pool *pool = (struct wl_work_pool *) source;
+	struct wl_list done;
+	uint64_t count;
+
+	if (read(source->fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		fprintf(stderr, "eventfd read error: %m\n");
+
+	pthread_mutex_lock(&pool->lock);
+	wl_list_init(&done);
+	wl_list_insert_list(&done, &pool->done);
+	wl_list_init(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+
+	work_pool_finish(&done);
+
+	return 1;
+}
+
+struct wl_event_source_interface work_source_interface = {
+	work_pool_dispatch,
+};
+
+static struct wl_work_pool *
+work_pool_create(struct wl_event_loop *loop)
+{
+	struct wl_work_pool *pool;
+	long cpus;
+
+	pool = malloc(sizeof *pool);
+	if (pool == NULL)
+		return NULL;
+
+	pool->base.interface = &work_source_interface;
+	pool->base.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	wl_list_init(&pool->queue);
+	wl_list_init(&pool->done);
+	pool->thread_count = 0;
+	pool->idle = 0;
+	pool->stop = 0;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	pool->thread_max = cpus < 1 ? 1 :
+		cpus > WL_WORK_THREADS_MAX ? WL_WORK_THREADS_MAX : cpus;
+
+	if (add_source(loop, &pool->base, WL_EVENT_READABLE, NULL) == NULL)
+		return NULL;
+
+	return pool;
+}
+
+/* Stop the threads, letting them finish the work they are running,
+ * and call the done functions of everything else */
+static void
+work_pool_destroy(struct wl_work_pool *pool)
+{
+	struct wl_event_work *work;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	wl_list_for_each(work, &pool->queue, link)
+		work->state = WL_EVENT_WORK_CANCELLED;
+	wl_list_insert_list(pool->done.prev, &pool->queue);
+	work_pool_finish(&pool->done);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	wl_event_source_remove(&pool->base);
+}
+
+/** Run a function on a thread pool
+ *
+ * \param loop The event loop
+ * \param work Function to run on the pool
+ * \param done Function to call on the loop afterwards
+ * \param data User data passed to both functions
+ * \return A handle for wl_event_work_cancel(), or NULL on failure
+ *
+ * This is for blocking work that shouldn't hold up the loop, such as
+ * reading files.  The loop has a pool of up to one thread per CPU, at
+ * most four, started when first needed.  Work is run in the order it
+ * was added, as threads become free, and when it has run, done is
+ * called with cancelled set to 0 from wl_event_loop_dispatch().  The
+ * handle stays valid until done has returned.
+ *
+ * Work still queued when the loop is destroyed is cancelled, and
+ * wl_event_loop_destroy() waits for running work and calls the
+ * outstanding done functions.
+ */
+WL_EXPORT struct wl_event_work *
+wl_event_loop_add_work(struct wl_event_loop *loop,
+		       wl_event_loop_work_func_t work,
+		       wl_event_loop_work_done_func_t done,
+		       void *data)
+{
+	struct wl_work_pool *pool;
+	struct wl_event_work *item;
+	sigset_t all, saved;
+
+	if (loop->work_pool == NULL) {
+		loop->work_pool = work_pool_create(loop);
+		if (loop->work_pool == NULL)
+			return NULL;
+	}
+	pool = loop->work_pool;
+
+	item = malloc(sizeof *item);
+	if (item == NULL)
+		return NULL;
+
+	item->pool = pool;
+	item->work = work;
+	item->done = done;
+	item->data = data;
+	item->state = WL_EVENT_WORK_QUEUED;
+
+	pthread_mutex_lock(&pool->lock);
+
+	/* Done functions called from wl_event_loop_destroy() can't
+	 * queue more work */
+	if (pool->stop) {
+		pthread_mutex_unlock(&pool->lock);
+		free(item);
+		return NULL;
+	}
+
+	/* Only start a thread when none is free to take the work */
+	if (pool->idle == 0 && pool->thread_count < pool->thread_max) {
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &saved);
+		if (pthread_create(&pool->threads[pool->thread_count], NULL,
+				   work_pool_run, pool) == 0)
+			pool->thread_count++;
+		pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	}
+
+	if (pool->thread_count == 0) {
+		pthread_mutex_unlock(&pool->lock);
+		free(item);
+		return NULL;
+	}
+
+	wl_list_insert(pool->queue.prev, &item->link);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return item;
+}
+
+/** Cancel work that hasn't started yet
+ *
+ * \param work Work from wl_event_loop_add_work()
+ * \return 0 if the work was cancelled, -1 if it is running or has run
+ *
+ * Cancelled work is never run, and its done function is called with
+ * cancelled set to 1 from the next wl_event_loop_dispatch().  Must be
+ * called from the loop's thread before the done function has run.
+ */
+WL_EXPORT int
+wl_event_work_cancel(struct wl_event_work *work)
+{
+	struct wl_work_pool *pool = work->pool;
+	int ret = -1;
+
+	pthread_mutex_lock(&pool->lock);
+	if (work->state == WL_EVENT_WORK_QUEUED) {
+		wl_list_remove(&work->link);
+		work->state = WL_EVENT_WORK_CANCELLED;
+		work_pool_complete(pool, work);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return ret;
+}
+
 WL_EXPORT void
 wl_event_source_check(struct wl_event_source *source)
 {
@@ -312,11 +1183,25 @@ wl_event_source_remove(struct wl_event_source *source)
 	/* We need to explicitly remove the fd, since closing the fd
 	 * isn't enough in case we've dup'ed the fd. */
 	if (source->fd >= 0) {
-		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+		if (loop->uring)
+			uring_remove_source(loop->uring, source);
+		else
+			epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL,
+				  source->fd, NULL);
 		close(source->fd);
 		source->fd = -1;
 	}
 
+	if (source->interface == &signal_source_interface)
+		signal_mux_remove(loop->signal_mux,
+				  (struct wl_event_source_signal *) source);
+
+	if (source->record) {
+		wl_list_remove(&source->record->link);
+		free(source->record);
+		source->record = NULL;
+	}
+
 	wl_list_remove(&source->link);
 	wl_list_insert(&loop->destroy_list, &source->link);
 
@@ -334,17 +1219,33 @@ wl_event_loop_process_destroy_list(struct wl_event_loop *loop)
 	wl_list_init(&loop->destroy_list);
 }
 
+/** Create an event loop
+ *
+ * The loop is built on epoll.  Setting WAYLAND_EVENT_LOOP=io_uring in
+ * the environment selects the io_uring backend instead, if the kernel
+ * supports everything it needs, falling back to epoll otherwise.
+ */
 WL_EXPORT struct wl_event_loop *
 wl_event_loop_create(void)
 {
 	struct wl_event_loop *loop;
+	const char *backend;
 
 	loop = malloc(sizeof *loop);
 	if (loop == NULL)
 		return NULL;
 
-	loop->epoll_fd = wl_os_epoll_create_cloexec();
-	if (loop->epoll_fd < 0) {
+	loop->uring = NULL;
+	loop->work_pool = NULL;
+	loop->signal_mux = NULL;
+	loop->epoll_fd = -1;
+	backend = getenv("WAYLAND_EVENT_LOOP");
+	if (backend && strcmp(backend, "io_uring") == 0)
+		loop->uring = uring_create();
+
+	if (loop->uring == NULL)
+		loop->epoll_fd = wl_os_epoll_create_cloexec();
+	if (loop->uring == NULL && loop->epoll_fd < 0) {
 		free(loop);
 		return NULL;
 	}
@@ -352,17 +1253,111 @@ wl_event_loop_create(void)
 	wl_list_init(&loop->idle_list);
 	wl_list_init(&loop->destroy_list);
 
+	loop->stats_enabled = 0;
+	wl_list_init(&loop->stats_list);
+	loop->watchdog_ns = 0;
+	loop->watchdog_func = NULL;
+	loop->watchdog_data = NULL;
+
 	return loop;
 }
 
 WL_EXPORT void
 wl_event_loop_destroy(struct wl_event_loop *loop)
 {
+	struct wl_event_source_record *record, *next;
+
+	if (loop->work_pool)
+		work_pool_destroy(loop->work_pool);
+	if (loop->signal_mux)
+		wl_event_source_remove(&loop->signal_mux->base);
+
 	wl_event_loop_process_destroy_list(loop);
-	close(loop->epoll_fd);
+
+	wl_list_for_each_safe(record, next, &loop->stats_list, link) {
+		record->source->record = NULL;
+		free(record);
+	}
+
+	if (loop->uring)
+		uring_destroy(loop->uring);
+	else
+		close(loop->epoll_fd);
 	free(loop);
 }
 
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+record_dispatch(struct wl_event_source *source, uint64_t ns)
+{
+	struct wl_event_source_record *record = source->record;
+	uint64_t us = ns / 1000;
+	int i;
+
+	/* Removed while dispatching.  Signal sources have no fd of
+	 * their own. */
+	if (source->interface == &signal_source_interface ?
+	    ((struct wl_event_source_signal *) source)->signal_number == 0 :
+	    source->fd == -1)
+		return;
+
+	if (record == NULL) {
+		record = calloc(1, sizeof *record);
+		if (record == NULL)
+			return;
+		record->source = source;
+		wl_list_insert(source->loop->stats_list.prev, &record->link);
+		source->record = record;
+	}
+
+	record->stats.count++;
+	record->stats.total_ns += ns;
+	if (ns > record->stats.max_ns)
+		record->stats.max_ns = ns;
+
+	i = us > 0 ? 63 - __builtin_clzll(us) : 0;
+	if (i >= WL_EVENT_SOURCE_HISTOGRAM_SIZE)
+		i = WL_EVENT_SOURCE_HISTOGRAM_SIZE - 1;
+	record->stats.histogram[i]++;
+}
+
+static int
+dispatch_source(struct wl_event_loop *loop, struct wl_event_source *source,
+		struct epoll_event *ep)
+{
+	uint64_t start, ns;
+	int n;
+
+	/* The signal mux times each signal source it passes a signal to,
+	 * and isn't reported itself */
+	if ((!loop->stats_enabled && loop->watchdog_func == NULL) ||
+	    source->interface == &signal_mux_interface)
+		return source->interface->dispatch(source, ep);
+
+	start = now_ns();
+	n = source->interface->dispatch(source, ep);
+	ns = now_ns() - start;
+
+	if (ns > loop->slowest_ns) {
+		loop->slowest = source;
+		loop->slowest_ns = ns;
+	}
+
+	if (loop->stats_enabled)
+		record_dispatch(source, ns);
+
+	return n;
+}
+
 static int
 post_dispatch_check(struct wl_event_loop *loop)
 {
@@ -373,7 +1368,7 @@ post_dispatch_check(struct wl_event_loop *loop)
 	ep.events = 0;
 	n = 0;
 	wl_list_for_each_safe(source, next, &loop->check_list, link)
-		n += source->interface->dispatch(source, &ep);
+		n += dispatch_source(loop, source, &ep);
 
 	return n;
 }
@@ -396,31 +1391,166 @@ wl_event_loop_dispatch(struct wl_event_loop *loop, int timeout)
 {
 	struct epoll_event ep[32];
 	struct wl_event_source *source;
+	uint64_t start = 0, busy = 0;
 	int i, count, n;
 
+	WL_PROBE(event_loop_dispatch_begin, loop, timeout);
+
+	if (loop->watchdog_func) {
+		loop->slowest = NULL;
+		loop->slowest_ns = 0;
+		start = now_ns();
+	}
+
 	dispatch_idle_sources(loop);
 
-	count = epoll_wait(loop->epoll_fd, ep, ARRAY_LENGTH(ep), timeout);
-	if (count < 0)
+	/* The time spent waiting doesn't count against the watchdog */
+	if (loop->watchdog_func)
+		busy = now_ns() - start;
+
+	if (loop->uring)
+		count = uring_wait(loop->uring, ep, ARRAY_LENGTH(ep), timeout);
+	else
+		count = epoll_wait(loop->epoll_fd, ep, ARRAY_LENGTH(ep),
+				   timeout);
+	if (count < 0) {
+		WL_PROBE(event_loop_dispatch_end, loop, -1);
 		return -1;
+	}
+
+	if (loop->watchdog_func)
+		start = now_ns();
+
 	n = 0;
 	for (i = 0; i < count; i++) {
 		source = ep[i].data.ptr;
 		if (source->fd != -1)
-			n += source->interface->dispatch(source, &ep[i]);
+			n += dispatch_source(loop, source, &ep[i]);
+		if (loop->uring)
+			uring_rearm(loop->uring, source);
 	}
 
-	wl_event_loop_process_destroy_list(loop);
-
 	do {
 		n = post_dispatch_check(loop);
 	} while (n > 0);
-		
+
+	/* Sources removed above are freed only after the watchdog has
+	 * had a chance to look at them */
+	if (loop->watchdog_func) {
+		busy += now_ns() - start;
+		if (busy > loop->watchdog_ns)
+			loop->watchdog_func(loop, busy, loop->slowest,
+					    loop->slowest_ns,
+					    loop->watchdog_data);
+	}
+
+	wl_event_loop_process_destroy_list(loop);
+
+	if (loop->uring)
+		uring_flush(loop->uring);
+
+	WL_PROBE(event_loop_dispatch_end, loop, count);
+
 	return 0;
 }
 
 WL_EXPORT int
 wl_event_loop_get_fd(struct wl_event_loop *loop)
 {
+	if (loop->uring) {
+		loop->uring->exported = 1;
+		uring_flush(loop->uring);
+		return loop->uring->fd;
+	}
+
 	return loop->epoll_fd;
 }
+
+/** Get the data pointer a source was created with
+ *
+ * \param source The event source
+ *
+ * Meant for telling sources apart in the stats and watchdog callbacks,
+ * e.g. the source of a client has the struct wl_client as its data.
+ */
+WL_EXPORT void *
+wl_event_source_get_data(struct wl_event_source *source)
+{
+	return source->data;
+}
+
+/** Turn dispatch time accounting on or off
+ *
+ * \param loop The event loop
+ * \param enable Whether to record dispatch times
+ *
+ * While enabled, every dispatch of a fd, timer or signal source is
+ * timed and added to that source's struct wl_event_source_stats.
+ * Turning it off keeps the stats collected so far.
+ */
+WL_EXPORT void
+wl_event_loop_set_stats(struct wl_event_loop *loop, int enable)
+{
+	loop->stats_enabled = enable;
+}
+
+/** Get the dispatch stats of a source
+ *
+ * \param source The event source
+ * \param stats Filled in with the stats
+ * \return 0 on success, -1 if nothing has been recorded for the source
+ */
+WL_EXPORT int
+wl_event_source_get_stats(struct wl_event_source *source,
+			  struct wl_event_source_stats *stats)
+{
+	if (source->record == NULL)
+		return -1;
+
+	*stats = source->record->stats;
+
+	return 0;
+}
+
+/** Call a function for each source with dispatch stats
+ *
+ * \param loop The event loop
+ * \param func Called with each source and its stats
+ * \param data User data passed to func
+ *
+ * Sources are visited in the order of their first recorded dispatch.
+ * func must not remove sources.
+ */
+WL_EXPORT void
+wl_event_loop_for_each_source(struct wl_event_loop *loop,
+			      wl_event_loop_stats_func_t func, void *data)
+{
+	struct wl_event_source_record *record;
+
+	wl_list_for_each(record, &loop->stats_list, link)
+		func(record->source, &record->stats, data);
+}
+
+/** Set a callback for slow loop iterations
+ *
+ * \param loop The event loop
+ * \param threshold_us Iterations taking longer than this many
+ * microseconds trigger the callback
+ * \param func The callback, or NULL to turn the watchdog off
+ * \param data User data passed to func
+ *
+ * The time is that spent dispatching in one wl_event_loop_dispatch()
+ * call, not counting the time waiting for events.  func gets the
+ * total and the source whose dispatch took longest, along with that
+ * dispatch's time.  The source is NULL if only idle sources ran, and
+ * may have been removed during the iteration, in which case it must
+ * only be used to identify it.
+ */
+WL_EXPORT void
+wl_event_loop_set_watchdog(struct wl_event_loop *loop, uint32_t threshold_us,
+			   wl_event_loop_watchdog_func_t func, void *data)
+{
+	loop->watchdog_ns = (uint64_t) threshold_us * 1000;
+	loop->watchdog_func = func;
+	loop->watchdog_data = data;
+}
@@ -33,10 +33,16 @@
 static int
 usage(int ret)
 {
-	fprintf(stderr, "usage: ./scanner [client-header|server-header|code]\n");
+	fprintf(stderr, "usage: ./scanner [--inline-marshal] "
+		"[client-header|server-header|code|cpp-client|cpp-server]\n");
 	exit(ret);
 }
 
+/* Emit request stubs and event wrappers that write the message straight
+ * into the connection buffer instead of calling the variadic
+ * wl_proxy_marshal() and wl_resource_post_event(). */
+static int inline_marshal;
+
 #define XML_BUFFER_SIZE 4096
 
 struct description {
@@ -532,6 +538,168 @@ emit_type(struct arg *a)
 	}
 }
 
+static void
+emit_proxy_marshal(struct message *m, struct interface *interface,
+		   const char *tabs)
+{
+	struct arg *a;
+
+	printf("%swl_proxy_marshal((struct wl_proxy *) %s,\n"
+	       "%s\t\t %s_%s",
+	       tabs, interface->name,
+	       tabs, interface->uppercase_name, m->uppercase_name);
+
+	wl_list_for_each(a, &m->arg_list, link)
+		printf(", %s", a->name);
+
+	printf(");\n");
+}
+
+static void
+emit_post_event(struct message *m, struct interface *interface,
+		const char *tabs)
+{
+	struct arg *a;
+
+	printf("%swl_resource_post_event(resource_, %s_%s",
+	       tabs, interface->uppercase_name, m->uppercase_name);
+
+	wl_list_for_each(a, &m->arg_list, link)
+		printf(", %s", a->name);
+
+	printf(");\n");
+}
+
+static int
+can_inline_marshal(struct message *m)
+{
+	struct arg *a;
+
+	/* File descriptors go through the closure, which dups them */
+	wl_list_for_each(a, &m->arg_list, link)
+		if (a->type == FD)
+			return 0;
+
+	return 1;
+}
+
+static void
+emit_inline_marshal_decls(struct message *m)
+{
+	struct arg *a;
+
+	if (m->arg_count > 0)
+		printf("\tuint32_t *p_, *q_;\n");
+	else
+		printf("\tuint32_t *p_;\n");
+	wl_list_for_each(a, &m->arg_list, link)
+		if (a->type == STRING || a->type == ARRAY)
+			printf("\tsize_t %s_len_;\n", a->name);
+}
+
+/* Emits code computing the size of the message, reserving it in the
+ * connection buffer and writing the arguments in wire format.  Strings
+ * and arrays are the only arguments whose size isn't known here.  If
+ * a non-nullable argument is NULL or the space can't be reserved, the
+ * message goes through the variadic path, which reports the error. */
+static void
+emit_inline_marshal(struct message *m, struct interface *interface,
+		    int server)
+{
+	struct arg *a;
+	const char *target, *prefix;
+	int first;
+
+	target = server ? "resource_" : interface->name;
+	prefix = server ? "wl_resource" : "wl_proxy";
+
+	wl_list_for_each(a, &m->arg_list, link) {
+		if (a->type == STRING)
+			printf("\t%s_len_ = %s ? strlen(%s) + 1 : 0;\n",
+			       a->name, a->name, a->name);
+		else if (a->type == ARRAY)
+			printf("\t%s_len_ = %s ? %s->size : 0;\n",
+			       a->name, a->name, a->name);
+	}
+
+	first = 1;
+	wl_list_for_each(a, &m->arg_list, link) {
+		/* the stub has already checked the new client proxy */
+		if (!is_nullable_type(a) || a->nullable ||
+		    (!server && a->type == NEW_ID))
+			continue;
+		if (first)
+			printf("\tp_ = NULL;\n"
+			       "\tif (%s != NULL", a->name);
+		else
+			printf(" &&\n\t    %s != NULL", a->name);
+		first = 0;
+	}
+	if (!first)
+		printf(")\n\t");
+
+	printf("\tp_ = %s_marshal_reserve(", prefix);
+	if (server)
+		printf("resource_, ");
+	else
+		printf("(struct wl_proxy *) %s, ", target);
+	printf("%s_%s, %d",
+	       interface->uppercase_name, m->uppercase_name,
+	       8 + 4 * m->arg_count);
+	wl_list_for_each(a, &m->arg_list, link)
+		if (a->type == STRING || a->type == ARRAY)
+			printf(" +\n\t\t\t\t((%s_len_ + 3) & ~(size_t) 3)",
+			       a->name);
+	printf(");\n\n");
+
+	printf("\tif (p_ == NULL) {\n");
+	if (server)
+		emit_post_event(m, interface, "\t\t");
+	else
+		emit_proxy_marshal(m, interface, "\t\t");
+	printf("\t} else {\n");
+	if (m->arg_count > 0)
+		printf("\t\tq_ = p_ + 2;\n");
+
+	wl_list_for_each(a, &m->arg_list, link) {
+		switch (a->type) {
+		case NEW_ID:
+		case OBJECT:
+			if (server)
+				printf("\t\t*q_++ = %s ? "
+				       "((struct wl_object *) %s)->id : 0;\n",
+				       a->name, a->name);
+			else
+				printf("\t\t*q_++ = %s ? wl_proxy_get_id("
+				       "(struct wl_proxy *) %s) : 0;\n",
+				       a->name, a->name);
+			break;
+		case STRING:
+		case ARRAY:
+			printf("\t\t*q_++ = %s_len_;\n"
+			       "\t\tif (%s_len_ > 0) {\n"
+			       "\t\t\tq_[(%s_len_ - 1) / 4] = 0;\n"
+			       "\t\t\tmemcpy(q_, %s%s, %s_len_);\n"
+			       "\t\t\tq_ += (%s_len_ + 3) / 4;\n"
+			       "\t\t}\n",
+			       a->name, a->name, a->name, a->name,
+			       a->type == ARRAY ? "->data" : "",
+			       a->name, a->name);
+			break;
+		default:
+			printf("\t\t*q_++ = %s;\n", a->name);
+			break;
+		}
+	}
+
+	printf("\t\t%s_marshal_commit(", prefix);
+	if (server)
+		printf("resource_, p_);\n");
+	else
+		printf("(struct wl_proxy *) %s, p_);\n", target);
+	printf("\t}\n");
+}
+
 static void
 emit_stubs(struct wl_list *message_list, struct interface *interface)
 {
@@ -615,6 +783,11 @@ emit_stubs(struct wl_list *message_list, struct interface *interface)
 
 		printf(")\n"
 		       "{\n");
+		if (inline_marshal && can_inline_marshal(m)) {
+			emit_inline_marshal_decls(m);
+			if (!ret)
+				printf("\n");
+		}
 		if (ret)
 			printf("\tstruct wl_proxy *%s;\n\n"
 			       "\t%s = wl_proxy_create("
@@ -627,17 +800,10 @@ emit_stubs(struct wl_list *message_list, struct interface *interface)
 			       interface->name, ret->interface_name,
 			       ret->name);
 
-		printf("\twl_proxy_marshal((struct wl_proxy *) %s,\n"
-		       "\t\t\t %s_%s",
-		       interface->name,
-		       interface->uppercase_name,
-		       m->uppercase_name);
-
-		wl_list_for_each(a, &m->arg_list, link) {
-			printf(", ");
-				printf("%s", a->name);
-		}
-		printf(");\n");
+		if (inline_marshal && can_inline_marshal(m))
+			emit_inline_marshal(m, interface, 0);
+		else
+			emit_proxy_marshal(m, interface, "\t");
 
 		if (m->destructor)
 			printf("\n\twl_proxy_destroy("
@@ -681,14 +847,14 @@ emit_event_wrappers(struct wl_list *message_list, struct interface *interface)
 		}
 
 		printf(")\n"
-		       "{\n"
-		       "\twl_resource_post_event(resource_, %s_%s",
-		       interface->uppercase_name, m->uppercase_name);
-
-		wl_list_for_each(a, &m->arg_list, link)
-			printf(", %s", a->name);
-
-		printf(");\n");
+		       "{\n");
+		if (inline_marshal && can_inline_marshal(m)) {
+			emit_inline_marshal_decls(m);
+			printf("\n");
+			emit_inline_marshal(m, interface, 1);
+		} else {
+			emit_post_event(m, interface, "\t");
+		}
 		printf("}\n\n");
 	}
 }
@@ -869,11 +1035,13 @@ emit_header(struct protocol *protocol, int server)
 	       "\n"
 	       "#include <stdint.h>\n"
 	       "#include <stddef.h>\n"
+	       "%s"
 	       "#include \"%s\"\n\n"
 	       "struct wl_client;\n"
 	       "struct wl_resource;\n\n",
 	       protocol->uppercase_name, s,
 	       protocol->uppercase_name, s,
+	       inline_marshal ? "#include <string.h>\n" : "",
 	       server ? "wayland-util.h" : "wayland-client.h");
 
 	wl_list_for_each(i, &protocol->interface_list, link)
@@ -887,6 +1055,9 @@ emit_header(struct protocol *protocol, int server)
 	}
 	printf("\n");
 
+	printf("extern const struct wl_protocol_info %s_protocol_info;\n\n",
+	       protocol->name);
+
 	wl_list_for_each(i, &protocol->interface_list, link) {
 
 		emit_enumerations(i);
@@ -1037,6 +1208,91 @@ emit_messages(struct wl_list *message_list,
 	printf("};\n\n");
 }
 
+static void
+emit_message_info(struct wl_list *message_list,
+		  struct interface *interface, const char *suffix)
+{
+	struct message *m;
+	struct arg *a;
+	uint32_t nullable;
+	int flags, size, fds, pointers, arrays, n;
+
+	if (wl_list_empty(message_list))
+		return;
+
+	printf("static const struct wl_message_info "
+	       "%s_%s_info[] = {\n",
+	       interface->name, suffix);
+
+	wl_list_for_each(m, message_list, link) {
+		nullable = 0;
+		flags = 0;
+		size = 8;
+		fds = 0;
+		pointers = 0;
+		arrays = 0;
+		n = 0;
+
+		printf("\t{ \"");
+		wl_list_for_each(a, &m->arg_list, link) {
+			if (is_nullable_type(a) && a->nullable)
+				nullable |= 1 << n;
+			n++;
+
+			switch (a->type) {
+			default:
+			case INT:
+				printf("i");
+				size += 4;
+				break;
+			case UNSIGNED:
+				printf("u");
+				size += 4;
+				break;
+			case FIXED:
+				printf("f");
+				size += 4;
+				break;
+			case NEW_ID:
+				printf("n");
+				flags |= WL_MESSAGE_HAS_NEW_ID;
+				size += 4;
+				pointers++;
+				break;
+			case OBJECT:
+				printf("o");
+				flags |= WL_MESSAGE_HAS_OBJECT;
+				size += 4;
+				pointers++;
+				break;
+			case STRING:
+				printf("s");
+				flags |= WL_MESSAGE_HAS_VARIABLE;
+				size += 4;
+				pointers++;
+				break;
+			case ARRAY:
+				printf("a");
+				flags |= WL_MESSAGE_HAS_VARIABLE;
+				size += 4;
+				pointers++;
+				arrays++;
+				break;
+			case FD:
+				printf("h");
+				flags |= WL_MESSAGE_HAS_FD;
+				fds++;
+				break;
+			}
+		}
+		printf("\", 0x%x, %d, 0x%x, %d, %d, %d, %d },\n",
+		       nullable, m->arg_count, flags, size,
+		       fds, pointers, arrays);
+	}
+
+	printf("};\n\n");
+}
+
 static void
 emit_code(struct protocol *protocol)
 {
@@ -1067,6 +1323,8 @@ emit_code(struct protocol *protocol)
 
 		emit_messages(&i->request_list, i, "requests");
 		emit_messages(&i->event_list, i, "events");
+		emit_message_info(&i->request_list, i, "requests");
+		emit_message_info(&i->event_list, i, "events");
 
 		printf("WL_EXPORT const struct wl_interface "
 		       "%s_interface = {\n"
@@ -1087,6 +1345,432 @@ emit_code(struct protocol *protocol)
 
 		printf("};\n\n");
 	}
+
+	printf("static const struct wl_interface_info interface_info[] = {\n");
+	wl_list_for_each(i, &protocol->interface_list, link) {
+		printf("\t{ &%s_interface, ", i->name);
+		if (!wl_list_empty(&i->request_list))
+			printf("%s_requests_info, ", i->name);
+		else
+			printf("NULL, ");
+		if (!wl_list_empty(&i->event_list))
+			printf("%s_events_info },\n", i->name);
+		else
+			printf("NULL },\n");
+	}
+	printf("};\n\n");
+
+	printf("WL_EXPORT const struct wl_protocol_info "
+	       "%s_protocol_info = {\n"
+	       "\tWL_PROTOCOL_INFO_VERSION,\n"
+	       "\tARRAY_LENGTH(interface_info), interface_info\n"
+	       "};\n",
+	       protocol->name);
+}
+
+/* C++ headers: the C header of the protocol is included for the types,
+ * opcodes and enums, and each interface gets a namespace holding
+ * constexpr message descriptors, a listener or implementation template
+ * that forwards to member functions of a user type, and request or
+ * event functions.  The C ABI and the wire format are the same. */
+
+static int
+is_fixed_size_message(struct message *m)
+{
+	struct arg *a;
+
+	wl_list_for_each(a, &m->arg_list, link) {
+		switch (a->type) {
+		case INT:
+		case UNSIGNED:
+		case FIXED:
+		case OBJECT:
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void
+emit_cpp_type(struct arg *a, int resource)
+{
+	switch (a->type) {
+	case NEW_ID:
+	case OBJECT:
+		if (resource)
+			printf("struct ::wl_resource *");
+		else
+			printf("struct ::%s *", a->interface_name);
+		break;
+	case ARRAY:
+		printf("struct ::wl_array *");
+		break;
+	default:
+		emit_type(a);
+		break;
+	}
+}
+
+static void
+emit_cpp_descriptors(struct wl_list *message_list, const char *name)
+{
+	struct message *m;
+	struct arg *a;
+	int size, has_fd, has_new_id;
+
+	if (wl_list_empty(message_list))
+		return;
+
+	printf("constexpr ::wayland::message_descriptor %s[] = {\n", name);
+	wl_list_for_each(m, message_list, link) {
+		size = 8;
+		has_fd = 0;
+		has_new_id = 0;
+		printf("\t{ \"%s\", \"", m->name);
+		wl_list_for_each(a, &m->arg_list, link) {
+			if (is_nullable_type(a) && a->nullable)
+				printf("?");
+			switch (a->type) {
+			default:
+			case INT:
+				printf("i");
+				break;
+			case NEW_ID:
+				printf("n");
+				has_new_id = 1;
+				break;
+			case UNSIGNED:
+				printf("u");
+				break;
+			case FIXED:
+				printf("f");
+				break;
+			case STRING:
+				printf("s");
+				break;
+			case OBJECT:
+				printf("o");
+				break;
+			case ARRAY:
+				printf("a");
+				break;
+			case FD:
+				printf("h");
+				has_fd = 1;
+				size -= 4;
+				break;
+			}
+			size += 4;
+		}
+		printf("\", %d, %d, %s, %s },\n",
+		       m->arg_count, size,
+		       has_fd ? "true" : "false",
+		       has_new_id ? "true" : "false");
+	}
+	printf("};\n\n");
+}
+
+/* Listener (client) or implementation (server) template: a table of
+ * C function pointers whose entries forward to the members of T. */
+static void
+emit_cpp_dispatch(struct wl_list *message_list, struct interface *interface,
+		  int server)
+{
+	struct message *m;
+	struct arg *a;
+	const char *table = server ? "implementation" : "listener";
+
+	if (wl_list_empty(message_list))
+		return;
+
+	printf("template<typename T>\n"
+	       "struct %s {\n", table);
+
+	wl_list_for_each(m, message_list, link) {
+		if (server)
+			printf("\tstatic void\n"
+			       "\t%s(struct ::wl_client *client, "
+			       "struct ::wl_resource *resource",
+			       m->name);
+		else
+			printf("\tstatic void\n"
+			       "\t%s(void *data, struct ::%s *%s",
+			       m->name, interface->name, interface->name);
+
+		wl_list_for_each(a, &m->arg_list, link) {
+			printf(", ");
+			if (server && a->type == NEW_ID)
+				printf("uint32_t ");
+			else
+				emit_cpp_type(a, server && a->type == OBJECT);
+			printf("%s", a->name);
+		}
+		printf(")\n"
+		       "\t{\n");
+
+		if (server)
+			printf("\t\tstatic_cast<T *>(resource->data)->%s("
+			       "client, resource", m->name);
+		else
+			printf("\t\tstatic_cast<T *>(data)->%s(%s",
+			       m->name, interface->name);
+		wl_list_for_each(a, &m->arg_list, link)
+			printf(", %s", a->name);
+		printf(");\n"
+		       "\t}\n\n");
+	}
+
+	printf("\tstatic const struct ::%s_%s table;\n"
+	       "};\n\n",
+	       interface->name, server ? "interface" : "listener");
+
+	printf("template<typename T>\n"
+	       "const struct ::%s_%s %s<T>::table = {\n",
+	       interface->name, server ? "interface" : "listener", table);
+	wl_list_for_each(m, message_list, link)
+		printf("\t&%s<T>::%s,\n", table, m->name);
+	printf("};\n\n");
+
+	if (!server)
+		printf("template<typename T>\n"
+		       "inline int\n"
+		       "add_listener(struct ::%s *%s, T *target)\n"
+		       "{\n"
+		       "\treturn ::%s_add_listener(%s, "
+		       "&listener<T>::table, target);\n"
+		       "}\n\n",
+		       interface->name, interface->name,
+		       interface->name, interface->name);
+}
+
+/* Request (client) or event (server) functions.  Messages made of
+ * integers and objects only are built in a std::array sized from the
+ * descriptor at compile time and copied to the connection in one go;
+ * the others, or when the copy can't be done, use the C functions. */
+static void
+emit_cpp_senders(struct wl_list *message_list, struct interface *interface,
+		 int server)
+{
+	struct message *m;
+	struct arg *a, *ret;
+	const char *target = server ? "resource_" : interface->name;
+	int first;
+
+	/* The C header has no wrappers for the display object either */
+	if (strcmp(interface->name, "wl_display") == 0)
+		return;
+
+	wl_list_for_each(m, message_list, link) {
+		ret = NULL;
+		wl_list_for_each(a, &m->arg_list, link)
+			if (!server && a->type == NEW_ID)
+				ret = a;
+
+		if (ret)
+			printf("inline struct ::%s *\n", ret->interface_name);
+		else
+			printf("inline void\n");
+
+		if (server)
+			printf("send_%s(struct ::wl_resource *resource_",
+			       m->name);
+		else
+			printf("%s(struct ::%s *%s",
+			       m->name, interface->name, interface->name);
+
+		wl_list_for_each(a, &m->arg_list, link) {
+			if (!server && a->type == NEW_ID)
+				continue;
+			printf(", ");
+			emit_cpp_type(a, server);
+			printf("%s", a->name);
+		}
+		printf(")\n"
+		       "{\n");
+
+		if (is_fixed_size_message(m)) {
+			printf("\tconst std::array<std::uint32_t,\n"
+			       "\t\t(%s[%s_%s].fixed_size - 8) / 4> args_ = {{",
+			       server ? "events" : "requests",
+			       interface->uppercase_name, m->uppercase_name);
+			first = 1;
+			wl_list_for_each(a, &m->arg_list, link) {
+				printf("%s\n\t\t", first ? "" : ",");
+				if (a->type == OBJECT)
+					printf("::wayland::%s::detail::id(%s)",
+					       server ? "server" : "client",
+					       a->name);
+				else
+					printf("static_cast<std::uint32_t>(%s)",
+					       a->name);
+				first = 0;
+			}
+			printf("\n\t}};\n\n");
+
+			printf("\tif (");
+			wl_list_for_each(a, &m->arg_list, link)
+				if (a->type == OBJECT && !a->nullable)
+					printf("%s != nullptr &&\n\t    ",
+					       a->name);
+			printf("::wayland::%s::detail::send(",
+			       server ? "server" : "client");
+			if (server)
+				printf("resource_");
+			else
+				printf("reinterpret_cast<struct ::wl_proxy *>"
+				       "(%s)", target);
+			printf(",\n\t\t\t%s_%s, args_)) {\n",
+			       interface->uppercase_name, m->uppercase_name);
+			if (m->destructor && !server)
+				printf("\t\t::wl_proxy_destroy("
+				       "reinterpret_cast<struct ::wl_proxy *>"
+				       "(%s));\n", target);
+			printf("\t\treturn;\n"
+			       "\t}\n\n");
+		}
+
+		printf("\t%s::%s_%s%s(%s",
+		       ret ? "return " : "",
+		       interface->name, server ? "send_" : "", m->name,
+		       target);
+		wl_list_for_each(a, &m->arg_list, link) {
+			if (!server && a->type == NEW_ID)
+				continue;
+			printf(", %s", a->name);
+		}
+		printf(");\n"
+		       "}\n\n");
+	}
+}
+
+static void
+emit_cpp_helpers(int server)
+{
+	const char *side = server ? "server" : "client";
+
+	printf("#ifndef WAYLAND_SCANNER_CPP_HELPERS\n"
+	       "#define WAYLAND_SCANNER_CPP_HELPERS\n\n"
+	       "namespace wayland {\n\n"
+	       "struct message_descriptor {\n"
+	       "\tconst char *name;\n"
+	       "\tconst char *signature;\n"
+	       "\tint arg_count;\n"
+	       "\tstd::uint32_t fixed_size;\t/* wire size with empty "
+	       "strings and arrays */\n"
+	       "\tbool has_fd;\n"
+	       "\tbool has_new_id;\n"
+	       "};\n\n"
+	       "}\n\n"
+	       "#endif\n\n");
+
+	printf("#ifndef WAYLAND_SCANNER_CPP_%s_HELPERS\n"
+	       "#define WAYLAND_SCANNER_CPP_%s_HELPERS\n\n"
+	       "namespace wayland {\n"
+	       "namespace %s {\n"
+	       "namespace detail {\n\n",
+	       server ? "SERVER" : "CLIENT",
+	       server ? "SERVER" : "CLIENT", side);
+
+	if (server)
+		printf("inline std::uint32_t\n"
+		       "id(struct ::wl_resource *resource)\n"
+		       "{\n"
+		       "\treturn resource ? resource->object.id : 0;\n"
+		       "}\n\n"
+		       "template<std::size_t N>\n"
+		       "inline bool\n"
+		       "send(struct ::wl_resource *resource, "
+		       "std::uint32_t opcode,\n"
+		       "     const std::array<std::uint32_t, N> &args)\n"
+		       "{\n"
+		       "\tstd::uint32_t *p;\n\n"
+		       "\tp = ::wl_resource_marshal_reserve(resource, opcode, "
+		       "8 + 4 * N);\n"
+		       "\tif (p == nullptr)\n"
+		       "\t\treturn false;\n\n"
+		       "\tstd::memcpy(p + 2, args.data(), 4 * N);\n"
+		       "\t::wl_resource_marshal_commit(resource, p);\n\n"
+		       "\treturn true;\n"
+		       "}\n\n");
+	else
+		printf("inline std::uint32_t\n"
+		       "id(void *proxy)\n"
+		       "{\n"
+		       "\treturn proxy ? ::wl_proxy_get_id("
+		       "static_cast<struct ::wl_proxy *>(proxy)) : 0;\n"
+		       "}\n\n"
+		       "template<std::size_t N>\n"
+		       "inline bool\n"
+		       "send(struct ::wl_proxy *proxy, std::uint32_t opcode,\n"
+		       "     const std::array<std::uint32_t, N> &args)\n"
+		       "{\n"
+		       "\tstd::uint32_t *p;\n\n"
+		       "\tp = ::wl_proxy_marshal_reserve(proxy, opcode, "
+		       "8 + 4 * N);\n"
+		       "\tif (p == nullptr)\n"
+		       "\t\treturn false;\n\n"
+		       "\tstd::memcpy(p + 2, args.data(), 4 * N);\n"
+		       "\t::wl_proxy_marshal_commit(proxy, p);\n\n"
+		       "\treturn true;\n"
+		       "}\n\n");
+
+	printf("}\n"
+	       "}\n"
+	       "}\n\n"
+	       "#endif\n\n");
+}
+
+static void
+emit_cpp_header(struct protocol *protocol, int server)
+{
+	struct interface *i;
+	const char *s = server ? "SERVER" : "CLIENT";
+	const char *side = server ? "server" : "client";
+
+	if (protocol->copyright)
+		format_copyright(protocol->copyright);
+
+	printf("#ifndef %s_%s_PROTOCOL_HPP\n"
+	       "#define %s_%s_PROTOCOL_HPP\n"
+	       "\n"
+	       "#include <array>\n"
+	       "#include <cstddef>\n"
+	       "#include <cstdint>\n"
+	       "#include <cstring>\n"
+	       "#include \"wayland-%s.h\"\n"
+	       "#include \"%s-%s-protocol.h\"\n\n",
+	       protocol->uppercase_name, s,
+	       protocol->uppercase_name, s,
+	       side, protocol->name, side);
+
+	emit_cpp_helpers(server);
+
+	printf("namespace wayland {\n"
+	       "namespace %s {\n\n", side);
+
+	wl_list_for_each(i, &protocol->interface_list, link) {
+		printf("namespace %s {\n\n", i->name);
+
+		emit_cpp_descriptors(&i->request_list, "requests");
+		emit_cpp_descriptors(&i->event_list, "events");
+
+		if (server) {
+			emit_cpp_dispatch(&i->request_list, i, 1);
+			emit_cpp_senders(&i->event_list, i, 1);
+		} else {
+			emit_cpp_dispatch(&i->event_list, i, 0);
+			emit_cpp_senders(&i->request_list, i, 0);
+		}
+
+		printf("}\n\n");
+	}
+
+	printf("}\n"
+	       "}\n\n"
+	       "#endif\n");
 }
 
 int main(int argc, char *argv[])
@@ -1096,6 +1780,12 @@ int main(int argc, char *argv[])
 	int len;
 	void *buf;
 
+	if (argc == 3 && strcmp(argv[1], "--inline-marshal") == 0) {
+		inline_marshal = 1;
+		argv++;
+		argc--;
+	}
+
 	if (argc != 2)
 		usage(EXIT_FAILURE);
 
@@ -1135,6 +1825,10 @@ int main(int argc, char *argv[])
 		emit_header(&protocol, 1);
 	} else if (strcmp(argv[1], "code") == 0) {
 		emit_code(&protocol);
+	} else if (strcmp(argv[1], "cpp-client") == 0) {
+		emit_cpp_header(&protocol, 0);
+	} else if (strcmp(argv[1], "cpp-server") == 0) {
+		emit_cpp_header(&protocol, 1);
 	}
 
 	return 0;
@@ -2,7 +2,13 @@
 	$(AM_V_GEN)$(wayland_scanner) code < $< > $@
 
 %-server-protocol.h : $(protocoldir)/%.xml
-	$(AM_V_GEN)$(wayland_scanner) server-header < $< > $@
+	$(AM_V_GEN)$(wayland_scanner) --inline-marshal server-header < $< > $@
 
 %-client-protocol.h : $(protocoldir)/%.xml
-	$(AM_V_GEN)$(wayland_scanner) client-header < $< > $@
+	$(AM_V_GEN)$(wayland_scanner) --inline-marshal client-header < $< > $@
+
+%-server-protocol.hpp : $(protocoldir)/%.xml
+	$(AM_V_GEN)$(wayland_scanner) cpp-server < $< > $@
+
+%-client-protocol.hpp : $(protocoldir)/%.xml
+	$(AM_V_GEN)$(wayland_scanner) cpp-client < $< > $@
@@ -34,11 +34,13 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <sys/poll.h>
+#include <pthread.h>
 
 #include "wayland-util.h"
 #include "wayland-os.h"
 #include "wayland-client.h"
 #include "wayland-private.h"
+#include "wayland-probes.h"
 
 struct wl_global_listener {
 	wl_display_global_func_t handler;
@@ -214,6 +216,56 @@ wl_proxy_marshal(struct wl_proxy *proxy, uint32_t opcode, ...)
 	wl_closure_destroy(closure);
 }
 
+/** Reserve space for a request in the connection buffer
+ *
+ * \param proxy The proxy object
+ * \param opcode Opcode of the request
+ * \param size Size of the request on the wire, header included
+ * \return Where to write the request arguments, or %NULL if the
+ * request must be sent with wl_proxy_marshal() instead
+ *
+ * This is used by the inline request stubs wayland-scanner generates
+ * with --inline-marshal.  The message header is filled in; the caller
+ * writes the arguments after it in wire format and then passes the
+ * returned pointer to wl_proxy_marshal_commit().  Nothing else may be
+ * sent on the connection in between.
+ *
+ * %NULL is returned when WAYLAND_DEBUG is set, so that requests are
+ * still logged, or when the request does not fit in the buffer.
+ */
+WL_EXPORT uint32_t *
+wl_proxy_marshal_reserve(struct wl_proxy *proxy, uint32_t opcode,
+			 size_t size)
+{
+	uint32_t *p;
+
+	if (wl_debug)
+		return NULL;
+
+	p = wl_connection_reserve(proxy->display->connection, size);
+	if (p == NULL)
+		return NULL;
+
+	p[0] = proxy->object.id;
+	p[1] = opcode | (size << 16);
+
+	return p;
+}
+
+/** Send a request written with wl_proxy_marshal_reserve()
+ *
+ * \param proxy The proxy object
+ * \param data The pointer returned by wl_proxy_marshal_reserve()
+ */
+WL_EXPORT void
+wl_proxy_marshal_commit(struct wl_proxy *proxy, uint32_t *data)
+{
+	WL_PROBE(marshal, proxy->object.interface->name, data[1] & 0xffff,
+		 data[0], data[1] >> 16);
+
+	wl_connection_commit(proxy->display->connection, data);
+}
+
 /* Can't do this, there may be more than one instance of an
  * interface... */
 WL_EXPORT uint32_t
@@ -355,6 +407,14 @@ connect_to_socket(struct wl_display *display, const char *name)
 	return 0;
 }
 
+static pthread_once_t protocol_info_once = PTHREAD_ONCE_INIT;
+
+static void
+add_protocol_info(void)
+{
+	wl_message_info_add(&wayland_protocol_info);
+}
+
 WL_EXPORT struct wl_display *
 wl_display_connect(const char *name)
 {
@@ -367,6 +427,8 @@ wl_display_connect(const char *name)
 	if (debug)
 		wl_debug = 1;
 
+	pthread_once(&protocol_info_once, add_protocol_info);
+
 	display = malloc(sizeof *display);
 	if (display == NULL)
 		return NULL;
@@ -478,17 +540,19 @@ static int
 create_proxies(struct wl_display *display, struct wl_closure *closure)
 {
 	struct wl_proxy *proxy;
-	const char *signature;
-	struct argument_details arg;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
 	uint32_t id;
 	int i;
 	int count;
 
-	signature = closure->message->signature;
-	count = arg_count_for_signature(signature) + 2;
+	info = wl_message_get_info(closure->message, &info_buffer);
+	if (!(info->flags & WL_MESSAGE_HAS_NEW_ID))
+		return 0;
+
+	count = info->arg_count + 2;
 	for (i = 2; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-		switch (arg.type) {
+		switch (info->types[i - 2]) {
 		case 'n':
 			id = **(uint32_t **) closure->args[i];
 			if (id == 0) {
@@ -34,6 +34,9 @@ struct wl_proxy;
 struct wl_display;
 
 void wl_proxy_marshal(struct wl_proxy *p, uint32_t opcode, ...);
+uint32_t *wl_proxy_marshal_reserve(struct wl_proxy *p, uint32_t opcode,
+				   size_t size);
+void wl_proxy_marshal_commit(struct wl_proxy *p, uint32_t *data);
 struct wl_proxy *wl_proxy_create(struct wl_proxy *factory,
 				 const struct wl_interface *interface);
 struct wl_proxy *wl_proxy_create_for_id(struct wl_proxy *factory,
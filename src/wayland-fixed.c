@@ -0,0 +1,464 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#define HAVE_SIMD
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define HAVE_SIMD
+#include <arm_neon.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#include "wayland-util.h"
+#include "wayland-private.h"
+
+/* The kernels convert as many values as they can in whole vectors and
+ * return how many that was, the scalar functions from wayland-util.h
+ * do the rest.  The results are bit for bit those of the scalar
+ * functions: int to double and scaling by 1/256 are exact, and going
+ * back to fixed uses the same magic number addition, keeping the low
+ * 32 bits of the sum. */
+
+#define FIXED_MAGIC ((double) (3LL << (51 - 8)))
+
+#if defined(__SSE2__)
+
+/* The low 32 bits of the four doubles in a and b */
+static inline __m128i
+pack_low_halves(__m128d a, __m128d b)
+{
+	return _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(a),
+					       _mm_castpd_ps(b),
+					       _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static size_t
+to_double_simd(double *d, const wl_fixed_t *f, size_t count)
+{
+	const __m128d scale = _mm_set1_pd(1.0 / 256);
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_si128((const __m128i *) (f + i));
+		_mm_storeu_pd(d + i, _mm_mul_pd(_mm_cvtepi32_pd(v), scale));
+		v = _mm_srli_si128(v, 8);
+		_mm_storeu_pd(d + i + 2,
+			      _mm_mul_pd(_mm_cvtepi32_pd(v), scale));
+	}
+
+	return i;
+}
+
+static size_t
+from_double_simd(wl_fixed_t *f, const double *d, size_t count)
+{
+	const __m128d magic = _mm_set1_pd(FIXED_MAGIC);
+	__m128d a, b;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		a = _mm_add_pd(_mm_loadu_pd(d + i), magic);
+		b = _mm_add_pd(_mm_loadu_pd(d + i + 2), magic);
+		_mm_storeu_si128((__m128i *) (f + i), pack_low_halves(a, b));
+	}
+
+	return i;
+}
+
+static size_t
+to_float_simd(float *d, const wl_fixed_t *f, size_t count)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 256);
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_si128((const __m128i *) (f + i));
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+
+	return i;
+}
+
+static size_t
+from_float_simd(wl_fixed_t *f, const float *d, size_t count)
+{
+	const __m128d magic = _mm_set1_pd(FIXED_MAGIC);
+	__m128d a, b;
+	__m128 v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_ps(d + i);
+		a = _mm_add_pd(_mm_cvtps_pd(v), magic);
+		b = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), magic);
+		_mm_storeu_si128((__m128i *) (f + i), pack_low_halves(a, b));
+	}
+
+	return i;
+}
+
+static size_t
+to_int_simd(int *d, const wl_fixed_t *f, size_t count)
+{
+	__m128i v, bias;
+	size_t i;
+
+	/* Round towards zero like f / 256 does, by adding 255 to
+	 * negative values before shifting */
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_si128((const __m128i *) (f + i));
+		bias = _mm_srli_epi32(_mm_srai_epi32(v, 31), 24);
+		v = _mm_srai_epi32(_mm_add_epi32(v, bias), 8);
+		_mm_storeu_si128((__m128i *) (d + i), v);
+	}
+
+	return i;
+}
+
+static size_t
+from_int_simd(wl_fixed_t *f, const int *d, size_t count)
+{
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_si128((const __m128i *) (d + i));
+		_mm_storeu_si128((__m128i *) (f + i), _mm_slli_epi32(v, 8));
+	}
+
+	return i;
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+static inline int32x4_t
+pack_low_halves(float64x2_t a, float64x2_t b)
+{
+	return vcombine_s32(vmovn_s64(vreinterpretq_s64_f64(a)),
+			    vmovn_s64(vreinterpretq_s64_f64(b)));
+}
+
+static size_t
+to_double_simd(double *d, const wl_fixed_t *f, size_t count)
+{
+	const float64x2_t scale = vdupq_n_f64(1.0 / 256);
+	int32x4_t v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = vld1q_s32(f + i);
+		vst1q_f64(d + i,
+			  vmulq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(v))),
+				    scale));
+		vst1q_f64(d + i + 2,
+			  vmulq_f64(vcvtq_f64_s64(vmovl_high_s32(v)), scale));
+	}
+
+	return i;
+}
+
+static size_t
+from_double_simd(wl_fixed_t *f, const double *d, size_t count)
+{
+	const float64x2_t magic = vdupq_n_f64(FIXED_MAGIC);
+	float64x2_t a, b;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		a = vaddq_f64(vld1q_f64(d + i), magic);
+		b = vaddq_f64(vld1q_f64(d + i + 2), magic);
+		vst1q_s32(f + i, pack_low_halves(a, b));
+	}
+
+	return i;
+}
+
+static size_t
+to_float_simd(float *d, const wl_fixed_t *f, size_t count)
+{
+	const float32x4_t scale = vdupq_n_f32(1.0f / 256);
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+		vst1q_f32(d + i,
+			  vmulq_f32(vcvtq_f32_s32(vld1q_s32(f + i)), scale));
+
+	return i;
+}
+
+static size_t
+from_float_simd(wl_fixed_t *f, const float *d, size_t count)
+{
+	const float64x2_t magic = vdupq_n_f64(FIXED_MAGIC);
+	float64x2_t a, b;
+	float32x4_t v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = vld1q_f32(d + i);
+		a = vaddq_f64(vcvt_f64_f32(vget_low_f32(v)), magic);
+		b = vaddq_f64(vcvt_high_f64_f32(v), magic);
+		vst1q_s32(f + i, pack_low_halves(a, b));
+	}
+
+	return i;
+}
+
+static size_t
+to_int_simd(int *d, const wl_fixed_t *f, size_t count)
+{
+	int32x4_t v, bias;
+	size_t i;
+
+	/* Round towards zero like f / 256 does, by adding 255 to
+	 * negative values before shifting */
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = vld1q_s32(f + i);
+		bias = vreinterpretq_s32_u32(
+			vshrq_n_u32(vreinterpretq_u32_s32(vshrq_n_s32(v, 31)),
+				    24));
+		vst1q_s32(d + i, vshrq_n_s32(vaddq_s32(v, bias), 8));
+	}
+
+	return i;
+}
+
+static size_t
+from_int_simd(wl_fixed_t *f, const int *d, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+		vst1q_s32(f + i, vshlq_n_s32(vld1q_s32(d + i), 8));
+
+	return i;
+}
+
+#endif
+
+#ifdef HAVE_AVX2
+
+#define AVX2 __attribute__ ((target("avx2")))
+
+static int
+has_avx2(void)
+{
+	static int avx2 = -1;
+
+	if (avx2 < 0) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2") != 0;
+	}
+
+	return avx2;
+}
+
+static inline AVX2 __m256i
+pack_low_halves_avx2(__m256d a, __m256d b)
+{
+	const __m256i index = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	__m256i la, lb;
+
+	la = _mm256_permutevar8x32_epi32(_mm256_castpd_si256(a), index);
+	lb = _mm256_permutevar8x32_epi32(_mm256_castpd_si256(b), index);
+
+	return _mm256_permute2x128_si256(la, lb, 0x20);
+}
+
+static AVX2 size_t
+to_double_avx2(double *d, const wl_fixed_t *f, size_t count)
+{
+	const __m256d scale = _mm256_set1_pd(1.0 / 256);
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_si128((const __m128i *) (f + i));
+		_mm256_storeu_pd(d + i,
+				 _mm256_mul_pd(_mm256_cvtepi32_pd(v), scale));
+	}
+
+	return i;
+}
+
+static AVX2 size_t
+from_double_avx2(wl_fixed_t *f, const double *d, size_t count)
+{
+	const __m256d magic = _mm256_set1_pd(FIXED_MAGIC);
+	__m256d a, b;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		a = _mm256_add_pd(_mm256_loadu_pd(d + i), magic);
+		b = _mm256_add_pd(_mm256_loadu_pd(d + i + 4), magic);
+		_mm256_storeu_si256((__m256i *) (f + i),
+				    pack_low_halves_avx2(a, b));
+	}
+
+	return i;
+}
+
+static AVX2 size_t
+to_float_avx2(float *d, const wl_fixed_t *f, size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 256);
+	__m256i v;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *) (f + i));
+		_mm256_storeu_ps(d + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+
+	return i;
+}
+
+static AVX2 size_t
+from_float_avx2(wl_fixed_t *f, const float *d, size_t count)
+{
+	const __m256d magic = _mm256_set1_pd(FIXED_MAGIC);
+	__m256d a, b;
+	__m256 v;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm256_loadu_ps(d + i);
+		a = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)),
+				  magic);
+		b = _mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)),
+				  magic);
+		_mm256_storeu_si256((__m256i *) (f + i),
+				    pack_low_halves_avx2(a, b));
+	}
+
+	return i;
+}
+
+static AVX2 size_t
+to_int_avx2(int *d, const wl_fixed_t *f, size_t count)
+{
+	__m256i v, bias;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *) (f + i));
+		bias = _mm256_srli_epi32(_mm256_srai_epi32(v, 31), 24);
+		v = _mm256_srai_epi32(_mm256_add_epi32(v, bias), 8);
+		_mm256_storeu_si256((__m256i *) (d + i), v);
+	}
+
+	return i;
+}
+
+static AVX2 size_t
+from_int_avx2(wl_fixed_t *f, const int *d, size_t count)
+{
+	__m256i v;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *) (d + i));
+		_mm256_storeu_si256((__m256i *) (f + i),
+				    _mm256_slli_epi32(v, 8));
+	}
+
+	return i;
+}
+
+#define convert(kernel, dst, src, count)				\
+	(has_avx2() ? kernel##_avx2(dst, src, count) :			\
+		      kernel##_simd(dst, src, count))
+
+#elif defined(HAVE_SIMD)
+
+#define convert(kernel, dst, src, count) kernel##_simd(dst, src, count)
+
+#else
+
+#define convert(kernel, dst, src, count) 0
+
+#endif
+
+WL_EXPORT void
+wl_fixed_to_double_array(double *d, const wl_fixed_t *f, size_t count)
+{
+	size_t i;
+
+	for (i = convert(to_double, d, f, count); i < count; i++)
+		d[i] = wl_fixed_to_double(f[i]);
+}
+
+WL_EXPORT void
+wl_fixed_from_double_array(wl_fixed_t *f, const double *d, size_t count)
+{
+	size_t i;
+
+	for (i = convert(from_double, f, d, count); i < count; i++)
+		f[i] = wl_fixed_from_double(d[i]);
+}
+
+WL_EXPORT void
+wl_fixed_to_float_array(float *d, const wl_fixed_t *f, size_t count)
+{
+	size_t i;
+
+	for (i = convert(to_float, d, f, count); i < count; i++)
+		d[i] = wl_fixed_to_double(f[i]);
+}
+
+WL_EXPORT void
+wl_fixed_from_float_array(wl_fixed_t *f, const float *d, size_t count)
+{
+	size_t i;
+
+	for (i = convert(from_float, f, d, count); i < count; i++)
+		f[i] = wl_fixed_from_double(d[i]);
+}
+
+WL_EXPORT void
+wl_fixed_to_int_array(int *d, const wl_fixed_t *f, size_t count)
+{
+	size_t i;
+
+	for (i = convert(to_int, d, f, count); i < count; i++)
+		d[i] = wl_fixed_to_int(f[i]);
+}
+
+WL_EXPORT void
+wl_fixed_from_int_array(wl_fixed_t *f, const int *d, size_t count)
+{
+	size_t i;
+
+	for (i = convert(from_int, f, d, count); i < count; i++)
+		f[i] = wl_fixed_from_int(d[i]);
+}
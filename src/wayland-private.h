@@ -70,13 +70,19 @@ int wl_connection_data(struct wl_connection *connection, uint32_t mask);
 int wl_connection_write(struct wl_connection *connection, const void *data, size_t count);
 int wl_connection_queue(struct wl_connection *connection,
 			const void *data, size_t count);
+uint32_t *wl_connection_reserve(struct wl_connection *connection, size_t size);
+void wl_connection_commit(struct wl_connection *connection, uint32_t *p);
+size_t wl_connection_unread_output(struct wl_connection *connection);
+int wl_connection_release_idle(struct wl_connection *connection);
+
+#define WL_CLOSURE_MAX_ARGS 20
 
 struct wl_closure {
 	int count;
 	const struct wl_message *message;
-	ffi_type *types[20];
+	ffi_type *types[WL_CLOSURE_MAX_ARGS];
 	ffi_cif cif;
-	void *args[20];
+	void *args[WL_CLOSURE_MAX_ARGS];
 	uint32_t *start;
 	uint32_t buffer[0];
 };
@@ -86,12 +92,29 @@ struct argument_details {
 	int nullable;
 };
 
+struct wl_message_info_buffer {
+	struct wl_message_info info;
+	char types[WL_CLOSURE_MAX_ARGS + 1];
+};
+
+void
+wl_message_info_add(const struct wl_protocol_info *protocol);
+
+const struct wl_message_info *
+wl_message_get_info(const struct wl_message *message,
+		    struct wl_message_info_buffer *buffer);
+
+static inline void
+get_argument(const struct wl_message_info *info, int i,
+	     struct argument_details *details)
+{
+	details->type = info->types[i];
+	details->nullable = (info->nullable >> i) & 1;
+}
+
 const char *
 get_next_argument(const char *signature, struct argument_details *details);
 
-int
-arg_count_for_signature(const char *signature);
-
 struct wl_closure *
 wl_closure_vmarshal(struct wl_object *sender,
 		    uint32_t opcode, va_list ap,
@@ -103,6 +126,9 @@ wl_connection_demarshal(struct wl_connection *connection,
 			struct wl_map *objects,
 			const struct wl_message *message);
 
+int
+wl_closure_lookup(struct wl_closure *closure, struct wl_map *objects);
+
 void
 wl_closure_invoke(struct wl_closure *closure,
 		  struct wl_object *target, void (*func)(void), void *data);
@@ -117,6 +143,18 @@ wl_closure_destroy(struct wl_closure *closure);
 
 extern wl_log_func_t wl_log_handler;
 
+struct wl_display;
+
+const char *
+wl_display_intern_string(struct wl_display *display, const char *string);
+void
+wl_display_release_string(struct wl_display *display, const char *string);
+
+struct wl_client;
+
+int
+wl_client_has_unread_output(struct wl_client *client);
+
 void wl_log(const char *fmt, ...);
 
 #endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+#ifndef WAYLAND_PROBES_H
+#define WAYLAND_PROBES_H
+
+#include "../config.h"
+
+/* USDT probes for bpftrace, perf and systemtap, in the "wayland"
+ * provider.  Each is a single nop until something attaches to it, and
+ * they are compiled out entirely without <sys/sdt.h>.
+ *
+ *   marshal(interface, opcode, id, size)
+ *   demarshal(message, opcode, id, size)
+ *   invoke_begin(interface, opcode, id, size)
+ *   invoke_end(opcode, id, size)
+ *   connection_read(fd, bytes)
+ *   connection_write(fd, bytes)
+ *   client_create(client, fd)
+ *   client_destroy(client)
+ *   event_loop_dispatch_begin(loop, timeout)
+ *   event_loop_dispatch_end(loop, events)
+ *
+ * Strings are char pointers, sizes are in bytes and include the
+ * message header.  demarshal doesn't know the target object yet, so it
+ * has the message name instead of the interface name, and invoke_end
+ * leaves out the interface as the target may be gone by then. */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define WL_PROBE(name, ...) STAP_PROBEV(wayland, name, __VA_ARGS__)
+#else
+#define WL_PROBE(name, ...) do { } while (0)
+#endif
+
+#endif
@@ -39,12 +39,17 @@
 #include <fcntl.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <ffi.h>
 
 #include "wayland-private.h"
 #include "wayland-server.h"
 #include "wayland-server-protocol.h"
 #include "wayland-os.h"
+#include "wayland-probes.h"
 
 /* This is the size of the char array in struct sock_addr_un.
    No Wayland socket can be created with a path longer than this,
@@ -65,9 +70,91 @@ struct wl_socket {
 	struct wl_event_source *source;
 };
 
+/* How long a connection has to be idle before its output and fd
+ * buffers are given back */
+#define WL_IDLE_SWEEP_MS	1000
+
+/* Gives back the buffers of the idle connections of the clients on one
+ * loop.  The timer only runs while some of them hold buffers. */
+struct wl_idle_sweep {
+	struct wl_display *display;
+	struct wl_event_source *timer;
+	int armed;
+};
+
+/* A thread with its own event loop, owning the clients created on it.
+ * Events posted to those clients from other threads are queued here
+ * and sent from the owning thread. */
+struct wl_shard {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct wl_list queue;
+	int wake_fd;
+	struct wl_event_source *wake_source;
+	struct wl_idle_sweep idle_sweep;
+};
+
+struct wl_shard_message {
+	struct wl_list link;
+	struct wl_client *client;
+	struct wl_closure *closure;	/* NULL for a new client */
+	int fd;
+};
+
+static __thread struct wl_shard *current_shard;
+
+/* Bursts smaller than this are cheaper to decode inline */
+#define WL_PIPELINE_MIN_BYTES	1024
+
+/* Highest client object id whose interface the pipeline remembers */
+#define WL_PIPELINE_MAX_ID	65536
+
+/* Worker threads decoding client requests off the display's loop.
+ * Jobs go to the workers on the jobs list and come back on the done
+ * list, and the display's loop dispatches the decoded requests. */
+struct wl_pipeline {
+	struct wl_display *display;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct wl_list jobs;
+	struct wl_list done;
+	int stop;
+	pthread_t *threads;
+	int thread_count;
+	int done_fd;
+	struct wl_event_source *done_source;
+};
+
+struct wl_pipeline_entry {
+	struct wl_closure *closure;	/* NULL if decoding failed */
+	int error;
+	uint32_t id;
+	uint32_t opcode;
+	const struct wl_interface *interface;
+};
+
+/* While busy, a worker owns the client's input buffer and fds, and the
+ * client's fd source does not poll for reading. */
+struct wl_pipeline_job {
+	struct wl_list link;
+	struct wl_client *client;
+	int busy;
+	int destroy;
+	int len;
+	struct wl_array entries;
+	/* Interfaces of the client's objects, indexed by id, as the
+	 * worker sees them; NULL when unknown */
+	struct wl_array interfaces;
+};
+
 struct wl_client {
 	struct wl_connection *connection;
 	struct wl_event_source *source;
+	struct wl_event_loop *loop;
+	struct wl_shard *shard;
+	struct wl_idle_sweep *idle_sweep;
 	struct wl_display *display;
 	struct wl_resource *display_resource;
 	uint32_t id_count;
@@ -77,8 +164,16 @@ struct wl_client {
 	struct wl_signal destroy_signal;
 	struct ucred ucred;
 	int error;
+	struct wl_pipeline_job *job;
+	struct wl_client_usage usage[WL_CLIENT_ACCOUNT_COUNT];
+	uint32_t over_soft_quota;
 };
 
+#define WL_INTERN_BUCKETS 64
+
+/* What an object is charged: the resource and its entry in the map */
+#define WL_RESOURCE_ACCOUNT_SIZE (sizeof(struct wl_resource) + sizeof(void *))
+
 struct wl_display {
 	struct wl_event_loop *loop;
 	int run;
@@ -86,9 +181,34 @@ struct wl_display {
 	uint32_t id;
 	uint32_t serial;
 
+	/* Protects the global and client lists and the strings */
+	pthread_mutex_t lock;
 	struct wl_list global_list;
 	struct wl_list socket_list;
 	struct wl_list client_list;
+	struct wl_interned *strings[WL_INTERN_BUCKETS];
+
+	struct wl_shard main_shard;
+	struct wl_shard *shards;
+	int shard_count;
+	int running_shards;	/* started by wl_display_run() */
+	int next_shard;
+
+	struct wl_idle_sweep idle_sweep;
+	struct wl_pipeline *pipeline;
+
+	struct wl_client_usage soft_quota[WL_CLIENT_ACCOUNT_COUNT];
+	struct wl_client_usage hard_quota[WL_CLIENT_ACCOUNT_COUNT];
+	wl_client_quota_func_t quota_handler;
+	void *quota_data;
+};
+
+/* A string shared by everything on the display that uses it */
+struct wl_interned {
+	struct wl_interned *next;
+	uint32_t hash;
+	int refcount;
+	char string[];
 };
 
 struct wl_global {
@@ -109,6 +229,202 @@ destroy_client(void *data)
 	wl_client_destroy(client);
 }
 
+static void
+idle_sweep_arm(struct wl_idle_sweep *sweep)
+{
+	if (!sweep->armed) {
+		wl_event_source_timer_update(sweep->timer, WL_IDLE_SWEEP_MS);
+		sweep->armed = 1;
+	}
+}
+
+static int
+idle_sweep_timeout(void *data)
+{
+	struct wl_idle_sweep *sweep = data;
+	struct wl_display *display = sweep->display;
+	struct wl_client *client;
+	int held = 0;
+
+	sweep->armed = 0;
+
+	pthread_mutex_lock(&display->lock);
+	wl_list_for_each(client, &display->client_list, link) {
+		if (client->idle_sweep != sweep)
+			continue;
+		/* A worker may be taking fds from the connection */
+		if (client->job && client->job->busy)
+			held = 1;
+		else
+			held |= wl_connection_release_idle(client->connection);
+	}
+	pthread_mutex_unlock(&display->lock);
+
+	if (held)
+		idle_sweep_arm(sweep);
+
+	return 1;
+}
+
+static int
+idle_sweep_init(struct wl_idle_sweep *sweep, struct wl_display *display,
+		struct wl_event_loop *loop)
+{
+	sweep->display = display;
+	sweep->armed = 0;
+	sweep->timer = wl_event_loop_add_timer(loop, idle_sweep_timeout,
+					       sweep);
+
+	return sweep->timer ? 0 : -1;
+}
+
+static void
+shard_queue(struct wl_shard *shard, struct wl_shard_message *message)
+{
+	uint64_t one = 1;
+	int empty;
+
+	pthread_mutex_lock(&shard->lock);
+	empty = wl_list_empty(&shard->queue);
+	wl_list_insert(shard->queue.prev, &message->link);
+	pthread_mutex_unlock(&shard->lock);
+
+	if (empty && write(shard->wake_fd, &one, sizeof one) < 0)
+		wl_log("failed to wake shard: %m\n");
+}
+
+/* Hand an event for a client owned by another thread over to that
+ * thread, which takes ownership of the closure */
+static void
+shard_post(struct wl_client *client, struct wl_closure *closure)
+{
+	struct wl_shard_message *message;
+
+	message = malloc(sizeof *message);
+	if (message == NULL) {
+		wl_closure_destroy(closure);
+		return;
+	}
+
+	message->client = client;
+	message->closure = closure;
+	message->fd = -1;
+	shard_queue(client->shard, message);
+}
+
+static void
+shard_message_destroy(struct wl_shard_message *message)
+{
+	if (message->closure)
+		wl_closure_destroy(message->closure);
+	else
+		close(message->fd);
+	free(message);
+}
+
+static int
+shard_wake(int fd, uint32_t mask, void *data)
+{
+	struct wl_shard *shard = data;
+	struct wl_shard_message *message;
+	struct wl_client *client;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		wl_log("failed to read shard wakeup: %m\n");
+
+	/* One at a time, so that a client destroyed while handling
+	 * one message has the ones after it purged */
+	for (;;) {
+		pthread_mutex_lock(&shard->lock);
+		if (wl_list_empty(&shard->queue)) {
+			pthread_mutex_unlock(&shard->lock);
+			break;
+		}
+		message = container_of(shard->queue.next,
+				       struct wl_shard_message, link);
+		wl_list_remove(&message->link);
+		pthread_mutex_unlock(&shard->lock);
+
+		client = message->client;
+		if (message->closure == NULL) {
+			wl_client_create(shard->display, message->fd);
+			message->fd = -1;
+			free(message);
+			continue;
+		}
+
+		if (wl_closure_send(message->closure, client->connection))
+			wl_event_loop_add_idle(client->loop,
+					       destroy_client, client);
+		shard_message_destroy(message);
+	}
+
+	return 1;
+}
+
+static int
+shard_init(struct wl_shard *shard, struct wl_display *display,
+	   struct wl_event_loop *loop)
+{
+	shard->display = display;
+	shard->loop = loop;
+	wl_list_init(&shard->queue);
+	pthread_mutex_init(&shard->lock, NULL);
+
+	shard->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (shard->wake_fd < 0)
+		return -1;
+
+	shard->wake_source = wl_event_loop_add_fd(loop, shard->wake_fd,
+						  WL_EVENT_READABLE,
+						  shard_wake, shard);
+	if (shard->wake_source == NULL) {
+		close(shard->wake_fd);
+		return -1;
+	}
+
+	/* The display sweeps the clients on its own loop */
+	shard->idle_sweep.timer = NULL;
+	if (loop != display->loop &&
+	    idle_sweep_init(&shard->idle_sweep, display, loop) < 0) {
+		wl_event_source_remove(shard->wake_source);
+		close(shard->wake_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+shard_release(struct wl_shard *shard)
+{
+	struct wl_shard_message *message, *next;
+
+	wl_list_for_each_safe(message, next, &shard->queue, link)
+		shard_message_destroy(message);
+
+	if (shard->idle_sweep.timer)
+		wl_event_source_remove(shard->idle_sweep.timer);
+	wl_event_source_remove(shard->wake_source);
+	close(shard->wake_fd);
+	pthread_mutex_destroy(&shard->lock);
+}
+
+static void *
+shard_run(void *data)
+{
+	struct wl_shard *shard = data;
+	struct wl_display *display = shard->display;
+
+	current_shard = shard;
+
+	while (__atomic_load_n(&display->run, __ATOMIC_ACQUIRE))
+		wl_event_loop_dispatch(shard->loop, -1);
+
+	return NULL;
+}
+
 WL_EXPORT void
 wl_resource_post_event(struct wl_resource *resource, uint32_t opcode, ...)
 {
@@ -124,17 +440,63 @@ wl_resource_post_event(struct wl_resource *resource, uint32_t opcode, ...)
 	if (closure == NULL)
 		return;
 
-	if (wl_closure_send(closure, resource->client->connection))
-		wl_event_loop_add_idle(resource->client->display->loop,
-				       destroy_client, resource->client);
-
 	if (wl_debug)
 		wl_closure_print(closure, object, true);
 
+	if (resource->client->shard != current_shard) {
+		shard_post(resource->client, closure);
+		return;
+	}
+
+	if (wl_closure_send(closure, resource->client->connection))
+		wl_event_loop_add_idle(resource->client->loop,
+				       destroy_client, resource->client);
+
 	wl_closure_destroy(closure);
 }
 
 
+/** Reserve space for an event in the client's connection buffer
+ *
+ * \param resource The resource the event is sent from
+ * \param opcode Opcode of the event
+ * \param size Size of the event on the wire, header included
+ * \return Where to write the event arguments, or %NULL if the event
+ * must be sent with wl_resource_post_event() instead
+ *
+ * This is the server side of wl_proxy_marshal_reserve(), used by the
+ * inline event wrappers wayland-scanner generates with
+ * --inline-marshal.  The event is sent by passing the returned pointer
+ * to wl_resource_marshal_commit().
+ */
+WL_EXPORT uint32_t *
+wl_resource_marshal_reserve(struct wl_resource *resource, uint32_t opcode,
+			    size_t size)
+{
+	uint32_t *p;
+
+	if (wl_debug || resource->client->shard != current_shard)
+		return NULL;
+
+	p = wl_connection_reserve(resource->client->connection, size);
+	if (p == NULL)
+		return NULL;
+
+	p[0] = resource->object.id;
+	p[1] = opcode | (size << 16);
+
+	return p;
+}
+
+WL_EXPORT void
+wl_resource_marshal_commit(struct wl_resource *resource, uint32_t *data)
+{
+	WL_PROBE(marshal, resource->object.interface->name, data[1] & 0xffff,
+		 data[0], data[1] >> 16);
+
+	wl_connection_commit(resource->client->connection, data);
+}
+
 WL_EXPORT void
 wl_resource_queue_event(struct wl_resource *resource, uint32_t opcode, ...)
 {
@@ -150,8 +512,15 @@ wl_resource_queue_event(struct wl_resource *resource, uint32_t opcode, ...)
 	if (closure == NULL)
 		return;
 
+	if (resource->client->shard != current_shard) {
+		if (wl_debug)
+			wl_closure_print(closure, object, true);
+		shard_post(resource->client, closure);
+		return;
+	}
+
 	if (wl_closure_queue(closure, resource->client->connection))
-		wl_event_loop_add_idle(resource->client->display->loop,
+		wl_event_loop_add_idle(resource->client->loop,
 				       destroy_client, resource->client);
 
 	if (wl_debug)
@@ -191,15 +560,19 @@ wl_resource_post_error(struct wl_resource *resource,
 static void
 deref_new_objects(struct wl_closure *closure)
 {
-	const char *signature;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
 	int i;
 
-	signature = closure->message->signature;
-	for (i = 0; signature[i]; i++) {
-		switch (signature[i]) {
+	info = wl_message_get_info(closure->message, &info_buffer);
+	if (!(info->flags & WL_MESSAGE_HAS_NEW_ID))
+		return;
+
+	for (i = 0; i < info->arg_count; i++) {
+		switch (info->types[i]) {
 		case 'n':
 			closure->args[i + 2] = *(uint32_t **) closure->args[i + 2];
-			closure->types[i] = &ffi_type_uint32;
+			closure->types[i + 2] = &ffi_type_uint32;
 			break;
 		}
 	}
@@ -208,9 +581,99 @@ deref_new_objects(struct wl_closure *closure)
 
 
 static int
-wl_client_connection_data(int fd, uint32_t mask, void *data)
+wl_client_connection_update(struct wl_connection *connection,
+			    uint32_t mask, void *data)
 {
 	struct wl_client *client = data;
+	uint32_t emask = 0;
+
+	client->mask = mask;
+	if (mask & WL_CONNECTION_READABLE &&
+	    !(client->job && client->job->busy))
+		emask |= WL_EVENT_READABLE;
+	if (mask & WL_CONNECTION_WRITABLE)
+		emask |= WL_EVENT_WRITABLE;
+
+	return wl_event_source_fd_update(client->source, emask);
+}
+
+static void
+pipeline_set_interface(struct wl_pipeline_job *job, uint32_t id,
+		       const struct wl_interface *interface)
+{
+	const struct wl_interface **p;
+	size_t size;
+
+	if (id >= WL_PIPELINE_MAX_ID)
+		return;
+
+	size = (id + 1) * sizeof *p;
+	if (job->interfaces.size < size) {
+		if (interface == NULL)
+			return;
+		p = wl_array_add(&job->interfaces,
+				 size - job->interfaces.size);
+		if (p == NULL)
+			return;
+		memset(p, 0, (char *) job->interfaces.data +
+		       job->interfaces.size - (char *) p);
+	}
+
+	p = job->interfaces.data;
+	p[id] = interface;
+}
+
+static const struct wl_interface *
+pipeline_get_interface(struct wl_pipeline_job *job, uint32_t id)
+{
+	const struct wl_interface **p = job->interfaces.data;
+
+	if (id >= job->interfaces.size / sizeof *p)
+		return NULL;
+
+	return p[id];
+}
+
+static void
+pipeline_seed_interface(void *element, void *data)
+{
+	struct wl_resource *resource = element;
+
+	if (resource == NULL || resource == WL_ZOMBIE_OBJECT)
+		return;
+
+	pipeline_set_interface(data, resource->object.id,
+			       resource->object.interface);
+}
+
+/* Record what the new ids of a dispatched request turned into */
+static void
+client_note_new_ids(struct wl_client *client, struct wl_closure *closure)
+{
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
+	struct wl_resource *resource;
+	uint32_t id;
+	int i;
+
+	info = wl_message_get_info(closure->message, &info_buffer);
+	if (!(info->flags & WL_MESSAGE_HAS_NEW_ID))
+		return;
+
+	for (i = 0; i < info->arg_count; i++) {
+		if (info->types[i] != 'n')
+			continue;
+		id = *(uint32_t *) closure->args[i + 2];
+		resource = wl_map_lookup(&client->objects, id);
+		pipeline_set_interface(client->job, id,
+				       resource && resource != WL_ZOMBIE_OBJECT ?
+				       resource->object.interface : NULL);
+	}
+}
+
+static void
+client_dispatch(struct wl_client *client, int len)
+{
 	struct wl_connection *connection = client->connection;
 	struct wl_resource *resource;
 	struct wl_object *object;
@@ -218,19 +681,6 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 	const struct wl_message *message;
 	uint32_t p[2];
 	int opcode, size;
-	uint32_t cmask = 0;
-	int len;
-
-	if (mask & WL_EVENT_READABLE)
-		cmask |= WL_CONNECTION_READABLE;
-	if (mask & WL_EVENT_WRITABLE)
-		cmask |= WL_CONNECTION_WRITABLE;
-
-	len = wl_connection_data(connection, cmask);
-	if (len < 0) {
-		wl_client_destroy(client);
-		return 1;
-	}
 
 	while ((size_t) len >= sizeof p) {
 		wl_connection_copy(connection, p, sizeof p);
@@ -266,68 +716,554 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 		if (wl_debug)
 			wl_closure_print(closure, object, false);
 
-		if (closure == NULL && errno == EINVAL) {
-			wl_resource_post_error(client->display_resource,
-					       WL_DISPLAY_ERROR_INVALID_METHOD,
-					       "invalid arguments for %s@%u.%s",
-					       object->interface->name,
-					       object->id,
-					       message->name);
-			break;
-		} else if (closure == NULL && errno == ENOMEM) {
-			wl_resource_post_no_memory(resource);
-			break;
-		}
+		if (closure == NULL && errno == EINVAL) {
+			wl_resource_post_error(client->display_resource,
+					       WL_DISPLAY_ERROR_INVALID_METHOD,
+					       "invalid arguments for %s@%u.%s",
+					       object->interface->name,
+					       object->id,
+					       message->name);
+			break;
+		} else if (closure == NULL && errno == ENOMEM) {
+			wl_resource_post_no_memory(resource);
+			break;
+		}
+
+		deref_new_objects(closure);
+
+		wl_closure_invoke(closure, object,
+				  object->implementation[opcode], client);
+
+		if (client->job)
+			client_note_new_ids(client, closure);
+
+		wl_closure_destroy(closure);
+
+		if (client->error)
+			break;
+	}
+
+	if (client->error)
+		wl_client_destroy(client);
+}
+
+/* Runs on a worker: decode as many complete requests as the interface
+ * cache allows, leaving the rest in the buffer for the owning thread. */
+static void
+pipeline_demarshal(struct wl_pipeline_job *job)
+{
+	struct wl_connection *connection = job->client->connection;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer info_buffer;
+	const struct wl_interface *interface;
+	const struct wl_message *message;
+	struct wl_pipeline_entry *entry;
+	struct wl_closure *closure;
+	uint32_t p[2];
+	int opcode, size, len = job->len, i;
+
+	while ((size_t) len >= sizeof p) {
+		wl_connection_copy(connection, p, sizeof p);
+		opcode = p[1] & 0xffff;
+		size = p[1] >> 16;
+		if (len < size || (size_t) size < sizeof p)
+			break;
+
+		interface = pipeline_get_interface(job, p[0]);
+		if (interface == NULL || opcode >= interface->method_count)
+			break;
+
+		entry = wl_array_add(&job->entries, sizeof *entry);
+		if (entry == NULL)
+			break;
+
+		message = &interface->methods[opcode];
+		closure = wl_connection_demarshal(connection, size,
+						  NULL, message);
+		entry->closure = closure;
+		entry->error = errno;
+		entry->id = p[0];
+		entry->opcode = opcode;
+		entry->interface = interface;
+		if (closure == NULL)
+			break;
+		len -= size;
+
+		info = wl_message_get_info(message, &info_buffer);
+		if (!(info->flags & WL_MESSAGE_HAS_NEW_ID))
+			continue;
+		for (i = 0; i < info->arg_count; i++)
+			if (info->types[i] == 'n')
+				pipeline_set_interface(job,
+					**(uint32_t **) closure->args[i + 2],
+					message->types[i]);
+	}
+}
+
+static void *
+pipeline_run(void *data)
+{
+	struct wl_pipeline *pipeline = data;
+	struct wl_pipeline_job *job;
+	uint64_t one = 1;
+	int wake;
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (!pipeline->stop) {
+		if (wl_list_empty(&pipeline->jobs)) {
+			pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+			continue;
+		}
+
+		job = container_of(pipeline->jobs.next,
+				   struct wl_pipeline_job, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&pipeline->lock);
+
+		pipeline_demarshal(job);
+
+		pthread_mutex_lock(&pipeline->lock);
+		wake = wl_list_empty(&pipeline->done);
+		wl_list_insert(pipeline->done.prev, &job->link);
+		if (wake && write(pipeline->done_fd, &one, sizeof one) < 0)
+			wl_log("failed to wake display: %m\n");
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+
+	return NULL;
+}
+
+static void
+pipeline_job_destroy(struct wl_pipeline_job *job)
+{
+	wl_array_release(&job->entries);
+	wl_array_release(&job->interfaces);
+	free(job);
+}
+
+static int
+pipeline_submit(struct wl_client *client, int len)
+{
+	struct wl_pipeline *pipeline = client->display->pipeline;
+	struct wl_pipeline_job *job = client->job;
+
+	if (job == NULL) {
+		job = malloc(sizeof *job);
+		if (job == NULL)
+			return -1;
+		job->client = client;
+		job->busy = 0;
+		job->destroy = 0;
+		wl_array_init(&job->entries);
+		wl_array_init(&job->interfaces);
+		client->job = job;
+		wl_map_for_each(&client->objects,
+				pipeline_seed_interface, job);
+	}
+
+	job->len = len;
+	job->busy = 1;
+	wl_client_connection_update(client->connection, client->mask, client);
+
+	pthread_mutex_lock(&pipeline->lock);
+	wl_list_insert(pipeline->jobs.prev, &job->link);
+	pthread_cond_signal(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->lock);
+
+	return 0;
+}
+
+/* Dispatch what a worker decoded, then hand the client back to its fd
+ * source and dispatch whatever the worker left in the buffer. */
+static void
+pipeline_finish(struct wl_pipeline_job *job)
+{
+	struct wl_client *client = job->client;
+	struct wl_pipeline_entry *entry, *end;
+	struct wl_resource *resource;
+	struct wl_object *object;
+	struct wl_closure *closure;
+	int len;
+
+	job->busy = 0;
+
+	end = (void *) ((char *) job->entries.data + job->entries.size);
+	for (entry = job->entries.data; entry < end; entry++) {
+		closure = entry->closure;
+		if (job->destroy || client->error) {
+			if (closure)
+				wl_closure_destroy(closure);
+			continue;
+		}
+
+		resource = wl_map_lookup(&client->objects, entry->id);
+		if (resource == NULL ||
+		    resource->object.interface != entry->interface) {
+			wl_resource_post_error(client->display_resource,
+					       WL_DISPLAY_ERROR_INVALID_OBJECT,
+					       "invalid object %u", entry->id);
+			if (closure)
+				wl_closure_destroy(closure);
+			continue;
+		}
+
+		object = &resource->object;
+		if (closure == NULL && entry->error == ENOMEM) {
+			wl_resource_post_no_memory(resource);
+			continue;
+		}
+
+		if (closure == NULL ||
+		    wl_closure_lookup(closure, &client->objects) < 0) {
+			wl_resource_post_error(client->display_resource,
+					       WL_DISPLAY_ERROR_INVALID_METHOD,
+					       "invalid arguments for %s@%u.%s",
+					       object->interface->name,
+					       object->id,
+					       object->interface->methods[entry->opcode].name);
+			if (closure)
+				wl_closure_destroy(closure);
+			continue;
+		}
+
+		if (wl_debug)
+			wl_closure_print(closure, object, false);
+
+		deref_new_objects(closure);
+
+		wl_closure_invoke(closure, object,
+				  object->implementation[entry->opcode],
+				  client);
+
+		client_note_new_ids(client, closure);
+
+		wl_closure_destroy(closure);
+	}
+	job->entries.size = 0;
+
+	if (job->destroy || client->error) {
+		wl_client_destroy(client);
+		return;
+	}
+
+	wl_client_connection_update(client->connection, client->mask, client);
+
+	len = wl_connection_data(client->connection, 0);
+	client_dispatch(client, len);
+}
+
+static int
+pipeline_done(int fd, uint32_t mask, void *data)
+{
+	struct wl_pipeline *pipeline = data;
+	struct wl_pipeline_job *job;
+	struct wl_list done;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		return 1;
+
+	pthread_mutex_lock(&pipeline->lock);
+	wl_list_init(&done);
+	wl_list_insert_list(&done, &pipeline->done);
+	wl_list_init(&pipeline->done);
+	pthread_mutex_unlock(&pipeline->lock);
+
+	while (!wl_list_empty(&done)) {
+		job = container_of(done.next, struct wl_pipeline_job, link);
+		wl_list_remove(&job->link);
+		pipeline_finish(job);
+	}
+
+	return 1;
+}
+
+/* Drop what a worker decoded without dispatching it, for when the
+ * display goes away.  Clients destroyed while busy go now. */
+static void
+pipeline_discard(struct wl_pipeline_job *job)
+{
+	struct wl_pipeline_entry *entry, *end;
+
+	job->busy = 0;
+
+	end = (void *) ((char *) job->entries.data + job->entries.size);
+	for (entry = job->entries.data; entry < end; entry++)
+		if (entry->closure)
+			wl_closure_destroy(entry->closure);
+	job->entries.size = 0;
+
+	if (job->destroy)
+		wl_client_destroy(job->client);
+}
+
+static void
+pipeline_destroy(struct wl_pipeline *pipeline)
+{
+	struct wl_pipeline_job *job, *next;
+	int i;
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->stop = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->lock);
+
+	for (i = 0; i < pipeline->thread_count; i++)
+		pthread_join(pipeline->threads[i], NULL);
+
+	/* Hand back clients the workers never got to or finished, but
+	 * don't run their requests while the display is torn down */
+	wl_list_insert_list(&pipeline->done, &pipeline->jobs);
+	wl_list_for_each_safe(job, next, &pipeline->done, link)
+		pipeline_discard(job);
+
+	wl_event_source_remove(pipeline->done_source);
+	close(pipeline->done_fd);
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->lock);
+	free(pipeline->threads);
+	free(pipeline);
+}
+
+static int
+wl_client_connection_data(int fd, uint32_t mask, void *data)
+{
+	struct wl_client *client = data;
+	struct wl_connection *connection = client->connection;
+	uint32_t cmask = 0;
+	int len;
+
+	if (mask & WL_EVENT_READABLE)
+		cmask |= WL_CONNECTION_READABLE;
+	if (mask & WL_EVENT_WRITABLE)
+		cmask |= WL_CONNECTION_WRITABLE;
+
+	/* A worker is reading the input buffer, only flush */
+	if (client->job && client->job->busy)
+		cmask &= ~WL_CONNECTION_READABLE;
+
+	len = wl_connection_data(connection, cmask);
+	if (len < 0) {
+		wl_client_destroy(client);
+		return 1;
+	}
+
+	idle_sweep_arm(client->idle_sweep);
+
+	if (client->job && client->job->busy)
+		return 1;
+
+	if (client->display->pipeline &&
+	    client->loop == client->display->loop &&
+	    len >= WL_PIPELINE_MIN_BYTES && pipeline_submit(client, len) == 0)
+		return 1;
+
+	client_dispatch(client, len);
+
+	return 1;
+}
+
+WL_EXPORT void
+wl_client_flush(struct wl_client *client)
+{
+	if (client->mask & WL_CONNECTION_WRITABLE) {
+		wl_connection_data(client->connection, WL_CONNECTION_WRITABLE);
+		idle_sweep_arm(client->idle_sweep);
+	}
+}
+
+WL_EXPORT struct wl_display *
+wl_client_get_display(struct wl_client *client)
+{
+	return client->display;
+}
+
+/* Whether the client hasn't read all the events sent to it yet, which
+ * means it isn't keeping up with them */
+int
+wl_client_has_unread_output(struct wl_client *client)
+{
+	return wl_connection_unread_output(client->connection) > 0;
+}
+
+/* Whether usage is over a quota; zero fields of the quota are unlimited */
+static int
+over_quota(const struct wl_client_usage *usage,
+	   const struct wl_client_usage *quota)
+{
+	return (quota->count && usage->count > quota->count) ||
+		(quota->bytes && usage->bytes > quota->bytes);
+}
+
+/* Add to the usage of a client unconditionally, telling the compositor
+ * when it first goes over the soft quota.  Returns -1 if the usage is
+ * now over the hard quota. */
+static int
+client_account(struct wl_client *client, enum wl_client_account account,
+	       size_t count, size_t bytes)
+{
+	struct wl_display *display = client->display;
+	struct wl_client_usage *usage = &client->usage[account];
+
+	usage->count += count;
+	usage->bytes += bytes;
+
+	if (!(client->over_soft_quota & (1 << account)) &&
+	    over_quota(usage, &display->soft_quota[account])) {
+		client->over_soft_quota |= 1 << account;
+		if (display->quota_handler)
+			display->quota_handler(client, account, usage,
+					       display->quota_data);
+	}
+
+	return over_quota(usage, &display->hard_quota[account]) ? -1 : 0;
+}
+
+static void
+post_quota_error(struct wl_client *client, enum wl_client_account account)
+{
+	/* Nobody to tell while the display resource is being set up or
+	 * torn down */
+	if (!client->display_resource)
+		return;
 
-		deref_new_objects(closure);
+	wl_resource_post_error(client->display_resource,
+			       WL_DISPLAY_ERROR_NO_MEMORY,
+			       "client quota %d exceeded", account);
+}
 
-		wl_closure_invoke(closure, object,
-				  object->implementation[opcode], client);
+/** Get the resources a client is using
+ *
+ * \param client The client
+ * \param account What kind of resources to report
+ * \param usage Set to the number of objects and bytes in use
+ *
+ * Objects count the server side of each protocol object, shm the pools
+ * with the size of their mappings, and data the MIME types offered by
+ * the client's data sources with the length of their names.  This lets
+ * the server's memory be attributed to the clients holding it.
+ */
+WL_EXPORT void
+wl_client_get_usage(struct wl_client *client, enum wl_client_account account,
+		    struct wl_client_usage *usage)
+{
+	*usage = client->usage[account];
+}
 
-		wl_closure_destroy(closure);
+/** Account for resources allocated on behalf of a client
+ *
+ * \param client The client
+ * \param account What kind of resource is allocated
+ * \param count Number of objects
+ * \param bytes Size of the allocation
+ * \return 0 on success, -1 if it would go over the hard quota
+ *
+ * On failure nothing is charged and a protocol error is posted to the
+ * client, so the caller just has to drop the allocation.  Going over
+ * the soft quota for the first time calls the quota handler set with
+ * wl_display_set_quota_handler().  Called from the thread owning the
+ * client.
+ */
+WL_EXPORT int
+wl_client_charge(struct wl_client *client, enum wl_client_account account,
+		 size_t count, size_t bytes)
+{
+	struct wl_client_usage usage = client->usage[account];
 
-		if (client->error)
-			break;
+	usage.count += count;
+	usage.bytes += bytes;
+	if (over_quota(&usage, &client->display->hard_quota[account])) {
+		post_quota_error(client, account);
+		return -1;
 	}
 
-	if (client->error)
-		wl_client_destroy(client);
+	client_account(client, account, count, bytes);
 
-	return 1;
+	return 0;
 }
 
-static int
-wl_client_connection_update(struct wl_connection *connection,
-			    uint32_t mask, void *data)
+/** Release resources charged with wl_client_charge()
+ *
+ * \param client The client
+ * \param account What kind of resource is released
+ * \param count Number of objects
+ * \param bytes Size of the allocation
+ */
+WL_EXPORT void
+wl_client_uncharge(struct wl_client *client, enum wl_client_account account,
+		   size_t count, size_t bytes)
 {
-	struct wl_client *client = data;
-	uint32_t emask = 0;
+	struct wl_display *display = client->display;
+	struct wl_client_usage *usage = &client->usage[account];
 
-	client->mask = mask;
-	if (mask & WL_CONNECTION_READABLE)
-		emask |= WL_EVENT_READABLE;
-	if (mask & WL_CONNECTION_WRITABLE)
-		emask |= WL_EVENT_WRITABLE;
+	usage->count -= count;
+	usage->bytes -= bytes;
 
-	return wl_event_source_fd_update(client->source, emask);
+	if (!over_quota(usage, &display->soft_quota[account]))
+		client->over_soft_quota &= ~(1 << account);
 }
 
+/** Set the quotas of all clients of a display
+ *
+ * \param display The display
+ * \param account What kind of resources to limit
+ * \param soft Usage above which the quota handler is called, or NULL
+ * \param hard Usage that requests can't go over, or NULL
+ *
+ * A zero or NULL limit is unlimited.  Requests that would take a client
+ * over its hard quota fail with a no_memory protocol error, which
+ * disconnects the client.  Set the quotas before clients connect; usage
+ * already over a new hard quota is left alone.
+ */
 WL_EXPORT void
-wl_client_flush(struct wl_client *client)
+wl_display_set_client_quota(struct wl_display *display,
+			    enum wl_client_account account,
+			    const struct wl_client_usage *soft,
+			    const struct wl_client_usage *hard)
 {
-	if (client->mask & WL_CONNECTION_WRITABLE)
-		wl_connection_data(client->connection, WL_CONNECTION_WRITABLE);
+	static const struct wl_client_usage unlimited;
+
+	display->soft_quota[account] = soft ? *soft : unlimited;
+	display->hard_quota[account] = hard ? *hard : unlimited;
 }
 
-WL_EXPORT struct wl_display *
-wl_client_get_display(struct wl_client *client)
+/** Set the function called when a client goes over a soft quota
+ *
+ * \param display The display
+ * \param handler Called with the client's usage, or NULL
+ * \param data User data passed to \a handler
+ *
+ * The handler is called once each time a client's usage rises above
+ * the soft quota, from the thread owning the client.
+ */
+WL_EXPORT void
+wl_display_set_quota_handler(struct wl_display *display,
+			     wl_client_quota_func_t handler, void *data)
 {
-	return client->display;
+	display->quota_handler = handler;
+	display->quota_data = data;
+}
+
+/** Get the event loop a client is dispatched from
+ *
+ * \param client The client
+ * \return The event loop of the thread owning the client
+ *
+ * This is the display's event loop, except with wl_display_set_shards(),
+ * where it is the loop of the shard the client was assigned to.  The
+ * client's requests are handled there, and it may only be destroyed
+ * and have resources created or destroyed from that loop.
+ */
+WL_EXPORT struct wl_event_loop *
+wl_client_get_event_loop(struct wl_client *client)
+{
+	return client->loop;
 }
 
 static void
-bind_display(struct wl_client *client,
-	     void *data, uint32_t version, uint32_t id);
+add_display_resource(struct wl_client *client, uint32_t id);
+static void
+post_globals(struct wl_client *client);
 
 WL_EXPORT struct wl_client *
 wl_client_create(struct wl_display *display, int fd)
@@ -341,7 +1277,13 @@ wl_client_create(struct wl_display *display, int fd)
 
 	memset(client, 0, sizeof *client);
 	client->display = display;
-	client->source = wl_event_loop_add_fd(display->loop, fd,
+	client->shard = current_shard;
+	if (client->shard == NULL && display->shard_count > 0)
+		client->shard = &display->main_shard;
+	client->loop = client->shard ? client->shard->loop : display->loop;
+	client->idle_sweep = client->loop == display->loop ?
+		&display->idle_sweep : &client->shard->idle_sweep;
+	client->source = wl_event_loop_add_fd(client->loop, fd,
 					      WL_EVENT_READABLE,
 					      wl_client_connection_data, client);
 
@@ -368,9 +1310,15 @@ wl_client_create(struct wl_display *display, int fd)
 	}
 
 	wl_signal_init(&client->destroy_signal);
-	bind_display(client, display, 1, 1);
+	add_display_resource(client, 1);
 
+	/* Under the lock, so that no global added meanwhile is missed */
+	pthread_mutex_lock(&display->lock);
+	post_globals(client);
 	wl_list_insert(display->client_list.prev, &client->link);
+	pthread_mutex_unlock(&display->lock);
+
+	WL_PROBE(client_create, client, fd);
 
 	return client;
 }
@@ -404,6 +1352,12 @@ wl_client_add_resource(struct wl_client *client,
 
 	resource->client = client;
 	wl_signal_init(&resource->destroy_signal);
+
+	/* The object is in the map either way, to be destroyed with the
+	 * client after the error */
+	if (client_account(client, WL_CLIENT_ACCOUNT_OBJECTS,
+			   1, WL_RESOURCE_ACCOUNT_SIZE) < 0)
+		post_quota_error(client, WL_CLIENT_ACCOUNT_OBJECTS);
 }
 
 WL_EXPORT struct wl_resource *
@@ -438,6 +1392,8 @@ wl_resource_destroy(struct wl_resource *resource)
 
 	id = resource->object.id;
 	destroy_resource(resource, NULL);
+	wl_client_uncharge(client, WL_CLIENT_ACCOUNT_OBJECTS,
+			   1, WL_RESOURCE_ACCOUNT_SIZE);
 
 	if (id < WL_SERVER_ID_START) {
 		if (client->display_resource) {
@@ -468,17 +1424,49 @@ WL_EXPORT void
 wl_client_destroy(struct wl_client *client)
 {
 	uint32_t serial = 0;
-	
+
+	/* Finish once the worker hands the client back */
+	if (client->job && client->job->busy) {
+		client->job->destroy = 1;
+		return;
+	}
+
 	wl_log("disconnect from client %p\n", client);
+	WL_PROBE(client_destroy, client);
 
 	wl_signal_emit(&client->destroy_signal, client);
 
+	/* Other threads post to the display resource of every client
+	 * on the list under the lock, so take the client off it before
+	 * the resources go */
+	pthread_mutex_lock(&client->display->lock);
+	wl_list_remove(&client->link);
+	pthread_mutex_unlock(&client->display->lock);
+
 	wl_client_flush(client);
 	wl_map_for_each(&client->objects, destroy_resource, &serial);
 	wl_map_release(&client->objects);
 	wl_event_source_remove(client->source);
 	wl_connection_destroy(client->connection);
-	wl_list_remove(&client->link);
+
+	/* Drop events other threads queued for the client */
+	if (client->shard) {
+		struct wl_shard_message *message, *next;
+
+		pthread_mutex_lock(&client->shard->lock);
+		wl_list_for_each_safe(message, next,
+				      &client->shard->queue, link) {
+			if (message->client != client)
+				continue;
+			wl_list_remove(&message->link);
+			shard_message_destroy(message);
+		}
+		pthread_mutex_unlock(&client->shard->lock);
+	}
+
+	if (client->job)
+		pipeline_job_destroy(client->job);
+
 	free(client);
 }
 
@@ -662,6 +1650,7 @@ wl_keyboard_init(struct wl_keyboard *keyboard)
 	keyboard->default_grab.keyboard = keyboard;
 	keyboard->grab = &keyboard->default_grab;
 	wl_signal_init(&keyboard->focus_signal);
+	keyboard->keymap.fd = -1;
 }
 
 WL_EXPORT void
@@ -671,6 +1660,98 @@ wl_keyboard_release(struct wl_keyboard *keyboard)
 	if (keyboard->focus_resource)
 		wl_list_remove(&keyboard->focus_listener.link);
 	wl_array_release(&keyboard->keys);
+	if (keyboard->keymap.fd >= 0)
+		close(keyboard->keymap.fd);
+}
+
+static int
+create_keymap_fd(const void *data, uint32_t size)
+{
+	const char *p = data;
+	ssize_t len;
+	int fd;
+
+	fd = memfd_create("wayland-keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			goto err;
+		p += len;
+		size -= len;
+	}
+
+	/* Clients get dups of this one fd, so seal it against anybody
+	 * changing the keymap under the others */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		  F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+		goto err;
+
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+/** Set the keymap of a keyboard and send it to all its resources
+ *
+ * \param keyboard The keyboard
+ * \param format A wl_keyboard_keymap_format value
+ * \param data The keymap, as the clients will map it
+ * \param size The size of \a data in bytes
+ * \return 0 on success, -1 if the keymap couldn't be stored
+ *
+ * The keymap is written once into a sealed, read-only memfd owned by
+ * the keyboard.  Every wl_keyboard.keymap event, here and from
+ * wl_keyboard_send_current_keymap(), carries a dup of that fd, so all
+ * clients share the same pages instead of each getting a file of its
+ * own.  Setting a new keymap replaces the fd; clients keep whatever
+ * version they were sent last.
+ */
+WL_EXPORT int
+wl_keyboard_set_keymap(struct wl_keyboard *keyboard, uint32_t format,
+		       const void *data, uint32_t size)
+{
+	struct wl_resource *resource;
+	int fd;
+
+	fd = create_keymap_fd(data, size);
+	if (fd < 0)
+		return -1;
+
+	if (keyboard->keymap.fd >= 0)
+		close(keyboard->keymap.fd);
+	keyboard->keymap.fd = fd;
+	keyboard->keymap.format = format;
+	keyboard->keymap.size = size;
+
+	wl_list_for_each(resource, &keyboard->resource_list, link)
+		wl_keyboard_send_current_keymap(keyboard, resource);
+
+	return 0;
+}
+
+/** Send the current keymap of a keyboard to one resource
+ *
+ * \param keyboard The keyboard
+ * \param resource A wl_keyboard resource, typically just bound
+ *
+ * Does nothing if no keymap was set with wl_keyboard_set_keymap().
+ */
+WL_EXPORT void
+wl_keyboard_send_current_keymap(struct wl_keyboard *keyboard,
+				struct wl_resource *resource)
+{
+	if (keyboard->keymap.fd < 0)
+		return;
+
+	wl_keyboard_send_keymap(resource, keyboard->keymap.format,
+				keyboard->keymap.fd, keyboard->keymap.size);
 }
 
 WL_EXPORT void
@@ -910,17 +1991,24 @@ display_bind(struct wl_client *client,
 {
 	struct wl_global *global;
 	struct wl_display *display = resource->data;
+	wl_global_bind_func_t bind = NULL;
+	void *data = NULL;
 
+	pthread_mutex_lock(&display->lock);
 	wl_list_for_each(global, &display->global_list, link)
-		if (global->name == name)
+		if (global->name == name) {
+			bind = global->bind;
+			data = global->data;
 			break;
+		}
+	pthread_mutex_unlock(&display->lock);
 
-	if (&global->link == &display->global_list)
+	if (bind == NULL)
 		wl_resource_post_error(resource,
 				       WL_DISPLAY_ERROR_INVALID_OBJECT,
 				       "invalid global %d", name);
 	else
-		global->bind(client, global->data, version, id);
+		bind(client, data, version, id);
 }
 
 static void
@@ -950,18 +2038,21 @@ destroy_client_display_resource(struct wl_resource *resource)
 }
 
 static void
-bind_display(struct wl_client *client,
-	     void *data, uint32_t version, uint32_t id)
+add_display_resource(struct wl_client *client, uint32_t id)
 {
-	struct wl_display *display = data;
-	struct wl_global *global;
-
 	client->display_resource =
 		wl_client_add_object(client, &wl_display_interface,
-				     &display_interface, id, display);
+				     &display_interface, id, client->display);
 	client->display_resource->destroy = destroy_client_display_resource;
+}
 
-	wl_list_for_each(global, &display->global_list, link)
+/* Called with the display lock held */
+static void
+post_globals(struct wl_client *client)
+{
+	struct wl_global *global;
+
+	wl_list_for_each(global, &client->display->global_list, link)
 		wl_resource_post_event(client->display_resource,
 				       WL_DISPLAY_GLOBAL,
 				       global->name,
@@ -969,6 +2060,27 @@ bind_display(struct wl_client *client,
 				       global->interface->version);
 }
 
+static void
+bind_display(struct wl_client *client,
+	     void *data, uint32_t version, uint32_t id)
+{
+	struct wl_display *display = data;
+
+	add_display_resource(client, id);
+
+	pthread_mutex_lock(&display->lock);
+	post_globals(client);
+	pthread_mutex_unlock(&display->lock);
+}
+
+static pthread_once_t protocol_info_once = PTHREAD_ONCE_INIT;
+
+static void
+add_protocol_info(void)
+{
+	wl_message_info_add(&wayland_protocol_info);
+}
+
 WL_EXPORT struct wl_display *
 wl_display_create(void)
 {
@@ -979,6 +2091,8 @@ wl_display_create(void)
 	if (debug)
 		wl_debug = 1;
 
+	pthread_once(&protocol_info_once, add_protocol_info);
+
 	display = malloc(sizeof *display);
 	if (display == NULL)
 		return NULL;
@@ -989,15 +2103,38 @@ wl_display_create(void)
 		return NULL;
 	}
 
+	pthread_mutex_init(&display->lock, NULL);
 	wl_list_init(&display->global_list);
 	wl_list_init(&display->socket_list);
 	wl_list_init(&display->client_list);
 
+	memset(display->strings, 0, sizeof display->strings);
+
 	display->id = 1;
 	display->serial = 0;
+	display->shards = NULL;
+	display->shard_count = 0;
+	display->running_shards = 0;
+	display->next_shard = 0;
+	display->pipeline = NULL;
+
+	memset(display->soft_quota, 0, sizeof display->soft_quota);
+	memset(display->hard_quota, 0, sizeof display->hard_quota);
+	display->quota_handler = NULL;
+	display->quota_data = NULL;
+
+	if (idle_sweep_init(&display->idle_sweep, display,
+			    display->loop) < 0) {
+		pthread_mutex_destroy(&display->lock);
+		wl_event_loop_destroy(display->loop);
+		free(display);
+		return NULL;
+	}
 
 	if (!wl_display_add_global(display, &wl_display_interface, 
 				   display, bind_display)) {
+		wl_event_source_remove(display->idle_sweep.timer);
+		pthread_mutex_destroy(&display->lock);
 		wl_event_loop_destroy(display->loop);
 		free(display);
 		return NULL;
@@ -1011,6 +2148,8 @@ wl_display_destroy(struct wl_display *display)
 {
 	struct wl_socket *s, *next;
 	struct wl_global *global, *gnext;
+	struct wl_interned *interned;
+	int i;
 
 	wl_list_for_each_safe(s, next, &display->socket_list, link) {
 		wl_event_source_remove(s->source);
@@ -1020,11 +2159,35 @@ wl_display_destroy(struct wl_display *display)
 		close(s->fd_lock);
 		free(s);
 	}
+
+	if (display->pipeline)
+		pipeline_destroy(display->pipeline);
+
+	if (display->shard_count > 0) {
+		for (i = 0; i < display->shard_count; i++) {
+			shard_release(&display->shards[i]);
+			wl_event_loop_destroy(display->shards[i].loop);
+		}
+		free(display->shards);
+		shard_release(&display->main_shard);
+		if (current_shard == &display->main_shard)
+			current_shard = NULL;
+	}
+
+	wl_event_source_remove(display->idle_sweep.timer);
 	wl_event_loop_destroy(display->loop);
 
 	wl_list_for_each_safe(global, gnext, &display->global_list, link)
 		free(global);
 
+	for (i = 0; i < WL_INTERN_BUCKETS; i++)
+		while (display->strings[i]) {
+			interned = display->strings[i];
+			display->strings[i] = interned->next;
+			free(interned);
+		}
+
+	pthread_mutex_destroy(&display->lock);
 	free(display);
 }
 
@@ -1040,10 +2203,12 @@ wl_display_add_global(struct wl_display *display,
 	if (global == NULL)
 		return NULL;
 
-	global->name = display->id++;
 	global->interface = interface;
 	global->data = data;
 	global->bind = bind;
+
+	pthread_mutex_lock(&display->lock);
+	global->name = display->id++;
 	wl_list_insert(display->global_list.prev, &global->link);
 
 	wl_list_for_each(client, &display->client_list, link)
@@ -1052,6 +2217,7 @@ wl_display_add_global(struct wl_display *display,
 				       global->name,
 				       global->interface->name,
 				       global->interface->version);
+	pthread_mutex_unlock(&display->lock);
 
 	return global;
 }
@@ -1061,25 +2227,92 @@ wl_display_remove_global(struct wl_display *display, struct wl_global *global)
 {
 	struct wl_client *client;
 
+	pthread_mutex_lock(&display->lock);
 	wl_list_for_each(client, &display->client_list, link)
 		wl_resource_post_event(client->display_resource,
 				       WL_DISPLAY_GLOBAL_REMOVE, global->name);
 	wl_list_remove(&global->link);
+	pthread_mutex_unlock(&display->lock);
+
 	free(global);
 }
 
 WL_EXPORT uint32_t
 wl_display_get_serial(struct wl_display *display)
 {
-	return display->serial;
+	return __atomic_load_n(&display->serial, __ATOMIC_RELAXED);
 }
 
 WL_EXPORT uint32_t
 wl_display_next_serial(struct wl_display *display)
 {
-	display->serial++;
+	return __atomic_add_fetch(&display->serial, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t
+intern_hash(const char *string)
+{
+	uint32_t hash = 5381;
+
+	while (*string)
+		hash = hash * 33 + (unsigned char) *string++;
+
+	return hash;
+}
+
+/* Returns the display's copy of string, creating it if needed, or
+ * NULL if out of memory.  Each call takes a reference that
+ * wl_display_release_string() drops. */
+const char *
+wl_display_intern_string(struct wl_display *display, const char *string)
+{
+	struct wl_interned *interned, **bucket;
+	uint32_t hash = intern_hash(string);
+	size_t len;
+
+	pthread_mutex_lock(&display->lock);
+	bucket = &display->strings[hash % WL_INTERN_BUCKETS];
+	for (interned = *bucket; interned; interned = interned->next)
+		if (interned->hash == hash &&
+		    strcmp(interned->string, string) == 0)
+			break;
+
+	if (interned == NULL) {
+		len = strlen(string) + 1;
+		interned = malloc(sizeof *interned + len);
+		if (interned == NULL) {
+			pthread_mutex_unlock(&display->lock);
+			return NULL;
+		}
+		interned->hash = hash;
+		interned->refcount = 0;
+		memcpy(interned->string, string, len);
+		interned->next = *bucket;
+		*bucket = interned;
+	}
+
+	interned->refcount++;
+	pthread_mutex_unlock(&display->lock);
+
+	return interned->string;
+}
+
+void
+wl_display_release_string(struct wl_display *display, const char *string)
+{
+	struct wl_interned *interned, **p;
+
+	interned = container_of(string, struct wl_interned, string[0]);
 
-	return display->serial;
+	pthread_mutex_lock(&display->lock);
+	if (--interned->refcount == 0) {
+		p = &display->strings[interned->hash % WL_INTERN_BUCKETS];
+		while (*p != interned)
+			p = &(*p)->next;
+		*p = interned->next;
+		free(interned);
+	}
+	pthread_mutex_unlock(&display->lock);
 }
 
 WL_EXPORT struct wl_event_loop *
@@ -1088,25 +2321,221 @@ wl_display_get_event_loop(struct wl_display *display)
 	return display->loop;
 }
 
+/** Spread clients over several threads
+ *
+ * \param display The display
+ * \param count Number of client threads
+ * \return 0 on success, -1 on failure
+ *
+ * Once wl_display_run() starts, clients connecting to the display's
+ * sockets are handed out in turn to count threads, each with its own
+ * event loop.  Everything about a client happens on its thread:
+ * connection I/O, request dispatch, and so the implementations of
+ * its resources and the bind functions of the globals it binds.
+ * wl_client_get_event_loop() gives the loop for a client.
+ *
+ * The display's own loop keeps running the listening sockets and
+ * whatever else the compositor added to it.  This function must be
+ * called from the thread that will call wl_display_run(), before
+ * it does.
+ *
+ * Events can be posted to any client from any thread.  An event posted
+ * from a thread other than the client's goes through a queue to that
+ * thread, in order with other such events.  That covers globals coming
+ * and going and seat focus changes driven from the main loop.  The
+ * global and client lists and serials are safe to use from all
+ * threads.  Resources must only be created and destroyed on the
+ * client's thread.  Any state the compositor shares between clients,
+ * including the resource lists of seats and devices, needs its own
+ * locking.
+ */
+WL_EXPORT int
+wl_display_set_shards(struct wl_display *display, int count)
+{
+	struct wl_event_loop *loop;
+	int i;
+
+	if (display->shard_count > 0 || count <= 0)
+		return -1;
+
+	display->shards = calloc(count, sizeof *display->shards);
+	if (display->shards == NULL)
+		return -1;
+
+	if (shard_init(&display->main_shard, display, display->loop) < 0) {
+		free(display->shards);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		loop = wl_event_loop_create();
+		if (loop == NULL)
+			break;
+		if (shard_init(&display->shards[i], display, loop) < 0) {
+			wl_event_loop_destroy(loop);
+			break;
+		}
+	}
+
+	if (i < count) {
+		while (i--) {
+			shard_release(&display->shards[i]);
+			wl_event_loop_destroy(display->shards[i].loop);
+		}
+		shard_release(&display->main_shard);
+		free(display->shards);
+		display->shards = NULL;
+		return -1;
+	}
+
+	display->shard_count = count;
+	current_shard = &display->main_shard;
+
+	return 0;
+}
+
+/** Decode client requests on worker threads
+ *
+ * \param display The display object
+ * \param count Number of worker threads
+ * \return 0 on success, -1 on failure
+ *
+ * When a client on the display's loop sends a large burst of requests,
+ * the burst is handed to one of count threads that checks it against
+ * the wire format and decodes it.  The decoded requests come back to
+ * the display's loop, which resolves their object arguments and
+ * dispatches them in the order they were sent, so request handlers
+ * still only ever run on that loop.  Small reads are dispatched inline
+ * as before.
+ *
+ * A worker only decodes requests to objects whose interface is known
+ * from requests it has seen, and stops at the first one it can't.  The
+ * rest of the burst is dispatched inline once the client is handed
+ * back.  Until then no more is read from the client, and
+ * wl_client_destroy() on it is deferred.
+ *
+ * This must be called from the thread running the display's loop and
+ * can only be called once.
+ */
+WL_EXPORT int
+wl_display_set_demarshal_threads(struct wl_display *display, int count)
+{
+	struct wl_pipeline *pipeline;
+	sigset_t all, saved;
+	int i;
+
+	if (display->pipeline || count <= 0)
+		return -1;
+
+	pipeline = calloc(1, sizeof *pipeline);
+	if (pipeline == NULL)
+		return -1;
+
+	pipeline->threads = calloc(count, sizeof *pipeline->threads);
+	if (pipeline->threads == NULL)
+		goto err_free;
+
+	pipeline->display = display;
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+	wl_list_init(&pipeline->jobs);
+	wl_list_init(&pipeline->done);
+
+	pipeline->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pipeline->done_fd < 0)
+		goto err_lock;
+
+	pipeline->done_source =
+		wl_event_loop_add_fd(display->loop, pipeline->done_fd,
+				     WL_EVENT_READABLE, pipeline_done,
+				     pipeline);
+	if (pipeline->done_source == NULL)
+		goto err_fd;
+
+	display->pipeline = pipeline;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &saved);
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&pipeline->threads[i], NULL,
+				   pipeline_run, pipeline))
+			break;
+		pipeline->thread_count++;
+	}
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (pipeline->thread_count == 0) {
+		display->pipeline = NULL;
+		pipeline_destroy(pipeline);
+		return -1;
+	}
+
+	return 0;
+
+err_fd:
+	close(pipeline->done_fd);
+err_lock:
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->lock);
+	free(pipeline->threads);
+err_free:
+	free(pipeline);
+	return -1;
+}
+
 WL_EXPORT void
 wl_display_terminate(struct wl_display *display)
 {
-	display->run = 0;
+	uint64_t one = 1;
+	int i;
+
+	__atomic_store_n(&display->run, 0, __ATOMIC_RELEASE);
+
+	for (i = 0; i < display->shard_count; i++)
+		if (write(display->shards[i].wake_fd, &one, sizeof one) < 0)
+			wl_log("failed to wake shard: %m\n");
+	if (display->shard_count > 0 &&
+	    write(display->main_shard.wake_fd, &one, sizeof one) < 0)
+		wl_log("failed to wake shard: %m\n");
 }
 
 WL_EXPORT void
 wl_display_run(struct wl_display *display)
 {
+	sigset_t all, saved;
+	int i, started;
+
 	display->run = 1;
 
-	while (display->run)
+	/* Signals are for the main loop to handle */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &saved);
+	for (started = 0; started < display->shard_count; started++)
+		if (pthread_create(&display->shards[started].thread, NULL,
+				   shard_run, &display->shards[started])) {
+			wl_log("failed to start shard thread: %m\n");
+			break;
+		}
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	/* Clients only go to the shards that are running, or stay on
+	 * the display's loop if none is */
+	display->running_shards = started;
+
+	while (__atomic_load_n(&display->run, __ATOMIC_ACQUIRE))
 		wl_event_loop_dispatch(display->loop, -1);
+
+	display->running_shards = 0;
+	for (i = 0; i < started; i++)
+		pthread_join(display->shards[i].thread, NULL);
 }
 
 static int
 socket_data(int fd, uint32_t mask, void *data)
 {
 	struct wl_display *display = data;
+	struct wl_shard_message *message;
+	struct wl_shard *shard;
 	struct sockaddr_un name;
 	socklen_t length;
 	int client_fd;
@@ -1114,10 +2543,23 @@ socket_data(int fd, uint32_t mask, void *data)
 	length = sizeof name;
 	client_fd = wl_os_accept_cloexec(fd, (struct sockaddr *) &name,
 					 &length);
-	if (client_fd < 0)
+	if (client_fd < 0) {
 		wl_log("failed to accept: %m\n");
-	else
+	} else if (display->running_shards > 0) {
+		message = malloc(sizeof *message);
+		if (message == NULL) {
+			close(client_fd);
+			return 1;
+		}
+		message->client = NULL;
+		message->closure = NULL;
+		message->fd = client_fd;
+		shard = &display->shards[display->next_shard++ %
+					 display->running_shards];
+		shard_queue(shard, message);
+	} else {
 		wl_client_create(display, client_fd);
+	}
 
 	return 1;
 }
@@ -1288,6 +2730,10 @@ wl_client_add_object(struct wl_client *client,
 		return NULL;
 	}
 
+	if (client_account(client, WL_CLIENT_ACCOUNT_OBJECTS,
+			   1, WL_RESOURCE_ACCOUNT_SIZE) < 0)
+		post_quota_error(client, WL_CLIENT_ACCOUNT_OBJECTS);
+
 	return resource;
 }
 
@@ -43,6 +43,8 @@ typedef int (*wl_event_loop_fd_func_t)(int fd, uint32_t mask, void *data);
 typedef int (*wl_event_loop_timer_func_t)(void *data);
 typedef int (*wl_event_loop_signal_func_t)(int signal_number, void *data);
 typedef void (*wl_event_loop_idle_func_t)(void *data);
+typedef void (*wl_event_loop_work_func_t)(void *data);
+typedef void (*wl_event_loop_work_done_func_t)(void *data, int cancelled);
 
 struct wl_event_loop *wl_event_loop_create(void);
 void wl_event_loop_destroy(struct wl_event_loop *loop);
@@ -72,6 +74,47 @@ struct wl_event_source *wl_event_loop_add_idle(struct wl_event_loop *loop,
 					       void *data);
 int wl_event_loop_get_fd(struct wl_event_loop *loop);
 
+struct wl_event_work;
+struct wl_event_work *wl_event_loop_add_work(struct wl_event_loop *loop,
+					     wl_event_loop_work_func_t work,
+					     wl_event_loop_work_done_func_t done,
+					     void *data);
+int wl_event_work_cancel(struct wl_event_work *work);
+
+void *wl_event_source_get_data(struct wl_event_source *source);
+
+#define WL_EVENT_SOURCE_HISTOGRAM_SIZE 32
+
+struct wl_event_source_stats {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	/* Entry i counts dispatches that took 2^i to 2^(i+1) µs,
+	 * the first one also those under 1 µs and the last one
+	 * everything longer. */
+	uint32_t histogram[WL_EVENT_SOURCE_HISTOGRAM_SIZE];
+};
+
+typedef void (*wl_event_loop_stats_func_t)(struct wl_event_source *source,
+					   const struct wl_event_source_stats *stats,
+					   void *data);
+typedef void (*wl_event_loop_watchdog_func_t)(struct wl_event_loop *loop,
+					      uint64_t duration_ns,
+					      struct wl_event_source *source,
+					      uint64_t source_ns,
+					      void *data);
+
+void wl_event_loop_set_stats(struct wl_event_loop *loop, int enable);
+int wl_event_source_get_stats(struct wl_event_source *source,
+			      struct wl_event_source_stats *stats);
+void wl_event_loop_for_each_source(struct wl_event_loop *loop,
+				   wl_event_loop_stats_func_t func,
+				   void *data);
+void wl_event_loop_set_watchdog(struct wl_event_loop *loop,
+				uint32_t threshold_us,
+				wl_event_loop_watchdog_func_t func,
+				void *data);
+
 struct wl_client;
 struct wl_display;
 struct wl_seat;
@@ -87,6 +130,8 @@ struct wl_event_loop *wl_display_get_event_loop(struct wl_display *display);
 int wl_display_add_socket(struct wl_display *display, const char *name);
 void wl_display_terminate(struct wl_display *display);
 void wl_display_run(struct wl_display *display);
+int wl_display_set_shards(struct wl_display *display, int count);
+int wl_display_set_demarshal_threads(struct wl_display *display, int count);
 
 typedef void (*wl_global_bind_func_t)(struct wl_client *client, void *data,
 				      uint32_t version, uint32_t id);
@@ -224,8 +269,10 @@ struct wl_keyboard_grab {
 
 struct wl_data_offer {
 	struct wl_resource resource;
+	struct wl_seat *seat;
 	struct wl_data_source *source;
 	struct wl_listener source_destroy_listener;
+	struct wl_listener seat_destroy_listener;
 };
 
 struct wl_data_source {
@@ -287,6 +334,12 @@ struct wl_keyboard {
 		uint32_t mods_locked;
 		uint32_t group;
 	} modifiers;
+
+	struct {
+		int fd;
+		uint32_t format;
+		uint32_t size;
+	} keymap;
 };
 
 struct wl_touch {
@@ -299,6 +352,9 @@ struct wl_touch {
 	uint32_t focus_serial;
 };
 
+struct wl_selection_cache;
+struct wl_drag_throttle;
+
 struct wl_seat {
 	struct wl_list base_resource_list;
 	struct wl_signal destroy_signal;
@@ -311,6 +367,7 @@ struct wl_seat {
 	struct wl_data_source *selection_data_source;
 	struct wl_listener selection_data_source_listener;
 	struct wl_signal selection_signal;
+	struct wl_selection_cache *selection_cache;
 
 	struct wl_list drag_resource_list;
 	struct wl_client *drag_client;
@@ -323,6 +380,7 @@ struct wl_seat {
 	struct wl_surface *drag_surface;
 	struct wl_listener drag_icon_listener;
 	struct wl_signal drag_icon_signal;
+	struct wl_drag_throttle *drag_throttle;
 };
 
 /*
@@ -345,6 +403,10 @@ void wl_resource_post_event(struct wl_resource *resource,
 			    uint32_t opcode, ...);
 void wl_resource_queue_event(struct wl_resource *resource,
 			     uint32_t opcode, ...);
+uint32_t *wl_resource_marshal_reserve(struct wl_resource *resource,
+				      uint32_t opcode, size_t size);
+void wl_resource_marshal_commit(struct wl_resource *resource,
+				uint32_t *data);
 
 /* msg is a printf format string, variable args are its args. */
 void wl_resource_post_error(struct wl_resource *resource,
@@ -361,6 +423,44 @@ wl_client_add_resource(struct wl_client *client,
 struct wl_display *
 wl_client_get_display(struct wl_client *client);
 
+struct wl_event_loop *
+wl_client_get_event_loop(struct wl_client *client);
+
+enum wl_client_account {
+	WL_CLIENT_ACCOUNT_OBJECTS,	/* protocol objects */
+	WL_CLIENT_ACCOUNT_SHM,		/* wl_shm pools and their mappings */
+	WL_CLIENT_ACCOUNT_DATA,		/* MIME types offered by data sources */
+	WL_CLIENT_ACCOUNT_COUNT
+};
+
+struct wl_client_usage {
+	size_t count;
+	size_t bytes;
+};
+
+typedef void (*wl_client_quota_func_t)(struct wl_client *client,
+				       enum wl_client_account account,
+				       const struct wl_client_usage *usage,
+				       void *data);
+
+void
+wl_client_get_usage(struct wl_client *client, enum wl_client_account account,
+		    struct wl_client_usage *usage);
+int
+wl_client_charge(struct wl_client *client, enum wl_client_account account,
+		 size_t count, size_t bytes);
+void
+wl_client_uncharge(struct wl_client *client, enum wl_client_account account,
+		   size_t count, size_t bytes);
+void
+wl_display_set_client_quota(struct wl_display *display,
+			    enum wl_client_account account,
+			    const struct wl_client_usage *soft,
+			    const struct wl_client_usage *hard);
+void
+wl_display_set_quota_handler(struct wl_display *display,
+			     wl_client_quota_func_t handler, void *data);
+
 void
 wl_resource_destroy(struct wl_resource *resource);
 
@@ -401,6 +501,12 @@ wl_keyboard_start_grab(struct wl_keyboard *device,
 		       struct wl_keyboard_grab *grab);
 void
 wl_keyboard_end_grab(struct wl_keyboard *keyboard);
+int
+wl_keyboard_set_keymap(struct wl_keyboard *keyboard, uint32_t format,
+		       const void *data, uint32_t size);
+void
+wl_keyboard_send_current_keymap(struct wl_keyboard *keyboard,
+				struct wl_resource *resource);
 
 void
 wl_touch_init(struct wl_touch *touch);
@@ -418,6 +524,15 @@ void
 wl_seat_set_selection(struct wl_seat *seat,
 		      struct wl_data_source *source, uint32_t serial);
 
+int
+wl_seat_set_selection_cache(struct wl_seat *seat, struct wl_event_loop *loop,
+			    const char * const *mime_types, size_t max_size);
+
+int
+wl_seat_set_drag_motion_throttle(struct wl_seat *seat,
+				 struct wl_event_loop *loop,
+				 uint32_t interval_ms);
+
 
 void *
 wl_shm_buffer_get_data(struct wl_buffer *buffer);
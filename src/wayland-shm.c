@@ -57,6 +57,10 @@ shm_pool_unref(struct wl_shm_pool *pool)
 	if (pool->refcount)
 		return;
 
+	/* Buffers are the client's resources too, so the client is still
+	 * around when the last one goes */
+	wl_client_uncharge(pool->resource.client, WL_CLIENT_ACCOUNT_SHM,
+			   1, pool->size);
 	munmap(pool->data, pool->size);
 	free(pool);
 }
@@ -160,15 +164,27 @@ shm_pool_resize(struct wl_client *client, struct wl_resource *resource,
 	struct wl_shm_pool *pool = resource->data;
 	void *data;
 
+	if (size > pool->size &&
+	    wl_client_charge(client, WL_CLIENT_ACCOUNT_SHM,
+			     0, size - pool->size) < 0)
+		return;
+
 	data = mremap(pool->data, pool->size, size, MREMAP_MAYMOVE);
 
 	if (data == MAP_FAILED) {
+		if (size > pool->size)
+			wl_client_uncharge(client, WL_CLIENT_ACCOUNT_SHM,
+					   0, size - pool->size);
 		wl_resource_post_error(resource,
 				       WL_SHM_ERROR_INVALID_FD,
 				       "failed mremap");
 		return;
 	}
 
+	if (size < pool->size)
+		wl_client_uncharge(client, WL_CLIENT_ACCOUNT_SHM,
+				   0, pool->size - size);
+
 	pool->data = data;
 	pool->size = size;
 }
@@ -198,6 +214,9 @@ shm_create_pool(struct wl_client *client, struct wl_resource *resource,
 		goto err_free;
 	}
 
+	if (wl_client_charge(client, WL_CLIENT_ACCOUNT_SHM, 1, size) < 0)
+		goto err_free;
+
 	pool->refcount = 1;
 	pool->size = size;
 	pool->data = mmap(NULL, size,
@@ -206,7 +225,7 @@ shm_create_pool(struct wl_client *client, struct wl_resource *resource,
 		wl_resource_post_error(resource,
 				       WL_SHM_ERROR_INVALID_FD,
 				       "failed mmap fd %d", fd);
-		goto err_free;
+		goto err_uncharge;
 	}
 	close(fd);
 
@@ -223,10 +242,12 @@ shm_create_pool(struct wl_client *client, struct wl_resource *resource,
 
 	return;
 
-err_close:
-	close(fd);
+err_uncharge:
+	wl_client_uncharge(client, WL_CLIENT_ACCOUNT_SHM, 1, size);
 err_free:
 	free(pool);
+err_close:
+	close(fd);
 }
 
 static const struct wl_shm_interface shm_interface = {
@@ -60,6 +60,44 @@ struct wl_interface {
 	const struct wl_message *events;
 };
 
+/*
+ * Precomputed description of each message, emitted by wayland-scanner
+ * next to the wl_message tables, so the marshalling code doesn't have
+ * to parse the signature every time.  struct wl_message and struct
+ * wl_interface are left as they are; the descriptions live in a side
+ * table per protocol, which the library ignores if its version isn't
+ * one it knows.
+ */
+#define WL_MESSAGE_HAS_FD	0x01
+#define WL_MESSAGE_HAS_NEW_ID	0x02
+#define WL_MESSAGE_HAS_OBJECT	0x04
+#define WL_MESSAGE_HAS_VARIABLE	0x08	/* strings or arrays */
+
+struct wl_message_info {
+	const char *types;	/* one type code per argument, no '?' */
+	uint32_t nullable;	/* bit n set if argument n may be null */
+	uint16_t arg_count;
+	uint16_t flags;
+	uint16_t fixed_size;	/* wire size with empty strings and arrays */
+	uint8_t fd_count;
+	uint8_t pointer_count;	/* string, object, new_id and array args */
+	uint8_t array_count;
+};
+
+struct wl_interface_info {
+	const struct wl_interface *interface;
+	const struct wl_message_info *requests;
+	const struct wl_message_info *events;
+};
+
+#define WL_PROTOCOL_INFO_VERSION 1
+
+struct wl_protocol_info {
+	uint32_t version;
+	uint32_t interface_count;
+	const struct wl_interface_info *interfaces;
+};
+
 struct wl_object {
 	const struct wl_interface *interface;
 	void (* const * implementation)(void);
@@ -204,6 +242,15 @@ static inline wl_fixed_t wl_fixed_from_int(int i)
 	return i * 256;
 }
 
+/* Convert count values at a time, giving the same results as the
+ * functions above.  Source and destination must not overlap. */
+void wl_fixed_to_double_array(double *d, const wl_fixed_t *f, size_t count);
+void wl_fixed_from_double_array(wl_fixed_t *f, const double *d, size_t count);
+void wl_fixed_to_float_array(float *d, const wl_fixed_t *f, size_t count);
+void wl_fixed_from_float_array(wl_fixed_t *f, const float *d, size_t count);
+void wl_fixed_to_int_array(int *i, const wl_fixed_t *f, size_t count);
+void wl_fixed_from_int_array(wl_fixed_t *f, const int *i, size_t count);
+
 typedef void (*wl_log_func_t)(const char *, va_list);
 
 #ifdef  __cplusplus
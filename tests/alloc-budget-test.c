@@ -0,0 +1,332 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "wayland-private.h"
+#include "wayland-server.h"
+#include "wayland-client.h"
+#include "test-runner.h"
+
+/* Steady state allocation budgets for the hot paths.  Every test
+ * warms up first, so that buffers allocated once per connection or
+ * loop don't count. */
+
+#define ITERATIONS 10000
+
+static void
+drain(int fd)
+{
+	char buffer[4096];
+	int len;
+
+	do
+		len = recv(fd, buffer, sizeof buffer, MSG_DONTWAIT);
+	while (len > 0);
+
+	assert(len == -1 && errno == EAGAIN);
+}
+
+static void
+post_events(int inline_marshal, struct alloc_phase *phase)
+{
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_resource *resource;
+	int s[2], i;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+	resource = wl_client_new_object(client, &wl_callback_interface,
+					NULL, NULL);
+	assert(resource);
+
+	for (i = -1000; i < ITERATIONS; i++) {
+		if (i >= 0)
+			alloc_phase_begin(phase);
+		if (inline_marshal)
+			wl_callback_send_done(resource, i);
+		else
+			wl_resource_post_event(resource,
+					       WL_CALLBACK_DONE, i);
+		if (i >= 0)
+			alloc_phase_end(phase);
+
+		if (i % 256 == 0) {
+			wl_client_flush(client);
+			drain(s[1]);
+		}
+	}
+
+	wl_client_destroy(client);
+	close(s[1]);
+	wl_display_destroy(display);
+}
+
+TEST(post_event_alloc_budget)
+{
+	struct alloc_phase phase = ALLOC_PHASE("wl_resource_post_event");
+
+	/* One closure per event */
+	post_events(0, &phase);
+	alloc_phase_check(&phase, ITERATIONS, ITERATIONS * 1536);
+}
+
+TEST(inline_marshal_alloc_budget)
+{
+	struct alloc_phase phase = ALLOC_PHASE("wl_callback_send_done");
+
+	/* Written straight into the connection buffer */
+	post_events(1, &phase);
+	alloc_phase_check(&phase, 0, 0);
+}
+
+static int
+update_func(struct wl_connection *connection, uint32_t mask, void *data)
+{
+	return 0;
+}
+
+static struct wl_closure *
+marshal(struct wl_object *sender, uint32_t opcode,
+	const struct wl_message *message, ...)
+{
+	struct wl_closure *closure;
+	va_list ap;
+
+	va_start(ap, message);
+	closure = wl_closure_vmarshal(sender, opcode, ap, message);
+	va_end(ap);
+
+	return closure;
+}
+
+TEST(demarshal_alloc_budget)
+{
+	struct alloc_phase phase = ALLOC_PHASE("wl_connection_demarshal");
+	struct wl_connection *in, *out;
+	struct wl_closure *closure;
+	struct wl_object object;
+	struct wl_map objects;
+	const struct wl_message *message;
+	int s[2], i, j, size;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	out = wl_connection_create(s[0], update_func, NULL);
+	in = wl_connection_create(s[1], update_func, NULL);
+	wl_map_init(&objects);
+
+	object.interface = &wl_surface_interface;
+	object.implementation = NULL;
+	object.id = 1234;
+	message = &wl_surface_interface.methods[WL_SURFACE_DAMAGE];
+	closure = marshal(&object, WL_SURFACE_DAMAGE, message, 1, 2, 3, 4);
+	assert(closure);
+	size = closure->start[1] >> 16;
+
+	for (i = -1000; i < ITERATIONS; i += 100) {
+		for (j = 0; j < 100; j++)
+			assert(wl_closure_send(closure, out) == 0);
+		assert(wl_connection_data(out, WL_CONNECTION_WRITABLE) == 0);
+		assert(wl_connection_data(in, WL_CONNECTION_READABLE) ==
+		       100 * size);
+
+		for (j = 0; j < 100; j++) {
+			struct wl_closure *c;
+
+			if (i >= 0)
+				alloc_phase_begin(&phase);
+			c = wl_connection_demarshal(in, size,
+						    &objects, message);
+			if (i >= 0)
+				alloc_phase_end(&phase);
+			assert(c);
+			wl_closure_destroy(c);
+		}
+	}
+
+	/* One closure per message */
+	alloc_phase_check(&phase, ITERATIONS, ITERATIONS * 512);
+
+	wl_closure_destroy(closure);
+	wl_map_release(&objects);
+	wl_connection_destroy(in);
+	wl_connection_destroy(out);
+}
+
+static int
+fd_dispatch(int fd, uint32_t mask, void *data)
+{
+	int *count = data;
+	char c;
+
+	assert(read(fd, &c, 1) == 1);
+	++*count;
+
+	return 1;
+}
+
+TEST(event_loop_dispatch_alloc_budget)
+{
+	struct alloc_phase phase = ALLOC_PHASE("wl_event_loop_dispatch");
+	struct wl_event_loop *loop;
+	struct wl_event_source *source;
+	int p[2], i, count = 0;
+
+	loop = wl_event_loop_create();
+	assert(loop);
+	assert(pipe(p) == 0);
+	source = wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+				      fd_dispatch, &count);
+	assert(source);
+
+	for (i = -1000; i < ITERATIONS; i++) {
+		assert(write(p[1], "x", 1) == 1);
+		if (i >= 0)
+			alloc_phase_begin(&phase);
+		assert(wl_event_loop_dispatch(loop, 0) == 0);
+		if (i >= 0)
+			alloc_phase_end(&phase);
+	}
+	assert(count == ITERATIONS + 1000);
+
+	alloc_phase_check(&phase, 0, 0);
+
+	wl_event_source_remove(source);
+	wl_event_loop_destroy(loop);
+	close(p[0]);
+	close(p[1]);
+}
+
+static void
+callback_done(void *data, struct wl_callback *callback, uint32_t serial)
+{
+	int *count = data;
+
+	++*count;
+}
+
+static const struct wl_callback_listener callback_listener = {
+	callback_done
+};
+
+#define BATCH 100
+
+static void
+run_iterate_client(int fd, int ack)
+{
+	struct alloc_phase phase = ALLOC_PHASE("wl_display_iterate");
+	struct wl_display *display;
+	struct wl_callback *callback;
+	char s[16];
+	int i, count = 0;
+
+	/* setenv() allocates, so this runs in a child process that
+	 * isn't checked for leaks */
+	snprintf(s, sizeof s, "%d", fd);
+	setenv("WAYLAND_SOCKET", s, 1);
+	display = wl_display_connect(NULL);
+	assert(display);
+
+	/* Never sent, just an object for the server to send events to,
+	 * as wl_callback@2 */
+	callback = wl_display_sync(display);
+	assert(wl_proxy_get_id((struct wl_proxy *) callback) == 2);
+	wl_callback_add_listener(callback, &callback_listener, &count);
+
+	for (i = -1000; i < ITERATIONS; i += BATCH) {
+		if (i >= 0)
+			alloc_phase_begin(&phase);
+		/* The first time around this also reads the globals */
+		while (count < i + 1000 + BATCH)
+			wl_display_iterate(display, WL_DISPLAY_READABLE);
+		if (i >= 0)
+			alloc_phase_end(&phase);
+
+		assert(write(ack, "x", 1) == 1);
+	}
+
+	/* One closure per event */
+	alloc_phase_check(&phase, ITERATIONS, ITERATIONS * 512);
+
+	wl_callback_destroy(callback);
+	wl_display_disconnect(display);
+}
+
+TEST(client_iterate_alloc_budget)
+{
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_resource *resource;
+	int s[2], p[2], i, j, status;
+	pid_t pid;
+	char c;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	assert(pipe(p) == 0);
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		close(s[0]);
+		close(p[0]);
+		run_iterate_client(s[1], p[1]);
+		exit(EXIT_SUCCESS);
+	}
+	close(s[1]);
+	close(p[1]);
+
+	display = wl_display_create();
+	assert(display);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+	resource = wl_client_add_object(client, &wl_callback_interface,
+					NULL, 2, NULL);
+	assert(resource);
+
+	for (i = -1000; i < ITERATIONS; i += BATCH) {
+		for (j = 0; j < BATCH; j++)
+			wl_callback_send_done(resource, j);
+		wl_client_flush(client);
+		assert(read(p[0], &c, 1) == 1);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	close(p[0]);
+	wl_client_destroy(client);
+	wl_display_destroy(display);
+}
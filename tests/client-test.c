@@ -20,6 +20,8 @@
  * OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -30,6 +32,8 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include "wayland-server.h"
 #include "test-runner.h"
@@ -85,3 +89,344 @@ TEST(client_destroy_listener)
 	wl_display_destroy(display);
 }
 
+
+static void
+unbind_keyboard(struct wl_resource *resource)
+{
+	wl_list_remove(&resource->link);
+	free(resource);
+}
+
+/* Read everything the server sent and pick out the keymap events; the
+ * wl_display.global events before them carry no fds */
+static int
+receive_keymaps(int sock, int *fds, uint32_t *sizes)
+{
+	char buf[4096], control[CMSG_SPACE(2 * sizeof(int))];
+	struct iovec iov = { buf, sizeof buf };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	uint32_t *p;
+	ssize_t len;
+	int i, count = 0;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+	len = recvmsg(sock, &msg, 0);
+	assert(len > 0);
+
+	for (i = 0; i < len; i += p[1] >> 16) {
+		p = (uint32_t *) (buf + i);
+		if (p[0] == 1)
+			continue;
+		assert((p[1] & 0xffff) == WL_KEYBOARD_KEYMAP);
+		assert(p[2] == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1);
+		sizes[count++] = p[3];
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	assert(cmsg && cmsg->cmsg_type == SCM_RIGHTS);
+	assert(cmsg->cmsg_len == CMSG_LEN(count * sizeof(int)));
+	memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+
+	return count;
+}
+
+TEST(keyboard_shared_keymap)
+{
+	static const char keymap[] = "xkb_keymap { };";
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_keyboard keyboard;
+	struct wl_resource *resource;
+	struct stat st[2];
+	uint32_t size[2];
+	char *map;
+	int s[2], fd[2], i;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+
+	wl_keyboard_init(&keyboard);
+	for (i = 0; i < 2; i++) {
+		resource = wl_client_add_object(client, &wl_keyboard_interface,
+						NULL, 2 + i, &keyboard);
+		assert(resource);
+		resource->destroy = unbind_keyboard;
+		wl_list_insert(&keyboard.resource_list, &resource->link);
+	}
+
+	assert(wl_keyboard_set_keymap(&keyboard,
+				      WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+				      keymap, sizeof keymap) == 0);
+	wl_client_flush(client);
+
+	/* Both resources get the same sealed file */
+	assert(receive_keymaps(s[1], fd, size) == 2);
+	for (i = 0; i < 2; i++) {
+		assert(size[i] == sizeof keymap);
+		assert(fstat(fd[i], &st[i]) == 0);
+	}
+	assert(st[0].st_ino == st[1].st_ino && st[0].st_dev == st[1].st_dev);
+	assert(fcntl(fd[0], F_GET_SEALS) & F_SEAL_WRITE);
+	assert(write(fd[0], "x", 1) < 0);
+
+	map = mmap(NULL, size[0], PROT_READ, MAP_SHARED, fd[0], 0);
+	assert(map != MAP_FAILED);
+	assert(memcmp(map, keymap, size[0]) == 0);
+	munmap(map, size[0]);
+
+	close(fd[0]);
+	close(fd[1]);
+
+	wl_client_destroy(client);
+	assert(wl_list_empty(&keyboard.resource_list));
+	wl_keyboard_release(&keyboard);
+
+	close(s[0]);
+	close(s[1]);
+
+	wl_display_destroy(display);
+}
+
+static void
+send_request(int sock, const uint32_t *request, int fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { (void *) request, request[1] >> 16 };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fd >= 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof fd);
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+	}
+
+	assert(sendmsg(sock, &msg, 0) == (ssize_t) iov.iov_len);
+}
+
+/* Return the code of the wl_display.error event among the events the
+ * server sent, or -1 */
+static int
+receive_error(int sock)
+{
+	char buf[4096];
+	uint32_t *p;
+	ssize_t len;
+	int i;
+
+	len = recv(sock, buf, sizeof buf, MSG_DONTWAIT);
+	for (i = 0; i < len; i += p[1] >> 16) {
+		p = (uint32_t *) (buf + i);
+		if (p[0] == 1 && (p[1] & 0xffff) == WL_DISPLAY_ERROR)
+			return p[3];
+	}
+
+	return -1;
+}
+
+static void
+dispatch(struct wl_display *display)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+
+	while (wl_event_loop_dispatch(loop, 0) > 0)
+		;
+}
+
+/* The wl_shm global is the first after wl_display's own */
+static void
+bind_shm(int sock, uint32_t id)
+{
+	uint32_t bind[] = { 1, 32 << 16 | 0, /* wl_display.bind */
+			    2, 7, 0, 0, 1, id };
+
+	memcpy(&bind[4], "wl_shm", 7);
+	send_request(sock, bind, -1);
+}
+
+static void
+create_pool(int sock, uint32_t shm, uint32_t id, int32_t size)
+{
+	uint32_t request[] = { shm, 16 << 16 | 0, /* wl_shm.create_pool */
+			       id, size };
+	int fd;
+
+	fd = memfd_create("client-test", MFD_CLOEXEC);
+	assert(fd >= 0);
+	assert(ftruncate(fd, size) == 0);
+	send_request(sock, request, fd);
+	close(fd);
+}
+
+static void
+check_usage(struct wl_client *client, enum wl_client_account account,
+	    size_t count, size_t bytes)
+{
+	struct wl_client_usage usage;
+
+	wl_client_get_usage(client, account, &usage);
+	assert(usage.count == count);
+	assert(bytes == (size_t) -1 || usage.bytes == bytes);
+}
+
+TEST(client_usage)
+{
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_client_usage objects;
+	/* wl_shm_pool.resize and destroy */
+	uint32_t resize[] = { 3, 12 << 16 | 2, 8192 };
+	uint32_t destroy[] = { 3, 8 << 16 | 1 };
+	int s[2];
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	assert(wl_display_init_shm(display) == 0);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+
+	/* The display resource */
+	check_usage(client, WL_CLIENT_ACCOUNT_OBJECTS, 1, -1);
+	check_usage(client, WL_CLIENT_ACCOUNT_SHM, 0, 0);
+	wl_client_get_usage(client, WL_CLIENT_ACCOUNT_OBJECTS, &objects);
+
+	bind_shm(s[1], 2);
+	create_pool(s[1], 2, 3, 4096);
+	dispatch(display);
+	check_usage(client, WL_CLIENT_ACCOUNT_OBJECTS, 3, 3 * objects.bytes);
+	check_usage(client, WL_CLIENT_ACCOUNT_SHM, 1, 4096);
+
+	send_request(s[1], resize, -1);
+	dispatch(display);
+	check_usage(client, WL_CLIENT_ACCOUNT_SHM, 1, 8192);
+
+	send_request(s[1], destroy, -1);
+	dispatch(display);
+	check_usage(client, WL_CLIENT_ACCOUNT_OBJECTS, 2, 2 * objects.bytes);
+	check_usage(client, WL_CLIENT_ACCOUNT_SHM, 0, 0);
+	assert(receive_error(s[1]) == -1);
+
+	wl_client_destroy(client);
+	close(s[0]);
+	close(s[1]);
+	wl_display_destroy(display);
+}
+
+struct quota_log {
+	struct wl_client *client;
+	enum wl_client_account account;
+	size_t count;
+	int calls;
+};
+
+static void
+quota_handler(struct wl_client *client, enum wl_client_account account,
+	      const struct wl_client_usage *usage, void *data)
+{
+	struct quota_log *log = data;
+
+	log->client = client;
+	log->account = account;
+	log->count = usage->count;
+	log->calls++;
+}
+
+TEST(client_object_quota)
+{
+	static const struct wl_client_usage soft = { 3, 0 }, hard = { 4, 0 };
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_resource *resource;
+	struct quota_log log;
+	int s[2], i;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	memset(&log, 0, sizeof log);
+	wl_display_set_client_quota(display, WL_CLIENT_ACCOUNT_OBJECTS,
+				    &soft, &hard);
+	wl_display_set_quota_handler(display, quota_handler, &log);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+
+	/* Going over the soft quota calls the handler, once */
+	for (i = 2; i <= 4; i++) {
+		resource = wl_client_add_object(client, &wl_callback_interface,
+						NULL, i, NULL);
+		assert(resource);
+	}
+	assert(log.calls == 1);
+	assert(log.client == client);
+	assert(log.account == WL_CLIENT_ACCOUNT_OBJECTS);
+	assert(log.count == 4);
+
+	/* Dropping below it and going over again calls it again */
+	wl_resource_destroy(resource);
+	resource = wl_client_add_object(client, &wl_callback_interface,
+					NULL, 4, NULL);
+	assert(log.calls == 2);
+
+	/* Going over the hard quota is a protocol error */
+	wl_client_flush(client);
+	assert(receive_error(s[1]) == -1);
+	wl_client_add_object(client, &wl_callback_interface, NULL, 5, NULL);
+	wl_client_flush(client);
+	assert(receive_error(s[1]) == WL_DISPLAY_ERROR_NO_MEMORY);
+
+	wl_client_destroy(client);
+	close(s[0]);
+	close(s[1]);
+	wl_display_destroy(display);
+}
+
+TEST(client_shm_quota)
+{
+	static const struct wl_client_usage hard = { 0, 4096 };
+	struct wl_display *display;
+	struct wl_client *client;
+	struct client_destroy_listener destroyed;
+	int s[2];
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	assert(wl_display_init_shm(display) == 0);
+	wl_display_set_client_quota(display, WL_CLIENT_ACCOUNT_SHM,
+				    NULL, &hard);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+	destroyed.listener.notify = client_destroy_notify;
+	destroyed.done = 0;
+	wl_client_add_destroy_listener(client, &destroyed.listener);
+
+	bind_shm(s[1], 2);
+	create_pool(s[1], 2, 3, 4096);
+	dispatch(display);
+	check_usage(client, WL_CLIENT_ACCOUNT_SHM, 1, 4096);
+
+	/* A second pool doesn't fit, and the client is disconnected */
+	create_pool(s[1], 2, 4, 4096);
+	dispatch(display);
+	assert(destroyed.done);
+	assert(receive_error(s[1]) == WL_DISPLAY_ERROR_NO_MEMORY);
+
+	close(s[1]);
+	wl_display_destroy(display);
+}
@@ -0,0 +1,928 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "wayland-server.h"
+#include "wayland-client.h"
+
+/* Runs a small compositor and N clients connected to it over
+ * socketpairs through WAYLAND_SOCKET, for N = 1, 10, 100, ... up to
+ * the requested maximum.  The clients are spread over forked worker
+ * processes.  Every run goes through three phases:
+ *
+ *  - pointer: the compositor sends a motion event to every client and
+ *    waits until all of them answered with a set_cursor request,
+ *    measuring the event latency on the client side;
+ *  - frames: every client does attach/damage/frame bursts and waits
+ *    for the frame callback, which the compositor sends from an idle
+ *    repaint;
+ *  - roundtrips: every client does wl_display_roundtrip().
+ *
+ * Each run forks a fresh compositor so that its RSS and CPU time
+ * only account for that run. */
+
+#define BUFFER_SIZE 64
+
+/* The compositor holds both ends of a worker's socketpairs until it
+ * forks, so bound that on top of the fds it keeps per client: the
+ * socket and the event loop's dup of it */
+#define MAX_WORKER_CLIENTS 4096
+#define SERVER_FDS_PER_CLIENT 2
+
+struct params {
+	int rounds;
+	int damage;
+	int json;
+};
+
+enum phase {
+	PHASE_POINTER,
+	PHASE_FRAMES,
+	PHASE_ROUNDTRIPS,
+	PHASE_COUNT
+};
+
+static const char *phase_names[] = {
+	"pointer", "frames", "roundtrips"
+};
+
+struct report {
+	int clients;
+	long rss;
+	uint64_t phase_time[PHASE_COUNT];
+};
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long
+get_rss(void)
+{
+	FILE *f;
+	long size, resident = 0;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void
+read_all(int fd, void *data, size_t size)
+{
+	char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = read(fd, p, size);
+		assert(len > 0);
+		p += len;
+		size -= len;
+	}
+}
+
+static void
+write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		assert(len > 0);
+		p += len;
+		size -= len;
+	}
+}
+
+/* Client side */
+
+struct bench_client {
+	struct worker *worker;
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct wl_seat *seat;
+	struct wl_pointer *pointer;
+	struct wl_data_device_manager *data_device_manager;
+	struct wl_data_device *data_device;
+	struct wl_surface *surface;
+	struct wl_buffer *buffer;
+	int motions, frames;
+	uint64_t frame_start;
+};
+
+struct worker {
+	const struct params *params;
+	struct bench_client *clients;
+	int count;
+	int epoll_fd;
+	int pending;
+	int shm_fd;
+	uint32_t *latency[PHASE_COUNT];
+	int latency_count[PHASE_COUNT];
+};
+
+static void
+record_latency(struct worker *worker, enum phase phase, uint64_t ns)
+{
+	worker->latency[phase][worker->latency_count[phase]++] =
+		ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+static void
+pointer_handle_enter(void *data, struct wl_pointer *pointer,
+		     uint32_t serial, struct wl_surface *surface,
+		     wl_fixed_t sx, wl_fixed_t sy)
+{
+}
+
+static void
+pointer_handle_leave(void *data, struct wl_pointer *pointer,
+		     uint32_t serial, struct wl_surface *surface)
+{
+}
+
+static void
+pointer_handle_motion(void *data, struct wl_pointer *pointer,
+		      uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
+{
+	struct bench_client *client = data;
+	struct worker *worker = client->worker;
+	uint32_t now = now_ns() / 1000;
+
+	/* The compositor sends the motion time in microseconds */
+	record_latency(worker, PHASE_POINTER, (uint64_t) (now - time) * 1000);
+
+	wl_pointer_set_cursor(pointer, time, NULL, 0, 0);
+
+	if (++client->motions == worker->params->rounds)
+		worker->pending--;
+}
+
+static void
+pointer_handle_button(void *data, struct wl_pointer *pointer,
+		      uint32_t serial, uint32_t time, uint32_t button,
+		      uint32_t state)
+{
+}
+
+static void
+pointer_handle_axis(void *data, struct wl_pointer *pointer,
+		    uint32_t time, uint32_t axis, wl_fixed_t value)
+{
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+	pointer_handle_enter,
+	pointer_handle_leave,
+	pointer_handle_motion,
+	pointer_handle_button,
+	pointer_handle_axis
+};
+
+static void client_frame(struct bench_client *client);
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct bench_client *client = data;
+	struct worker *worker = client->worker;
+
+	record_latency(worker, PHASE_FRAMES, now_ns() - client->frame_start);
+	wl_callback_destroy(callback);
+
+	if (++client->frames < worker->params->rounds)
+		client_frame(client);
+	else
+		worker->pending--;
+}
+
+static const struct wl_callback_listener frame_listener = {
+	frame_done
+};
+
+static void
+client_frame(struct bench_client *client)
+{
+	struct wl_callback *callback;
+	int i;
+
+	client->frame_start = now_ns();
+
+	wl_surface_attach(client->surface, client->buffer, 0, 0);
+	for (i = 0; i < client->worker->params->damage; i++)
+		wl_surface_damage(client->surface, i, i, 1, 1);
+	callback = wl_surface_frame(client->surface);
+	wl_callback_add_listener(callback, &frame_listener, client);
+}
+
+static void *
+client_bind(struct wl_display *display, const char *name,
+	    const struct wl_interface *interface)
+{
+	uint32_t id;
+
+	id = wl_display_get_global(display, name, interface->version);
+	assert(id != 0);
+
+	return wl_display_bind(display, id, interface);
+}
+
+static void
+client_connect(struct bench_client *client, int fd)
+{
+	struct epoll_event ep;
+	struct wl_shm_pool *pool;
+	char s[32];
+
+	snprintf(s, sizeof s, "%d", fd);
+	setenv("WAYLAND_SOCKET", s, 1);
+	client->display = wl_display_connect(NULL);
+	assert(client->display);
+
+	ep.events = EPOLLIN;
+	ep.data.ptr = client;
+	assert(epoll_ctl(client->worker->epoll_fd, EPOLL_CTL_ADD,
+			 wl_display_get_fd(client->display, NULL, NULL),
+			 &ep) == 0);
+
+	/* Receive the globals, then set up like a regular client */
+	wl_display_roundtrip(client->display);
+
+	client->compositor = client_bind(client->display, "wl_compositor",
+					 &wl_compositor_interface);
+	client->shm = client_bind(client->display, "wl_shm",
+				  &wl_shm_interface);
+	client->seat = client_bind(client->display, "wl_seat",
+				   &wl_seat_interface);
+	client->data_device_manager =
+		client_bind(client->display, "wl_data_device_manager",
+			    &wl_data_device_manager_interface);
+
+	client->pointer = wl_seat_get_pointer(client->seat);
+	wl_pointer_add_listener(client->pointer, &pointer_listener, client);
+	client->data_device =
+		wl_data_device_manager_get_data_device(client->data_device_manager,
+						       client->seat);
+
+	client->surface = wl_compositor_create_surface(client->compositor);
+	pool = wl_shm_create_pool(client->shm, client->worker->shm_fd,
+				  BUFFER_SIZE * BUFFER_SIZE * 4);
+	client->buffer = wl_shm_pool_create_buffer(pool, 0,
+						   BUFFER_SIZE, BUFFER_SIZE,
+						   BUFFER_SIZE * 4,
+						   WL_SHM_FORMAT_ARGB8888);
+	wl_shm_pool_destroy(pool);
+
+	wl_display_roundtrip(client->display);
+}
+
+static void
+worker_dispatch(struct worker *worker)
+{
+	struct epoll_event ep[32];
+	struct bench_client *client;
+	int i, count;
+
+	while (worker->pending > 0) {
+		count = epoll_wait(worker->epoll_fd,
+				   ep, ARRAY_LENGTH(ep), -1);
+		/* Flushing from the listeners would dispatch the
+		 * pending events again, so flush here instead */
+		for (i = 0; i < count; i++) {
+			client = ep[i].data.ptr;
+			wl_display_iterate(client->display,
+					   WL_DISPLAY_READABLE);
+			wl_display_flush(client->display);
+		}
+	}
+}
+
+static void
+run_worker(const struct params *params, int *fds, int count, int pipe_fd)
+{
+	struct worker worker;
+	struct report report;
+	uint64_t start;
+	long rss;
+	int i, j;
+
+	memset(&worker, 0, sizeof worker);
+	worker.params = params;
+	worker.count = count;
+	worker.clients = calloc(count, sizeof *worker.clients);
+	worker.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	for (i = 0; i < PHASE_COUNT; i++)
+		worker.latency[i] = malloc(count * params->rounds *
+					   sizeof *worker.latency[i]);
+
+	worker.shm_fd = memfd_create("compositor-benchmark", MFD_CLOEXEC);
+	assert(worker.shm_fd >= 0);
+	assert(ftruncate(worker.shm_fd,
+			 BUFFER_SIZE * BUFFER_SIZE * 4) == 0);
+
+	rss = get_rss();
+	for (i = 0; i < count; i++) {
+		worker.clients[i].worker = &worker;
+		client_connect(&worker.clients[i], fds[i]);
+	}
+	report.rss = get_rss() - rss;
+	report.clients = count;
+
+	/* Tell the compositor we're ready for the pointer phase */
+	write_all(pipe_fd, "r", 1);
+
+	start = now_ns();
+	worker.pending = count;
+	worker_dispatch(&worker);
+	report.phase_time[PHASE_POINTER] = now_ns() - start;
+
+	start = now_ns();
+	worker.pending = count;
+	for (i = 0; i < count; i++) {
+		client_frame(&worker.clients[i]);
+		wl_display_flush(worker.clients[i].display);
+	}
+	worker_dispatch(&worker);
+	report.phase_time[PHASE_FRAMES] = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < params->rounds; j++) {
+			uint64_t t = now_ns();
+
+			wl_display_roundtrip(worker.clients[i].display);
+			record_latency(&worker, PHASE_ROUNDTRIPS,
+				       now_ns() - t);
+		}
+	}
+	report.phase_time[PHASE_ROUNDTRIPS] = now_ns() - start;
+
+	write_all(pipe_fd, &report, sizeof report);
+	for (i = 0; i < PHASE_COUNT; i++)
+		write_all(pipe_fd, worker.latency[i],
+			  worker.latency_count[i] * sizeof *worker.latency[i]);
+
+	for (i = 0; i < count; i++)
+		wl_display_disconnect(worker.clients[i].display);
+	close(worker.shm_fd);
+}
+
+/* Compositor side */
+
+struct server_worker {
+	struct server *server;
+	int pipe_fd;
+	int clients;
+	int ready;
+	struct wl_event_source *source;
+};
+
+struct server {
+	struct wl_display *display;
+	const struct params *params;
+	struct wl_seat seat;
+	struct wl_pointer pointer;
+	struct wl_list frame_list;
+	struct wl_event_source *repaint_source;
+
+	int clients;
+	int workers, ready, done;
+	int round, acks;
+	uint64_t pointer_start;
+
+	struct report total;
+	uint32_t *latency[PHASE_COUNT];
+	int latency_count[PHASE_COUNT];
+};
+
+static void
+unbind_resource(struct wl_resource *resource)
+{
+	wl_list_remove(&resource->link);
+	free(resource);
+}
+
+static void
+send_motion_round(struct server *server)
+{
+	struct wl_resource *resource;
+	uint32_t time;
+	wl_fixed_t pos;
+
+	server->round++;
+	server->acks = 0;
+	pos = wl_fixed_from_int(server->round);
+	time = now_ns() / 1000;
+
+	wl_list_for_each(resource, &server->pointer.resource_list, link)
+		wl_pointer_send_motion(resource, time, pos, pos);
+}
+
+static void
+pointer_set_cursor(struct wl_client *client, struct wl_resource *resource,
+		   uint32_t serial, struct wl_resource *surface,
+		   int32_t x, int32_t y)
+{
+	struct server *server = resource->data;
+
+	if (++server->acks < server->clients)
+		return;
+
+	if (server->round < server->params->rounds)
+		send_motion_round(server);
+	else
+		server->total.phase_time[PHASE_POINTER] =
+			now_ns() - server->pointer_start;
+}
+
+static const struct wl_pointer_interface pointer_implementation = {
+	pointer_set_cursor
+};
+
+static void
+seat_get_pointer(struct wl_client *client, struct wl_resource *resource,
+		 uint32_t id)
+{
+	struct server *server =
+		container_of(resource->data, struct server, seat);
+	struct wl_resource *cr;
+
+	cr = wl_client_add_object(client, &wl_pointer_interface,
+				  &pointer_implementation, id, server);
+	wl_list_insert(&server->pointer.resource_list, &cr->link);
+	cr->destroy = unbind_resource;
+}
+
+static void
+seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
+		  uint32_t id)
+{
+}
+
+static void
+seat_get_touch(struct wl_client *client, struct wl_resource *resource,
+	       uint32_t id)
+{
+}
+
+static const struct wl_seat_interface seat_implementation = {
+	seat_get_pointer,
+	seat_get_keyboard,
+	seat_get_touch
+};
+
+static void
+bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	struct server *server = data;
+	struct wl_resource *resource;
+
+	/* The data device takes the seat from the seat resource */
+	resource = wl_client_add_object(client, &wl_seat_interface,
+					&seat_implementation, id,
+					&server->seat);
+	wl_list_insert(&server->seat.base_resource_list, &resource->link);
+	resource->destroy = unbind_resource;
+
+	wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_POINTER);
+}
+
+static void
+repaint(void *data)
+{
+	struct server *server = data;
+	struct wl_resource *cb, *next;
+	uint32_t time = now_ns() / 1000000;
+
+	server->repaint_source = NULL;
+
+	wl_list_for_each_safe(cb, next, &server->frame_list, link) {
+		wl_callback_send_done(cb, time);
+		wl_resource_destroy(cb);
+	}
+	wl_list_init(&server->frame_list);
+}
+
+static void
+surface_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+surface_attach(struct wl_client *client, struct wl_resource *resource,
+	       struct wl_resource *buffer, int32_t x, int32_t y)
+{
+}
+
+static void
+surface_damage(struct wl_client *client, struct wl_resource *resource,
+	       int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void
+surface_frame(struct wl_client *client,
+	      struct wl_resource *resource, uint32_t callback)
+{
+	struct server *server = resource->data;
+	struct wl_resource *cb;
+	struct wl_event_loop *loop;
+
+	cb = wl_client_add_object(client, &wl_callback_interface,
+				  NULL, callback, NULL);
+	wl_list_insert(server->frame_list.prev, &cb->link);
+
+	if (server->repaint_source == NULL) {
+		loop = wl_display_get_event_loop(server->display);
+		server->repaint_source =
+			wl_event_loop_add_idle(loop, repaint, server);
+	}
+}
+
+static void
+surface_set_region(struct wl_client *client,
+		   struct wl_resource *resource, struct wl_resource *region)
+{
+}
+
+static const struct wl_surface_interface surface_implementation = {
+	surface_destroy,
+	surface_attach,
+	surface_damage,
+	surface_frame,
+	surface_set_region,
+	surface_set_region
+};
+
+static void
+compositor_create_surface(struct wl_client *client,
+			  struct wl_resource *resource, uint32_t id)
+{
+	wl_client_add_object(client, &wl_surface_interface,
+			     &surface_implementation, id, resource->data);
+}
+
+static void
+compositor_create_region(struct wl_client *client,
+			 struct wl_resource *resource, uint32_t id)
+{
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+	compositor_create_surface,
+	compositor_create_region
+};
+
+static void
+bind_compositor(struct wl_client *client,
+		void *data, uint32_t version, uint32_t id)
+{
+	wl_client_add_object(client, &wl_compositor_interface,
+			     &compositor_implementation, id, data);
+}
+
+static int
+worker_data(int fd, uint32_t mask, void *data)
+{
+	struct server_worker *sw = data;
+	struct server *server = sw->server;
+	struct report report;
+	char c;
+	int i;
+
+	if (!sw->ready) {
+		read_all(fd, &c, 1);
+		sw->ready = 1;
+		if (++server->ready == server->workers) {
+			server->pointer_start = now_ns();
+			send_motion_round(server);
+		}
+		return 1;
+	}
+
+	read_all(fd, &report, sizeof report);
+	server->total.rss += report.rss;
+	for (i = 0; i < PHASE_COUNT; i++) {
+		if (report.phase_time[i] > server->total.phase_time[i] &&
+		    i != PHASE_POINTER)
+			server->total.phase_time[i] = report.phase_time[i];
+	}
+	for (i = 0; i < PHASE_COUNT; i++) {
+		read_all(fd, server->latency[i] + server->latency_count[i],
+			 report.clients * server->params->rounds *
+			 sizeof *server->latency[i]);
+		server->latency_count[i] +=
+			report.clients * server->params->rounds;
+	}
+
+	wl_event_source_remove(sw->source);
+	close(fd);
+
+	if (++server->done == server->workers)
+		wl_display_terminate(server->display);
+
+	return 1;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+	uint32_t la = *(const uint32_t *) a, lb = *(const uint32_t *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static double
+percentile(uint32_t *latency, int count, int p)
+{
+	return latency[(int64_t) (count - 1) * p / 100] / 1000.0;
+}
+
+static void
+print_results(struct server *server, long rss, uint64_t cpu, int first)
+{
+	const struct params *params = server->params;
+	/* Messages per round of every phase: motion + set_cursor;
+	 * attach, damage, frame, done + delete_id; sync, done +
+	 * delete_id */
+	int messages[PHASE_COUNT] = {
+		2, params->damage + 4, 3
+	};
+	double rate, p50, p99;
+	int i;
+
+	if (params->json)
+		printf("%s    { \"clients\": %d,\n", first ? "" : ",\n",
+		       server->clients);
+	else
+		printf("%d clients:\n", server->clients);
+
+	for (i = 0; i < PHASE_COUNT; i++) {
+		qsort(server->latency[i], server->latency_count[i],
+		      sizeof *server->latency[i], compare_latency);
+		rate = (double) server->clients * params->rounds *
+			messages[i] * 1e9 / server->total.phase_time[i];
+		p50 = percentile(server->latency[i],
+				 server->latency_count[i], 50);
+		p99 = percentile(server->latency[i],
+				 server->latency_count[i], 99);
+
+		if (params->json)
+			printf("      \"%s\": { \"messages_per_s\": %.0f, "
+			       "\"p50_us\": %.1f, \"p99_us\": %.1f },\n",
+			       phase_names[i], rate, p50, p99);
+		else
+			printf("\t%-10s %10.0f msg/s, latency p50 %8.1fus, "
+			       "p99 %8.1fus\n",
+			       phase_names[i], rate, p50, p99);
+	}
+
+	if (params->json)
+		printf("      \"server_cpu_us_per_client\": %.1f,\n"
+		       "      \"server_rss_per_client\": %ld,\n"
+		       "      \"client_rss_per_client\": %ld }",
+		       cpu / 1e3 / server->clients, rss / server->clients,
+		       server->total.rss / server->clients);
+	else
+		printf("\tserver %.1fus cpu and %ld bytes rss per client, "
+		       "client %ld bytes rss per client\n",
+		       cpu / 1e3 / server->clients, rss / server->clients,
+		       server->total.rss / server->clients);
+}
+
+static uint64_t
+cpu_time(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+		1000000000ull +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+static void
+run_server(const struct params *params, int clients, int first)
+{
+	struct server server;
+	struct server_worker *workers;
+	struct wl_event_loop *loop;
+	int *fds, *server_fds, s[2], p[2];
+	int i, j, n, per_worker, server_fd_count = 0;
+	uint64_t cpu;
+	long rss;
+	pid_t pid;
+
+	memset(&server, 0, sizeof server);
+	server.params = params;
+	server.clients = clients;
+	server.display = wl_display_create();
+	loop = wl_display_get_event_loop(server.display);
+	wl_list_init(&server.frame_list);
+	for (i = 0; i < PHASE_COUNT; i++)
+		server.latency[i] = malloc(clients * params->rounds *
+					   sizeof *server.latency[i]);
+
+	assert(wl_display_init_shm(server.display) == 0);
+	assert(wl_data_device_manager_init(server.display) == 0);
+	wl_display_add_global(server.display, &wl_compositor_interface,
+			      &server, bind_compositor);
+	wl_seat_init(&server.seat);
+	wl_pointer_init(&server.pointer);
+	wl_seat_set_pointer(&server.seat, &server.pointer);
+	wl_display_add_global(server.display, &wl_seat_interface,
+			      &server, bind_seat);
+
+	server.workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (server.workers < (clients + MAX_WORKER_CLIENTS - 1) /
+	    MAX_WORKER_CLIENTS)
+		server.workers = (clients + MAX_WORKER_CLIENTS - 1) /
+			MAX_WORKER_CLIENTS;
+	if (server.workers > clients)
+		server.workers = clients;
+	workers = calloc(server.workers, sizeof *workers);
+	fds = malloc(clients * sizeof *fds);
+	server_fds = malloc((clients + server.workers) * sizeof *server_fds);
+
+	rss = get_rss();
+	cpu = cpu_time();
+
+	for (i = 0; i < server.workers; i++) {
+		per_worker = clients / server.workers +
+			(i < clients % server.workers);
+
+		for (n = 0; n < per_worker; n++) {
+			assert(socketpair(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+			server_fds[server_fd_count++] = s[0];
+			fds[n] = s[1];
+		}
+		assert(pipe(p) == 0);
+
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			for (j = 0; j < server_fd_count; j++)
+				close(server_fds[j]);
+			close(p[0]);
+			run_worker(params, fds, per_worker, p[1]);
+			_exit(EXIT_SUCCESS);
+		}
+
+		close(p[1]);
+		for (n = 0; n < per_worker; n++) {
+			close(fds[n]);
+			wl_client_create(server.display,
+					 server_fds[server_fd_count - per_worker + n]);
+		}
+		server_fds[server_fd_count++] = p[0];
+
+		workers[i].server = &server;
+		workers[i].pipe_fd = p[0];
+		workers[i].clients = per_worker;
+		workers[i].source =
+			wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+					     worker_data, &workers[i]);
+	}
+
+	wl_display_run(server.display);
+
+	cpu = cpu_time() - cpu;
+	rss = get_rss() - rss;
+
+	while (wait(NULL) > 0)
+		;
+
+	print_results(&server, rss, cpu, first);
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [--json] [-n max-clients] [-r rounds] "
+		"[-d damage-per-frame]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct params params;
+	struct rlimit limit;
+	int i, clients, max_clients = 10000, status;
+	pid_t pid;
+
+	params.rounds = 20;
+	params.damage = 4;
+	params.json = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0)
+			params.json = 1;
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			max_clients = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			params.rounds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			params.damage = atoi(argv[++i]);
+		else
+			usage(argv[0]);
+	}
+	if (max_clients < 1 || params.rounds < 1 || params.damage < 0)
+		usage(argv[0]);
+
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	if ((rlim_t) max_clients * SERVER_FDS_PER_CLIENT +
+	    MAX_WORKER_CLIENTS + 64 > limit.rlim_cur) {
+		max_clients = (limit.rlim_cur - MAX_WORKER_CLIENTS - 64) /
+			SERVER_FDS_PER_CLIENT;
+		fprintf(stderr, "fd limit is %lu, only going up to %d clients\n",
+			(unsigned long) limit.rlim_cur, max_clients);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (params.json)
+		printf("{\n  \"rounds\": %d,\n  \"damage\": %d,\n"
+		       "  \"runs\": [\n", params.rounds, params.damage);
+
+	for (clients = 1; ; clients *= 10) {
+		if (clients > max_clients)
+			clients = max_clients;
+
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run_server(&params, clients, clients == 1);
+			fflush(stdout);
+			_exit(EXIT_SUCCESS);
+		}
+
+		if (waitpid(pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "run with %d clients failed\n",
+				clients);
+			return EXIT_FAILURE;
+		}
+
+		if (clients == max_clients)
+			break;
+	}
+
+	if (params.json)
+		printf("\n  ]\n}\n");
+
+	return EXIT_SUCCESS;
+}
@@ -31,6 +31,8 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #include "wayland-private.h"
 #include "test-runner.h"
@@ -142,6 +144,201 @@ TEST(connection_queue)
 	close(s[1]);
 }
 
+TEST(connection_reserve)
+{
+	struct wl_connection *connection;
+	int s[2], i, count = 300;
+	uint32_t mask, *p, buffer[5 * 300];
+
+	connection = setup(s, &mask);
+
+	/* 20 byte messages don't divide the buffer size, so some of
+	 * them wrap around its end and go through the reserve buffer */
+	for (i = 0; i < count; i++) {
+		p = wl_connection_reserve(connection, 20);
+		assert(p);
+		p[0] = i;
+		p[1] = 20 << 16;
+		p[2] = i;
+		p[3] = i * 2;
+		p[4] = i * 3;
+		wl_connection_commit(connection, p);
+		assert(mask == (WL_CONNECTION_WRITABLE |
+				WL_CONNECTION_READABLE));
+	}
+
+	assert(wl_connection_data(connection, WL_CONNECTION_WRITABLE) == 0);
+	assert(mask == WL_CONNECTION_READABLE);
+	assert(recv(s[1], buffer, sizeof buffer, MSG_WAITALL) ==
+	       sizeof buffer);
+
+	for (i = 0; i < count; i++) {
+		assert(buffer[i * 5] == (uint32_t) i);
+		assert(buffer[i * 5 + 1] == 20 << 16);
+		assert(buffer[i * 5 + 2] == (uint32_t) i);
+		assert(buffer[i * 5 + 3] == (uint32_t) i * 2);
+		assert(buffer[i * 5 + 4] == (uint32_t) i * 3);
+	}
+
+	wl_connection_destroy(connection);
+	close(s[1]);
+}
+
+extern const struct wl_protocol_info wayland_protocol_info;
+
+static void
+check_message_info(const struct wl_message *message,
+		   const struct wl_message_info *info)
+{
+	struct wl_message_info_buffer buffer;
+	const struct wl_message_info *parsed;
+
+	/* Not added yet, so this is parsed from the signature */
+	parsed = wl_message_get_info(message, &buffer);
+	assert(parsed == &buffer.info);
+
+	assert(strcmp(parsed->types, info->types) == 0);
+	assert(parsed->nullable == info->nullable);
+	assert(parsed->arg_count == info->arg_count);
+	assert(parsed->flags == info->flags);
+	assert(parsed->fixed_size == info->fixed_size);
+	assert(parsed->fd_count == info->fd_count);
+	assert(parsed->pointer_count == info->pointer_count);
+	assert(parsed->array_count == info->array_count);
+}
+
+TEST(protocol_info)
+{
+	const struct wl_protocol_info *protocol = &wayland_protocol_info;
+	const struct wl_interface_info *interface_info;
+	const struct wl_interface *interface;
+	struct wl_message_info_buffer buffer;
+	uint32_t i;
+	int j;
+
+	assert(protocol->version == WL_PROTOCOL_INFO_VERSION);
+
+	for (i = 0; i < protocol->interface_count; i++) {
+		interface_info = &protocol->interfaces[i];
+		interface = interface_info->interface;
+		for (j = 0; j < interface->method_count; j++)
+			check_message_info(&interface->methods[j],
+					   &interface_info->requests[j]);
+		for (j = 0; j < interface->event_count; j++)
+			check_message_info(&interface->events[j],
+					   &interface_info->events[j]);
+	}
+
+	wl_message_info_add(protocol);
+
+	for (i = 0; i < protocol->interface_count; i++) {
+		interface_info = &protocol->interfaces[i];
+		interface = interface_info->interface;
+		for (j = 0; j < interface->method_count; j++)
+			assert(wl_message_get_info(&interface->methods[j],
+						   &buffer) ==
+			       &interface_info->requests[j]);
+		for (j = 0; j < interface->event_count; j++)
+			assert(wl_message_get_info(&interface->events[j],
+						   &buffer) ==
+			       &interface_info->events[j]);
+	}
+}
+
+#define LOOKUP_THREADS 4
+
+static int lookups_done;
+
+/* A message is either found with its own description or described
+ * from its signature, never with a half added slot */
+static void *
+lookup_thread(void *data)
+{
+	const struct wl_protocol_info *protocol = data;
+	const struct wl_interface_info *interface_info;
+	const struct wl_interface *interface;
+	const struct wl_message_info *info;
+	struct wl_message_info_buffer buffer;
+	uint32_t i;
+	int j;
+
+	while (!__atomic_load_n(&lookups_done, __ATOMIC_ACQUIRE)) {
+		for (i = 0; i < protocol->interface_count; i++) {
+			interface_info = &protocol->interfaces[i];
+			interface = interface_info->interface;
+			for (j = 0; j < interface->event_count; j++) {
+				info = wl_message_get_info(
+					&interface->events[j], &buffer);
+				assert(info == &buffer.info ||
+				       info == &interface_info->events[j]);
+				assert(info->arg_count ==
+				       interface_info->events[j].arg_count);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void *
+add_thread(void *data)
+{
+	wl_message_info_add(data);
+
+	return NULL;
+}
+
+static void
+run_protocol_info_threads(void)
+{
+	const struct wl_protocol_info *protocol = &wayland_protocol_info;
+	const struct wl_interface_info *interface_info;
+	struct wl_message_info_buffer buffer;
+	pthread_t lookups[LOOKUP_THREADS], adds[2];
+	uint32_t i;
+	int j;
+
+	for (i = 0; i < LOOKUP_THREADS; i++)
+		assert(pthread_create(&lookups[i], NULL, lookup_thread,
+				      (void *) protocol) == 0);
+	for (i = 0; i < ARRAY_LENGTH(adds); i++)
+		assert(pthread_create(&adds[i], NULL, add_thread,
+				      (void *) protocol) == 0);
+
+	for (i = 0; i < ARRAY_LENGTH(adds); i++)
+		assert(pthread_join(adds[i], NULL) == 0);
+	__atomic_store_n(&lookups_done, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < LOOKUP_THREADS; i++)
+		assert(pthread_join(lookups[i], NULL) == 0);
+
+	/* Adding twice concurrently added everything once */
+	for (i = 0; i < protocol->interface_count; i++) {
+		interface_info = &protocol->interfaces[i];
+		for (j = 0; j < interface_info->interface->event_count; j++)
+			assert(wl_message_get_info(
+				       &interface_info->interface->events[j],
+				       &buffer) == &interface_info->events[j]);
+	}
+}
+
+/* Threads may allocate, so they run in a child process that isn't
+ * checked for leaks */
+TEST(protocol_info_threads)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_protocol_info_threads();
+		_exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
 struct marshal_data {
 	struct wl_connection *read_connection;
 	struct wl_connection *write_connection;
@@ -566,3 +763,61 @@ TEST(invoke_closure)
 {
 	marshal_helper("suu", suu_handler, "foo", 500, 404040);
 }
+
+static struct wl_closure *
+vmarshal_helper(struct wl_object *sender,
+		const struct wl_message *message, ...)
+{
+	struct wl_closure *closure;
+	va_list ap;
+
+	va_start(ap, message);
+	closure = wl_closure_vmarshal(sender, 0, ap, message);
+	va_end(ap);
+
+	return closure;
+}
+
+BENCH(connection_marshal_bench)
+{
+	static struct wl_object sender = { NULL, NULL, 1234 };
+	struct wl_message message = { "test", "uiu", NULL };
+	struct wl_closure *closure;
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		closure = vmarshal_helper(&sender, &message, 1, -2, 3);
+		wl_closure_destroy(closure);
+	}
+}
+
+BENCH(connection_send_demarshal_bench)
+{
+	static struct wl_object sender = { NULL, NULL, 1234 };
+	struct wl_message message = { "test", "uiu", NULL };
+	struct marshal_data data;
+	struct wl_closure *closure, *received;
+	struct wl_map objects;
+	unsigned long i;
+	int size;
+
+	setup_marshal_data(&data);
+	wl_map_init(&objects);
+	closure = vmarshal_helper(&sender, &message, 1, -2, 3);
+	size = closure->start[1] >> 16;
+
+	for (i = 0; i < iterations; i++) {
+		assert(wl_closure_send(closure, data.write_connection) == 0);
+		assert(wl_connection_data(data.write_connection,
+					  WL_CONNECTION_WRITABLE) == 0);
+		assert(wl_connection_data(data.read_connection,
+					  WL_CONNECTION_READABLE) == size);
+		received = wl_connection_demarshal(data.read_connection,
+						   size, &objects, &message);
+		wl_closure_destroy(received);
+	}
+
+	wl_closure_destroy(closure);
+	wl_map_release(&objects);
+	release_marshal_data(&data);
+}
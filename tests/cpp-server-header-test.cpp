@@ -0,0 +1,135 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+/* Builds wayland-server-protocol.hpp with the C++ compiler and checks
+ * that its message descriptors agree with the C interfaces. */
+
+#include <cassert>
+#include <cstring>
+
+#include "wayland-server-protocol.hpp"
+
+using namespace wayland::server;
+
+template<std::size_t N>
+static void
+check_messages(const wayland::message_descriptor (&descriptors)[N],
+	       const struct wl_message *messages, int count)
+{
+	const char *s;
+	int args;
+
+	assert(static_cast<int>(N) == count);
+
+	for (std::size_t i = 0; i < N; i++) {
+		assert(std::strcmp(descriptors[i].name,
+				   messages[i].name) == 0);
+		assert(std::strcmp(descriptors[i].signature,
+				   messages[i].signature) == 0);
+
+		args = 0;
+		for (s = messages[i].signature; *s; s++)
+			args += *s != '?';
+		assert(descriptors[i].arg_count == args);
+		assert(descriptors[i].has_fd ==
+		       (std::strchr(messages[i].signature, 'h') != nullptr));
+		assert(descriptors[i].has_new_id ==
+		       (std::strchr(messages[i].signature, 'n') != nullptr));
+	}
+}
+
+#define CHECK_REQUESTS(name)						\
+	check_messages(name::requests, name##_interface.methods,	\
+		       name##_interface.method_count)
+#define CHECK_EVENTS(name)						\
+	check_messages(name::events, name##_interface.events,		\
+		       name##_interface.event_count)
+
+/* The sizes are usable in constant expressions */
+static_assert(wl_display::requests[1].fixed_size == 12,
+	      "wl_display.sync is a header and a new_id");
+static_assert(wl_surface::requests[1].fixed_size == 20,
+	      "wl_surface.attach is a header and three arguments");
+
+struct test_display {
+	uint32_t callback;
+
+	void
+	bind(struct ::wl_client *client, struct ::wl_resource *resource,
+	     uint32_t name, const char *interface, uint32_t version,
+	     uint32_t id)
+	{
+	}
+
+	void
+	sync(struct ::wl_client *client, struct ::wl_resource *resource,
+	     uint32_t callback)
+	{
+		this->callback = callback;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	struct test_display display = { 0 };
+	struct wl_resource resource;
+
+	CHECK_REQUESTS(wl_display);
+	CHECK_EVENTS(wl_display);
+	CHECK_EVENTS(wl_callback);
+	CHECK_REQUESTS(wl_compositor);
+	CHECK_REQUESTS(wl_shm_pool);
+	CHECK_REQUESTS(wl_shm);
+	CHECK_EVENTS(wl_shm);
+	CHECK_REQUESTS(wl_buffer);
+	CHECK_EVENTS(wl_buffer);
+	CHECK_REQUESTS(wl_data_offer);
+	CHECK_EVENTS(wl_data_offer);
+	CHECK_REQUESTS(wl_data_source);
+	CHECK_EVENTS(wl_data_source);
+	CHECK_REQUESTS(wl_data_device);
+	CHECK_EVENTS(wl_data_device);
+	CHECK_REQUESTS(wl_data_device_manager);
+	CHECK_REQUESTS(wl_shell);
+	CHECK_REQUESTS(wl_shell_surface);
+	CHECK_EVENTS(wl_shell_surface);
+	CHECK_REQUESTS(wl_surface);
+	CHECK_EVENTS(wl_surface);
+	CHECK_REQUESTS(wl_seat);
+	CHECK_EVENTS(wl_seat);
+	CHECK_REQUESTS(wl_pointer);
+	CHECK_EVENTS(wl_pointer);
+	CHECK_EVENTS(wl_keyboard);
+	CHECK_EVENTS(wl_touch);
+	CHECK_EVENTS(wl_output);
+	CHECK_REQUESTS(wl_region);
+
+	/* The implementation forwards to the member function */
+	std::memset(&resource, 0, sizeof resource);
+	resource.data = &display;
+	wl_display::implementation<test_display>::table.sync(nullptr, &resource,
+							      7);
+	assert(display.callback == 7);
+
+	return 0;
+}
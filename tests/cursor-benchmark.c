@@ -0,0 +1,392 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "wayland-server.h"
+#include "wayland-client.h"
+#include "wayland-cursor.h"
+
+/* Generates a synthetic Xcursor theme in a temporary directory and
+ * times wl_cursor_theme_load()/wl_cursor_theme_destroy() against an
+ * in-process compositor. */
+
+#define XCURSOR_MAGIC		0x72756358
+#define XCURSOR_IMAGE_TYPE	0xfffd0002
+
+struct theme_spec {
+	const char *name;
+	int cursors;	/* number of cursor files */
+	int frames;	/* animation frames per nominal size */
+	int sizes[4];	/* nominal sizes stored in each file, 0 terminated */
+};
+
+static const struct theme_spec specs[] = {
+	{ "small", 32, 1, { 24, 0 } },
+	{ "large", 128, 1, { 24, 32, 48, 64 } },
+	{ "animated", 64, 16, { 32, 48, 64, 0 } },
+};
+
+static void
+put_uint(FILE *f, uint32_t u)
+{
+	unsigned char b[4];
+	size_t len;
+
+	b[0] = u;
+	b[1] = u >> 8;
+	b[2] = u >> 16;
+	b[3] = u >> 24;
+	len = fwrite(b, 1, sizeof b, f);
+	assert(len == sizeof b);
+}
+
+static void
+write_cursor_file(const char *path, const struct theme_spec *spec)
+{
+	FILE *f;
+	uint32_t ntoc, position, x, y;
+	int i, j, size;
+
+	f = fopen(path, "w");
+	assert(f);
+
+	for (ntoc = 0; ntoc < 4 && spec->sizes[ntoc]; ntoc++)
+		;
+	ntoc *= spec->frames;
+
+	put_uint(f, XCURSOR_MAGIC);
+	put_uint(f, 16);
+	put_uint(f, 0x10000);
+	put_uint(f, ntoc);
+
+	position = 16 + ntoc * 12;
+	for (i = 0; i < 4 && spec->sizes[i]; i++) {
+		size = spec->sizes[i];
+		for (j = 0; j < spec->frames; j++) {
+			put_uint(f, XCURSOR_IMAGE_TYPE);
+			put_uint(f, size);
+			put_uint(f, position);
+			position += 36 + size * size * 4;
+		}
+	}
+
+	for (i = 0; i < 4 && spec->sizes[i]; i++) {
+		size = spec->sizes[i];
+		for (j = 0; j < spec->frames; j++) {
+			put_uint(f, 36);
+			put_uint(f, XCURSOR_IMAGE_TYPE);
+			put_uint(f, size);
+			put_uint(f, 1);
+			put_uint(f, size);
+			put_uint(f, size);
+			put_uint(f, size / 2);
+			put_uint(f, size / 2);
+			put_uint(f, 50);
+			for (y = 0; y < (uint32_t) size; y++)
+				for (x = 0; x < (uint32_t) size; x++)
+					put_uint(f, 0xff000000 | (x << 8) |
+						 (y << 16) | j);
+		}
+	}
+
+	fclose(f);
+}
+
+static void
+write_theme(const char *root, const struct theme_spec *spec)
+{
+	char path[256];
+	int i, ret;
+
+	snprintf(path, sizeof path, "%s/%s", root, spec->name);
+	ret = mkdir(path, 0700);
+	assert(ret == 0);
+	snprintf(path, sizeof path, "%s/%s/cursors", root, spec->name);
+	ret = mkdir(path, 0700);
+	assert(ret == 0);
+
+	for (i = 0; i < spec->cursors; i++) {
+		snprintf(path, sizeof path, "%s/%s/cursors/cursor-%03d",
+			 root, spec->name, i);
+		write_cursor_file(path, spec);
+	}
+}
+
+static void
+remove_theme(const char *root, const struct theme_spec *spec)
+{
+	char path[256];
+	int i;
+
+	for (i = 0; i < spec->cursors; i++) {
+		snprintf(path, sizeof path, "%s/%s/cursors/cursor-%03d",
+			 root, spec->name, i);
+		unlink(path);
+	}
+	snprintf(path, sizeof path, "%s/%s/cursors", root, spec->name);
+	rmdir(path);
+	snprintf(path, sizeof path, "%s/%s", root, spec->name);
+	rmdir(path);
+}
+
+struct shm_listener {
+	struct wl_display *display;
+	struct wl_shm *shm;
+};
+
+static void
+handle_global(struct wl_display *display, uint32_t id,
+	      const char *interface, uint32_t version, void *data)
+{
+	struct shm_listener *listener = data;
+
+	if (strcmp(interface, "wl_shm") == 0)
+		listener->shm = wl_display_bind(display, id,
+						&wl_shm_interface);
+}
+
+static void
+benchmark(const char *s, int size, int iterations,
+	  struct wl_display *client, struct wl_display *server,
+	  struct wl_shm *shm)
+{
+	struct timespec start, stop;
+	struct wl_cursor_theme *theme;
+	double elapsed;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		theme = wl_cursor_theme_load(s, size, shm);
+		assert(theme);
+		wl_cursor_theme_destroy(theme);
+
+		/* Let the compositor map and unmap the pools */
+		wl_display_flush(client);
+		wl_event_loop_dispatch(wl_display_get_event_loop(server), 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	elapsed = (stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e9;
+	printf("benchmarked %s@%d:\t%.3fms per load\n",
+	       s, size, elapsed * 1000 / iterations);
+}
+
+static void
+load_done(struct wl_cursor_theme *theme, void *data)
+{
+	int *done_fd = data;
+	char c = 0;
+	ssize_t len;
+
+	len = write(done_fd[1], &c, 1);
+	assert(len == 1);
+}
+
+static void
+benchmark_async(const char *s, int size, int iterations,
+		struct wl_display *client, struct wl_display *server,
+		struct wl_shm *shm)
+{
+	struct timespec start, stop;
+	struct wl_cursor_theme *theme;
+	double elapsed, blocked = 0;
+	int i, ret, done_fd[2];
+	ssize_t len;
+	char c;
+
+	ret = pipe(done_fd);
+	assert(ret == 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		struct timespec call, ret;
+
+		clock_gettime(CLOCK_MONOTONIC, &call);
+		theme = wl_cursor_theme_load_async(s, size, shm,
+						   load_done, done_fd);
+		clock_gettime(CLOCK_MONOTONIC, &ret);
+		assert(theme);
+		blocked += (ret.tv_sec - call.tv_sec) +
+			(ret.tv_nsec - call.tv_nsec) / 1e9;
+
+		len = read(done_fd[0], &c, 1);
+		assert(len == 1);
+		wl_cursor_theme_destroy(theme);
+
+		wl_display_flush(client);
+		wl_event_loop_dispatch(wl_display_get_event_loop(server), 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	close(done_fd[0]);
+	close(done_fd[1]);
+
+	elapsed = (stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e9;
+	printf("benchmarked async %s@%d:\t%.3fms per load, "
+	       "%.3fms blocked\n", s, size, elapsed * 1000 / iterations,
+	       blocked * 1000 / iterations);
+}
+
+static void
+benchmark_scaled(const char *s, int size, int scaled_size, int iterations,
+		 struct wl_display *client, struct wl_display *server,
+		 struct wl_shm *shm)
+{
+	struct timespec start, stop;
+	struct wl_cursor_theme *base, *theme;
+	double elapsed;
+	int i;
+
+	base = wl_cursor_theme_load(s, size, shm);
+	assert(base);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		theme = wl_cursor_theme_create_scaled(base, scaled_size);
+		assert(theme);
+		wl_cursor_theme_destroy(theme);
+
+		wl_display_flush(client);
+		wl_event_loop_dispatch(wl_display_get_event_loop(server), 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	wl_cursor_theme_destroy(base);
+
+	elapsed = (stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e9;
+	printf("benchmarked scaled %s@%d->%d:\t%.3fms per theme\n",
+	       s, size, scaled_size, elapsed * 1000 / iterations);
+}
+
+static void
+benchmark_frames(const char *s, int size, int iterations, struct wl_shm *shm)
+{
+	struct timespec start, stop;
+	struct wl_cursor_theme *theme;
+	struct wl_cursor *cursor;
+	uint32_t duration, sum = 0;
+	double elapsed;
+	int i, frame;
+
+	theme = wl_cursor_theme_load(s, size, shm);
+	assert(theme);
+	cursor = wl_cursor_theme_get_cursor(theme, "cursor-000");
+	assert(cursor);
+
+	/* Every frame of the synthetic themes lasts 50ms */
+	frame = wl_cursor_frame_and_duration(cursor, 50 * 3 + 20, &duration);
+	assert(frame == 3 && duration == 30);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		frame = wl_cursor_frame_and_duration(cursor, i * 7, &duration);
+		sum += frame + duration;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	wl_cursor_theme_destroy(theme);
+
+	elapsed = (stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e9;
+	printf("benchmarked frame lookup %s@%d:\t%.3fns per lookup (%u)\n",
+	       s, size, elapsed * 1e9 / iterations, sum);
+}
+
+int main(int argc, char *argv[])
+{
+	char root[] = "/tmp/wayland-cursor-benchmark-XXXXXX";
+	struct wl_display *server, *client;
+	struct wl_event_loop *loop;
+	struct shm_listener listener;
+	struct wl_client *server_client;
+	char fd_str[16], *dir;
+	unsigned int i;
+	int s[2], ret;
+
+	dir = mkdtemp(root);
+	assert(dir);
+	for (i = 0; i < ARRAY_LENGTH(specs); i++)
+		write_theme(root, &specs[i]);
+	setenv("XCURSOR_PATH", root, 1);
+	/* The cursor library needs somewhere to create its shm files */
+	setenv("XDG_RUNTIME_DIR", root, 0);
+
+	server = wl_display_create();
+	assert(server);
+	ret = wl_display_init_shm(server);
+	assert(ret == 0);
+	loop = wl_display_get_event_loop(server);
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s);
+	assert(ret == 0);
+	server_client = wl_client_create(server, s[0]);
+	assert(server_client);
+
+	snprintf(fd_str, sizeof fd_str, "%d", s[1]);
+	setenv("WAYLAND_SOCKET", fd_str, 1);
+	client = wl_display_connect(NULL);
+	assert(client);
+	wl_display_get_fd(client, NULL, NULL);
+
+	listener.display = client;
+	listener.shm = NULL;
+	wl_display_add_global_listener(client, handle_global, &listener);
+
+	/* Flush the globals to the client and read them */
+	wl_event_loop_dispatch(loop, 0);
+	wl_display_iterate(client, WL_DISPLAY_READABLE);
+	assert(listener.shm);
+
+	benchmark("small", 24, 200, client, server, listener.shm);
+	benchmark("large", 24, 50, client, server, listener.shm);
+	benchmark("large", 64, 50, client, server, listener.shm);
+	benchmark("animated", 48, 20, client, server, listener.shm);
+	benchmark_async("large", 64, 50, client, server, listener.shm);
+	benchmark_async("animated", 48, 20, client, server, listener.shm);
+	benchmark_scaled("large", 64, 96, 50, client, server, listener.shm);
+	benchmark_scaled("large", 64, 40, 50, client, server, listener.shm);
+	benchmark_frames("animated", 48, 10000000, listener.shm);
+
+	wl_display_disconnect(client);
+	wl_display_destroy(server);
+
+	for (i = 0; i < ARRAY_LENGTH(specs); i++)
+		remove_theme(root, &specs[i]);
+	rmdir(root);
+
+	return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "wayland-server.h"
+#include "wayland-client.h"
+#include "wayland-cursor.h"
+#include "cursor-scale.h"
+#include "test-runner.h"
+
+/* cursor-scale.c built without SSE2, see cursor-scale-generic.c */
+void
+cursor_scale_image_generic(const uint32_t *src, int src_width,
+			   int src_height, uint32_t *dst,
+			   int dst_width, int dst_height);
+
+#define XCURSOR_MAGIC		0x72756358
+#define XCURSOR_IMAGE_TYPE	0xfffd0002
+
+static int
+channels_differ(uint32_t a, uint32_t b, int tolerance)
+{
+	int shift, d;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		d = (int) ((a >> shift) & 0xff) - (int) ((b >> shift) & 0xff);
+		if (d > tolerance || d < -tolerance)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Both implementations, checked against each other */
+static void
+scale(const uint32_t *src, int sw, int sh, uint32_t *dst, int dw, int dh)
+{
+	uint32_t generic[64 * 64];
+	int i;
+
+	assert(dw * dh <= (int) ARRAY_LENGTH(generic));
+
+	cursor_scale_image(src, sw, sh, dst, dw, dh);
+	cursor_scale_image_generic(src, sw, sh, generic, dw, dh);
+
+	/* The box filter may round an exact half differently */
+	for (i = 0; i < dw * dh; i++)
+		assert(!channels_differ(dst[i], generic[i], 1));
+}
+
+TEST(cursor_scale_copy)
+{
+	uint32_t src[3 * 2] = { 1, 2, 3, 4, 5, 6 }, dst[3 * 2];
+
+	scale(src, 3, 2, dst, 3, 2);
+	assert(memcmp(src, dst, sizeof src) == 0);
+}
+
+TEST(cursor_scale_bilinear)
+{
+	/* Black left column, white right column */
+	uint32_t src[2 * 2] = {
+		0x00000000, 0xffffffff,
+		0x00000000, 0xffffffff,
+	};
+	uint32_t dst[4 * 4], row[4] = {
+		0x00000000, 0x3f3f3f3f, 0xbfbfbfbf, 0xffffffff
+	};
+	int y;
+
+	/* Sampling at pixel centers, the outer destination pixels sit
+	 * on the source pixels and the inner ones a quarter of the
+	 * way between them */
+	scale(src, 2, 2, dst, 4, 4);
+	for (y = 0; y < 4; y++)
+		assert(memcmp(dst + y * 4, row, sizeof row) == 0);
+
+	/* Channels are filtered independently */
+	src[0] = src[2] = 0xff000000;
+	src[1] = src[3] = 0x000000ff;
+	scale(src, 2, 2, dst, 4, 4);
+	assert(dst[0] == 0xff000000);
+	assert(dst[1] == 0xbf00003f);
+	assert(dst[2] == 0x3f0000bf);
+	assert(dst[3] == 0x000000ff);
+
+	/* Stretched in one direction only */
+	scale(src, 2, 2, dst, 4, 2);
+	assert(dst[1] == 0xbf00003f && dst[5] == 0xbf00003f);
+}
+
+TEST(cursor_scale_box)
+{
+	uint32_t src[4 * 4], dst[2 * 2];
+	int x, y;
+
+	/* Every destination pixel averages a 2x2 block */
+	for (y = 0; y < 4; y++)
+		for (x = 0; x < 4; x++)
+			src[y * 4 + x] = 0x01010101 * (y * 4 + x) * 4;
+
+	scale(src, 4, 4, dst, 2, 2);
+	assert(dst[0] == 0x0a0a0a0a);	/* (0 + 1 + 4 + 5) * 4 / 4 */
+	assert(dst[1] == 0x12121212);	/* (2 + 3 + 6 + 7) * 4 / 4 */
+	assert(dst[2] == 0x2a2a2a2a);	/* (8 + 9 + 12 + 13) * 4 / 4 */
+	assert(dst[3] == 0x32323232);	/* (10 + 11 + 14 + 15) * 4 / 4 */
+
+	/* Shrinking to a single pixel averages everything */
+	scale(src, 4, 4, dst, 1, 1);
+	assert(dst[0] == 0x1e1e1e1e);
+
+	/* A single row can't be filtered bilinearly and is boxed even
+	 * when enlarged */
+	scale(src, 2, 1, dst, 4, 1);
+	assert(dst[0] == src[0] && dst[1] == src[0]);
+	assert(dst[2] == src[1] && dst[3] == src[1]);
+}
+
+TEST(cursor_scale_matches_generic)
+{
+	uint32_t src[32 * 32], dst[64 * 64];
+	static const int sizes[][2] = {
+		{ 24, 48 }, { 24, 36 }, { 24, 32 }, { 32, 24 },
+		{ 32, 17 }, { 24, 7 }, { 3, 64 }, { 2, 2 },
+	};
+	unsigned int i;
+	int a;
+
+	srand(0);
+	for (i = 0; i < ARRAY_LENGTH(src); i++) {
+		/* Premultiplied: no channel above alpha */
+		a = rand() & 0xff;
+		src[i] = a << 24 | (rand() % (a + 1)) << 16 |
+			(rand() % (a + 1)) << 8 | (rand() % (a + 1));
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(sizes); i++) {
+		scale(src, sizes[i][0], sizes[i][0],
+		      dst, sizes[i][1], sizes[i][1]);
+		scale(src, sizes[i][0], sizes[i][1] < 32 ? sizes[i][1] : 32,
+		      dst, sizes[i][1], sizes[i][0]);
+	}
+}
+
+static void
+put_uint(FILE *f, uint32_t u)
+{
+	unsigned char b[4];
+
+	b[0] = u;
+	b[1] = u >> 8;
+	b[2] = u >> 16;
+	b[3] = u >> 24;
+	assert(fwrite(b, 1, sizeof b, f) == sizeof b);
+}
+
+/* A cursor of two 24x24 frames, with its hotspot at (6, 18), saved
+ * with the given nominal size */
+static void
+write_cursor_file(const char *path, uint32_t nominal)
+{
+	FILE *f;
+	uint32_t i, j;
+
+	f = fopen(path, "w");
+	assert(f);
+
+	put_uint(f, XCURSOR_MAGIC);
+	put_uint(f, 16);
+	put_uint(f, 0x10000);
+	put_uint(f, 2);
+	for (i = 0; i < 2; i++) {
+		put_uint(f, XCURSOR_IMAGE_TYPE);
+		put_uint(f, nominal);
+		put_uint(f, 16 + 2 * 12 + i * (36 + 24 * 24 * 4));
+	}
+
+	for (i = 0; i < 2; i++) {
+		put_uint(f, 36);
+		put_uint(f, XCURSOR_IMAGE_TYPE);
+		put_uint(f, nominal);
+		put_uint(f, 1);
+		put_uint(f, 24);
+		put_uint(f, 24);
+		put_uint(f, 6);
+		put_uint(f, 18);
+		put_uint(f, 40 + i * 20);
+		for (j = 0; j < 24 * 24; j++)
+			put_uint(f, 0xff000000 | j);
+	}
+
+	fclose(f);
+}
+
+static void
+handle_global(struct wl_display *display, uint32_t id,
+	      const char *interface, uint32_t version, void *data)
+{
+	struct wl_shm **shm = data;
+
+	if (strcmp(interface, "wl_shm") == 0)
+		*shm = wl_display_bind(display, id, &wl_shm_interface);
+}
+
+static void
+check_scaled(struct wl_cursor_theme *base, int size,
+	     int width, int hotspot_x, int hotspot_y)
+{
+	struct wl_cursor_theme *theme;
+	struct wl_cursor *cursor;
+	struct wl_cursor_image *image;
+	unsigned int i;
+
+	theme = wl_cursor_theme_create_scaled(base, size);
+	assert(theme);
+
+	cursor = wl_cursor_theme_get_cursor(theme, "left_ptr");
+	assert(cursor);
+	assert(strcmp(cursor->name, "left_ptr") == 0);
+	assert(cursor->image_count == 2);
+
+	for (i = 0; i < cursor->image_count; i++) {
+		image = cursor->images[i];
+		assert(image->width == (uint32_t) width);
+		assert(image->height == (uint32_t) width);
+		assert(image->hotspot_x == (uint32_t) hotspot_x);
+		assert(image->hotspot_y == (uint32_t) hotspot_y);
+		assert(image->delay == 40 + i * 20);
+		assert(wl_cursor_image_get_buffer(image));
+	}
+
+	/* Frames are looked up on the scaled cursor as on the base */
+	assert(wl_cursor_frame(cursor, 50) == 1);
+
+	wl_cursor_theme_destroy(theme);
+}
+
+/* setenv() and the theme loader allocate, so this runs in a child
+ * process that isn't checked for leaks */
+static void
+run_scaled_theme(void)
+{
+	char root[] = "/tmp/wayland-cursor-scale-test-XXXXXX";
+	char path[256], zero_path[256], fd_str[16];
+	struct wl_display *server, *client;
+	struct wl_cursor_theme *base;
+	struct wl_shm *shm = NULL;
+	int s[2];
+
+	assert(mkdtemp(root));
+	snprintf(path, sizeof path, "%s/test", root);
+	assert(mkdir(path, 0700) == 0);
+	snprintf(path, sizeof path, "%s/test/cursors", root);
+	assert(mkdir(path, 0700) == 0);
+	snprintf(path, sizeof path, "%s/test/cursors/left_ptr", root);
+	write_cursor_file(path, 24);
+	snprintf(zero_path, sizeof zero_path, "%s/test/cursors/zero", root);
+	write_cursor_file(zero_path, 0);
+	setenv("XCURSOR_PATH", root, 1);
+	setenv("XDG_RUNTIME_DIR", root, 1);
+
+	server = wl_display_create();
+	assert(server);
+	assert(wl_display_init_shm(server) == 0);
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	assert(wl_client_create(server, s[0]));
+	snprintf(fd_str, sizeof fd_str, "%d", s[1]);
+	setenv("WAYLAND_SOCKET", fd_str, 1);
+	client = wl_display_connect(NULL);
+	assert(client);
+
+	wl_display_add_global_listener(client, handle_global, &shm);
+	wl_event_loop_dispatch(wl_display_get_event_loop(server), 0);
+	wl_display_iterate(client, WL_DISPLAY_READABLE);
+	assert(shm);
+
+	base = wl_cursor_theme_load("test", 24, shm);
+	assert(base);
+	/* Images without a nominal size can't be scaled and are skipped */
+	assert(wl_cursor_theme_get_cursor(base, "zero") == NULL);
+
+	check_scaled(base, 24, 24, 6, 18);
+	check_scaled(base, 48, 48, 12, 36);
+	check_scaled(base, 36, 36, 9, 27);
+	check_scaled(base, 16, 16, 4, 12);
+	/* The hotspot stays inside the image */
+	check_scaled(base, 1, 1, 0, 0);
+	assert(wl_cursor_theme_create_scaled(base, 0) == NULL);
+
+	wl_cursor_theme_destroy(base);
+	wl_display_disconnect(client);
+	wl_display_destroy(server);
+
+	unlink(path);
+	unlink(zero_path);
+	snprintf(path, sizeof path, "%s/test/cursors", root);
+	rmdir(path);
+	snprintf(path, sizeof path, "%s/test", root);
+	rmdir(path);
+	rmdir(root);
+}
+
+TEST(cursor_theme_create_scaled)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_scaled_theme();
+		_exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "wayland-server.h"
+#include "wayland-client.h"
+#include "wayland-cursor.h"
+#include "test-runner.h"
+
+#define XCURSOR_MAGIC		0x72756358
+#define XCURSOR_IMAGE_TYPE	0xfffd0002
+#define CURSOR_SIZE		8
+
+struct cursor_spec {
+	const char *name;
+	int frames;
+	uint32_t delays[4];
+};
+
+static const struct cursor_spec cursors[] = {
+	/* The second frame has no delay and is never shown */
+	{ "animated", 4, { 10, 0, 30, 20 } },
+	{ "static", 1, { 50 } },
+	{ "stopped", 2, { 0, 0 } },
+};
+
+static void
+put_uint(FILE *f, uint32_t u)
+{
+	unsigned char b[4];
+
+	b[0] = u;
+	b[1] = u >> 8;
+	b[2] = u >> 16;
+	b[3] = u >> 24;
+	assert(fwrite(b, 1, sizeof b, f) == sizeof b);
+}
+
+static void
+write_cursor_file(const char *path, const struct cursor_spec *spec)
+{
+	FILE *f;
+	int i, j;
+
+	f = fopen(path, "w");
+	assert(f);
+
+	put_uint(f, XCURSOR_MAGIC);
+	put_uint(f, 16);
+	put_uint(f, 0x10000);
+	put_uint(f, spec->frames);
+	for (i = 0; i < spec->frames; i++) {
+		put_uint(f, XCURSOR_IMAGE_TYPE);
+		put_uint(f, CURSOR_SIZE);
+		put_uint(f, 16 + spec->frames * 12 +
+			 i * (36 + CURSOR_SIZE * CURSOR_SIZE * 4));
+	}
+
+	for (i = 0; i < spec->frames; i++) {
+		put_uint(f, 36);
+		put_uint(f, XCURSOR_IMAGE_TYPE);
+		put_uint(f, CURSOR_SIZE);
+		put_uint(f, 1);
+		put_uint(f, CURSOR_SIZE);
+		put_uint(f, CURSOR_SIZE);
+		put_uint(f, 0);
+		put_uint(f, 0);
+		put_uint(f, spec->delays[i]);
+		for (j = 0; j < CURSOR_SIZE * CURSOR_SIZE; j++)
+			put_uint(f, 0xff000000 | i);
+	}
+
+	fclose(f);
+}
+
+static void
+handle_global(struct wl_display *display, uint32_t id,
+	      const char *interface, uint32_t version, void *data)
+{
+	struct wl_shm **shm = data;
+
+	if (strcmp(interface, "wl_shm") == 0)
+		*shm = wl_display_bind(display, id, &wl_shm_interface);
+}
+
+static void
+check_frame(struct wl_cursor *cursor, uint32_t time,
+	    int frame, uint32_t duration)
+{
+	uint32_t d = 0xdeadbeef;
+
+	assert(wl_cursor_frame_and_duration(cursor, time, &d) == frame);
+	assert(d == duration);
+	assert(wl_cursor_frame_and_duration(cursor, time, NULL) == frame);
+	assert(wl_cursor_frame(cursor, time) == frame);
+}
+
+static void
+check_frames(struct wl_cursor_theme *theme)
+{
+	struct wl_cursor *cursor;
+
+	cursor = wl_cursor_theme_get_cursor(theme, "animated");
+	assert(cursor && cursor->image_count == 4);
+
+	/* Each frame is shown from the end of the previous one up to,
+	 * but not including, its own end: 10, 10, 40 and 60ms */
+	check_frame(cursor, 0, 0, 10);
+	check_frame(cursor, 9, 0, 1);
+	check_frame(cursor, 10, 2, 30);
+	check_frame(cursor, 39, 2, 1);
+	check_frame(cursor, 40, 3, 20);
+	check_frame(cursor, 59, 3, 1);
+
+	/* Past the total duration the animation starts over */
+	check_frame(cursor, 60, 0, 10);
+	check_frame(cursor, 60 * 1000 + 45, 3, 15);
+	check_frame(cursor, UINT32_MAX, 2, 25);	/* UINT32_MAX % 60 == 15 */
+
+	/* A single image is shown for good */
+	cursor = wl_cursor_theme_get_cursor(theme, "static");
+	assert(cursor && cursor->image_count == 1);
+	check_frame(cursor, 0, 0, 0);
+	check_frame(cursor, 50, 0, 0);
+	check_frame(cursor, UINT32_MAX, 0, 0);
+
+	/* So is the first of several that have no delay */
+	cursor = wl_cursor_theme_get_cursor(theme, "stopped");
+	assert(cursor && cursor->image_count == 2);
+	check_frame(cursor, 0, 0, 0);
+	check_frame(cursor, 1000, 0, 0);
+}
+
+/* setenv() and the theme loader allocate, so this runs in a child
+ * process that isn't checked for leaks */
+static void
+run_frames(void)
+{
+	char root[] = "/tmp/wayland-cursor-test-XXXXXX";
+	char path[256], fd_str[16];
+	struct wl_display *server, *client;
+	struct wl_cursor_theme *theme, *scaled;
+	struct wl_shm *shm = NULL;
+	unsigned int i;
+	int s[2];
+
+	assert(mkdtemp(root));
+	snprintf(path, sizeof path, "%s/test", root);
+	assert(mkdir(path, 0700) == 0);
+	snprintf(path, sizeof path, "%s/test/cursors", root);
+	assert(mkdir(path, 0700) == 0);
+	for (i = 0; i < ARRAY_LENGTH(cursors); i++) {
+		snprintf(path, sizeof path, "%s/test/cursors/%s",
+			 root, cursors[i].name);
+		write_cursor_file(path, &cursors[i]);
+	}
+	setenv("XCURSOR_PATH", root, 1);
+	setenv("XDG_RUNTIME_DIR", root, 1);
+
+	server = wl_display_create();
+	assert(server);
+	assert(wl_display_init_shm(server) == 0);
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	assert(wl_client_create(server, s[0]));
+	snprintf(fd_str, sizeof fd_str, "%d", s[1]);
+	setenv("WAYLAND_SOCKET", fd_str, 1);
+	client = wl_display_connect(NULL);
+	assert(client);
+
+	wl_display_add_global_listener(client, handle_global, &shm);
+	wl_event_loop_dispatch(wl_display_get_event_loop(server), 0);
+	wl_display_iterate(client, WL_DISPLAY_READABLE);
+	assert(shm);
+
+	theme = wl_cursor_theme_load("test", CURSOR_SIZE, shm);
+	assert(theme);
+	check_frames(theme);
+
+	/* Scaled cursors keep the delays of the frames */
+	scaled = wl_cursor_theme_create_scaled(theme, 2 * CURSOR_SIZE);
+	assert(scaled);
+	check_frames(scaled);
+
+	wl_cursor_theme_destroy(scaled);
+	wl_cursor_theme_destroy(theme);
+	wl_display_disconnect(client);
+	wl_display_destroy(server);
+
+	for (i = 0; i < ARRAY_LENGTH(cursors); i++) {
+		snprintf(path, sizeof path, "%s/test/cursors/%s",
+			 root, cursors[i].name);
+		unlink(path);
+	}
+	snprintf(path, sizeof path, "%s/test/cursors", root);
+	rmdir(path);
+	snprintf(path, sizeof path, "%s/test", root);
+	rmdir(path);
+	rmdir(root);
+}
+
+TEST(cursor_frame_and_duration)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_frames();
+		_exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
@@ -0,0 +1,712 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "wayland-server.h"
+#include "wayland-client.h"
+#include "test-runner.h"
+
+#define SOCKET_NAME "wayland-data-device-test"
+#define TEXT "text to paste"
+#define PASTES 3
+#define LARGE_SIZE (16 * 1024)
+
+struct selection_test {
+	struct wl_display *display;
+	struct wl_event_source *timer;
+	struct wl_seat seat;
+	struct wl_keyboard keyboard;
+	struct wl_data_source source;
+	int client_source;
+	int sends[3];
+	int focused;
+};
+
+static const char *cached_types[] = { "text/plain", "text/x-large", NULL };
+
+static void
+source_accept(struct wl_data_source *source,
+	      uint32_t serial, const char *mime_type)
+{
+}
+
+static void
+source_send(struct wl_data_source *source, const char *mime_type,
+	    int32_t fd)
+{
+	struct selection_test *test =
+		container_of(source, struct selection_test, source);
+	char large[LARGE_SIZE];
+
+	if (strcmp(mime_type, "text/x-large") == 0) {
+		test->sends[2]++;
+		memset(large, 'x', sizeof large);
+		assert(write(fd, large, sizeof large) == sizeof large);
+	} else {
+		test->sends[strcmp(mime_type, "text/plain") == 0 ? 0 : 1]++;
+		assert(write(fd, TEXT, sizeof TEXT) == sizeof TEXT);
+	}
+	close(fd);
+}
+
+static void
+source_cancel(struct wl_data_source *source)
+{
+}
+
+static void
+bind_seat(struct wl_client *client, void *data, uint32_t version,
+	  uint32_t id)
+{
+	wl_client_add_object(client, &wl_seat_interface, NULL, id, data);
+}
+
+static int
+check_progress(void *data)
+{
+	struct selection_test *test = data;
+	struct wl_list *devices = &test->seat.drag_resource_list;
+	struct wl_data_source *source = test->seat.selection_data_source;
+	int focus;
+
+	/* Focus the client as soon as it has a data device and there is
+	 * a selection, twice if the client made the selection, and stop
+	 * once the client is gone again */
+	focus = !wl_list_empty(devices) && source &&
+		test->focused < (test->client_source ? 2 : 1);
+	if (focus) {
+		/* Each type only once */
+		if (test->client_source)
+			assert(source->mime_types.size == 2 * sizeof(char *));
+		test->keyboard.focus_resource =
+			container_of(devices->next, struct wl_resource, link);
+		wl_data_device_set_keyboard_focus(&test->seat);
+		test->focused++;
+	} else if (test->focused && wl_list_empty(devices)) {
+		test->keyboard.focus_resource = NULL;
+		wl_display_terminate(test->display);
+		return 1;
+	}
+
+	wl_event_source_timer_update(test->timer, 10);
+
+	return 1;
+}
+
+struct offer_log {
+	struct wl_data_offer *selection;
+	int selections;
+	int count;
+	char types[8][32];
+};
+
+static void
+data_offer_offer(void *data, struct wl_data_offer *offer, const char *type)
+{
+	struct offer_log *log = data;
+
+	assert(log->count < (int) ARRAY_LENGTH(log->types));
+	assert(strlen(type) < sizeof log->types[0]);
+	strcpy(log->types[log->count++], type);
+}
+
+static const struct wl_data_offer_listener data_offer_listener = {
+	data_offer_offer,
+};
+
+static void
+data_device_data_offer(void *data, struct wl_data_device *data_device,
+		       struct wl_data_offer *offer)
+{
+	wl_data_offer_add_listener(offer, &data_offer_listener, data);
+}
+
+static void
+data_device_selection(void *data, struct wl_data_device *data_device,
+		      struct wl_data_offer *offer)
+{
+	struct offer_log *log = data;
+
+	log->selection = offer;
+	log->selections++;
+}
+
+static const struct wl_data_device_listener data_device_listener = {
+	data_device_data_offer,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	data_device_selection,
+};
+
+static void
+paste(struct wl_display *display, struct wl_data_offer *offer,
+      const char *mime_type)
+{
+	char buffer[64];
+	int p[2], len, total = 0;
+
+	assert(pipe(p) == 0);
+	wl_data_offer_receive(offer, mime_type, p[1]);
+	close(p[1]);
+	wl_display_roundtrip(display);
+
+	while ((len = read(p[0], buffer + total,
+			   sizeof buffer - total)) > 0)
+		total += len;
+	close(p[0]);
+
+	assert(total == sizeof TEXT);
+	assert(strcmp(buffer, TEXT) == 0);
+}
+
+/* Walk away from a paste that doesn't fit the pipe, leaving the
+ * compositor to find the read end gone */
+static void
+paste_abort(struct wl_display *display, struct wl_data_offer *offer,
+	    const char *mime_type)
+{
+	char c;
+	int p[2];
+
+	assert(pipe(p) == 0);
+	assert(fcntl(p[0], F_SETPIPE_SZ, 4096) >= 0);
+	wl_data_offer_receive(offer, mime_type, p[1]);
+	close(p[1]);
+	wl_display_roundtrip(display);
+
+	assert(read(p[0], &c, 1) == 1 && c == 'x');
+	close(p[0]);
+	wl_display_roundtrip(display);
+}
+
+static void
+run_client(void)
+{
+	struct wl_display *display;
+	struct wl_seat *seat;
+	struct wl_data_device_manager *manager;
+	struct wl_data_device *data_device;
+	struct offer_log log;
+	uint32_t id;
+	int i;
+
+	display = wl_display_connect(SOCKET_NAME);
+	assert(display);
+	wl_display_roundtrip(display);
+
+	id = wl_display_get_global(display, "wl_seat", 1);
+	assert(id);
+	seat = wl_display_bind(display, id, &wl_seat_interface);
+	id = wl_display_get_global(display, "wl_data_device_manager", 1);
+	assert(id);
+	manager = wl_display_bind(display, id,
+				  &wl_data_device_manager_interface);
+	data_device = wl_data_device_manager_get_data_device(manager, seat);
+	memset(&log, 0, sizeof log);
+	wl_data_device_add_listener(data_device, &data_device_listener, &log);
+	wl_display_flush(display);
+
+	while (!log.selection)
+		wl_display_iterate(display, WL_DISPLAY_READABLE);
+	assert(log.count == 3);
+	assert(strcmp(log.types[0], "text/plain") == 0);
+	assert(strcmp(log.types[1], "text/html") == 0);
+	assert(strcmp(log.types[2], "text/x-large") == 0);
+
+	for (i = 0; i < PASTES; i++)
+		paste(display, log.selection, "text/plain");
+	paste(display, log.selection, "text/html");
+	paste_abort(display, log.selection, "text/x-large");
+
+	wl_display_disconnect(display);
+}
+
+static void
+run_source_client(void)
+{
+	struct wl_display *display;
+	struct wl_seat *seat;
+	struct wl_data_device_manager *manager;
+	struct wl_data_device *data_device;
+	struct wl_data_source *source;
+	struct offer_log log;
+	uint32_t id;
+
+	display = wl_display_connect(SOCKET_NAME);
+	assert(display);
+	wl_display_roundtrip(display);
+
+	id = wl_display_get_global(display, "wl_seat", 1);
+	assert(id);
+	seat = wl_display_bind(display, id, &wl_seat_interface);
+	id = wl_display_get_global(display, "wl_data_device_manager", 1);
+	assert(id);
+	manager = wl_display_bind(display, id,
+				  &wl_data_device_manager_interface);
+	data_device = wl_data_device_manager_get_data_device(manager, seat);
+	memset(&log, 0, sizeof log);
+	wl_data_device_add_listener(data_device, &data_device_listener, &log);
+
+	source = wl_data_device_manager_create_data_source(manager);
+	wl_data_source_offer(source, "text/plain");
+	wl_data_source_offer(source, "text/plain");
+	wl_data_source_offer(source, "text/html");
+	wl_data_source_offer(source, "text/plain");
+	wl_data_device_set_selection(data_device, source, 0);
+	wl_display_flush(display);
+
+	/* Every offer made from the source lists its types once */
+	while (log.selections < 2)
+		wl_display_iterate(display, WL_DISPLAY_READABLE);
+	assert(log.count == 4);
+	assert(strcmp(log.types[0], "text/plain") == 0);
+	assert(strcmp(log.types[1], "text/html") == 0);
+	assert(strcmp(log.types[2], "text/plain") == 0);
+	assert(strcmp(log.types[3], "text/html") == 0);
+
+	wl_display_disconnect(display);
+}
+
+static void
+run_server(int client_source)
+{
+	struct selection_test test;
+	char dir[] = "/tmp/wayland-data-device-test-XXXXXX";
+	struct wl_event_loop *loop;
+	char **p;
+	pid_t pid;
+	int status;
+
+	assert(mkdtemp(dir));
+	setenv("XDG_RUNTIME_DIR", dir, 1);
+
+	memset(&test, 0, sizeof test);
+	test.client_source = client_source;
+	test.display = wl_display_create();
+	assert(test.display);
+	loop = wl_display_get_event_loop(test.display);
+	assert(wl_display_add_socket(test.display, SOCKET_NAME) == 0);
+	assert(wl_data_device_manager_init(test.display) == 0);
+
+	wl_seat_init(&test.seat);
+	wl_keyboard_init(&test.keyboard);
+	wl_seat_set_keyboard(&test.seat, &test.keyboard);
+	assert(wl_display_add_global(test.display, &wl_seat_interface,
+				     &test.seat, bind_seat));
+	if (!client_source) {
+		assert(wl_seat_set_selection_cache(&test.seat, loop,
+						   cached_types,
+						   LARGE_SIZE) == 0);
+
+		wl_signal_init(&test.source.resource.destroy_signal);
+		wl_array_init(&test.source.mime_types);
+		p = wl_array_add(&test.source.mime_types, 3 * sizeof *p);
+		p[0] = "text/plain";
+		p[1] = "text/html";
+		p[2] = "text/x-large";
+		test.source.accept = source_accept;
+		test.source.send = source_send;
+		test.source.cancel = source_cancel;
+
+		/* The cached types are asked for right away */
+		wl_seat_set_selection(&test.seat, &test.source,
+				      wl_display_next_serial(test.display));
+		assert(test.sends[0] == 1 && test.sends[1] == 0 &&
+		       test.sends[2] == 1);
+	}
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		if (client_source)
+			run_source_client();
+		else
+			run_client();
+		_exit(EXIT_SUCCESS);
+	}
+
+	test.timer = wl_event_loop_add_timer(loop, check_progress, &test);
+	wl_event_source_timer_update(test.timer, 10);
+
+	wl_display_run(test.display);
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	/* Only the uncached type went back to the source */
+	if (!client_source)
+		assert(test.sends[0] == 1 && test.sends[1] == 1 &&
+		       test.sends[2] == 1);
+
+	wl_event_source_remove(test.timer);
+	wl_seat_release(&test.seat);
+	wl_display_destroy(test.display);
+	rmdir(dir);
+}
+
+#define MOTIONS 50
+
+struct drag_test {
+	struct wl_display *display;
+	struct wl_event_source *timer;
+	struct wl_seat seat;
+	struct wl_pointer pointer;
+	struct wl_surface surface;
+	int has_surface;
+	int step;
+	int moved;
+	int stall_fd;
+};
+
+static void
+destroy_surface(struct wl_resource *resource)
+{
+}
+
+static void
+compositor_create_surface(struct wl_client *client,
+			  struct wl_resource *resource, uint32_t id)
+{
+	struct drag_test *test = resource->data;
+
+	test->surface.resource.object.id = id;
+	test->surface.resource.object.interface = &wl_surface_interface;
+	test->surface.resource.object.implementation = NULL;
+	test->surface.resource.data = &test->surface;
+	test->surface.resource.destroy = destroy_surface;
+	wl_signal_init(&test->surface.resource.destroy_signal);
+	wl_client_add_resource(client, &test->surface.resource);
+	test->has_surface = 1;
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+	compositor_create_surface,
+	NULL,
+};
+
+static void
+bind_compositor(struct wl_client *client, void *data, uint32_t version,
+		uint32_t id)
+{
+	wl_client_add_object(client, &wl_compositor_interface,
+			     &compositor_implementation, id, data);
+}
+
+static void
+move_pointer_to(struct drag_test *test, int i)
+{
+	struct wl_pointer_grab *grab = test->pointer.grab;
+
+	grab->interface->motion(grab, i, wl_fixed_from_int(i),
+				wl_fixed_from_int(i));
+}
+
+static void
+move_pointer(struct drag_test *test, int start)
+{
+	int i;
+
+	for (i = start; i < start + MOTIONS; i++)
+		move_pointer_to(test, i);
+}
+
+static void
+release_button(struct drag_test *test)
+{
+	struct wl_pointer_grab *grab = test->pointer.grab;
+
+	test->pointer.grab_button = 0x110;
+	grab->interface->button(grab, 2 * MOTIONS, 0x110,
+				WL_POINTER_BUTTON_STATE_RELEASED);
+}
+
+static int
+drag_progress(void *data)
+{
+	struct drag_test *test = data;
+	struct wl_list *devices = &test->seat.drag_resource_list;
+	const struct wl_data_device_interface *implementation;
+	struct wl_resource *device;
+
+	switch (test->step) {
+	case 0:
+		/* Start dragging over the client's surface */
+		if (wl_list_empty(devices) || !test->has_surface)
+			break;
+		device = container_of(devices->next, struct wl_resource, link);
+		implementation = (const struct wl_data_device_interface *)
+			device->object.implementation;
+		test->pointer.current = &test->surface;
+		implementation->start_drag(device->client, device, NULL,
+					   &test->surface.resource, NULL, 0);
+		move_pointer(test, 0);
+		test->step++;
+		break;
+	case 1:
+		if (test->stall_fd >= 0) {
+			/* Move once per dispatch while the client is
+			 * stalled, so that each motion has been written to
+			 * the socket before the next, then let it go on */
+			move_pointer_to(test, MOTIONS + test->moved++);
+			if (test->moved == MOTIONS) {
+				assert(write(test->stall_fd, "", 1) == 1);
+				test->step++;
+			}
+			break;
+		}
+		/* Release the button right after moving, with the last
+		 * motion still held back */
+		move_pointer(test, MOTIONS);
+		release_button(test);
+		test->step += 2;
+		break;
+	case 2:
+		/* Drop with the motion held back from the stalled client */
+		release_button(test);
+		test->step++;
+		break;
+	default:
+		if (wl_list_empty(devices)) {
+			wl_display_terminate(test->display);
+			return 1;
+		}
+	}
+
+	wl_event_source_timer_update(test->timer, 10);
+
+	return 1;
+}
+
+struct drag_log {
+	int enters;
+	int motions;
+	int drops;
+	wl_fixed_t x;
+	int stall_fd;
+};
+
+static void
+drag_enter(void *data, struct wl_data_device *data_device,
+	   uint32_t serial, struct wl_surface *surface,
+	   wl_fixed_t x, wl_fixed_t y, struct wl_data_offer *offer)
+{
+	struct drag_log *log = data;
+
+	log->enters++;
+}
+
+static void
+drag_leave(void *data, struct wl_data_device *data_device)
+{
+}
+
+static void
+drag_motion(void *data, struct wl_data_device *data_device,
+	    uint32_t time, wl_fixed_t x, wl_fixed_t y)
+{
+	struct drag_log *log = data;
+	char c;
+
+	assert(log->enters == 1 && log->drops == 0);
+	assert(x > log->x || log->motions == 0);
+	log->motions++;
+	log->x = x;
+
+	/* Stop reading on the first motion, until the server says */
+	if (log->stall_fd >= 0 && log->motions == 1)
+		assert(read(log->stall_fd, &c, 1) == 1);
+}
+
+static void
+drag_drop(void *data, struct wl_data_device *data_device)
+{
+	struct drag_log *log = data;
+
+	log->drops++;
+}
+
+static const struct wl_data_device_listener drag_listener = {
+	data_device_data_offer,
+	drag_enter,
+	drag_leave,
+	drag_motion,
+	drag_drop,
+	NULL,
+};
+
+static void
+run_drag_client(int stall_fd)
+{
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_seat *seat;
+	struct wl_data_device_manager *manager;
+	struct wl_data_device *data_device;
+	struct drag_log log;
+	uint32_t id;
+
+	display = wl_display_connect(SOCKET_NAME);
+	assert(display);
+	wl_display_roundtrip(display);
+
+	id = wl_display_get_global(display, "wl_compositor", 1);
+	assert(id);
+	compositor = wl_display_bind(display, id, &wl_compositor_interface);
+	wl_compositor_create_surface(compositor);
+	id = wl_display_get_global(display, "wl_seat", 1);
+	assert(id);
+	seat = wl_display_bind(display, id, &wl_seat_interface);
+	id = wl_display_get_global(display, "wl_data_device_manager", 1);
+	assert(id);
+	manager = wl_display_bind(display, id,
+				  &wl_data_device_manager_interface);
+	data_device = wl_data_device_manager_get_data_device(manager, seat);
+	memset(&log, 0, sizeof log);
+	log.stall_fd = stall_fd;
+	wl_data_device_add_listener(data_device, &drag_listener, &log);
+	wl_display_flush(display);
+
+	while (!log.drops)
+		wl_display_iterate(display, WL_DISPLAY_READABLE);
+
+	/* Motion came in bursts, each delivered once, with the final
+	 * position before the drop.  While stalled, the client didn't
+	 * read the first motion after it stopped, so the rest were held
+	 * back even though each was sent on its own. */
+	assert(log.enters == 1);
+	assert(log.motions >= 2 && log.motions < 2 * MOTIONS);
+	if (stall_fd >= 0)
+		assert(log.motions <= 3);
+	assert(log.x == wl_fixed_from_int(2 * MOTIONS - 1));
+
+	wl_display_disconnect(display);
+}
+
+static void
+run_drag_server(int stall)
+{
+	struct drag_test test;
+	int stall_fds[2] = { -1, -1 };
+	char dir[] = "/tmp/wayland-data-device-test-XXXXXX";
+	struct wl_event_loop *loop;
+	pid_t pid;
+	int status;
+
+	assert(mkdtemp(dir));
+	setenv("XDG_RUNTIME_DIR", dir, 1);
+
+	memset(&test, 0, sizeof test);
+	test.display = wl_display_create();
+	assert(test.display);
+	loop = wl_display_get_event_loop(test.display);
+	assert(wl_display_add_socket(test.display, SOCKET_NAME) == 0);
+	assert(wl_data_device_manager_init(test.display) == 0);
+	assert(wl_display_add_global(test.display, &wl_compositor_interface,
+				     &test, bind_compositor));
+
+	wl_seat_init(&test.seat);
+	wl_pointer_init(&test.pointer);
+	wl_seat_set_pointer(&test.seat, &test.pointer);
+	assert(wl_display_add_global(test.display, &wl_seat_interface,
+				     &test.seat, bind_seat));
+	assert(wl_seat_set_drag_motion_throttle(&test.seat, loop, 0) == 0);
+
+	if (stall)
+		assert(socketpair(AF_UNIX, SOCK_STREAM, 0, stall_fds) == 0);
+	test.stall_fd = stall_fds[0];
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_drag_client(stall_fds[1]);
+		_exit(EXIT_SUCCESS);
+	}
+
+	test.timer = wl_event_loop_add_timer(loop, drag_progress, &test);
+	wl_event_source_timer_update(test.timer, 10);
+
+	wl_display_run(test.display);
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	if (stall) {
+		close(stall_fds[0]);
+		close(stall_fds[1]);
+	}
+	wl_event_source_remove(test.timer);
+	wl_seat_release(&test.seat);
+	wl_display_destroy(test.display);
+	rmdir(dir);
+}
+
+/* The servers call setenv(), which allocates, so they run in a child
+ * process that isn't checked for leaks */
+static void
+fork_server(void (*server)(int), int arg)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		server(arg);
+		_exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+TEST(selection_cache)
+{
+	fork_server(run_server, 0);
+}
+
+TEST(client_source_offers)
+{
+	fork_server(run_server, 1);
+}
+
+TEST(drag_motion_throttle)
+{
+	fork_server(run_drag_server, 0);
+}
+
+TEST(drag_motion_throttle_stalled)
+{
+	fork_server(run_drag_server, 1);
+}
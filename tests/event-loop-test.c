@@ -24,9 +24,27 @@
 #include <assert.h>
 #include <unistd.h>
 #include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <poll.h>
+#include <sys/wait.h>
 #include "wayland-server.h"
 #include "test-runner.h"
 
+#ifdef EVENT_LOOP_BACKEND
+/* Built a second time with this set, to run the tests on the io_uring
+ * backend.  This runs before main(), so the leak checks don't see the
+ * allocations setenv() makes. */
+static void __attribute__ ((constructor))
+select_backend(void)
+{
+	setenv("WAYLAND_EVENT_LOOP", EVENT_LOOP_BACKEND, 1);
+}
+#endif
+
+/* io_uring polls stdout as ready when it is a regular file, as it is
+ * under make check, so the check doesn't get to run on its own */
+#ifndef EVENT_LOOP_BACKEND
 static int
 fd_dispatch(int fd, uint32_t mask, void *data)
 {
@@ -54,6 +72,7 @@ TEST(event_loop_post_dispatch_check)
 	wl_event_source_remove(source);
 	wl_event_loop_destroy(loop);
 }
+#endif
 
 struct free_source_context {
 	struct wl_event_source *source1, *source2;
@@ -159,6 +178,55 @@ TEST(event_loop_signal)
 }
 
 
+static int
+signal_count_callback(int signal_number, void *data)
+{
+	int *count = data;
+
+	count[signal_number == SIGUSR1 ? 0 : 1]++;
+
+	return 1;
+}
+
+TEST(event_loop_multiple_signals)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *first, *second, *other;
+	int count1[2] = { 0, 0 }, count2[2] = { 0, 0 };
+	int count3[2] = { 0, 0 }, fds;
+
+	first = wl_event_loop_add_signal(loop, SIGUSR1,
+					 signal_count_callback, count1);
+	assert(first);
+	fds = count_open_fds();
+
+	/* Further signal sources share the first one's fd */
+	second = wl_event_loop_add_signal(loop, SIGUSR1,
+					  signal_count_callback, count2);
+	other = wl_event_loop_add_signal(loop, SIGUSR2,
+					 signal_count_callback, count3);
+	assert(second && other);
+	assert(count_open_fds() == fds);
+
+	kill(getpid(), SIGUSR1);
+	kill(getpid(), SIGUSR2);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count1[0] == 1 && count1[1] == 0);
+	assert(count2[0] == 1 && count2[1] == 0);
+	assert(count3[0] == 0 && count3[1] == 1);
+
+	wl_event_source_remove(first);
+	kill(getpid(), SIGUSR1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count1[0] == 1);
+	assert(count2[0] == 2);
+
+	wl_event_source_remove(second);
+	wl_event_source_remove(other);
+	wl_event_loop_destroy(loop);
+}
+
+
 static int
 timer_callback(void *data)
 {
@@ -185,3 +253,460 @@ TEST(event_loop_timer)
 	wl_event_source_remove(source);
 	wl_event_loop_destroy(loop);
 }
+
+static int
+fd_read_dispatch(int fd, uint32_t mask, void *data)
+{
+	char c;
+
+	assert(read(fd, &c, 1) == 1);
+
+	return 1;
+}
+
+static int
+slow_read_dispatch(int fd, uint32_t mask, void *data)
+{
+	usleep(5000);
+
+	return fd_read_dispatch(fd, mask, data);
+}
+
+static void
+count_source(struct wl_event_source *source,
+	     const struct wl_event_source_stats *stats, void *data)
+{
+	int *count = data;
+
+	assert(wl_event_source_get_data(source) == data);
+	assert(stats->count == 3);
+	++*count;
+}
+
+TEST(event_loop_stats)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *source;
+	struct wl_event_source_stats stats;
+	uint32_t total;
+	int p[2], i, count = 0;
+
+	assert(loop);
+	assert(pipe(p) == 0);
+	source = wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+				      slow_read_dispatch, &count);
+	assert(source);
+
+	/* Nothing is recorded until enabled */
+	assert(write(p[1], "x", 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(wl_event_source_get_stats(source, &stats) == -1);
+
+	wl_event_loop_set_stats(loop, 1);
+	for (i = 0; i < 3; i++) {
+		assert(write(p[1], "x", 1) == 1);
+		assert(wl_event_loop_dispatch(loop, 0) == 0);
+	}
+
+	assert(wl_event_source_get_stats(source, &stats) == 0);
+	assert(stats.count == 3);
+	assert(stats.max_ns >= 5000000);
+	assert(stats.total_ns >= 3 * 5000000);
+	assert(stats.max_ns <= stats.total_ns);
+
+	/* 5 ms is in the 4096 µs and up buckets */
+	for (i = 0, total = 0; i < WL_EVENT_SOURCE_HISTOGRAM_SIZE; i++) {
+		total += stats.histogram[i];
+		if (i < 12)
+			assert(stats.histogram[i] == 0);
+	}
+	assert(total == 3);
+
+	wl_event_loop_for_each_source(loop, count_source, &count);
+	assert(count == 1);
+
+	wl_event_source_remove(source);
+	wl_event_loop_destroy(loop);
+	close(p[0]);
+	close(p[1]);
+}
+
+struct watchdog_context {
+	struct wl_event_source *source;
+	uint64_t duration_ns, source_ns;
+	int count;
+};
+
+static void
+watchdog(struct wl_event_loop *loop, uint64_t duration_ns,
+	 struct wl_event_source *source, uint64_t source_ns, void *data)
+{
+	struct watchdog_context *context = data;
+
+	context->source = source;
+	context->duration_ns = duration_ns;
+	context->source_ns = source_ns;
+	context->count++;
+}
+
+TEST(event_loop_watchdog)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *fast, *slow;
+	struct watchdog_context context = { NULL, 0, 0, 0 };
+	int p1[2], p2[2];
+
+	assert(loop);
+	assert(pipe(p1) == 0);
+	assert(pipe(p2) == 0);
+	fast = wl_event_loop_add_fd(loop, p1[0], WL_EVENT_READABLE,
+				    fd_read_dispatch, NULL);
+	assert(fast);
+	slow = wl_event_loop_add_fd(loop, p2[0], WL_EVENT_READABLE,
+				    slow_read_dispatch, NULL);
+	assert(slow);
+
+	wl_event_loop_set_watchdog(loop, 2000, watchdog, &context);
+
+	assert(write(p1[1], "x", 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 0);
+
+	assert(write(p1[1], "x", 1) == 1);
+	assert(write(p2[1], "x", 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 1);
+	assert(context.source == slow);
+	assert(context.source_ns >= 5000000);
+	assert(context.duration_ns >= context.source_ns);
+
+	/* Time spent waiting doesn't count */
+	wl_event_loop_dispatch(loop, 10);
+	assert(context.count == 1);
+
+	wl_event_loop_set_watchdog(loop, 0, NULL, NULL);
+	assert(write(p2[1], "x", 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 1);
+
+	wl_event_source_remove(fast);
+	wl_event_source_remove(slow);
+	wl_event_loop_destroy(loop);
+	close(p1[0]);
+	close(p1[1]);
+	close(p2[0]);
+	close(p2[1]);
+}
+
+static int
+slow_signal_callback(int signal_number, void *data)
+{
+	usleep(5000);
+
+	return signal_callback(signal_number, data);
+}
+
+static void
+only_source(struct wl_event_source *source,
+	    const struct wl_event_source_stats *stats, void *data)
+{
+	assert(source == data);
+	assert(stats->count == 1);
+}
+
+TEST(event_loop_signal_stats)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *source;
+	struct wl_event_source_stats stats;
+	struct watchdog_context context = { NULL, 0, 0, 0 };
+	int got_it = 0;
+
+	assert(loop);
+	source = wl_event_loop_add_signal(loop, SIGUSR1,
+					  slow_signal_callback, &got_it);
+	assert(source);
+	wl_event_loop_set_stats(loop, 1);
+	wl_event_loop_set_watchdog(loop, 2000, watchdog, &context);
+
+	/* Charged to the signal source, not to the fd they share */
+	kill(getpid(), SIGUSR1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(got_it);
+	assert(context.count == 1);
+	assert(context.source == source);
+	assert(context.source_ns >= 5000000);
+	assert(wl_event_source_get_stats(source, &stats) == 0);
+	assert(stats.count == 1);
+	assert(stats.max_ns >= 5000000);
+	wl_event_loop_for_each_source(loop, only_source, source);
+
+	wl_event_source_remove(source);
+	wl_event_loop_destroy(loop);
+}
+
+static int
+count_read_dispatch(int fd, uint32_t mask, void *data)
+{
+	int *count = data;
+
+	++*count;
+
+	return fd_read_dispatch(fd, mask, data);
+}
+
+TEST(event_loop_get_fd)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *source;
+	struct pollfd pfd;
+	char path[32], target[64];
+	int p[2], count = 0, len;
+
+	assert(loop);
+	assert(pipe(p) == 0);
+	source = wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+				      count_read_dispatch, &count);
+	assert(source);
+
+	pfd.fd = wl_event_loop_get_fd(loop);
+	pfd.events = POLLIN;
+
+	snprintf(path, sizeof path, "/proc/self/fd/%d", pfd.fd);
+	len = readlink(path, target, sizeof target - 1);
+	assert(len > 0);
+	target[len] = '\0';
+	fprintf(stderr, "event loop fd is %s\n", target);
+	assert(strcmp(target, "anon_inode:[eventpoll]") == 0 ||
+	       strcmp(target, "anon_inode:[io_uring]") == 0);
+
+	/* Usable from another loop: readable when there is something to
+	 * dispatch, and not afterwards */
+	assert(poll(&pfd, 1, 0) == 0);
+	assert(write(p[1], "x", 1) == 1);
+	assert(poll(&pfd, 1, 1000) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 1);
+	assert(poll(&pfd, 1, 0) == 0);
+
+	assert(write(p[1], "x", 1) == 1);
+	assert(poll(&pfd, 1, 1000) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 2);
+
+	wl_event_source_remove(source);
+	wl_event_loop_destroy(loop);
+	close(p[0]);
+	close(p[1]);
+}
+
+static int
+update_dispatch(int fd, uint32_t mask, void *data)
+{
+	int *count = data;
+
+	++*count;
+
+	return 0;
+}
+
+TEST(event_loop_fd_update)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *source;
+	int p[2], count = 0;
+
+	assert(loop);
+	assert(pipe(p) == 0);
+
+	/* Not readable, so nothing to do until we also wait for the
+	 * write end to become writable */
+	source = wl_event_loop_add_fd(loop, p[1], WL_EVENT_READABLE,
+				      update_dispatch, &count);
+	assert(source);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 0);
+
+	/* Level triggered, until told otherwise */
+	assert(wl_event_source_fd_update(source, WL_EVENT_WRITABLE) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 2);
+
+	assert(wl_event_source_fd_update(source, WL_EVENT_READABLE) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 2 || count == 3);
+
+	wl_event_source_remove(source);
+	wl_event_loop_destroy(loop);
+	close(p[0]);
+	close(p[1]);
+}
+
+/* More ready sources than the io_uring backend has submission or
+ * completion queue entries, so re-arming them has to cope with a full
+ * ring */
+#define READY_COUNT 1024
+
+TEST(event_loop_many_ready_sources)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *source[READY_COUNT];
+	int p[READY_COUNT][2], count[READY_COUNT];
+	int i;
+
+	assert(loop);
+	memset(count, 0, sizeof count);
+	for (i = 0; i < READY_COUNT; i++) {
+		assert(pipe(p[i]) == 0);
+		assert(write(p[i][1], "x", 1) == 1);
+		source[i] = wl_event_loop_add_fd(loop, p[i][0],
+						 WL_EVENT_READABLE,
+						 update_dispatch, &count[i]);
+		assert(source[i]);
+	}
+
+	/* Level triggered, so every source keeps coming back */
+	for (i = 0; i < READY_COUNT / 4; i++)
+		assert(wl_event_loop_dispatch(loop, 0) == 0);
+	for (i = 0; i < READY_COUNT; i++)
+		assert(count[i] >= 2);
+
+	for (i = 0; i < READY_COUNT; i++) {
+		wl_event_source_remove(source[i]);
+		close(p[i][0]);
+		close(p[i][1]);
+	}
+	wl_event_loop_destroy(loop);
+}
+
+#define WORK_COUNT 16
+
+struct work_item {
+	int ran;
+	int done;
+	int cancelled;
+	int *done_count;
+};
+
+static void
+work_run(void *data)
+{
+	struct work_item *item = data;
+
+	usleep(1000);
+	item->ran = 1;
+}
+
+static void
+work_done(void *data, int cancelled)
+{
+	struct work_item *item = data;
+
+	assert(!item->done);
+	assert(item->ran == !cancelled);
+	item->done = 1;
+	item->cancelled = cancelled;
+	(*item->done_count)++;
+}
+
+static void
+run_work(void)
+{
+	struct wl_event_loop *loop;
+	struct wl_event_work *work[WORK_COUNT];
+	struct work_item items[WORK_COUNT];
+	int i, done_count, cancelled;
+
+	/* Everything runs and is reported back on the loop */
+	loop = wl_event_loop_create();
+	assert(loop);
+	memset(items, 0, sizeof items);
+	done_count = 0;
+	for (i = 0; i < WORK_COUNT; i++) {
+		items[i].done_count = &done_count;
+		assert(wl_event_loop_add_work(loop, work_run, work_done,
+					      &items[i]));
+	}
+	assert(done_count == 0);
+	for (i = 0; i < 1000 && done_count < WORK_COUNT; i++)
+		assert(wl_event_loop_dispatch(loop, 100) == 0);
+	assert(done_count == WORK_COUNT);
+	for (i = 0; i < WORK_COUNT; i++)
+		assert(items[i].ran && !items[i].cancelled);
+
+	/* Cancelling succeeds exactly for work that hasn't started */
+	memset(items, 0, sizeof items);
+	done_count = 0;
+	for (i = 0; i < WORK_COUNT; i++) {
+		items[i].done_count = &done_count;
+		work[i] = wl_event_loop_add_work(loop, work_run, work_done,
+						 &items[i]);
+		assert(work[i]);
+	}
+	for (i = WORK_COUNT - 1, cancelled = 0; i >= 0; i--)
+		cancelled += wl_event_work_cancel(work[i]) == 0;
+	assert(cancelled > 0);
+	for (i = 0; i < 1000 && done_count < WORK_COUNT; i++)
+		assert(wl_event_loop_dispatch(loop, 100) == 0);
+	assert(done_count == WORK_COUNT);
+	for (i = 0; i < WORK_COUNT; i++)
+		cancelled -= items[i].cancelled;
+	assert(cancelled == 0);
+
+	/* Destroying the loop finishes up what's left */
+	memset(items, 0, sizeof items);
+	done_count = 0;
+	for (i = 0; i < WORK_COUNT; i++) {
+		items[i].done_count = &done_count;
+		assert(wl_event_loop_add_work(loop, work_run, work_done,
+					      &items[i]));
+	}
+	wl_event_loop_destroy(loop);
+	assert(done_count == WORK_COUNT);
+}
+
+TEST(event_loop_work)
+{
+	pid_t pid;
+	int status;
+
+	/* The thread library keeps some memory of joined threads around
+	 * for reuse, so the pool runs in a child that isn't checked for
+	 * leaks */
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_work();
+		_exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+BENCH(event_loop_fd_dispatch_bench)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *source;
+	unsigned long i;
+	int p[2];
+
+	assert(loop);
+	assert(pipe(p) == 0);
+	source = wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+				      fd_read_dispatch, NULL);
+	assert(source);
+
+	for (i = 0; i < iterations; i++) {
+		assert(write(p[1], "x", 1) == 1);
+		assert(wl_event_loop_dispatch(loop, 0) == 0);
+	}
+
+	wl_event_source_remove(source);
+	wl_event_loop_destroy(loop);
+	close(p[0]);
+	close(p[1]);
+}
@@ -74,6 +74,52 @@ div_conversion(void)
 		global_d = f / factor;
 }
 
+#define ARRAY_COUNT 4096
+#define ROUNDS (INT32_MAX / ARRAY_COUNT)
+
+static wl_fixed_t fixed_array[ARRAY_COUNT];
+static double double_array[ARRAY_COUNT];
+
+static void
+scalar_to_double(void)
+{
+	int r, i;
+
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < ARRAY_COUNT; i++)
+			double_array[i] = wl_fixed_to_double(fixed_array[i]);
+}
+
+static void
+batch_to_double(void)
+{
+	int r;
+
+	for (r = 0; r < ROUNDS; r++)
+		wl_fixed_to_double_array(double_array,
+					 fixed_array, ARRAY_COUNT);
+}
+
+static void
+scalar_from_double(void)
+{
+	int r, i;
+
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < ARRAY_COUNT; i++)
+			fixed_array[i] = wl_fixed_from_double(double_array[i]);
+}
+
+static void
+batch_from_double(void)
+{
+	int r;
+
+	for (r = 0; r < ROUNDS; r++)
+		wl_fixed_from_double_array(fixed_array,
+					   double_array, ARRAY_COUNT);
+}
+
 static void
 benchmark(const char *s, void (*f)(void))
 {
@@ -95,10 +141,19 @@ benchmark(const char *s, void (*f)(void))
 
 int main(int argc, char *argv[])
 {
+	int i;
+
 	benchmark("noop", noop_conversion);
 	benchmark("magic", magic_conversion);
 	benchmark("div", div_conversion);
 	benchmark("mul", mul_conversion);
 
+	for (i = 0; i < ARRAY_COUNT; i++)
+		fixed_array[i] = i * 37 - ARRAY_COUNT * 16;
+	benchmark("scalar to_double", scalar_to_double);
+	benchmark("batch to_double", batch_to_double);
+	benchmark("scalar from_double", scalar_from_double);
+	benchmark("batch from_double", batch_from_double);
+
 	return 0;
 }
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include "wayland-private.h"
 #include "test-runner.h"
@@ -88,3 +89,61 @@ TEST(fixed_int_conversions)
 	i = wl_fixed_to_int(f);
 	assert(i == -0x50);
 }
+
+#define BATCH_COUNT 1023
+
+TEST(fixed_batch_conversions)
+{
+	static const wl_fixed_t edges[] = {
+		0, 1, -1, 255, -255, 256, -256, 0x277013, -0x5044,
+		INT32_MAX, INT32_MIN, INT32_MAX - 255, INT32_MIN + 255
+	};
+	wl_fixed_t f[BATCH_COUNT], g[BATCH_COUNT], h[BATCH_COUNT];
+	double d[BATCH_COUNT], e[BATCH_COUNT];
+	float x[BATCH_COUNT], y[BATCH_COUNT];
+	int i[BATCH_COUNT], j[BATCH_COUNT];
+	size_t n, k;
+
+	srand(0);
+	for (k = 0; k < BATCH_COUNT; k++) {
+		if (k < sizeof edges / sizeof edges[0])
+			f[k] = edges[k];
+		else
+			f[k] = (wl_fixed_t) ((unsigned) rand() << 16 ^ rand());
+		d[k] = (rand() - RAND_MAX / 2) / 3.0;
+		x[k] = (rand() - RAND_MAX / 2) / 7.0f;
+		i[k] = rand() % 0x1000000 - 0x800000;
+	}
+
+	/* Odd counts exercise the scalar tails after the vector loops */
+	for (n = 0; n <= BATCH_COUNT; n += n < 20 ? 1 : 101) {
+		wl_fixed_to_double_array(e, f, n);
+		for (k = 0; k < n; k++)
+			assert(e[k] == wl_fixed_to_double(f[k]));
+
+		wl_fixed_from_double_array(g, d, n);
+		for (k = 0; k < n; k++)
+			assert(g[k] == wl_fixed_from_double(d[k]));
+
+		wl_fixed_to_float_array(y, f, n);
+		for (k = 0; k < n; k++)
+			assert(y[k] == (float) wl_fixed_to_double(f[k]));
+
+		wl_fixed_from_float_array(g, x, n);
+		for (k = 0; k < n; k++)
+			assert(g[k] == wl_fixed_from_double(x[k]));
+
+		wl_fixed_to_int_array(j, f, n);
+		for (k = 0; k < n; k++)
+			assert(j[k] == wl_fixed_to_int(f[k]));
+
+		wl_fixed_from_int_array(g, i, n);
+		for (k = 0; k < n; k++)
+			assert(g[k] == wl_fixed_from_int(i[k]));
+	}
+
+	/* Round trips */
+	wl_fixed_to_double_array(e, f, BATCH_COUNT);
+	wl_fixed_from_double_array(h, e, BATCH_COUNT);
+	assert(memcmp(f, h, sizeof f) == 0);
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "wayland-server.h"
+
+/* Connects N clients to a bare display and measures the server's
+ * memory once they have all gone idle.  The server first sends every
+ * client more events than its output buffer holds, going through
+ * wl_resource_marshal_reserve() as generated inline wrappers do, so
+ * that the buffer has wrapped.  Every client then does one
+ * wl_display.sync roundtrip, so that the server has read from each
+ * connection, and stays connected without sending anything.  The client ends are held by forked worker
+ * processes, which write the requests straight to the socket.  The
+ * server measures once it has been idle long enough to give back the
+ * buffers it only needs while clients are active.
+ *
+ * Prints the RSS and heap growth of the server process, in total and
+ * per client. */
+
+/* Clients per worker, which also bounds the fds the server holds for
+ * a worker before it forks */
+#define MAX_WORKER_CLIENTS 1024
+
+/* The socket and the event loop's dup of it */
+#define SERVER_FDS_PER_CLIENT 2
+
+/* Two of the server's idle sweeps, a second apart */
+#define IDLE_MS 2500
+
+/* wl_display.delete_id events sent to each client, more than fit the
+ * 4 KiB output buffer */
+#define BURST_EVENTS 400
+
+struct worker {
+	struct wl_event_source *source;
+	struct wl_event_source *idle;
+	int *done;
+};
+
+static long
+get_rss(void)
+{
+	FILE *f;
+	long size, resident = 0;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static long
+get_heap(void)
+{
+	struct mallinfo2 info = mallinfo2();
+
+	return info.uordblks + info.hblkhd;
+}
+
+/* Sends wl_display.sync and waits for the wl_callback.done that
+ * answers it, skipping the globals and the delete_id */
+static void
+roundtrip(int fd)
+{
+	uint32_t sync[] = { 1, 12 << 16 | 1, 2 };
+	uint32_t buffer[256], *p;
+	int len = 0, done = 0, i, n;
+
+	assert(write(fd, sync, sizeof sync) == sizeof sync);
+
+	while (!done) {
+		n = read(fd, (char *) buffer + len, sizeof buffer - len);
+		assert(n > 0);
+		len += n;
+
+		for (i = 0; len - i >= 8; i += p[1] >> 16) {
+			p = (uint32_t *) ((char *) buffer + i);
+			if (len - i < (int) (p[1] >> 16))
+				break;
+			if (p[0] == 2)
+				done = 1;
+		}
+		memmove(buffer, (char *) buffer + i, len - i);
+		len -= i;
+	}
+}
+
+static void
+send_burst(struct wl_client *client)
+{
+	struct wl_resource *display_resource = wl_client_get_object(client, 1);
+	uint32_t *p;
+	int i;
+
+	for (i = 0; i < BURST_EVENTS; i++) {
+		p = wl_resource_marshal_reserve(display_resource,
+						WL_DISPLAY_DELETE_ID,
+						3 * sizeof *p);
+		assert(p);
+		p[2] = i;
+		wl_resource_marshal_commit(display_resource, p);
+	}
+}
+
+static void
+run_worker(int *fds, int count, int channel)
+{
+	char c = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		roundtrip(fds[i]);
+
+	/* Report and stay connected until the server closes its end */
+	assert(write(channel, &c, 1) == 1);
+	while (read(channel, &c, 1) > 0)
+		;
+}
+
+static int
+worker_done(int fd, uint32_t mask, void *data)
+{
+	struct worker *worker = data;
+
+	wl_event_source_remove(worker->source);
+	if (--*worker->done == 0)
+		wl_event_source_timer_update(worker->idle, IDLE_MS);
+
+	return 1;
+}
+
+static int
+idle_done(void *data)
+{
+	wl_display_terminate(data);
+
+	return 1;
+}
+
+static void
+run(int clients)
+{
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct worker *workers;
+	struct wl_event_source *idle;
+	struct wl_client *client;
+	int *fds, *channels, s[2], p[2];
+	int i, j, n, count, worker_count, done;
+	long rss, heap;
+	pid_t pid;
+
+	display = wl_display_create();
+	assert(display);
+	loop = wl_display_get_event_loop(display);
+
+	worker_count = (clients + MAX_WORKER_CLIENTS - 1) / MAX_WORKER_CLIENTS;
+	workers = calloc(worker_count, sizeof *workers);
+	channels = malloc(worker_count * sizeof *channels);
+	fds = malloc(MAX_WORKER_CLIENTS * 2 * sizeof *fds);
+	assert(workers && channels && fds);
+	done = worker_count;
+	idle = wl_event_loop_add_timer(loop, idle_done, display);
+	assert(idle);
+
+	rss = get_rss();
+	heap = get_heap();
+
+	for (i = 0; i < worker_count; i++) {
+		count = clients / worker_count + (i < clients % worker_count);
+
+		for (n = 0; n < count; n++) {
+			assert(socketpair(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+			fds[n] = s[1];
+			fds[count + n] = s[0];
+		}
+		assert(socketpair(AF_UNIX, SOCK_STREAM, 0, p) == 0);
+
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			for (j = 0; j < count; j++)
+				close(fds[count + j]);
+			for (j = 0; j < i; j++)
+				close(channels[j]);
+			close(p[0]);
+			run_worker(fds, count, p[1]);
+			_exit(EXIT_SUCCESS);
+		}
+
+		close(p[1]);
+		channels[i] = p[0];
+		for (n = 0; n < count; n++) {
+			close(fds[n]);
+			client = wl_client_create(display, fds[count + n]);
+			assert(client);
+			send_burst(client);
+		}
+
+		workers[i].idle = idle;
+		workers[i].done = &done;
+		workers[i].source =
+			wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+					     worker_done, &workers[i]);
+	}
+
+	wl_display_run(display);
+
+	/* The buffers given back lie between those still in use, so
+	 * malloc keeps their pages until asked */
+	malloc_trim(0);
+
+	rss = get_rss() - rss;
+	heap = get_heap() - heap;
+
+	printf("%d idle clients: rss %ld KiB (%ld bytes per client), "
+	       "heap %ld KiB (%ld bytes per client)\n",
+	       clients, rss / 1024, rss / clients, heap / 1024, heap / clients);
+	fflush(stdout);
+
+	for (i = 0; i < worker_count; i++)
+		close(channels[i]);
+	while (wait(NULL) > 0)
+		;
+
+	wl_event_source_remove(idle);
+	wl_display_destroy(display);
+	free(fds);
+	free(channels);
+	free(workers);
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n clients]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct rlimit limit;
+	int i, clients = 10000;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			clients = atoi(argv[++i]);
+		else
+			usage(argv[0]);
+	}
+	if (clients < 1)
+		usage(argv[0]);
+
+	/* Root may go over the hard limit */
+	getrlimit(RLIMIT_NOFILE, &limit);
+	if (limit.rlim_max < (rlim_t) clients * SERVER_FDS_PER_CLIENT +
+	    MAX_WORKER_CLIENTS + 64) {
+		limit.rlim_max = (rlim_t) clients * SERVER_FDS_PER_CLIENT +
+			MAX_WORKER_CLIENTS + 64;
+		limit.rlim_cur = limit.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+			getrlimit(RLIMIT_NOFILE, &limit);
+	}
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	if ((rlim_t) clients * SERVER_FDS_PER_CLIENT +
+	    MAX_WORKER_CLIENTS + 64 > limit.rlim_cur) {
+		clients = (limit.rlim_cur - MAX_WORKER_CLIENTS - 64) /
+			SERVER_FDS_PER_CLIENT;
+		fprintf(stderr, "fd limit is %lu, only connecting %d clients\n",
+			(unsigned long) limit.rlim_cur, clients);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	run(clients);
+
+	return EXIT_SUCCESS;
+}
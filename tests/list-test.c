@@ -161,3 +161,43 @@ TEST(list_insert_list)
 	wl_list_insert_list(list.next, &other);
 	assert(validate_list(&list, reference3, ARRAY_LENGTH(reference3)));
 }
+
+BENCH(list_insert_remove_bench)
+{
+	struct wl_list list;
+	struct element e[64];
+	unsigned long i;
+
+	wl_list_init(&list);
+	for (i = 0; i < ARRAY_LENGTH(e); i++)
+		wl_list_insert(&list, &e[i].link);
+
+	/* Rotate the elements through the list */
+	for (i = 0; i < iterations; i++) {
+		struct element *first =
+			container_of(list.next, struct element, link);
+
+		wl_list_remove(&first->link);
+		wl_list_insert(list.prev, &first->link);
+	}
+}
+
+BENCH(list_iterate_bench)
+{
+	struct wl_list list;
+	struct element e[64], *p;
+	unsigned long i;
+	int sum = 0;
+
+	wl_list_init(&list);
+	for (i = 0; i < ARRAY_LENGTH(e); i++) {
+		e[i].i = i;
+		wl_list_insert(&list, &e[i].link);
+	}
+
+	for (i = 0; i < iterations; i++)
+		wl_list_for_each(p, &list, link)
+			sum += p->i;
+
+	assert(sum == (int) (iterations * 63 * 64 / 2));
+}
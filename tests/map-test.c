@@ -93,3 +93,36 @@ TEST(map_remove)
 
 	wl_map_release(&map);
 }
+
+BENCH(map_lookup_bench)
+{
+	struct wl_map map;
+	uint32_t ids[1024];
+	unsigned long i;
+	void *p = NULL;
+
+	wl_map_init(&map);
+	for (i = 0; i < ARRAY_LENGTH(ids); i++)
+		ids[i] = wl_map_insert_new(&map, WL_MAP_CLIENT_SIDE, &map);
+
+	for (i = 0; i < iterations; i++)
+		p = wl_map_lookup(&map, ids[i % ARRAY_LENGTH(ids)]);
+	assert(p == &map);
+
+	wl_map_release(&map);
+}
+
+BENCH(map_insert_remove_bench)
+{
+	struct wl_map map;
+	unsigned long i;
+	uint32_t id;
+
+	wl_map_init(&map);
+	for (i = 0; i < iterations; i++) {
+		id = wl_map_insert_new(&map, WL_MAP_SERVER_SIDE, &map);
+		wl_map_remove(&map, id);
+	}
+
+	wl_map_release(&map);
+}
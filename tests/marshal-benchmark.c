@@ -0,0 +1,439 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "wayland-private.h"
+#include "test-runner.h"
+
+/* Times wl_closure_vmarshal(), wl_closure_send(),
+ * wl_connection_demarshal() and wl_closure_invoke() for every request
+ * and event of the core protocol.  Pass --json for a machine readable
+ * report. */
+
+extern const struct wl_protocol_info wayland_protocol_info;
+
+struct result {
+	const char *interface;
+	const char *message;
+	const char *signature;
+	uint32_t size;
+	double marshal_ns, send_ns, demarshal_ns, invoke_ns;
+	double marshal_allocs, demarshal_allocs;
+};
+
+struct message_bench {
+	struct wl_object *sender;
+	const struct wl_message *message;
+	const struct wl_message_info *info;
+	uint32_t opcode;
+	int iterations;
+	struct wl_connection *write_connection;
+	struct wl_connection *read_connection;
+	struct wl_map *objects;
+	struct result *result;
+};
+
+static int
+update_func(struct wl_connection *connection, uint32_t mask, void *data)
+{
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+close_closure_fds(struct wl_closure *closure, const struct wl_message_info *info)
+{
+	int i;
+
+	if (!(info->flags & WL_MESSAGE_HAS_FD))
+		return;
+
+	for (i = 0; i < info->arg_count; i++)
+		if (info->types[i] == 'h')
+			close(*(int *) closure->args[i + 2]);
+}
+
+static void
+dup_closure_fds(struct wl_closure *closure, const struct wl_message_info *info,
+		const int *fds)
+{
+	int i;
+
+	if (!(info->flags & WL_MESSAGE_HAS_FD))
+		return;
+
+	/* wl_closure_send() closes the fds once they are sent, so send
+	 * a fresh copy of the fds the closure was marshalled with */
+	for (i = 0; i < info->arg_count; i++)
+		if (info->types[i] == 'h')
+			*(int *) closure->args[i + 2] =
+				fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+}
+
+static void
+noop(void)
+{
+}
+
+static void
+run_message(struct message_bench *bench, ...)
+{
+	struct result *result = bench->result;
+	struct wl_closure *closure, *closures[256];
+	va_list ap, aq;
+	double start, send_ns = 0, demarshal_ns = 0, invoke_ns = 0;
+	int fds[WL_CLOSURE_MAX_ARGS];
+	struct alloc_phase marshal = ALLOC_PHASE("marshal");
+	struct alloc_phase demarshal = ALLOC_PHASE("demarshal");
+	int i, j, batch, done;
+
+	va_start(ap, bench);
+
+	/* marshal */
+	alloc_phase_begin(&marshal);
+	start = now();
+	for (i = 0; i < bench->iterations; i++) {
+		va_copy(aq, ap);
+		closure = wl_closure_vmarshal(bench->sender, bench->opcode,
+					      aq, bench->message);
+		va_end(aq);
+		close_closure_fds(closure, bench->info);
+		wl_closure_destroy(closure);
+	}
+	result->marshal_ns = (now() - start) / bench->iterations;
+	alloc_phase_end(&marshal);
+	result->marshal_allocs =
+		(double) marshal.total.count / bench->iterations;
+
+	va_copy(aq, ap);
+	closure = wl_closure_vmarshal(bench->sender, bench->opcode,
+				      aq, bench->message);
+	va_end(aq);
+	assert(closure);
+	result->size = closure->start[1] >> 16;
+	for (i = 0; i < bench->info->arg_count; i++)
+		if (bench->info->types[i] == 'h')
+			fds[i] = *(int *) closure->args[i + 2];
+
+	/* Send in batches that fit in the connection buffers, then let
+	 * the other end read them and demarshal and invoke them */
+	batch = 2048 / result->size;
+	if (batch > (int) ARRAY_LENGTH(closures))
+		batch = ARRAY_LENGTH(closures);
+
+	for (done = 0; done < bench->iterations; done += batch) {
+		if (batch > bench->iterations - done)
+			batch = bench->iterations - done;
+
+		start = now();
+		for (j = 0; j < batch; j++) {
+			dup_closure_fds(closure, bench->info, fds);
+			assert(wl_closure_send(closure,
+					       bench->write_connection) == 0);
+		}
+		assert(wl_connection_data(bench->write_connection,
+					  WL_CONNECTION_WRITABLE) == 0);
+		send_ns += now() - start;
+
+		while (wl_connection_data(bench->read_connection,
+					  WL_CONNECTION_READABLE) <
+		       (int) (batch * result->size))
+			;
+
+		alloc_phase_begin(&demarshal);
+		start = now();
+		for (j = 0; j < batch; j++) {
+			closures[j] =
+				wl_connection_demarshal(bench->read_connection,
+							result->size,
+							bench->objects,
+							bench->message);
+			assert(closures[j]);
+		}
+		demarshal_ns += now() - start;
+		alloc_phase_end(&demarshal);
+
+		start = now();
+		for (j = 0; j < batch; j++)
+			wl_closure_invoke(closures[j], bench->sender,
+					  noop, NULL);
+		invoke_ns += now() - start;
+
+		for (j = 0; j < batch; j++) {
+			close_closure_fds(closures[j], bench->info);
+			wl_closure_destroy(closures[j]);
+		}
+	}
+
+	for (i = 0; i < bench->info->arg_count; i++)
+		if (bench->info->types[i] == 'h')
+			close(fds[i]);
+	wl_closure_destroy(closure);
+
+	result->send_ns = send_ns / bench->iterations;
+	result->demarshal_ns = demarshal_ns / bench->iterations;
+	result->invoke_ns = invoke_ns / bench->iterations;
+	result->demarshal_allocs =
+		(double) demarshal.total.count / bench->iterations;
+
+	va_end(ap);
+}
+
+/* Objects of every interface, at the ids matching their index in the
+ * protocol, and one id left reserved for new_id arguments */
+struct objects {
+	struct wl_map map;
+	struct wl_object *objects;
+	struct wl_object new_object;
+	int count;
+};
+
+static struct wl_object *
+find_object(struct objects *objects, const struct wl_interface *interface)
+{
+	int i;
+
+	for (i = 0; i < objects->count; i++)
+		if (interface == NULL ||
+		    objects->objects[i].interface == interface)
+			return &objects->objects[i];
+
+	return NULL;
+}
+
+static void
+benchmark_message(struct message_bench *bench, struct objects *objects)
+{
+	const struct wl_message_info *info = bench->info;
+	ffi_type *types[WL_CLOSURE_MAX_ARGS + 1];
+	void *values[WL_CLOSURE_MAX_ARGS + 1];
+	union {
+		uint32_t u;
+		int32_t i;
+		int h;
+		void *p;
+	} args[WL_CLOSURE_MAX_ARGS];
+	static const char string[] = "wayland benchmark string";
+	static char array_data[16];
+	struct wl_array array;
+	ffi_cif cif;
+	int i;
+
+	array.size = sizeof array_data;
+	array.alloc = 0;
+	array.data = array_data;
+
+	types[0] = &ffi_type_pointer;
+	values[0] = &bench;
+
+	for (i = 0; i < info->arg_count; i++) {
+		values[i + 1] = &args[i];
+		switch (info->types[i]) {
+		case 'i':
+		case 'f':
+			types[i + 1] = &ffi_type_sint32;
+			args[i].i = 42;
+			break;
+		case 'u':
+			types[i + 1] = &ffi_type_uint32;
+			args[i].u = 42;
+			break;
+		case 'h':
+			types[i + 1] = &ffi_type_sint;
+			args[i].h = STDIN_FILENO;
+			break;
+		case 's':
+			types[i + 1] = &ffi_type_pointer;
+			args[i].p = (void *) string;
+			break;
+		case 'o':
+			types[i + 1] = &ffi_type_pointer;
+			args[i].p = find_object(objects,
+						bench->message->types[i]);
+			break;
+		case 'n':
+			types[i + 1] = &ffi_type_pointer;
+			args[i].p = &objects->new_object;
+			break;
+		case 'a':
+			types[i + 1] = &ffi_type_pointer;
+			args[i].p = &array;
+			break;
+		}
+	}
+
+	assert(ffi_prep_cif_var(&cif, FFI_DEFAULT_ABI, 1,
+				info->arg_count + 1,
+				&ffi_type_void, types) == FFI_OK);
+	ffi_call(&cif, FFI_FN(run_message), NULL, values);
+}
+
+static void
+print_text(struct result *results, int count)
+{
+	struct result *r;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		r = &results[i];
+		printf("benchmarked %s.%s(%s), %u bytes:\t"
+		       "marshal %.1fns, send %.1fns, demarshal %.1fns, "
+		       "invoke %.1fns, %.2f+%.2f allocs/msg, "
+		       "%.1f MB/s sent, %.1f MB/s demarshalled\n",
+		       r->interface, r->message, r->signature, r->size,
+		       r->marshal_ns, r->send_ns, r->demarshal_ns,
+		       r->invoke_ns, r->marshal_allocs, r->demarshal_allocs,
+		       r->size * 1e3 / r->send_ns,
+		       r->size * 1e3 / r->demarshal_ns);
+	}
+}
+
+static void
+print_json(struct result *results, int count, int iterations)
+{
+	struct result *r;
+	int i;
+
+	printf("{\n"
+	       "  \"iterations\": %d,\n"
+	       "  \"messages\": [\n", iterations);
+
+	for (i = 0; i < count; i++) {
+		r = &results[i];
+		printf("    { \"interface\": \"%s\", \"message\": \"%s\", "
+		       "\"signature\": \"%s\", \"size\": %u,\n"
+		       "      \"marshal_ns\": %.1f, \"send_ns\": %.1f, "
+		       "\"demarshal_ns\": %.1f, \"invoke_ns\": %.1f,\n"
+		       "      \"marshal_allocs\": %.2f, "
+		       "\"demarshal_allocs\": %.2f,\n"
+		       "      \"send_bytes_per_s\": %.0f, "
+		       "\"demarshal_bytes_per_s\": %.0f }%s\n",
+		       r->interface, r->message, r->signature, r->size,
+		       r->marshal_ns, r->send_ns, r->demarshal_ns,
+		       r->invoke_ns, r->marshal_allocs, r->demarshal_allocs,
+		       r->size * 1e9 / r->send_ns,
+		       r->size * 1e9 / r->demarshal_ns,
+		       i + 1 < count ? "," : "");
+	}
+
+	printf("  ]\n"
+	       "}\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const struct wl_protocol_info *protocol = &wayland_protocol_info;
+	const struct wl_interface *interface;
+	struct wl_message_info_buffer info_buffer;
+	struct objects objects;
+	struct result results[256];
+	struct message_bench bench;
+	int s[2], i, j, count, json = 0, iterations = 20000;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0)
+			json = 1;
+		else
+			iterations = atoi(argv[i]);
+	}
+	assert(iterations > 0);
+
+	wl_message_info_add(protocol);
+
+	wl_map_init(&objects.map);
+	objects.count = protocol->interface_count;
+	objects.objects = calloc(objects.count, sizeof *objects.objects);
+	assert(wl_map_insert_new(&objects.map, WL_MAP_CLIENT_SIDE,
+				 NULL) == 0);
+	for (i = 0; i < objects.count; i++) {
+		objects.objects[i].interface =
+			protocol->interfaces[i].interface;
+		objects.objects[i].id =
+			wl_map_insert_new(&objects.map, WL_MAP_CLIENT_SIDE,
+					  &objects.objects[i]);
+	}
+	objects.new_object.id = objects.count + 1;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	bench.write_connection = wl_connection_create(s[0], update_func, NULL);
+	bench.read_connection = wl_connection_create(s[1], update_func, NULL);
+	bench.objects = &objects.map;
+	bench.iterations = iterations;
+
+	count = 0;
+	for (i = 0; i < objects.count; i++) {
+		interface = objects.objects[i].interface;
+		bench.sender = &objects.objects[i];
+
+		for (j = 0; j < interface->method_count +
+			     interface->event_count; j++) {
+			if (j < interface->method_count) {
+				bench.opcode = j;
+				bench.message = &interface->methods[j];
+			} else {
+				bench.opcode = j - interface->method_count;
+				bench.message =
+					&interface->events[bench.opcode];
+			}
+			bench.info = wl_message_get_info(bench.message,
+							 &info_buffer);
+			bench.result = &results[count++];
+			bench.result->interface = interface->name;
+			bench.result->message = bench.message->name;
+			bench.result->signature = bench.message->signature;
+
+			benchmark_message(&bench, &objects);
+		}
+	}
+
+	if (json)
+		print_json(results, count, iterations);
+	else
+		print_text(results, count);
+
+	wl_connection_destroy(bench.write_connection);
+	wl_connection_destroy(bench.read_connection);
+	wl_map_release(&objects.map);
+	free(objects.objects);
+
+	return 0;
+}
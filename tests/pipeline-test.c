@@ -0,0 +1,269 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "wayland-server.h"
+#include "test-runner.h"
+
+/* Enough requests that a burst goes to the workers, few enough that
+ * it fits in one read */
+#define BURST 300
+
+struct test_interface {
+	void (*order)(struct wl_client *client,
+		      struct wl_resource *resource, uint32_t n);
+	void (*create)(struct wl_client *client,
+		       struct wl_resource *resource, uint32_t id);
+};
+
+static const struct wl_interface test_pipeline_interface;
+
+static const struct wl_interface *test_types[] = {
+	NULL,
+	&test_pipeline_interface,
+};
+
+static const struct wl_message test_requests[] = {
+	{ "order", "u", test_types + 0 },
+	{ "create", "n", test_types + 1 },
+};
+
+static const struct wl_interface test_pipeline_interface = {
+	"test_pipeline", 1,
+	ARRAY_LENGTH(test_requests), test_requests,
+	0, NULL,
+};
+
+struct pipeline_test {
+	struct wl_listener destroy_listener;
+	pthread_t loop_thread;
+	uint32_t next;
+	int destroyed;
+};
+
+static void
+test_order(struct wl_client *client, struct wl_resource *resource,
+	   uint32_t n)
+{
+	struct pipeline_test *test = resource->data;
+
+	/* Requests decoded by the workers still dispatch on the loop */
+	assert(pthread_equal(pthread_self(), test->loop_thread));
+	assert(n == test->next);
+	test->next++;
+}
+
+static void test_create(struct wl_client *client,
+			struct wl_resource *resource, uint32_t id);
+
+static const struct test_interface test_implementation = {
+	test_order,
+	test_create,
+};
+
+static void
+test_create(struct wl_client *client, struct wl_resource *resource,
+	    uint32_t id)
+{
+	assert(wl_client_add_object(client, &test_pipeline_interface,
+				    &test_implementation, id,
+				    resource->data));
+}
+
+static void
+bind_test(struct wl_client *client, void *data, uint32_t version,
+	  uint32_t id)
+{
+	assert(wl_client_add_object(client, &test_pipeline_interface,
+				    &test_implementation, id, data));
+}
+
+static void
+client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct pipeline_test *test =
+		container_of(listener, struct pipeline_test,
+			     destroy_listener);
+
+	test->destroyed = 1;
+}
+
+static uint32_t *
+put_order(uint32_t *p, uint32_t id, uint32_t n)
+{
+	p[0] = id;
+	p[1] = (12 << 16) | 0;
+	p[2] = n;
+
+	return p + 3;
+}
+
+static uint32_t *
+put_create(uint32_t *p, uint32_t id, uint32_t new_id)
+{
+	p[0] = id;
+	p[1] = (12 << 16) | 1;
+	p[2] = new_id;
+
+	return p + 3;
+}
+
+static void
+send_burst(struct wl_event_loop *loop, struct pipeline_test *test,
+	   int fd, uint32_t *data, uint32_t *end, uint32_t expected)
+{
+	size_t size = (char *) end - (char *) data;
+	int i;
+
+	assert(write(fd, data, size) == (ssize_t) size);
+
+	for (i = 0; i < 100 && test->next < expected && !test->destroyed; i++)
+		wl_event_loop_dispatch(loop, 100);
+}
+
+static void
+run_pipeline(void)
+{
+	struct pipeline_test test;
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_client *client;
+	uint32_t data[1024], *p;
+	unsigned long decoded;
+	uint32_t i;
+	int s[2];
+
+	memset(&test, 0, sizeof test);
+	test.loop_thread = pthread_self();
+	memset(data, 0, sizeof data);
+	display = wl_display_create();
+	assert(display);
+	loop = wl_display_get_event_loop(display);
+	assert(wl_display_set_demarshal_threads(display, 2) == 0);
+	assert(wl_display_set_demarshal_threads(display, 2) == -1);
+	assert(wl_display_add_global(display, &test_pipeline_interface,
+				     &test, bind_test));
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+	test.destroy_listener.notify = client_destroyed;
+	wl_client_add_destroy_listener(client, &test.destroy_listener);
+
+	/* wl_display.bind to the test global, the second one after the
+	 * display's own, as object 2.  The workers can't tell what the
+	 * untyped new id is, so they leave the rest of the burst to the
+	 * display's loop. */
+	p = data;
+	p[0] = 1;
+	p[1] = (40 << 16) | 0;
+	p[2] = 2;
+	p[3] = sizeof "test_pipeline";
+	memcpy(&p[4], "test_pipeline", sizeof "test_pipeline");
+	p[8] = 1;
+	p[9] = 2;
+	p += 10;
+	for (i = 0; i < BURST; i++)
+		p = put_order(p, 2, test.next + i);
+	send_burst(loop, &test, s[1], data, p, BURST);
+	assert(test.next == BURST);
+
+	/* Now object 2 is known to them, and they allocate a closure
+	 * for each request they decode */
+	decoded = other_thread_alloc_count();
+	for (i = 0, p = data; i < BURST; i++)
+		p = put_order(p, 2, test.next + i);
+	send_burst(loop, &test, s[1], data, p, 2 * BURST);
+	assert(test.next == 2 * BURST);
+	assert(other_thread_alloc_count() - decoded >= BURST);
+
+	/* As are typed new ids from within the burst */
+	decoded = other_thread_alloc_count();
+	p = put_create(data, 2, 3);
+	for (i = 0; i < BURST; i++)
+		p = put_order(p, 2 + i % 2, test.next + i);
+	send_burst(loop, &test, s[1], data, p, 3 * BURST);
+	assert(test.next == 3 * BURST);
+	assert(other_thread_alloc_count() - decoded >= BURST + 1);
+
+	/* Requests to an unknown object are still an error */
+	for (i = 0, p = data; i < BURST / 2; i++)
+		p = put_order(p, 3, test.next + i);
+	p = put_order(p, 4, 0);
+	for (i = 0; i < BURST / 2; i++)
+		p = put_order(p, 2, 0);
+	send_burst(loop, &test, s[1], data, p, 4 * BURST);
+	assert(test.destroyed);
+	assert(test.next == 3 * BURST + BURST / 2);
+
+	close(s[1]);
+
+	/* Destroying the display drops requests still with the workers
+	 * instead of dispatching them.  The client is left behind, as
+	 * with a compositor that doesn't destroy its clients first. */
+	memset(&test, 0, sizeof test);
+	test.loop_thread = pthread_self();
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+	test.destroy_listener.notify = client_destroyed;
+	wl_client_add_destroy_listener(client, &test.destroy_listener);
+	assert(wl_client_add_object(client, &test_pipeline_interface,
+				    &test_implementation, 2, &test));
+	for (i = 0, p = data; i < BURST; i++)
+		p = put_order(p, 2, i);
+	assert(write(s[1], data, (char *) p - (char *) data) ==
+	       (char *) p - (char *) data);
+	wl_event_loop_dispatch(loop, 100);
+	wl_display_destroy(display);
+	assert(test.next == 0);
+	close(s[1]);
+}
+
+TEST(pipeline_dispatch_in_order)
+{
+	pid_t pid;
+	int status;
+
+	/* The thread library keeps some memory of joined threads around
+	 * for reuse, so the workers run in a child that isn't checked for
+	 * leaks */
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_pipeline();
+		_exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
@@ -0,0 +1,385 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "wayland-server.h"
+#include "wayland-client.h"
+#include "test-runner.h"
+
+#define SHARDS 4
+#define CLIENTS 8
+#define SOCKET_NAME "wayland-shard-test"
+
+struct shard_test;
+
+struct destroy_listener {
+	struct wl_listener listener;
+	struct shard_test *test;
+};
+
+struct shard_test {
+	struct wl_display *display;
+	struct wl_event_source *timer;
+	pthread_mutex_t lock;
+	pthread_t threads[CLIENTS];
+	struct destroy_listener listeners[CLIENTS];
+	int bound, destroyed, late_global;
+};
+
+static void
+client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct destroy_listener *l =
+		container_of(listener, struct destroy_listener, listener);
+	struct shard_test *test = l->test;
+
+	pthread_mutex_lock(&test->lock);
+	test->destroyed++;
+	pthread_mutex_unlock(&test->lock);
+}
+
+static void
+bind_compositor(struct wl_client *client,
+		void *data, uint32_t version, uint32_t id)
+{
+	struct shard_test *test = data;
+
+	assert(wl_client_get_event_loop(client) !=
+	       wl_display_get_event_loop(test->display));
+	wl_client_add_object(client, &wl_compositor_interface,
+			     NULL, id, NULL);
+
+	pthread_mutex_lock(&test->lock);
+	assert(test->bound < CLIENTS);
+	test->threads[test->bound] = pthread_self();
+	test->listeners[test->bound].test = test;
+	test->listeners[test->bound].listener.notify = client_destroyed;
+	wl_client_add_destroy_listener(client,
+				       &test->listeners[test->bound].listener);
+	test->bound++;
+	pthread_mutex_unlock(&test->lock);
+}
+
+static void
+bind_nothing(struct wl_client *client,
+	     void *data, uint32_t version, uint32_t id)
+{
+	assert(0);
+}
+
+static int
+check_progress(void *data)
+{
+	struct shard_test *test = data;
+	int bound, destroyed;
+
+	pthread_mutex_lock(&test->lock);
+	bound = test->bound;
+	destroyed = test->destroyed;
+	pthread_mutex_unlock(&test->lock);
+
+	/* Announced from the main thread to clients on the shards */
+	if (bound == CLIENTS && !test->late_global) {
+		assert(wl_display_add_global(test->display, &wl_shm_interface,
+					     NULL, bind_nothing));
+		test->late_global = 1;
+	}
+
+	if (destroyed == CLIENTS)
+		wl_display_terminate(test->display);
+	else
+		wl_event_source_timer_update(test->timer, 10);
+
+	return 1;
+}
+
+static void
+run_client(void)
+{
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	uint32_t id;
+
+	display = wl_display_connect(SOCKET_NAME);
+	assert(display);
+	wl_display_roundtrip(display);
+
+	id = wl_display_get_global(display, "wl_compositor", 1);
+	assert(id);
+	compositor = wl_display_bind(display, id, &wl_compositor_interface);
+	assert(compositor);
+	wl_display_roundtrip(display);
+
+	while (!wl_display_get_global(display, "wl_shm", 1))
+		wl_display_iterate(display, WL_DISPLAY_READABLE);
+
+	wl_compositor_destroy(compositor);
+	wl_display_disconnect(display);
+}
+
+static void
+run_server(void)
+{
+	struct shard_test test;
+	char dir[] = "/tmp/wayland-shard-test-XXXXXX";
+	pid_t pids[CLIENTS];
+	int i, j, status, distinct;
+
+	/* setenv() allocates, so this runs in a child process that isn't
+	 * checked for leaks */
+	assert(mkdtemp(dir));
+	setenv("XDG_RUNTIME_DIR", dir, 1);
+
+	memset(&test, 0, sizeof test);
+	pthread_mutex_init(&test.lock, NULL);
+	test.display = wl_display_create();
+	assert(test.display);
+	assert(wl_display_set_shards(test.display, SHARDS) == 0);
+	assert(wl_display_add_socket(test.display, SOCKET_NAME) == 0);
+	assert(wl_display_add_global(test.display, &wl_compositor_interface,
+				     &test, bind_compositor));
+
+	for (i = 0; i < CLIENTS; i++) {
+		pids[i] = fork();
+		assert(pids[i] >= 0);
+		if (pids[i] == 0) {
+			run_client();
+			_exit(EXIT_SUCCESS);
+		}
+	}
+
+	test.timer = wl_event_loop_add_timer(
+		wl_display_get_event_loop(test.display),
+		check_progress, &test);
+	wl_event_source_timer_update(test.timer, 10);
+
+	wl_display_run(test.display);
+
+	for (i = 0; i < CLIENTS; i++) {
+		assert(waitpid(pids[i], &status, 0) == pids[i]);
+		assert(WIFEXITED(status) &&
+		       WEXITSTATUS(status) == EXIT_SUCCESS);
+	}
+
+	/* Round robin over the shards, none of them the main thread */
+	assert(test.bound == CLIENTS && test.destroyed == CLIENTS);
+	for (i = 0, distinct = 0; i < CLIENTS; i++) {
+		assert(!pthread_equal(test.threads[i], pthread_self()));
+		for (j = 0; j < i; j++)
+			if (pthread_equal(test.threads[i], test.threads[j]))
+				break;
+		distinct += j == i;
+	}
+	assert(distinct == SHARDS);
+
+	wl_event_source_remove(test.timer);
+	wl_display_destroy(test.display);
+	rmdir(dir);
+}
+
+TEST(sharded_display)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_server();
+		exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+#define CHURN_ROUNDS 20
+
+struct churn_test {
+	struct wl_display *display;
+	struct wl_event_source *timer;
+	pthread_mutex_t lock;
+	int destroyed, churned;
+};
+
+struct churn_listener {
+	struct wl_listener listener;
+	struct churn_test *test;
+};
+
+static void
+churn_client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct churn_listener *l =
+		container_of(listener, struct churn_listener, listener);
+
+	pthread_mutex_lock(&l->test->lock);
+	l->test->destroyed++;
+	pthread_mutex_unlock(&l->test->lock);
+	free(l);
+}
+
+static void
+bind_churn_compositor(struct wl_client *client,
+		      void *data, uint32_t version, uint32_t id)
+{
+	struct churn_listener *l;
+
+	wl_client_add_object(client, &wl_compositor_interface,
+			     NULL, id, NULL);
+
+	l = malloc(sizeof *l);
+	assert(l);
+	l->test = data;
+	l->listener.notify = churn_client_destroyed;
+	wl_client_add_destroy_listener(client, &l->listener);
+}
+
+/* Announces globals to every client on the list, from the main thread,
+ * while the shards take disconnected clients off it */
+static int
+churn_globals(void *data)
+{
+	struct churn_test *test = data;
+	struct wl_global *global;
+	int i, destroyed;
+
+	for (i = 0; i < 16; i++) {
+		global = wl_display_add_global(test->display,
+					       &wl_shm_interface,
+					       NULL, bind_nothing);
+		assert(global);
+		wl_display_remove_global(test->display, global);
+		test->churned++;
+	}
+
+	pthread_mutex_lock(&test->lock);
+	destroyed = test->destroyed;
+	pthread_mutex_unlock(&test->lock);
+
+	if (destroyed == CLIENTS * CHURN_ROUNDS)
+		wl_display_terminate(test->display);
+	else
+		wl_event_source_timer_update(test->timer, 1);
+
+	return 1;
+}
+
+static void
+run_churn_client(void)
+{
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	uint32_t id;
+	int i;
+
+	for (i = 0; i < CHURN_ROUNDS; i++) {
+		display = wl_display_connect(SOCKET_NAME);
+		assert(display);
+		wl_display_roundtrip(display);
+
+		id = wl_display_get_global(display, "wl_compositor", 1);
+		assert(id);
+		compositor = wl_display_bind(display, id,
+					     &wl_compositor_interface);
+		assert(compositor);
+		wl_display_roundtrip(display);
+
+		wl_compositor_destroy(compositor);
+		wl_display_disconnect(display);
+	}
+}
+
+static void
+run_churn_server(void)
+{
+	struct churn_test test;
+	char dir[] = "/tmp/wayland-shard-test-XXXXXX";
+	pid_t pids[CLIENTS];
+	int i, status;
+
+	assert(mkdtemp(dir));
+	setenv("XDG_RUNTIME_DIR", dir, 1);
+
+	memset(&test, 0, sizeof test);
+	pthread_mutex_init(&test.lock, NULL);
+	test.display = wl_display_create();
+	assert(test.display);
+	assert(wl_display_set_shards(test.display, SHARDS) == 0);
+	assert(wl_display_add_socket(test.display, SOCKET_NAME) == 0);
+	assert(wl_display_add_global(test.display, &wl_compositor_interface,
+				     &test, bind_churn_compositor));
+
+	for (i = 0; i < CLIENTS; i++) {
+		pids[i] = fork();
+		assert(pids[i] >= 0);
+		if (pids[i] == 0) {
+			run_churn_client();
+			_exit(EXIT_SUCCESS);
+		}
+	}
+
+	test.timer = wl_event_loop_add_timer(
+		wl_display_get_event_loop(test.display),
+		churn_globals, &test);
+	wl_event_source_timer_update(test.timer, 1);
+
+	wl_display_run(test.display);
+
+	for (i = 0; i < CLIENTS; i++) {
+		assert(waitpid(pids[i], &status, 0) == pids[i]);
+		assert(WIFEXITED(status) &&
+		       WEXITSTATUS(status) == EXIT_SUCCESS);
+	}
+	assert(test.churned > 0);
+
+	wl_event_source_remove(test.timer);
+	wl_display_destroy(test.display);
+	pthread_mutex_destroy(&test.lock);
+	rmdir(dir);
+}
+
+TEST(sharded_globals_while_disconnecting)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		run_churn_server();
+		exit(EXIT_SUCCESS);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
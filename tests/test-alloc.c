@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <dlfcn.h>
+#include "test-runner.h"
+
+/* Counts allocations by replacing malloc and friends, for the test
+ * runner's leak check and for allocation budgets */
+
+static int num_alloc;
+static struct alloc_stats alloc_stats;
+static unsigned long other_thread_allocs;
+static __thread int test_thread;
+static void* (*sys_malloc)(size_t);
+static void (*sys_free)(void*);
+static void* (*sys_realloc)(void*, size_t);
+static void* (*sys_calloc)(size_t, size_t);
+
+/* Library threads allocate while the test runs, so the counters are
+ * updated atomically */
+static void
+count_alloc(size_t size)
+{
+	__atomic_add_fetch(&alloc_stats.count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_stats.bytes, size, __ATOMIC_RELAXED);
+}
+
+__attribute__ ((visibility("default"))) void *
+malloc(size_t size)
+{
+	__atomic_add_fetch(&num_alloc, 1, __ATOMIC_RELAXED);
+	count_alloc(size);
+	if (!test_thread)
+		__atomic_add_fetch(&other_thread_allocs, 1, __ATOMIC_RELAXED);
+	return sys_malloc(size);
+}
+
+__attribute__ ((visibility("default"))) void
+free(void* mem)
+{
+	if (mem != NULL)
+		__atomic_sub_fetch(&num_alloc, 1, __ATOMIC_RELAXED);
+	sys_free(mem);
+}
+
+__attribute__ ((visibility("default"))) void *
+realloc(void* mem, size_t size)
+{
+	if (mem == NULL)
+		__atomic_add_fetch(&num_alloc, 1, __ATOMIC_RELAXED);
+	count_alloc(size);
+	if (!test_thread)
+		__atomic_add_fetch(&other_thread_allocs, 1, __ATOMIC_RELAXED);
+	return sys_realloc(mem, size);
+}
+
+__attribute__ ((visibility("default"))) void *
+calloc(size_t nmemb, size_t size)
+{
+	if (sys_calloc == NULL)
+		return NULL;
+
+	__atomic_add_fetch(&num_alloc, 1, __ATOMIC_RELAXED);
+	count_alloc(nmemb * size);
+	if (!test_thread)
+		__atomic_add_fetch(&other_thread_allocs, 1, __ATOMIC_RELAXED);
+
+	return sys_calloc(nmemb, size);
+}
+
+int
+alloc_live_count(void)
+{
+	return __atomic_load_n(&num_alloc, __ATOMIC_RELAXED);
+}
+
+void
+alloc_set_test_thread(void)
+{
+	test_thread = 1;
+}
+
+unsigned long
+other_thread_alloc_count(void)
+{
+	return __atomic_load_n(&other_thread_allocs, __ATOMIC_RELAXED);
+}
+
+void
+alloc_phase_begin(struct alloc_phase *phase)
+{
+	phase->start.count = __atomic_load_n(&alloc_stats.count,
+					     __ATOMIC_RELAXED);
+	phase->start.bytes = __atomic_load_n(&alloc_stats.bytes,
+					     __ATOMIC_RELAXED);
+}
+
+void
+alloc_phase_end(struct alloc_phase *phase)
+{
+	phase->total.count += __atomic_load_n(&alloc_stats.count,
+					      __ATOMIC_RELAXED) -
+		phase->start.count;
+	phase->total.bytes += __atomic_load_n(&alloc_stats.bytes,
+					      __ATOMIC_RELAXED) -
+		phase->start.bytes;
+}
+
+void
+alloc_phase_check(const struct alloc_phase *phase,
+		  unsigned long max_count, unsigned long max_bytes)
+{
+	fprintf(stderr, "%s: %lu allocations (budget %lu), "
+		"%lu bytes (budget %lu)\n", phase->name,
+		phase->total.count, max_count,
+		phase->total.bytes, max_bytes);
+
+	assert(phase->total.count <= max_count &&
+	       "allocation count over budget");
+	assert(phase->total.bytes <= max_bytes &&
+	       "allocated bytes over budget");
+}
+
+/* Load system malloc, free, and realloc.  This runs ahead of other
+ * constructors, so tests can use those to set up the environment. */
+static void __attribute__ ((constructor (101)))
+load_allocator(void)
+{
+	sys_calloc = dlsym(RTLD_NEXT, "calloc");
+	sys_realloc = dlsym(RTLD_NEXT, "realloc");
+	sys_malloc = dlsym(RTLD_NEXT, "malloc");
+	sys_free = dlsym(RTLD_NEXT, "free");
+}
@@ -29,51 +29,19 @@
 #include <sys/wait.h>
 #include <string.h>
 #include <assert.h>
-#include <dlfcn.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include "test-runner.h"
 
-static int num_alloc;
-static void* (*sys_malloc)(size_t);
-static void (*sys_free)(void*);
-static void* (*sys_realloc)(void*, size_t);
-static void* (*sys_calloc)(size_t, size_t);
-
 extern const struct test __start_test_section, __stop_test_section;
 
-__attribute__ ((visibility("default"))) void *
-malloc(size_t size)
-{
-	num_alloc++;
-	return sys_malloc(size);
-}
-
-__attribute__ ((visibility("default"))) void
-free(void* mem)
-{
-	if (mem != NULL)
-		num_alloc--;
-	sys_free(mem);
-}
-
-__attribute__ ((visibility("default"))) void *
-realloc(void* mem, size_t size)
-{
-	if (mem == NULL)
-		num_alloc++;
-	return sys_realloc(mem, size);
-}
-
-__attribute__ ((visibility("default"))) void *
-calloc(size_t nmemb, size_t size)
-{
-	if (sys_calloc == NULL)
-		return NULL;
-
-	num_alloc++;
-
-	return sys_calloc(nmemb, size);
-}
+/* Not every test has benchmarks, and then the section isn't there */
+extern const struct bench __start_bench_section __attribute__ ((weak));
+extern const struct bench __stop_bench_section __attribute__ ((weak));
 
 static const struct test *
 find_test(const char *name)
@@ -90,16 +58,274 @@ find_test(const char *name)
 static void
 run_test(const struct test *t)
 {
-	int cur_alloc = num_alloc;
+	int cur_alloc = alloc_live_count();
 	int cur_fds;
 
+	alloc_set_test_thread();
 	cur_fds = count_open_fds();
 	t->run();
-	assert(cur_alloc == num_alloc && "memory leak detected in test.");
+	assert(cur_alloc == alloc_live_count() &&
+	       "memory leak detected in test.");
 	assert(cur_fds == count_open_fds() && "fd leak detected");
 	exit(EXIT_SUCCESS);
 }
 
+#define BENCH_RUNS 5
+#define BENCH_MIN_TIME 50000000 /* ns */
+
+enum bench_counter {
+	BENCH_CYCLES,
+	BENCH_INSTRUCTIONS,
+	BENCH_CACHE_MISSES,
+	BENCH_BRANCH_MISSES,
+	BENCH_COUNTER_COUNT
+};
+
+static const struct {
+	const char *name;
+	uint64_t config;
+} bench_counters[] = {
+	{ "cycles", PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache-misses", PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch-misses", PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/* The counters open as one group, so they're read in one go and
+ * scaled together if the kernel had to multiplex them */
+struct bench_group {
+	int leader;
+	int fd[BENCH_COUNTER_COUNT];
+	int index[BENCH_COUNTER_COUNT];
+	int count;
+};
+
+struct bench_sample {
+	double wall;
+	double cpu;
+	double counter[BENCH_COUNTER_COUNT];
+};
+
+static void
+bench_group_open(struct bench_group *group)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	group->leader = -1;
+	group->count = 0;
+
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++) {
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = bench_counters[i].config;
+		attr.disabled = group->leader == -1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP |
+			PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		group->fd[i] = syscall(__NR_perf_event_open, &attr,
+				       0, -1, group->leader, 0);
+		if (group->fd[i] < 0) {
+			group->index[i] = -1;
+			continue;
+		}
+
+		if (group->leader == -1)
+			group->leader = group->fd[i];
+		group->index[i] = group->count++;
+	}
+}
+
+static void
+bench_group_close(struct bench_group *group)
+{
+	int i;
+
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++)
+		if (group->fd[i] >= 0)
+			close(group->fd[i]);
+}
+
+static uint64_t
+bench_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bench_sample(const struct bench *b, unsigned long iterations,
+	     struct bench_group *group, struct bench_sample *sample)
+{
+	uint64_t values[3 + BENCH_COUNTER_COUNT];
+	uint64_t wall, cpu;
+	double scale;
+	int i;
+
+	if (group->leader >= 0) {
+		ioctl(group->leader, PERF_EVENT_IOC_RESET,
+		      PERF_IOC_FLAG_GROUP);
+		ioctl(group->leader, PERF_EVENT_IOC_ENABLE,
+		      PERF_IOC_FLAG_GROUP);
+	}
+
+	wall = bench_clock(CLOCK_MONOTONIC);
+	cpu = bench_clock(CLOCK_PROCESS_CPUTIME_ID);
+	b->run(iterations);
+	cpu = bench_clock(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+	wall = bench_clock(CLOCK_MONOTONIC) - wall;
+
+	sample->wall = (double) wall / iterations;
+	sample->cpu = (double) cpu / iterations;
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++)
+		sample->counter[i] = -1;
+
+	if (group->leader < 0)
+		return;
+
+	ioctl(group->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	if (read(group->leader, values, sizeof values) <
+	    (ssize_t) ((3 + group->count) * sizeof values[0]) ||
+	    values[2] == 0)
+		return;
+
+	/* values is { nr, time_enabled, time_running, counters... } */
+	scale = (double) values[1] / values[2];
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++)
+		if (group->index[i] >= 0)
+			sample->counter[i] = values[3 + group->index[i]] *
+				scale / iterations;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double da = *(const double *) a, db = *(const double *) b;
+
+	return da < db ? -1 : da > db;
+}
+
+static double
+median(double *values)
+{
+	qsort(values, BENCH_RUNS, sizeof *values, compare_double);
+
+	return values[BENCH_RUNS / 2];
+}
+
+static void
+run_bench(const struct bench *b, struct bench_group *group, int json,
+	  int first)
+{
+	struct bench_sample samples[BENCH_RUNS], result;
+	double values[BENCH_RUNS];
+	unsigned long iterations;
+	int i, j;
+
+	/* Double the iterations until a run takes long enough that the
+	 * clocks are precise and the warm up doesn't matter */
+	for (iterations = 1; ; iterations *= 2) {
+		bench_sample(b, iterations, group, &samples[0]);
+		if (samples[0].wall * iterations >= BENCH_MIN_TIME ||
+		    iterations >= (1ul << 40))
+			break;
+	}
+
+	for (i = 0; i < BENCH_RUNS; i++)
+		bench_sample(b, iterations, group, &samples[i]);
+
+	for (i = 0; i < BENCH_RUNS; i++)
+		values[i] = samples[i].wall;
+	result.wall = median(values);
+	for (i = 0; i < BENCH_RUNS; i++)
+		values[i] = samples[i].cpu;
+	result.cpu = median(values);
+	for (j = 0; j < BENCH_COUNTER_COUNT; j++) {
+		for (i = 0; i < BENCH_RUNS; i++)
+			values[i] = samples[i].counter[j];
+		result.counter[j] = median(values);
+	}
+
+	if (json) {
+		printf("%s    { \"name\": \"%s\", \"iterations\": %lu, "
+		       "\"wall_ns\": %.3f, \"cpu_ns\": %.3f",
+		       first ? "" : ",\n", b->name, iterations,
+		       result.wall, result.cpu);
+		for (j = 0; j < BENCH_COUNTER_COUNT; j++) {
+			if (result.counter[j] < 0)
+				printf(", \"%s\": null",
+				       bench_counters[j].name);
+			else
+				printf(", \"%s\": %.3f",
+				       bench_counters[j].name,
+				       result.counter[j]);
+		}
+		printf(" }");
+	} else {
+		printf("bench \"%s\":\t%.3f ns wall, %.3f ns cpu",
+		       b->name, result.wall, result.cpu);
+		for (j = 0; j < BENCH_COUNTER_COUNT; j++)
+			if (result.counter[j] >= 0)
+				printf(", %.3f %s", result.counter[j],
+				       bench_counters[j].name);
+		printf(" per iteration, %lu iterations\n", iterations);
+	}
+}
+
+/* Usage: test --bench [--json] [name] */
+static int
+run_benches(int argc, char *argv[])
+{
+	const struct bench *b;
+	struct bench_group group;
+	const char *name = NULL;
+	int i, json = 0, count = 0;
+
+	for (i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0)
+			json = 1;
+		else
+			name = argv[i];
+	}
+
+	if (&__start_bench_section == &__stop_bench_section && !name)
+		return EXIT_SUCCESS;
+
+	bench_group_open(&group);
+	if (group.leader < 0)
+		fprintf(stderr, "perf_event_open failed (%m), "
+			"only measuring time\n");
+
+	if (json)
+		printf("{\n  \"benchmarks\": [\n");
+
+	for (b = &__start_bench_section; b < &__stop_bench_section; b++) {
+		if (name && strcmp(b->name, name) != 0)
+			continue;
+		run_bench(b, &group, json, count == 0);
+		count++;
+	}
+
+	if (json)
+		printf("%s  ]\n}\n", count ? "\n" : "");
+
+	bench_group_close(&group);
+
+	if (name && count == 0) {
+		fprintf(stderr, "unknown benchmark: \"%s\"\n", name);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
 	const struct test *t;
@@ -107,11 +333,8 @@ int main(int argc, char *argv[])
 	int total, pass;
 	siginfo_t info;
 
-	/* Load system malloc, free, and realloc */
-	sys_calloc = dlsym(RTLD_NEXT, "calloc");
-	sys_realloc = dlsym(RTLD_NEXT, "realloc");
-	sys_malloc = dlsym(RTLD_NEXT, "malloc");
-	sys_free = dlsym(RTLD_NEXT, "free");
+	if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+		return run_benches(argc, argv);
 
 	if (argc == 2) {
 		t = find_test(argv[1]);
@@ -31,9 +31,68 @@ struct test {
 								\
 	static void name(void)
 
+struct bench {
+	const char *name;
+	void (*run)(unsigned long iterations);
+} __attribute__ ((aligned (16)));
+
+/* Benchmarks only run when the test binary is passed --bench.  The
+ * body should do its setup, run the measured operation "iterations"
+ * times and clean up; the runner picks the count and reports every
+ * measurement divided by it. */
+#define BENCH(name)						\
+	static void name(unsigned long iterations);		\
+								\
+	const struct bench bench##name				\
+		 __attribute__ ((section ("bench_section"))) = {	\
+		#name, name					\
+	};							\
+								\
+	static void name(unsigned long iterations)
+
 int
 count_open_fds(void);
 
+/* Every malloc, calloc and realloc counts as an allocation, whether
+ * or not it's freed again, so that hot paths can be held to a budget */
+struct alloc_stats {
+	unsigned long count;
+	unsigned long bytes;
+};
+
+struct alloc_phase {
+	const char *name;
+	struct alloc_stats start;
+	struct alloc_stats total;
+};
+
+#define ALLOC_PHASE(name) { name, { 0, 0 }, { 0, 0 } }
+
+/* Allocations not freed yet */
+int
+alloc_live_count(void);
+
+/* Marks the calling thread as the one running the test */
+void
+alloc_set_test_thread(void);
+
+/* Allocations made so far by threads other than the one running the
+ * test, such as threads the library starts */
+unsigned long
+other_thread_alloc_count(void);
+
+/* A phase may be entered and left any number of times, the
+ * allocations made between begin and end add up in total */
+void
+alloc_phase_begin(struct alloc_phase *phase);
+
+void
+alloc_phase_end(struct alloc_phase *phase);
+
+void
+alloc_phase_check(const struct alloc_phase *phase,
+		  unsigned long max_count, unsigned long max_bytes);
+
 void
 exec_fd_leak_check(int nr_expected_fds); /* never returns */
 
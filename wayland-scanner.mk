@@ -6,3 +6,9 @@
 
 %-client-protocol.h : $(wayland_protocoldir)/%.xml
 	$(AM_V_GEN)$(wayland_scanner) client-header < $< > $@
+
+%-server-protocol.hpp : $(wayland_protocoldir)/%.xml
+	$(AM_V_GEN)$(wayland_scanner) cpp-server < $< > $@
+
+%-client-protocol.hpp : $(wayland_protocoldir)/%.xml
+	$(AM_V_GEN)$(wayland_scanner) cpp-client < $< > $@